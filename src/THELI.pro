@@ -109,18 +109,28 @@ SOURCES += \
     threading/sourceextractorworker.cc \
     threading/swarpworker.cc \
     threading/worker.cc \
+    threading/writequeue.cc \
     threading/anetworker.cc \
+    threading/imageprefetcher.cc \
+    tools/bitmask.cc \
     tools/cfitsioerrorcodes.cc \
     tools/correlator.cc \
+    tools/combineestimator.cc \
     tools/cpu.cc \
     tools/debayer.cc \
     tools/detectedobject.cc \
+    tools/detectioncatalog.cc \
+    tools/detectionfilter.cc \
     tools/fileprogresscounter.cc \
     tools/fitgauss1d.cc \
     tools/fitting.cc \
     tools/imagequality.cc \
+    tools/medianfilter.cc \
     tools/polygon.cc \
     tools/ram.cc \
+    tools/resampler.cc \
+    tools/slidingwindowstack.cc \
+    tools/sortingnetwork.cc \
     tools/splitter.cc \
     tools/splitter_RAW.cc \
     tools/splitter_buildHeader.cc \
@@ -177,6 +187,7 @@ HEADERS += \
     status.h \
     threading/abszpworker.h \
     threading/anetworker.h \
+    threading/imageprefetcher.h \
     threading/colorpictureworker.h \
     threading/mainguiworker.h \
     threading/memoryworker.h \
@@ -184,16 +195,25 @@ HEADERS += \
     threading/sourceextractorworker.h \
     threading/swarpworker.h \
     threading/worker.h \
+    threading/writequeue.h \
+    tools/bitmask.h \
     tools/cfitsioerrorcodes.h \
     tools/correlator.h \
+    tools/combineestimator.h \
     tools/cpu.h \
     tools/detectedobject.h \
+    tools/detectioncatalog.h \
+    tools/detectionfilter.h \
     tools/fileprogresscounter.h \
     tools/fitgauss1d.h \
     tools/fitting.h \
     tools/imagequality.h \
+    tools/medianfilter.h \
     tools/polygon.h \
     tools/ram.h \
+    tools/resampler.h \
+    tools/slidingwindowstack.h \
+    tools/sortingnetwork.h \
     tools/splitter.h \
     tools/swarpfilter.h \
     tools/tools.h \
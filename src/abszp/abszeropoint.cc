@@ -214,7 +214,7 @@ void AbsZeroPoint::updateSaturationValue(float value)
 // Here is where the actual work happens
 void AbsZeroPoint::taskInternalAbszeropoint()
 {
-    myImage = new MyImage(ui->zpImageLineEdit->text(), QVector<bool>(), &verbosity);
+    myImage = new MyImage(ui->zpImageLineEdit->text(), BitMask::empty(), &verbosity);
 
     connect(myImage, &MyImage::messageAvailable, this, &AbsZeroPoint::displayMessage);
     connect(myImage, &MyImage::critical, this, &AbsZeroPoint::criticalReceived);
@@ -270,8 +270,8 @@ void AbsZeroPoint::taskInternalAbszeropoint()
             myImage->backgroundModel(100, "interpolate");
             myImage->segmentImage(DT, DMIN, true, false);
             long ngood = 0;
-            for (auto &it : myImage->objectList) if (it->FLAGS == 0) ++ngood;
-            emit messageAvailable(QString::number(myImage->objectList.length()) + " sources detected, "+QString::number(ngood) + " selected", "info");
+            for (auto &flag : myImage->objectCatalog.FLAGS) if (flag == 0) ++ngood;
+            emit messageAvailable(QString::number(myImage->objectCatalog.length()) + " sources detected, "+QString::number(ngood) + " selected", "info");
         }
     }
 
@@ -282,11 +282,12 @@ void AbsZeroPoint::taskInternalAbszeropoint()
     objDat.clear();
     // DEC comes first in the catalogs, because the matching alg sorts the vectors for DEC
 
-    for (auto &object : myImage->objectList) {
+    const DetectionCatalog &cat = myImage->objectCatalog;
+    for (long i=0; i<cat.length(); ++i) {
         QVector<double> objdata;
-        if (object->FLAGS == 0) {
-            objdata << object->DELTA_J2000 << object->ALPHA_J2000 << object->MAG_AUTO
-                    << object->MAGERR_AUTO << object->MAG_APER << object->MAGERR_APER;
+        if (cat.FLAGS.at(i) == 0) {
+            objdata << cat.DELTA_J2000.at(i) << cat.ALPHA_J2000.at(i) << cat.MAG_AUTO.at(i)
+                    << cat.MAGERR_AUTO.at(i) << cat.magAper(i) << cat.magerrAper(i);
             objDat.append(objdata);
             //            qDebug() << qSetRealNumberPrecision(12) << object->ALPHA_J2000 << object->DELTA_J2000;
         }
@@ -370,16 +370,17 @@ QVector<QVector<double>> ColorPicture::getObjectData(MyImage *myImage)
 {
     QVector<QVector<double>> objData;
 
-    objData.reserve(myImage->objectList.length());
-    if (myImage->objectList.length() == 0) {
+    const DetectionCatalog &cat = myImage->objectCatalog;
+    objData.reserve(cat.length());
+    if (cat.isEmpty()) {
         emit messageAvailable("No objects detected in "+myImage->baseName+" !", "error");
     }
     else {
-        for (auto &object : myImage->objectList) {
+        for (long i=0; i<cat.length(); ++i) {
             QVector<double> tmp;
-            if (object->FLAGS == 0 && object->FLUX_AUTO > 0.) {
+            if (cat.FLAGS.at(i) == 0 && cat.FLUX_AUTO.at(i) > 0.) {
                 // DEC comes first in the catalogs, because the matching alg sorts the vectors for DEC
-                tmp << object->DELTA_J2000 << object->ALPHA_J2000 << object->FLUX_AUTO;
+                tmp << cat.DELTA_J2000.at(i) << cat.ALPHA_J2000.at(i) << cat.FLUX_AUTO.at(i);
                 objData.append(tmp);
             }
         }
@@ -446,7 +446,7 @@ void ColorPicture::colorCalibSegmentImages()
         if (it->name == ui->redComboBox->currentText()) channelName = "R";
         if (it->name == ui->greenComboBox->currentText()) channelName = "G";
         if (it->name == ui->blueComboBox->currentText()) channelName = "B";
-        if (verbosity >= 2) emit messageAvailable(channelName + " : " + QString::number(it->objectList.length()) + " sources", "ignore");
+        if (verbosity >= 2) emit messageAvailable(channelName + " : " + QString::number(it->objectCatalog.length()) + " sources", "ignore");
     }
 }
 
@@ -126,7 +126,7 @@ void ColorPicture::taskInternalCropCoadds()
     QStringList imageList = colorTheli.entryList(filter);
     coaddList.clear();
     for (auto &it : imageList) {
-        QVector<bool> dummyMask;
+        BitMask dummyMask;
         dummyMask.clear();
         MyImage *myImage = new MyImage(dirName+it, dummyMask, &verbosity);
         connect(myImage, &MyImage::messageAvailable, this, &ColorPicture::displayMessage);
@@ -182,7 +182,7 @@ void ColorPicture::taskInternalBBNBcombine()
 
     QString path = bbImage->path + "/";
 
-    QVector<bool> dummyMask;
+    BitMask dummyMask;
     dummyMask.clear();
     QString newName = bbImage->baseName + nbImage->baseName + "_cropped.fits";
     QString newNameWeight = bbImage->baseName + nbImage->baseName + "_cropped.weight.fits";
@@ -511,7 +511,7 @@ QString DataModel::getIndicator(bool flag)
 bool DataModel::insertRows(int row, int count, const QModelIndex &parent)
 {
     beginInsertRows(parent, row, row + count - 1);
-    QVector<bool> dummyMask;
+    BitMask dummyMask;
     dummyMask.clear();
     MyImage *newImage = new MyImage("path", "file", "", 1, dummyMask, myData->verbosity);
     connect(newImage, &MyImage::modelUpdateNeeded, this, &DataModel::modelUpdateReceiver);
@@ -194,6 +194,7 @@ void ConfDockWidget::loadDefaults()
         ui->rowxtalkAmplitudeLineEdit->setText("");
         ui->overscanCheckBox->setChecked(true);
         ui->theliRenamingCheckBox->setChecked(true);
+        ui->fitsCompressionComboBox->setCurrentIndex(0);
         ui->nonlinearityCheckBox->setChecked(false);
         ui->nonlinearityCheckBox->setChecked(false);
         ui->splitMIRcubeCheckBox->setChecked(false);
@@ -354,6 +355,7 @@ void ConfDockWidget::loadDefaults()
         ui->CSCrejectExposureLineEdit->clear();
         ui->CSCsamplingCheckBox->setChecked(false);
         ui->CSCconvolutionCheckBox->setChecked(true);
+        ui->CSCfilterComboBox->setCurrentIndex(0);
         ui->CSCsaturationLineEdit->clear();
     }
 
@@ -428,6 +430,8 @@ void ConfDockWidget::loadDefaults()
         ui->COAprojectionComboBox->setCurrentIndex(0);
         ui->COAraLineEdit->clear();
         ui->COArescaleweightsCheckBox->setChecked(false);
+        ui->COAresampleInternalCheckBox->setChecked(false);
+        ui->COAincrementalCheckBox->setChecked(false);
         ui->COAsizexLineEdit->clear();
         ui->COAsizeyLineEdit->clear();
         ui->COAskypaLineEdit->clear();
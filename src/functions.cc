@@ -20,6 +20,7 @@ If not, see https://www.gnu.org/licenses/ .
 #include "functions.h"
 #include "preferences.h"
 #include "tools/fitgauss1d.h"
+#include "tools/combineestimator.h"
 
 #include <wcs.h>
 #include <unordered_map>
@@ -993,9 +994,31 @@ QVector<float> getSmallSample(const QVector<float> &data, const QVector<bool> &m
     return sample;
 }
 
+QVector<float> getSmallSample(const QVector<float> &data, const BitMask &mask)
+{
+    if (mask.isEmpty()) return getSmallSample(data);
+
+    long n = data.length();
+    QVector<float> sample;
+    long step = 1;
+    if (n>10000) {
+        step = 379;
+        sample.reserve(n/379);
+    }
+    else sample.reserve(n);
+
+    for (long i=0; i<n; i+=step) {
+        if (!std::isnan(data[i]) && !std::isinf(data[i]) && !mask.at(i))
+            sample.append(data[i]);
+    }
+    return sample;
+}
+
 // A fast mode calculator
-// Optionally, it also provides an rms estimate based on the truncated histogram
-QVector<float> modeMask(const QVector<float> &data, QString mode, const QVector<bool> &mask, bool smooth)
+// Optionally, it also provides an rms estimate based on the truncated histogram.
+// The mask can be a QVector<bool> or a BitMask
+template<class M>
+QVector<float> modeMask_T(const QVector<float> &data, QString mode, const M &mask, bool smooth)
 {
     QVector<float> sky;
 
@@ -1045,6 +1068,16 @@ QVector<float> modeMask(const QVector<float> &data, QString mode, const QVector<
     return sky << skyValue << skySigma;
 }
 
+QVector<float> modeMask(const QVector<float> &data, QString mode, const QVector<bool> &mask, bool smooth)
+{
+    return modeMask_T(data, mode, mask, smooth);
+}
+
+QVector<float> modeMask(const QVector<float> &data, QString mode, const BitMask &mask, bool smooth)
+{
+    return modeMask_T(data, mode, mask, smooth);
+}
+
 // MODE: Determine optimal sample density
 int modeMask_sampleDensity(long numDataPoints, int numBins, float SNdesired)
 {
@@ -1083,6 +1116,32 @@ QVector<float> modeMask_clipData(const QVector<float> &data, const QVector<bool>
     return dataThresholded;
 }
 
+// Fully masked runs of 64 pixels are skipped as a whole
+QVector<float> modeMask_clipData(const QVector<float> &data, const BitMask &mask, int sampleDensity, float minVal, float maxVal)
+{
+    if (mask.isEmpty()) return modeMask_clipData(data, QVector<bool>(), sampleDensity, minVal, maxVal);
+
+    QVector<float> dataThresholded;
+    long n = data.length();
+    dataThresholded.reserve(n/sampleDensity);
+    long i = 0;
+    while (i<n) {
+        // Jump to the first sample point in or behind the next unmasked pixel
+        long next = mask.nextUnmasked(i);
+        if (next > i) {
+            i += (next - i + sampleDensity - 1) / sampleDensity * sampleDensity;
+            continue;
+        }
+        float it = data[i];
+        if (it > minVal && it < maxVal) {
+            dataThresholded.append(it);
+        }
+        i += sampleDensity;
+    }
+
+    return dataThresholded;
+}
+
 // MODE: Build histogram
 QVector<long> modeMask_buildHistogram(QVector<float> &data, float &rescale, const int numBins, const float minVal,
                                       const float maxVal, const float madVal, const bool smooth)
@@ -1269,6 +1328,21 @@ float straightMedian_MinMax(QVector<float> &data, const int nlow, const int nhig
     return med;
 }
 
+// Changes data! Operates on a caller-owned buffer and does not (re)allocate memory,
+// so that each thread in a combination can reuse its own preallocated pixel stack
+float straightMedian_MinMax(float *data, const long num, const int nlow, const int nhigh)
+{
+    if (num == 0) return 0.;
+    if (nlow+nhigh >= num) return 0;
+
+    std::sort(data, data+num);
+
+    // Calculate average of central two elements if number is even
+    const float *first = data + nlow;
+    long dsize = num - nlow - nhigh;
+    return (dsize % 2) ? first[dsize/2] : (first[dsize/2-1] + first[dsize/2]) * 0.5f;
+}
+
 // Changes data!
 float straightMedian_MinMax(QList<float> &data, const int nlow, const int nhigh)
 {
@@ -1324,6 +1398,33 @@ float meanMask(const QVector<float> &vector_in, const QVector<bool> &mask, long
     }
 }
 
+float meanMask(const QVector<float> &vector_in, const BitMask &mask)
+{
+    if (mask.isEmpty()) return meanMask(vector_in);
+
+    long maxDim = vector_in.length();
+    double sum = 0.;
+    long num = 0;
+    for (long i=mask.nextUnmasked(0); i<maxDim; i=mask.nextUnmasked(i+1)) {
+        sum += vector_in[i];
+        ++num;
+    }
+    if (num == 0) return 0.;
+    else return sum / num;
+}
+
+// Kappa-sigma clipped mean, starting from the median (see tools/combineestimator.h)
+float clippedMeanMask(const QVector<float> &data, const QVector<bool> &mask, long maxLength)
+{
+    return CombineEstimator::combineVector(CombineEstimator::ClippedMean, data, mask, maxLength);
+}
+
+// Winsorised mean; without rejection parameters identical to the mean (see tools/combineestimator.h)
+float winsorisedMeanMask(const QVector<float> &data, const QVector<bool> &mask, long maxLength)
+{
+    return CombineEstimator::combineVector(CombineEstimator::WinsorisedMean, data, mask, maxLength);
+}
+
 // Calculate an iterative mean using sigma outlier rejection.
 // The algorithm terminates after iterMax iterations, or if converged.
 // Data points can re-enter the process.
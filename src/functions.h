@@ -23,6 +23,7 @@ If not, see https://www.gnu.org/licenses/ .
 #include <valarray>
 #include "fitsio2.h"
 #include <wcs.h>
+#include "tools/bitmask.h"
 
 #include <QString>
 #include <QFile>
@@ -63,6 +64,7 @@ void paintPathLineEdit(QLineEdit *, QString, QString check = "dir");
 bool listContains(QStringList stringList, QString string);
 // void exec_system_command(QString);
 QVector<float> getSmallSample(const QVector<float> &data, const QVector<bool> &mask = QVector<bool>());
+QVector<float> getSmallSample(const QVector<float> &data, const BitMask &mask);
 void initEnvironment(QString &thelidir, QString &userdir);
 // void listSwapLastPairs(QStringList &stringlist, int n);
 long numFilesDir(QString path, QString filter);
@@ -92,17 +94,23 @@ bool moveFiles(QString filter, QString sourceDirName, QString targetDirName);
 bool moveFile(QString filename, QString sourceDirPath, QString targetDirPath, bool skipNonExistingFile = false);
 bool deleteFile(QString fileName, QString path);
 QVector<float> modeMask(const QVector<float> &data, QString mode, const QVector<bool> &mask = QVector<bool>(), bool smooth = true);
+QVector<float> modeMask(const QVector<float> &data, QString mode, const BitMask &mask, bool smooth = true);
 int modeMask_sampleDensity(long numDataPoints, int numBins, float SNdesired);
 QVector<float> modeMask_clipData(const QVector<float> &data, const QVector<bool> &mask, int sampleDensity = 1, float minVal = 0., float maxVal = 0.);
+QVector<float> modeMask_clipData(const QVector<float> &data, const BitMask &mask, int sampleDensity = 1, float minVal = 0., float maxVal = 0.);
 QVector<long> modeMask_buildHistogram(QVector<float> &data, float &rescale, const int numBins, const float minVal,
                                       const float maxVal, const float madVal, const bool smooth = true);
 void modeMask_classic(const QVector<long> histogram, float &skyValue);
 void modeMask_gaussian(QVector<long> histogram, float &skyValue);
 void modeMask_stable(const QVector<long> histogram, float &skyValue);
 float meanMask(const QVector<float> &data, const QVector<bool> &mask = QVector<bool>(), long maxLength = 0);
+float meanMask(const QVector<float> &data, const BitMask &mask);
 float medianMask(const QVector<float> &data, const QVector<bool> &mask = QVector<bool>(), long maxLength = 0);
+float clippedMeanMask(const QVector<float> &data, const QVector<bool> &mask = QVector<bool>(), long maxLength = 0);
+float winsorisedMeanMask(const QVector<float> &data, const QVector<bool> &mask = QVector<bool>(), long maxLength = 0);
 float straightMedian_MinMax(QVector<float> &data, const int nlow, const int nhigh);
 float straightMedian_MinMax(QList<float> &data, const int nlow, const int nhigh);
+float straightMedian_MinMax(float *data, const long num, const int nlow, const int nhigh);
 bool readData3D(QString path, QVector<double> &x, QVector<double> &y, QVector<double> &z);
 long remainingDataDriveSpace(QString maindir);
 int gauss_f(const gsl_vector *x, void *params, gsl_vector *f);
@@ -334,9 +342,9 @@ T rmsMask_T(const QVector<T> &vector_in, QVector<bool> mask = QVector<bool>())
     }
 }
 
-// Masked mad
-template<class T>
-T madMask_T(const QVector<T> vector_in, const QVector<bool> mask = QVector<bool>(), QString ignoreZeroes = "")
+// Masked mad; the mask can be a QVector<bool> or a BitMask
+template<class T, class M = QVector<bool>>
+T madMask_T(const QVector<T> vector_in, const M &mask = M(), QString ignoreZeroes = "")
 {
     long maxDim = vector_in.length();
     if (maxDim == 0) return 0.;
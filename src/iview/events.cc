@@ -489,7 +489,7 @@ void IView::updateCRPIXFITS()
 //        qDebug() << dirName+"/"+currentMyImage->pathExtension+"/"+currentFileName;
 //        qDebug() << currentMyImage->path+"/"+currentMyImage->chipName+currentMyImage->processingStatus->statusString+".fits";
         fitsfile *fptr = nullptr;
-        fits_open_file(&fptr, (dirName+"/"+currentMyImage->pathExtension+"/"+currentFileName).toUtf8().data(), READWRITE, &status);
+        fits_open_image(&fptr, (dirName+"/"+currentMyImage->pathExtension+"/"+currentFileName).toUtf8().data(), READWRITE, &status);
         fits_update_key_flt(fptr, "CRPIX1", wcs->crpix[0], -5, nullptr, &status);
         fits_update_key_flt(fptr, "CRPIX2", wcs->crpix[1], -5, nullptr, &status);
         fits_close_file(fptr, &status);
@@ -509,7 +509,7 @@ void IView::updateCDmatrixFITS()
         int status = 0;
         if (currentFileName.isEmpty()) currentFileName = currentMyImage->baseName+".fits";
         fitsfile *fptr = nullptr;
-        fits_open_file(&fptr, (dirName+"/"+currentMyImage->pathExtension+"/"+currentFileName).toUtf8().data(), READWRITE, &status);
+        fits_open_image(&fptr, (dirName+"/"+currentMyImage->pathExtension+"/"+currentFileName).toUtf8().data(), READWRITE, &status);
         fits_update_key_dbl(fptr, "CD1_1", wcs->cd[0], 8, nullptr, &status);
         fits_update_key_dbl(fptr, "CD1_2", wcs->cd[1], 8, nullptr, &status);
         fits_update_key_dbl(fptr, "CD2_1", wcs->cd[2], 8, nullptr, &status);
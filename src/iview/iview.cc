@@ -624,7 +624,7 @@ bool IView::loadFITSdata(QString filename, QVector<float> &data, QString colorMo
         delete currentMyImage;
         currentMyImage = nullptr;
     }
-    QVector<bool> dummyMask;
+    BitMask dummyMask;
     dummyMask.clear();
     currentMyImage = new MyImage(filename, dummyMask, &verbose);
     currentMyImage->readImage(filename);
@@ -532,18 +532,34 @@ void MainWindow::updateControllerFunctors(QString text)
 
     if (cdw->ui->biasMethodComboBox->currentText() == "Median")
         controller->combineBias_ptr = &medianMask;
+    else if (cdw->ui->biasMethodComboBox->currentText() == "Clipped mean")
+        controller->combineBias_ptr = &clippedMeanMask;
+    else if (cdw->ui->biasMethodComboBox->currentText() == "Winsorised mean")
+        controller->combineBias_ptr = &winsorisedMeanMask;
     else controller->combineBias_ptr = &meanMask;
 
     if (cdw->ui->darkMethodComboBox->currentText() == "Median")
         controller->combineDark_ptr = &medianMask;
+    else if (cdw->ui->darkMethodComboBox->currentText() == "Clipped mean")
+        controller->combineDark_ptr = &clippedMeanMask;
+    else if (cdw->ui->darkMethodComboBox->currentText() == "Winsorised mean")
+        controller->combineDark_ptr = &winsorisedMeanMask;
     else controller->combineDark_ptr = &meanMask;
 
     if (cdw->ui->flatoffMethodComboBox->currentText() == "Median")
         controller->combineFlatoff_ptr = &medianMask;
+    else if (cdw->ui->flatoffMethodComboBox->currentText() == "Clipped mean")
+        controller->combineFlatoff_ptr = &clippedMeanMask;
+    else if (cdw->ui->flatoffMethodComboBox->currentText() == "Winsorised mean")
+        controller->combineFlatoff_ptr = &winsorisedMeanMask;
     else controller->combineFlatoff_ptr = &meanMask;
 
     if (cdw->ui->flatMethodComboBox->currentText() == "Median")
         controller->combineFlat_ptr = &medianMask;
+    else if (cdw->ui->flatMethodComboBox->currentText() == "Clipped mean")
+        controller->combineFlat_ptr = &clippedMeanMask;
+    else if (cdw->ui->flatMethodComboBox->currentText() == "Winsorised mean")
+        controller->combineFlat_ptr = &winsorisedMeanMask;
     else controller->combineFlat_ptr = &meanMask;
 
     if (cdw->ui->BACmethodComboBox->currentText() == "Median")
@@ -21,10 +21,8 @@ If not, see https://www.gnu.org/licenses/ .
 #include "../functions.h"
 #include "myimage.h"
 
-#include <gsl/gsl_math.h>
-#include <gsl/gsl_interp2d.h>
-#include <gsl/gsl_spline2d.h>
-
+#include <omp.h>
+#include <algorithm>
 #include <vector>
 
 #include <QDebug>
@@ -66,7 +64,7 @@ void MyImage::backgroundModel(int filtersize, QString splinemode)
     filterGridStatistics();
 
     // Do the spline fit
-    fitBackgroundGSL();
+    fitBackgroundSpline();
 
     backgroundModelDone = true;
 }
@@ -82,56 +80,161 @@ void MyImage::getMeanBackground()
     meanExposureBackground = skysum / (naxis1*naxis2);
 }
 
-void MyImage::fitBackgroundGSL()
+// Second derivatives of the natural cubic spline through (x[k], z[k*stride+c]), for the 'ncol' columns c in [c0, c1)
+// of a row-major table with 'stride' columns. All columns share the same knots, hence the tridiagonal system
+// is solved once for all of them (Thomas algorithm, row operations are contiguous in memory).
+static void naturalSplineSecondDerivatives(const double *x, const long nk, const double *z, double *m2,
+                                           const long stride, const long c0, const long c1, double *work)
 {
-    if (!successProcessing) return;
-
-    double *xa = new double[n_grid];
-    double *ya = new double[m_grid];
-    double *za = new double[nGridPoints];
-
-    // Prepare the input data
-    for (int i=1; i<=n_grid; ++i) xa[i-1] = i*gridStep;
-    for (int j=1; j<=m_grid; ++j) ya[j-1] = j*gridStep;
-    long k=0;
-    for (int j=0; j<m_grid; ++j) {
-        for (int i=0; i<n_grid; ++i) {
-            za[k] = backStatsGrid[k];
-            ++k;
+    for (long c=c0; c<c1; ++c) {
+        m2[c] = 0.;
+        m2[(nk-1)*stride+c] = 0.;
+    }
+    if (nk < 3) return;
+
+    // work[k] holds the modified upper diagonal of row k
+    // forward sweep
+    for (long k=1; k<nk-1; ++k) {
+        const double h0 = x[k] - x[k-1];
+        const double h1 = x[k+1] - x[k];
+        const double lower = k > 1 ? h0 : 0.;
+        const double denom = 2.*(h0+h1) - lower * (k > 1 ? work[k-1] : 0.);
+        work[k] = h1 / denom;
+        const double *zlo = z + (k-1)*stride;
+        const double *zmi = z + k*stride;
+        const double *zhi = z + (k+1)*stride;
+        const double *mprev = m2 + (k-1)*stride;
+        double *mk = m2 + k*stride;
+        for (long c=c0; c<c1; ++c) {
+            const double rhs = 6. * ((zhi[c] - zmi[c]) / h1 - (zmi[c] - zlo[c]) / h0);
+            mk[c] = (rhs - lower * mprev[c]) / denom;
+        }
+    }
+    // back substitution (the natural boundary condition makes m2 vanish at the last knot)
+    for (long k=nk-3; k>=1; --k) {
+        const double *mnext = m2 + (k+1)*stride;
+        double *mk = m2 + k*stride;
+        const double u = work[k];
+        for (long c=c0; c<c1; ++c) {
+            mk[c] -= u * mnext[c];
         }
     }
+}
 
-    const gsl_interp2d_type *T = gsl_interp2d_bicubic;
-    gsl_spline2d *spline = gsl_spline2d_alloc(T, n_grid, m_grid);
-    gsl_interp_accel *xacc = gsl_interp_accel_alloc();
-    gsl_interp_accel *yacc = gsl_interp_accel_alloc();
+// Evaluation table for a cubic spline with knots x[k] at position 'pos':
+// s(pos) = w[0]*z[k] + w[1]*z[k+1] + w[2]*m2[k] + w[3]*m2[k+1]
+static void splineWeights(const double *x, const long nk, const double pos, long &k, double *w)
+{
+    // interval such that x[k] <= pos < x[k+1]; positions beyond the outermost knots extrapolate the end intervals
+    k = std::upper_bound(x, x+nk, pos) - x - 1;
+    if (k < 0) k = 0;
+    if (k > nk-2) k = nk-2;
+    const double h = x[k+1] - x[k];
+    const double a = (x[k+1] - pos) / h;
+    const double b = (pos - x[k]) / h;
+    w[0] = a;
+    w[1] = b;
+    w[2] = (a*a*a - a) * h*h / 6.;
+    w[3] = (b*b*b - b) * h*h / 6.;
+}
+
+// Bicubic interpolation of the grid statistics.
+// This is the tensor product of natural cubic splines, i.e. identical to gsl_interp2d_bicubic, but evaluated
+// separably: first each grid row is interpolated along NAXIS1 onto all image columns, then the resulting
+// table is interpolated along NAXIS2 for each image row. Both steps are linear combinations of a few rows.
+void MyImage::fitBackgroundSpline()
+{
+    if (!successProcessing) return;
 
-    // initialize interpolation
-    gsl_spline2d_init(spline, xa, ya, za, n_grid, m_grid);
+    const long n = naxis1;
+    const long m = naxis2;
+    const long ng = n_grid;
+    const long mg = m_grid;
 
-    // interpolate; remove padding at the same time
     dataBackground.clear();
-    dataBackground.resize(naxis1*naxis2);
+    dataBackground.resize(n*m);
 //    dataBackground.squeeze();             // deactivated; causes random crash I don't understand (perhaps not anymore after reading memory directly from /proc/meminfo
-    for (long j=pad_b; j<m_pad-pad_t; ++j) {
-        double y = double(j);
-        for (long i=pad_l; i<n_pad-pad_r; ++i) {
-            if (i-pad_l < 0 || i-pad_l >= naxis1 || j-pad_b < 0 || j-pad_b >= naxis2) qDebug() << "MyImage::background: GSLFIT: padding error";
-            double x = double(i);
-            dataBackground[i-pad_l+naxis1*(j-pad_b)] = gsl_spline2d_eval(spline, x, y, xacc, yacc);
-        }
+
+    if (ng < 2 || mg < 2) {
+        emit messageAvailable(chipName + " : Background model: grid too coarse for interpolation", "error");
+        emit critical();
+        successProcessing = false;
+        return;
     }
 
-    gsl_spline2d_free(spline);
-    gsl_interp_accel_free(xacc);
-    gsl_interp_accel_free(yacc);
+    // Knots (in padded coordinates), and the grid values
+    QVector<double> xa(ng);
+    QVector<double> ya(mg);
+    QVector<double> za(nGridPoints);
+    for (long i=0; i<ng; ++i) xa[i] = (i+1)*gridStep;
+    for (long j=0; j<mg; ++j) ya[j] = (j+1)*gridStep;
+    for (long k=0; k<nGridPoints; ++k) za[k] = backStatsGrid[k];
+
+    // Natural spline along NAXIS1 for each grid row
+    QVector<double> workx(ng);
+    QVector<double> zaxx(nGridPoints);
+    for (long j=0; j<mg; ++j) {
+        naturalSplineSecondDerivatives(xa.constData(), ng, za.constData()+j*ng, zaxx.data()+j*ng, 1, 0, 1, workx.data());
+    }
 
-    delete [] xa;
-    delete [] ya;
-    delete [] za;
-    xa = nullptr;
-    ya = nullptr;
-    za = nullptr;
+    // Evaluation tables for the image columns; removes the padding at the same time
+    QVector<long> kx(n);
+    QVector<double> wx(4*n);
+    for (long i=0; i<n; ++i) splineWeights(xa.constData(), ng, double(i+pad_l), kx[i], wx.data()+4*i);
+
+    // The grid rows interpolated onto the image columns, and their second derivatives along NAXIS2
+    QVector<double> rows(mg*n);
+    QVector<double> rowsyy(mg*n);
+
+    const double *yaPtr = ya.constData();
+    const double *zaPtr = za.constData();
+    const double *zaxxPtr = zaxx.constData();
+    const long *kxPtr = kx.constData();
+    const double *wxPtr = wx.constData();
+    double *rowsPtr = rows.data();
+    double *rowsyyPtr = rowsyy.data();
+    float *background = dataBackground.data();
+
+    // Column blocks, so that the NAXIS2 solve of a block stays in cache
+    const long blockSize = 256;
+    const long numBlocks = (n + blockSize - 1) / blockSize;
+
+#pragma omp parallel num_threads(maxCPU)
+    {
+        QVector<double> worky(mg);
+
+#pragma omp for schedule(static)
+        for (long b=0; b<numBlocks; ++b) {
+            const long c0 = b*blockSize;
+            const long c1 = std::min(n, c0+blockSize);
+            for (long j=0; j<mg; ++j) {
+                const double *z = zaPtr + j*ng;
+                const double *zxx = zaxxPtr + j*ng;
+                double *row = rowsPtr + j*n;
+                for (long i=c0; i<c1; ++i) {
+                    const long k = kxPtr[i];
+                    const double *w = wxPtr + 4*i;
+                    row[i] = w[0]*z[k] + w[1]*z[k+1] + w[2]*zxx[k] + w[3]*zxx[k+1];
+                }
+            }
+            naturalSplineSecondDerivatives(yaPtr, mg, rowsPtr, rowsyyPtr, n, c0, c1, worky.data());
+        }
+
+#pragma omp for schedule(static)
+        for (long j=0; j<m; ++j) {
+            long k = 0;
+            double w[4];
+            splineWeights(yaPtr, mg, double(j+pad_b), k, w);
+            const double *r0 = rowsPtr + k*n;
+            const double *r1 = rowsPtr + (k+1)*n;
+            const double *s0 = rowsyyPtr + k*n;
+            const double *s1 = rowsyyPtr + (k+1)*n;
+            float *out = background + j*n;
+            for (long i=0; i<n; ++i) {
+                out[i] = w[0]*r0[i] + w[1]*r1[i] + w[2]*s0[i] + w[3]*s1[i];
+            }
+        }
+    }
 }
 
 void MyImage::getGridStatistics()
@@ -145,48 +248,63 @@ void MyImage::getGridStatistics()
     rmsStatsGrid.fill(-1., nGridPoints);
 
     long sampleSize = gridStep * gridStep / 4;       // This many pixels are evaluated at each grid point
-    QVector<float> backgroundSample;
-    backgroundSample.reserve(sampleSize);
-    // for (long index=0; index<nGridPoints; ++index) {
 
     // TODO: grid size must be at least twice smaller than the smoothing kernel!
 
-    for (long jg=1; jg<m_grid-1; ++jg) {
-        for (long ig=1; ig<n_grid-1; ++ig) {
+    const float *data = dataCurrent.constData();
+    const float *weight = weightInMemory ? dataWeight.constData() : nullptr;
+    const long *grid_x = grid[0].constData();
+    const long *grid_y = grid[1].constData();
+    float *backStats = backStatsGrid.data();
+    float *rmsStats = rmsStatsGrid.data();
+    const long numInnerGridPoints = (n_grid-2) * (m_grid-2);
+
+    // Each thread has its own sample buffer. Grid points near masked areas have fewer samples, hence dynamic scheduling.
+#pragma omp parallel num_threads(maxCPU)
+    {
+        QVector<float> backgroundSample;
+        backgroundSample.reserve(sampleSize);
+
+#pragma omp for schedule(dynamic)
+        for (long g=0; g<numInnerGridPoints; ++g) {
+            long ig = 1 + g % (n_grid-2);
+            long jg = 1 + g / (n_grid-2);
             long index = ig+n_grid*jg;
-            // Select data points in a square around the current grid point
-            for (long j=grid[1][index]-gridStep/2; j<grid[1][index]+gridStep/2; ++j) {
-                for (long i=grid[0][index]-gridStep/2; i<grid[0][index]+gridStep/2; ++i) {
-                    //                    if (!mask_padded[i+n_pad*j]) backgroundSample.append(data_padded[i+n_pad*j]);
-                    if (i-pad_l < 0 || i-pad_l >= naxis1 || j-pad_b < 0 || j-pad_b>=naxis2) continue;
+            // Select data points in a square around the current grid point (and inside the image)
+            long jmin = std::max(grid_y[index]-gridStep/2, long(pad_b));
+            long jmax = std::min(grid_y[index]+gridStep/2, naxis2+pad_b);
+            long imin = std::max(grid_x[index]-gridStep/2, long(pad_l));
+            long imax = std::min(grid_x[index]+gridStep/2, naxis1+pad_l);
+            for (long j=jmin; j<jmax; ++j) {
+                for (long i=imin; i<imax; ++i) {
                     // Take into account global mask, and possibly object masks as well (if defined)
 
                     // With global mask
                     long ii = i-pad_l+naxis1*(j-pad_b);
-                    if (globalMaskAvailable && !globalMask[ii]) {
-                        if (!weightInMemory) {
-                            if (!objectMaskDone || !objectMask[ii]) {   // !objectMask[ii] implies objectMaskDone = true
-                                backgroundSample.append(dataCurrent[ii]);
+                    if (globalMaskAvailable && !globalMask.at(ii)) {
+                        if (weight == nullptr) {
+                            if (!objectMaskDone || !objectMask.at(ii)) {   // !objectMask[ii] implies objectMaskDone = true
+                                backgroundSample.append(data[ii]);
                             }
                         }
                         else {
-                            if (dataWeight[ii] > 0.
-                                    && (!objectMaskDone || !objectMask[ii])) {
-                                backgroundSample.append(dataCurrent[ii]);
+                            if (weight[ii] > 0.
+                                    && (!objectMaskDone || !objectMask.at(ii))) {
+                                backgroundSample.append(data[ii]);
                             }
                         }
                     }
                     // without global mask: external image, e.g. for absZP
                     else {
-                        if (!weightInMemory) {
-                            if (!objectMaskDone || !objectMask[ii]) {
-                                backgroundSample.append(dataCurrent[ii]);
+                        if (weight == nullptr) {
+                            if (!objectMaskDone || !objectMask.at(ii)) {
+                                backgroundSample.append(data[ii]);
                             }
                         }
                         else {
-                            if (dataWeight[ii] > 0.
-                                    && (!objectMaskDone || !objectMask[ii])) {
-                                backgroundSample.append(dataCurrent[ii]);
+                            if (weight[ii] > 0.
+                                    && (!objectMaskDone || !objectMask.at(ii))) {
+                                backgroundSample.append(data[ii]);
                             }
                         }
                     }
@@ -194,8 +312,8 @@ void MyImage::getGridStatistics()
             }
 
             QVector<float> sky = modeMask(backgroundSample, "stable");
-            if (sky[1] > 0.) backStatsGrid[index] = sky[0];  // Histogram peak location (if rms could be evaluated, or data were present)
-            if (sky[1] > 0.) rmsStatsGrid[index] = sky[1];
+            if (sky[1] > 0.) backStats[index] = sky[0];  // Histogram peak location (if rms could be evaluated, or data were present)
+            if (sky[1] > 0.) rmsStats[index] = sky[1];
             backgroundSample.clear();
         }
     }
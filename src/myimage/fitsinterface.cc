@@ -29,6 +29,17 @@ If not, see https://www.gnu.org/licenses/ .
 #include <QFileInfo>
 #include <QDebug>
 
+namespace {
+// The image geometry. NAXIS1/2 must not be read as keywords: for tile-compressed images they describe the binary table.
+void readImageSize(fitsfile *fptr, long &naxis1, long &naxis2, int *status)
+{
+    long naxis[2] = {0, 0};
+    fits_get_img_size(fptr, 2, naxis, status);
+    naxis1 = naxis[0];
+    naxis2 = naxis[1];
+}
+}
+
 // Extract the FILTER keyword from a yet unopened FITS file
 void MyImage::readFILTER(QString loadFileName)
 {
@@ -54,8 +65,7 @@ bool MyImage::informSwarpfilter(long &naxis1, long &naxis2, double &crpix1, doub
     initFITS(&fptr, loadFileName, &status);
     fits_read_key_dbl(fptr, "CRPIX1", &crpix1, NULL, &status);
     fits_read_key_dbl(fptr, "CRPIX2", &crpix2, NULL, &status);
-    fits_read_key_lng(fptr, "NAXIS1", &naxis1, NULL, &status);
-    fits_read_key_lng(fptr, "NAXIS2", &naxis2, NULL, &status);
+    readImageSize(fptr, naxis1, naxis2, &status);
     fits_read_key_dbl(fptr, "SKYVALUE", &sky, NULL, &status);
     fits_read_key_dbl(fptr, "FLXSCALE", &fluxscale, NULL, &status);
     fits_close_file(fptr, &status);
@@ -78,8 +88,10 @@ void MyImage::initFITS(fitsfile **fptr, QString loadFileName, int *status)
         *status = 104;
         return;
     }
-    fits_open_file(fptr, loadFileName.toUtf8().data(), READONLY, status);
+    // fits_open_image() moves to the first HDU with image data, i.e. to the extension of tile-compressed files
+    fits_open_image(fptr, loadFileName.toUtf8().data(), READONLY, status);
     fits_get_num_hdus(*fptr, &numExt, status);
+    if (numExt == 2 && fits_is_compressed_image(*fptr, status)) numExt = 1;
     if (numExt > 1) {
         QMessageBox msgBox;
         msgBox.setText(name+" is a multi-extension FITS file, which is currently not supported.");
@@ -92,7 +104,8 @@ void MyImage::readHeader(fitsfile **fptr, int *status)
 {
     if (*status) return;
     // Read the entire header. This should always work!
-    fits_hdr2str(*fptr, 0, NULL, 0, &fullheader, &numHeaderKeys, status);
+    // For tile-compressed images, this returns the header of the uncompressed image
+    fits_convert_hdr2str(*fptr, 0, NULL, 0, &fullheader, &numHeaderKeys, status);
 
     fullheaderAllocated = true;
     if (*status) return;
@@ -111,6 +124,18 @@ void MyImage::readHeader(fitsfile **fptr, int *status)
     }
 }
 
+namespace {
+// Sizes the vector for a FITS read. A vector shared with e.g. a backup copy is released instead of
+// being detached, because detaching would copy pixels that are overwritten anyway.
+void prepareReadTarget(QVector<float> &target, long nelements)
+{
+    if (target.size() != nelements || !target.isDetached()) {
+        target.clear();
+        target.resize(nelements);
+    }
+}
+}
+
 void MyImage::readData(fitsfile **fptr, int *status)
 {
     if (*status) return;
@@ -119,28 +144,18 @@ void MyImage::readData(fitsfile **fptr, int *status)
     // Get image geometry
     fits_get_img_size(*fptr, 2, naxis, status);
 
-    // Read the data block
+    // Read the data block straight into the vector
     naxis1 = naxis[0];
     naxis2 = naxis[1];
     long nelements = naxis1*naxis2;
-    float *buffer = new float[nelements];
+    prepareReadTarget(dataCurrent, nelements);
     float nullval = 0.;
     int anynull;
     long fpixel = 1;
-    fits_read_img(*fptr, TFLOAT, fpixel, nelements, &nullval, buffer, &anynull, status);
-
-    if (! *status) {
-        dataCurrent.resize(nelements);
-        for (long i=0; i<nelements; ++i) {
-            // if (isinf(buffer[i])) data[i] = 0.;
-            // else data[i] = buffer[i];
-            dataCurrent[i] = buffer[i];
-        }
-    }
-    dataCurrent.squeeze(); // shed excess memory
+    fits_read_img(*fptr, TFLOAT, fpixel, nelements, &nullval, dataCurrent.data(), &anynull, status);
 
-    delete [] buffer;
-    buffer = nullptr;
+    if (*status) dataCurrent.clear();
+    dataCurrent.squeeze(); // shed excess memory
 }
 
 void MyImage::readDataWeight(fitsfile **fptr, int *status)
@@ -151,33 +166,24 @@ void MyImage::readDataWeight(fitsfile **fptr, int *status)
     // Get image geometry
     fits_get_img_size(*fptr, 2, naxis, status);
 
-    // Read the data block
+    // Read the data block straight into the vector
     long nax1 = naxis[0];
     long nax2 = naxis[1];
     long nelements = nax1*nax2;
-    float *buffer = new float[nelements];
+    prepareReadTarget(dataWeight, nelements);
     float nullval = 0.;
     int anynull;
     long fpixel = 1;
-    fits_read_img(*fptr, TFLOAT, fpixel, nelements, &nullval, buffer, &anynull, status);
-
-    if (! *status) {
-        dataWeight.resize(nelements);
-        for (long i=0; i<nelements; ++i) {
-            // if (isinf(buffer[i])) data[i] = 0.;
-            // else data[i] = buffer[i];
-            dataWeight[i] = buffer[i];
-        }
-    }
-    dataWeight.squeeze(); // shed excess memory
+    fits_read_img(*fptr, TFLOAT, fpixel, nelements, &nullval, dataWeight.data(), &anynull, status);
 
-    delete [] buffer;
-    buffer = nullptr;
+    if (*status) dataWeight.clear();
+    dataWeight.squeeze(); // shed excess memory
 }
 
 bool MyImage::loadData(QString loadFileName)
 {
     if (loadFileName.isEmpty()) loadFileName = path + "/" + chipName+processingStatus->statusString+".fits";
+    waitForPendingWrites();
 
     int status = 0;
     fitsfile *fptr = nullptr;
@@ -205,6 +211,7 @@ bool MyImage::loadData(QString loadFileName)
 // for weights only, when having to read the globalweights
 bool MyImage::loadDataThreadSafe(QString loadFileName)
 {
+    waitForPendingWrites();
     int status = 0;
 #pragma omp critical
     {
@@ -290,6 +297,7 @@ void MyImage::loadHeader(QString loadFileName)
 {
     if (headerInfoProvided) return;
     if (loadFileName.isEmpty()) loadFileName = path+"/"+baseName+".fits";
+    waitForPendingWrites();
     int status = 0;
     fitsfile *fptr = nullptr;
     initFITS(&fptr, loadFileName, &status);
@@ -321,7 +329,7 @@ void MyImage::getMJD()
     QString fileName = path+"/"+chipName+processingStatus->statusString+".fits";
 
     int status = 0;
-    fits_open_file(&fptr, fileName.toUtf8().data(), READONLY, &status);
+    fits_open_image(&fptr, fileName.toUtf8().data(), READONLY, &status);
     fits_read_key_dbl(fptr, "MJD-OBS", &mjdobs, NULL, &status);
     fits_close_file(fptr, &status);
 
@@ -440,6 +448,9 @@ void MyImage::propagateHeader(fitsfile *fptr, QVector<QString> header)
                 || key.contains("NAXIS")
                 || key.contains("BITPIX")
                 || key.contains("EXTEND")
+                || key == "XTENSION"
+                || key == "PCOUNT"
+                || key == "GCOUNT"
                 || key.contains("END")) {
             continue;
         }
@@ -448,6 +459,40 @@ void MyImage::propagateHeader(fitsfile *fptr, QVector<QString> header)
 }
 
 
+// Must be called after fits_create_file() and before fits_create_img(). Tiles are single image lines (cfitsio default),
+// such that reading sections of lines (e.g. in swarpfilter) only decompresses the lines needed.
+void MyImage::setupFitsCompression(fitsfile *fptr, bool lossless, int *status)
+{
+    if (fitsCompression == "Quantised" && !lossless) {
+        fits_set_compression_type(fptr, RICE_1, status);
+        fits_set_quantize_level(fptr, 16., status);
+        fits_set_quantize_method(fptr, SUBTRACTIVE_DITHER_2, status);     // preserves exact zeros
+    }
+    else if (fitsCompression == "Lossless" || fitsCompression == "Quantised") {
+        fits_set_compression_type(fptr, GZIP_2, status);
+        fits_set_quantize_level(fptr, 0., status);                         // floating point data are not quantised
+    }
+}
+
+// External tools (SWarp, Source Extractor) cannot read tile-compressed images. If 'fileName' is compressed, an uncompressed
+// copy is written to 'outName' and true is returned. Returns false if the file is not compressed, or if an error occurred.
+bool MyImage::uncompressedCopy(QString fileName, QString outName, int *status)
+{
+    fitsfile *fptr = nullptr;
+    fits_open_image(&fptr, fileName.toUtf8().data(), READONLY, status);
+    if (*status) return false;
+    if (!fits_is_compressed_image(fptr, status)) {
+        fits_close_file(fptr, status);
+        return false;
+    }
+    fitsfile *outptr = nullptr;
+    fits_create_file(&outptr, ("!"+outName).toUtf8().data(), status);
+    fits_img_decompress(fptr, outptr, status);
+    fits_close_file(outptr, status);
+    fits_close_file(fptr, status);
+    return !*status;
+}
+
 void MyImage::stayWithinBounds(long &coord, QString axis)
 {
     if (coord < 0) coord = 0;
@@ -468,16 +513,49 @@ void MyImage::stayWithinBounds(QVector<long> &vertices)
     if (vertices[3] > naxis2-1) vertices[3] = naxis2-1;
 }
 
-// used in swarpfilter (using arrays instead of vectors, for performance reasons; unnecessary data copying)
-void MyImage::loadDataSection(long xmin, long xmax, long ymin, long ymax, float *dataSect)
+// Keep the FITS file open for subsequent loadDataSection() / writeDataSection() calls (swarpfilter reads many sections of the same images).
+// Returns false if the file could not be opened, e.g. because too many files are open; loadDataSection() then
+// falls back to opening the file for every call.
+bool MyImage::openDataSectionFile(bool readWrite)
 {
+    if (sectionFptr != nullptr) return true;
+
     QString fileName = path + "/" + name;
+    int status = 0;
+    fits_open_image(&sectionFptr, fileName.toUtf8().data(), readWrite ? READWRITE : READONLY, &status);
+    readImageSize(sectionFptr, naxis1, naxis2, &status);
+    if (status) {
+        if (sectionFptr != nullptr) {
+            int closeStatus = 0;
+            fits_close_file(sectionFptr, &closeStatus);
+        }
+        sectionFptr = nullptr;
+        return false;
+    }
+    return true;
+}
 
+void MyImage::closeDataSectionFile()
+{
+    if (sectionFptr == nullptr) return;
     int status = 0;
-    fitsfile *fptr = nullptr;
-    initFITS(&fptr, fileName, &status);
-    fits_read_key_lng(fptr, "NAXIS1", &naxis1, NULL, &status);
-    fits_read_key_lng(fptr, "NAXIS2", &naxis2, NULL, &status);
+    fits_close_file(sectionFptr, &status);
+    sectionFptr = nullptr;
+    printCfitsioError("MyImage::closeDataSectionFile()", status);
+}
+
+// used in swarpfilter and when combining calibrators from drive
+// (using arrays instead of vectors, for performance reasons; unnecessary data copying)
+bool MyImage::loadDataSection(long xmin, long xmax, long ymin, long ymax, float *dataSect)
+{
+    int status = 0;
+    fitsfile *fptr = sectionFptr;
+    // Open the file just for this section, unless it is kept open anyway
+    if (fptr == nullptr) {
+        QString fileName = path + "/" + name;
+        initFITS(&fptr, fileName, &status);
+        readImageSize(fptr, naxis1, naxis2, &status);
+    }
 
     long xmin_old = xmin;
     long xmax_old = xmax;
@@ -492,17 +570,60 @@ void MyImage::loadDataSection(long xmin, long xmax, long ymin, long ymax, float
             || ymin != ymin_old
             || ymax != ymax_old) {
         emit messageAvailable("MyImage::loadDataSection() / swarpfilter: image size was modified!", "error");
-        return;
+        if (fptr != sectionFptr) fits_close_file(fptr, &status);
+        return false;
     }
 
     float nullval = 0.;
     int anynull = 0;
-    long fpixel[2] = {xmin+1, ymin+1};   // cfitsio starts counting at 1, at least here
-    long lpixel[2] = {xmax+1, ymax+1};   // cfitsio starts counting at 1, at least here
-    long strides[2] = {1, 1};
-    fits_read_subset(fptr, TFLOAT, fpixel, lpixel, strides, &nullval, dataSect, &anynull, &status);
-    fits_close_file(fptr, &status);
+    if (xmin == 0 && xmax == naxis1-1) {
+        // Full lines are contiguous in the file, and can be read in one go
+        LONGLONG firstelem = ymin*naxis1 + 1;     // cfitsio starts counting at 1
+        LONGLONG nelements = (ymax-ymin+1)*naxis1;
+        fits_read_img(fptr, TFLOAT, firstelem, nelements, &nullval, dataSect, &anynull, &status);
+    }
+    else {
+        long fpixel[2] = {xmin+1, ymin+1};   // cfitsio starts counting at 1, at least here
+        long lpixel[2] = {xmax+1, ymax+1};   // cfitsio starts counting at 1, at least here
+        long strides[2] = {1, 1};
+        fits_read_subset(fptr, TFLOAT, fpixel, lpixel, strides, &nullval, dataSect, &anynull, &status);
+    }
+    if (fptr != sectionFptr) fits_close_file(fptr, &status);
 
-    printCfitsioError("MyImage::stayWithinBounds()", status);
+    printCfitsioError("MyImage::loadDataSection()", status);
+
+    if (status) return false;
+    else return true;
+}
+
+// Overwrites the full lines ymin ... ymax of the FITS file in place, leaving the header untouched
+// (used by swarpfilter to update the resampled weights). Needs a file opened with openDataSectionFile(true),
+// otherwise the file is opened for this call only.
+bool MyImage::writeDataSection(long ymin, long ymax, float *dataSect)
+{
+    int status = 0;
+    fitsfile *fptr = sectionFptr;
+    if (fptr == nullptr) {
+        QString fileName = path + "/" + name;
+        fits_open_image(&fptr, fileName.toUtf8().data(), READWRITE, &status);
+        readImageSize(fptr, naxis1, naxis2, &status);
+    }
+
+    if (!status && (ymin < 0 || ymax >= naxis2 || ymin > ymax)) {
+        emit messageAvailable("MyImage::writeDataSection(): lines " + QString::number(ymin) + " - " + QString::number(ymax)
+                              + " are outside of " + name, "error");
+        if (fptr != sectionFptr) fits_close_file(fptr, &status);
+        return false;
+    }
+
+    LONGLONG firstelem = ymin*naxis1 + 1;     // cfitsio starts counting at 1
+    LONGLONG nelements = (ymax-ymin+1)*naxis1;
+    fits_write_img(fptr, TFLOAT, firstelem, nelements, dataSect, &status);
+    if (fptr != sectionFptr) fits_close_file(fptr, &status);
+
+    printCfitsioError("MyImage::writeDataSection()", status);
+
+    if (status) return false;
+    else return true;
 }
 
@@ -65,6 +65,9 @@ void MyImage::makeDriveBackup(QString backupDirName, QString statusOld)
     QString oldName = chipName+statusOld+".fits";
     QFile image(currentPath+"/"+oldName);
 
+    // The image may still be queued for writing
+    waitForPendingWrites();
+
     // Do nothing if the image does not exist on drive (i.e. is in memory only)
     if (!image.exists()) return;
 
@@ -571,15 +574,16 @@ float MyImage::freeData(QString type)
         released = true;
     }
     else if (type == "dataCurrent" && dataCurrent_deletable && dataCurrent.capacity() > 0) {
-        // Must write image to drive if not yet the case
-        if (!imageOnDrive) {
-            writeImage();
-            imageOnDrive = true;
+        // Must write image to drive if not yet the case (a queued write may still be on its way).
+        // The pixels are kept if they could not be written, otherwise they would be lost.
+        waitForPendingWrites();
+        if (!imageOnDrive) writeImage();
+        if (imageOnDrive) {
+            dataCurrent.clear();
+            dataCurrent.squeeze();
+            imageInMemory = false;
+            released = true;
         }
-        dataCurrent.clear();
-        dataCurrent.squeeze();
-        imageInMemory = false;
-        released = true;
     }
     else if (type == "all") {
         // used if a project is changed; release all memory
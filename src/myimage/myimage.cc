@@ -34,9 +34,11 @@ If not, see https://www.gnu.org/licenses/ .
 #include <QString>
 #include <QTest>
 
+QString MyImage::fitsCompression = "None";
+
 // C'tor
 MyImage::MyImage(QString pathname, QString filename, QString statusString, int chipnumber,
-                 const QVector<bool> &mask, int *verbose, QObject *parent) : QObject(parent), globalMask(mask)
+                 const BitMask &mask, int *verbose, QObject *parent) : QObject(parent), globalMask(mask)
 {
     path = pathname;
     name = filename;
@@ -92,7 +94,7 @@ void MyImage::checkTaskRepeatStatus(QString taskBasename)
     else if (taskBasename == "Skysub" && processingStatus->Skysub) isTaskRepeated = true;
 }
 
-MyImage::MyImage(QString fullPathName, const QVector<bool> &mask, int *verbose, QObject *parent) :
+MyImage::MyImage(QString fullPathName, const BitMask &mask, int *verbose, QObject *parent) :
     QObject(parent), globalMask(mask)
 {
     QFileInfo fi(fullPathName);
@@ -142,10 +144,8 @@ MyImage::MyImage(QString fullPathName, const QVector<bool> &mask, int *verbose,
 
 MyImage::~MyImage()
 {
-    for (auto &object : objectList) {
-        delete object;
-        object = nullptr;
-    }
+    waitForPendingWrites();
+    closeDataSectionFile();
 
     if (wcsInit) wcsfree(wcs);
     if (wcsInit) {
@@ -347,22 +347,18 @@ void MyImage::readImageBackupL1()
 
         int status = 0;
         long nelements = naxis1*naxis2;
-        float *buffer = new float[nelements];
         float nullval = 0.;
         int anynull;
         long fpixel = 1;
         fitsfile *fptr = nullptr;
-        fits_open_file(&fptr, backupName.toUtf8().data(), READONLY, &status);
-        fits_read_img(fptr, TFLOAT, fpixel, nelements, &nullval, buffer, &anynull, &status);
+        // Read straight into the vector (released first, so that a copy shared with dataCurrent is not detached)
+        dataBackupL1.clear();
+        dataBackupL1.resize(nelements);
+        fits_open_image(&fptr, backupName.toUtf8().data(), READONLY, &status);
+        fits_read_img(fptr, TFLOAT, fpixel, nelements, &nullval, dataBackupL1.data(), &anynull, &status);
         fits_close_file(fptr, &status);
         printCfitsioError("readImageBackupL1()", status);
 
-        dataBackupL1.resize(nelements);
-        for (long i=0; i<nelements; ++i) {
-            dataBackupL1[i] = buffer[i];
-        }
-        delete [] buffer;
-        buffer = nullptr;
         backupL1InMemory = true;
         dataCurrent = dataBackupL1;     // probably unnecessary, as we operate on databackupL1, updating dataCurrent
         dataBackupL1.squeeze();  // shed excess memory
@@ -474,21 +470,20 @@ void MyImage::backupOrigHeader(int chip)
     fitsfile *fptr;
     int status = 0;
     int nkeys = 0;
-    int keypos = 0;
-    char card[FLEN_CARD];
+    char *cards = nullptr;
     // Must read from pathBackupL1
     QString filename = pathBackupL1+"/"+baseNameBackupL1+".fits";
     //    QString filename = path+"/"+baseName+".fits";
-    fits_open_file(&fptr, filename.toUtf8().data(), READWRITE, &status);
-    fits_get_hdrpos(fptr, &nkeys, &keypos, &status); // get number of keywords
-    for (int i=1; i<=nkeys; ++i) {
-        fits_read_record(fptr, i, card, &status);
-        stream << card << "\n";
-    }
-    if (status == END_OF_FILE) status = 0;
-    else {
-        printCfitsioError("backupOrigHeader()", status);
+    fits_open_image(&fptr, filename.toUtf8().data(), READWRITE, &status);
+    // For tile-compressed images, this returns the header of the uncompressed image instead of the binary table
+    fits_convert_hdr2str(fptr, 0, NULL, 0, &cards, &nkeys, &status);
+    if (!status) {
+        for (int i=0; i<nkeys; ++i) {
+            stream << QString::fromUtf8(cards+80*i, 80) << "\n";
+        }
+        fits_free_memory(cards, &status);
     }
+    printCfitsioError("backupOrigHeader()", status);
     fits_close_file(fptr, &status);
     file.close();
     file.setPermissions(QFile::ReadUser | QFile::WriteUser);
@@ -624,7 +619,7 @@ void MyImage::updateHeaderValueInFITS(QString keyName, QString keyValue)
 
     int status = 0;
     fitsfile *fptr = nullptr;
-    fits_open_file(&fptr, (path+"/"+name).toUtf8().data(), READWRITE, &status);
+    fits_open_image(&fptr, (path+"/"+name).toUtf8().data(), READWRITE, &status);
     fits_update_key_str(fptr, keyName.toUtf8().data(), keyValue.toUtf8().data(), nullptr, &status);
     fits_close_file(fptr, &status);
     printCfitsioError("updateHeaderValueInFITS", status);
@@ -874,7 +869,7 @@ void MyImage::illuminationCorrection(int chip, QString thelidir, QString instNam
     QString illumcorrFileName = "illumcorr_"+filter+"_"+QString::number(chip)+".fits";
     if (QFile(illumcorrPath+illumcorrFileName).exists()) {
         if (*verbosity > 1) emit messageAvailable(chipName + " : External illumination correction : <br>" + illumcorrPath+illumcorrFileName, "image");
-        QVector<bool> dummyMask;
+        BitMask dummyMask;
         dummyMask.clear();
         MyImage *illumCorrFlat = new MyImage(illumcorrPath, illumcorrFileName, "", chip+1, dummyMask, verbosity);
         illumCorrFlat->readImage();
@@ -1033,7 +1028,7 @@ void MyImage::setupCoaddMode()
     QFile file(path+"/"+weightName);
     if (!file.exists()) return;
 
-    QVector<bool> dummyMask;
+    BitMask dummyMask;
     dummyMask.clear();
     MyImage *myWeight = new MyImage(path, weightName, "", 1, dummyMask, verbosity);
     myWeight->readImage();
@@ -1046,6 +1041,7 @@ void MyImage::setupCoaddMode()
 void MyImage::updateZeroOrderOnDrive(QString updateMode)
 {
     if (!successProcessing) return;
+    waitForPendingWrites();
     if (!imageOnDrive) return;
 
     // Must write file to disk (scamp reads the header information) if it does not exist yet
@@ -1056,7 +1052,7 @@ void MyImage::updateZeroOrderOnDrive(QString updateMode)
     char zerohead[80] = {0};
     QString zeroheadString = "";
     fitsfile *fptr = nullptr;
-    fits_open_file(&fptr, (path+"/"+chipName+processingStatus->statusString+".fits").toUtf8().data(), READWRITE, &status);
+    fits_open_image(&fptr, (path+"/"+chipName+processingStatus->statusString+".fits").toUtf8().data(), READWRITE, &status);
     fits_read_key_str(fptr, "ZEROHEAD", zerohead, nullptr, &status);
     if (status > 0) {
         // Add the key if it doesn't exist
@@ -1161,7 +1157,7 @@ void MyImage::updateCRVALinHeaderOnDrive()
 
     int status = 0;
     fitsfile *fptr = nullptr;
-    fits_open_file(&fptr, (outfile).toUtf8().data(), READWRITE, &status);
+    fits_open_image(&fptr, (outfile).toUtf8().data(), READWRITE, &status);
     fits_update_key_dbl(fptr, "CRVAL1", wcs->crval[0], 6, nullptr, &status);
     fits_update_key_dbl(fptr, "CRVAL2", wcs->crval[1], 6, nullptr, &status);
     fits_close_file(fptr, &status);
@@ -1177,7 +1173,7 @@ void MyImage::updateCRVALCDinHeaderOnDrive()
 
     int status = 0;
     fitsfile *fptr = nullptr;
-    fits_open_file(&fptr, (outfile).toUtf8().data(), READWRITE, &status);
+    fits_open_image(&fptr, (outfile).toUtf8().data(), READWRITE, &status);
     fits_update_key_dbl(fptr, "CRVAL1", wcs->crval[0], 6, nullptr, &status);
     fits_update_key_dbl(fptr, "CRVAL2", wcs->crval[1], 6, nullptr, &status);
     fits_update_key_flt(fptr, "CD1_1", wcs->cd[0], 6, nullptr, &status);
@@ -1209,10 +1205,11 @@ void MyImage::applyMask()
         return;
     }
 
-    long i=0;
-    for (auto &it : dataCurrent) {
-        if (globalMask[i]) it = maskValue;
-        ++i;
+    // Visit the masked pixels only
+    float *data = dataCurrent.data();
+    const long n = dataCurrent.length();
+    for (long i=globalMask.nextMasked(0); i<n; i=globalMask.nextMasked(i+1)) {
+        data[i] = maskValue;
     }
 }
 
@@ -1453,13 +1450,7 @@ QVector<float> MyImage::retainUnmaskedData(int sampleDensity)
 void MyImage::mergeObjectWithGlobalMask()
 {
     if (objectMask.isEmpty()) objectMask = globalMask;
-    else {
-        long i=0;
-        for (auto &pixel : objectMask) {
-            pixel *= globalMask.at(i);
-            ++i;
-        }
-    }
+    else objectMask &= globalMask;
 }
 
 void MyImage::subtract(float value, QString mode)
@@ -1561,6 +1552,7 @@ void MyImage::setActiveState(active_type state)
     QString currentPath = path + pathExtension;      // The path where the image is currently located (if on disk)
     updateInactivePath();                            // Update pathextension according to the set state
     QString newPath = path + pathExtension;          // The path where the image should go
+    waitForPendingWrites();
     if (!imageOnDrive) return;
     moveFile(baseName+".fits", currentPath, newPath);
     // TODO: must do a modelUpdate
@@ -20,9 +20,13 @@ If not, see https://www.gnu.org/licenses/ .
 #ifndef MYIMAGE_H
 #define MYIMAGE_H
 
+#include "../tools/bitmask.h"
 #include "../tools/detectedobject.h"
+#include "../tools/detectioncatalog.h"
+#include "../tools/detectionfilter.h"
 #include "../threading/sourceextractorworker.h"
 #include "../threading/anetworker.h"
+#include "../threading/writequeue.h"
 #include "../processingStatus/processingStatus.h"
 #include "../instrumentdata.h"
 
@@ -33,6 +37,8 @@ If not, see https://www.gnu.org/licenses/ .
 #include <wcs.h>
 
 #include <QObject>
+#include <QMutex>
+#include <QWaitCondition>
 
 // This class keeps track of an individual image, its memory/disk state,
 // processing status, previous processing states, file name, FITS file handles,
@@ -46,6 +52,7 @@ private:
 
     void stayWithinBounds(QVector<long> &vertices);
     void stayWithinBounds(long &coord, QString axis);
+    fitsfile *sectionFptr = nullptr;    // kept open between loadDataSection() calls, see openDataSectionFile()
     float polynomialSum(float x, QVector<float> coefficients);
 
     // ================= BACKGROUND MODELING ===========================
@@ -73,7 +80,7 @@ private:
     void planGrid();
     void getGridStatistics();
     void filterGridStatistics();
-    void fitBackgroundGSL();
+    void fitBackgroundSpline();
     void getPadDimensions();
     void padImage();
     void padCorner(int width, QString corner, long ipadmin, long ipadmax, long jpadmin, long jpadmax);
@@ -87,9 +94,7 @@ private:
 
     // ================== Image segmentation ===========================
     void thresholdImage();
-    bool insideImage(QPoint p);
-    void floodFill(const QPoint startPoint, QList<long> &objectPixelIndices, long &objID,
-                   QVector<long> &dataSegmentation, const long DMIN);
+    void labelObjects(const long DMIN, QVector<QList<long>> &objectPixels);
     QVector<float> directConvolve(const QVector<float> &data);
     void writeObjectMask(QString fileName);
 
@@ -121,7 +126,24 @@ private:
     void checkTHELIheader(int *status);
     void propagateHeader(fitsfile *fptr, QVector<QString> header);
     bool write(QString fileName, const QVector<float> &data,
-               const float exptime, const QString filter, const QVector<QString> header);
+               const float exptime, const QString filter, const QVector<QString> header, const bool lossless = false);
+    // Everything write() puts into the FITS file, detached from the members so that it can be written
+    // by the write-behind queue while the image is processed further
+    struct FitsWriteRequest {
+        QString fileName;
+        QVector<float> data;         // implicitly shared with dataCurrent
+        QVector<QString> header;
+        long naxis1 = 0;
+        long naxis2 = 0;
+        float exptime = -1.0;
+        QString filter;
+        bool addGainNormalization = false;
+        float gainNormalization = 1.0;
+        double mjdobs = 0.;
+        bool lossless = false;
+    };
+    void writeFITS(const FitsWriteRequest &request, int *status);
+    bool queuedWriteFinished(QString fileName, int status);
     void writeConstImage(QString fileName, const float constValue, const QVector<QString> header);
     bool writeDebayer(QString fileName, const float exptime, const QString filter,
                       const QVector<QString> header);
@@ -130,8 +152,8 @@ private:
     bool doesHeaderContain(QString keyword);
 public:
     explicit MyImage(QString pathname, QString filename, QString statusString, int chipnumber,
-                     const QVector<bool> &mask, int *verbose, QObject *parent = nullptr);
-    explicit MyImage(QString fullPathName, const QVector<bool> &mask, int *verbose, QObject *parent = nullptr);
+                     const BitMask &mask, int *verbose, QObject *parent = nullptr);
+    explicit MyImage(QString fullPathName, const BitMask &mask, int *verbose, QObject *parent = nullptr);
     explicit MyImage(QObject *parent = nullptr);
 
     // A series of flags telling the status of a MyImage
@@ -155,6 +177,7 @@ public:
     ProcessingStatus *processingStatus;
 
     int maxCPU = 1;       // In case we work on a single image, e.g. for abszeropoint, we can speed up calculations
+    DetectionFilter detectionFilter;   // noise filter applied before object detection
 
     QList<QVector<double>> skyPolyfitNodes;
 
@@ -199,7 +222,7 @@ public:
     bool hasTHELIheader = false;
     bool addGainNormalization = false;
 
-    QList<DetectedObject*> objectList;
+    DetectionCatalog objectCatalog;
 
     QVector<QString> header;
 
@@ -230,6 +253,13 @@ public:
     bool headerRead = false;
     bool modeDetermined = false;
     bool hasMJDread = false;
+    // Write-behind queue: writes of this image that are not yet on the drive, and the outcome of those finished.
+    // Shared with the I/O threads, hence only accessed under writeMutex; waitForPendingWrites() applies the outcome.
+    QMutex writeMutex;
+    QWaitCondition writeFinished;
+    int writesPending = 0;
+    bool queuedWritesDone = false;
+    bool queuedWriteFailed = false;
     bool validFile = true;         // Is the file valid
     bool validMode = true;         // Is the statistical mode within accepted range
     bool validBackground = true;   // Is the image accepted to contribute to a background model (no if e.g. bright star)
@@ -260,8 +290,8 @@ public:
     QVector<float> dataBackupL2;   // Second backup level
     QVector<float> dataBackupL3;   // Third backup level
     QVector<float> dataMeasure;    // temporary (for object detection)
-    const QVector<bool> &globalMask;      // Global mask (e.g. vignetting, permanently bad pixels; same for all images)
-    QVector<bool> objectMask;      // Object mask (used for background modeling and sky subtraction)
+    const BitMask &globalMask;      // Global mask (e.g. vignetting, permanently bad pixels; same for all images)
+    BitMask objectMask;             // Object mask (used for background modeling and sky subtraction)
     bool backgroundPushedDown = false;  // Used to detect whether a backup copy was made already during twopass background correction
     bool globalMaskAvailable = true;    // Unless we load an external image, e.g. for absolute zeropoint
 
@@ -288,6 +318,13 @@ public:
     bool hasBrightStars = false;
 
     int *verbosity;
+
+    // Tile compression of the FITS files written by THELI: "None", "Lossless" or "Quantised".
+    // A project setting, updated by Controller::runTask() between tasks only (no writer threads are running then).
+    static QString fitsCompression;
+    static void setupFitsCompression(fitsfile *fptr, bool lossless, int *status);
+    static bool uncompressedCopy(QString fileName, QString outName, int *status);
+
     omp_lock_t backgroundLock;
     omp_lock_t objectLock;
 
@@ -355,6 +392,7 @@ public:
     void checkCorrectMaskSize(const instrumentDataType *instData);
     void checkTaskRepeatStatus(QString taskBasename);
     void checkWCSsanity();
+    void closeDataSectionFile();
     void collapseCorrection(QString threshold, QString direction);
     QVector<double> collectObjectParameter(QString paramName);
     void collectSeeingParameters(QVector<QVector<double> > &outputParams, QVector<double> &outputMag, int goodChip);
@@ -390,10 +428,10 @@ public:
     void initFITS(fitsfile **fptr, QString loadFileName, int *status);
     void initWCS();
     void initWeightfromGlobalWeight(const QList<MyImage *> &gwList);
-    void laplaceFilter(QVector<float> &dataFiltered);
     bool loadData(QString loadFileName = "");
     bool loadDataThreadSafe(QString loadFileName = "");
-    void loadDataSection(long xmin, long xmax, long ymin, long ymax, float *dataSect);
+    bool loadDataSection(long xmin, long xmax, long ymin, long ymax, float *dataSect);
+    bool writeDataSection(long ymin, long ymax, float *dataSect);
     void loadHeader(QString loadFileName = "");
     void makeBackgroundBackup();
     void makeCutout(long xmin, long xmax, long ymin, long ymax);
@@ -409,6 +447,7 @@ public:
     void mergeObjectWithGlobalMask();
     void multiply(float value, QString mode = "");
     void normalizeFlat();
+    bool openDataSectionFile(bool readWrite = false);
     void protectMemory();
     void pullUp();
     void pushDown(QString backupDir);
@@ -472,10 +511,12 @@ public:
     void updateProcInfo(QString text);
     void updateSaturation(QString saturation);
     void updateZeroOrderOnDrive(QString updateMode);
+    void waitForPendingWrites();
     void writeBackgroundModel();
     void writeCatalog(QString minFWHM_string, QString maxFlag_string);
     void writeConstSkyImage(float constValue);
     void writeImage(QString fileName = "", QString filter = "", float exptime = -1.0, bool addGain = false);
+    void writeImageQueued(WriteQueue *queue, QString fileName = "", QString filter = "", float exptime = -1.0, bool addGain = false);
     void writeImageTIFF(QString fileName = "", QString filter = "", float exptime = -1.0, bool addGain = false);
     void writeImageBackupL1();
     void writeImageBackupL2();
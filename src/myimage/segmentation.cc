@@ -24,7 +24,8 @@ If not, see https://www.gnu.org/licenses/ .
 
 #include <QDebug>
 #include <QMessageBox>
-#include <QQueue>
+#include <omp.h>
+#include <algorithm>
 
 void MyImage::resetObjectMasking()
 {
@@ -37,15 +38,7 @@ void MyImage::resetObjectMasking()
     objectMaskDone = false;
     objectMaskDonePass1 = false;
     objectMaskDonePass2 = false;
-    for (auto object : objectList) {
-        object->pixels_flux.clear();
-        object->pixels_x.clear();
-        object->pixels_y.clear();
-        object->pixels_flux.squeeze();
-        object->pixels_x.squeeze();
-        object->pixels_y.squeeze();
-    }
-    objectList.clear();
+    objectCatalog.clear();
     objectMask.clear();
     objectMask.squeeze();
 }
@@ -88,9 +81,6 @@ void MyImage::segmentImage(const QString DTstring, const QString DMINstring, con
 //    dataSegmentation.squeeze();  // shed excess memory
 //    dataMeasure.squeeze();       // shed excess memory
 
-    QList<long> allObjectPixelIndices;
-    allObjectPixelIndices.reserve(naxis1*naxis2/2); // Avoid initial memory reallocations; assume half the pixels belong to objects
-
     // Noise filter (for detection only)
     QVector<float> dataConv;
     if (convolution) dataConv = directConvolve(dataCurrent);
@@ -103,51 +93,51 @@ void MyImage::segmentImage(const QString DTstring, const QString DMINstring, con
     if (weightInMemory) {
         maxWeight = maxVec_T(dataWeight); // Could sort a sub-sample and use the 90% highest value or sth like that, more stable
     }
-    long i = 0;
-    for (auto &pixel: dataCurrent) {
+
+    const float *dataPtr = dataCurrent.constData();
+    const float *convPtr = dataConv.constData();
+    const float *backPtr = dataBackground.constData();
+    const float *weightPtr = weightInMemory ? dataWeight.constData() : nullptr;
+    float *measurePtr = dataMeasure.data();
+    long *segPtr = dataSegmentation.data();
+    long numObjectPixels = 0;
+
+#pragma omp parallel for num_threads(maxCPU) reduction(+:numObjectPixels)
+    for (long i=0; i<naxis1*naxis2; ++i) {
         // subtract background model
-        float dorig = pixel - dataBackground.at(i);
-        float dconv = dataConv.at(i) - dataBackground.at(i);
-//        dataMeasure.append(dorig);
-        dataMeasure[i] = dorig;
-        // Initialize objects in the segmentation map with a negative value (meaning it is still unprocessed)
-        // WARNING: Using the globalMask is essential, otherwise the floodfill alg seems to run forever. Really?
+        float dorig = dataPtr[i] - backPtr[i];
+        float dconv = convPtr[i] - backPtr[i];
+        measurePtr[i] = dorig;
+        // Mark objects in the segmentation map with a negative value (meaning it is still unlabelled)
+        bool detected = false;
         // With global mask
         if (globalMaskAvailable) {
             if (!weightInMemory) {
-                if (dconv > threshold && !globalMask.at(i)) {
-                    dataSegmentation[i] = -1;
-                    allObjectPixelIndices.append(i);
-                }
+                if (dconv > threshold && !globalMask.at(i)) detected = true;
             }
             else {
-                float rescale = sqrt(maxWeight/dataWeight.at(i));
-                if (dataWeight.at(i) > 0. && !globalMask.at(i) && dconv > threshold*rescale) {
-                    dataSegmentation[i] = -1;
-                    allObjectPixelIndices.append(i);
-                }
+                float rescale = sqrt(maxWeight/weightPtr[i]);
+                if (weightPtr[i] > 0. && !globalMask.at(i) && dconv > threshold*rescale) detected = true;
             }
         }
         // Without global mask
         else {
             if (!weightInMemory) {
-                if (dconv > threshold) {
-                    dataSegmentation[i] = -1;
-                    allObjectPixelIndices.append(i);
-                }
+                if (dconv > threshold) detected = true;
             }
             else {
-                float rescale = sqrt(maxWeight/dataWeight.at(i));
-                if (dataWeight.at(i) > 0. && dconv > threshold*rescale) {
-                    dataSegmentation[i] = -1;
-                    allObjectPixelIndices.append(i);
-                }
+                float rescale = sqrt(maxWeight/weightPtr[i]);
+                if (weightPtr[i] > 0. && dconv > threshold*rescale) detected = true;
             }
         }
-        ++i;
+        if (detected) {
+            segPtr[i] = -1;
+            ++numObjectPixels;
+        }
+        else segPtr[i] = 0;
     }
 
-    if (allObjectPixelIndices.isEmpty()) {
+    if (numObjectPixels == 0) {
         emit messageAvailable(chipName + " : No objects detected!" , "error");
         emit critical();
         successProcessing = false;
@@ -155,40 +145,38 @@ void MyImage::segmentImage(const QString DTstring, const QString DMINstring, con
     }
 
     // Create segmentation map
-    objectList.clear();
-    bool scanning = true;
-    long startindex = allObjectPixelIndices[0];
-    long DMIN = DMINstring.toLong();
-    QPoint startPoint(startindex % naxis1, startindex / naxis1);
-    long objID = 1; // Number of the first object; we start counting at 1 not 0
-
-    while (scanning) {
-        // Flood fill the current object belonging to that pixel, and update dataSegmentation and allObjectPixelIndices
-        floodFill(startPoint, allObjectPixelIndices, objID, dataSegmentation, DMIN);
-        // Retrieve next non-zero pixel index from 'objectPixelIndices'
-        if (!allObjectPixelIndices.isEmpty()) {
-            long nextIndex = allObjectPixelIndices.first();
-            startPoint.setX(nextIndex % naxis1);
-            startPoint.setY(nextIndex / naxis1);
-        }
-        else {
-            scanning = false;
-        }
-    }
+    QVector<QList<long>> objectPixels;
+    labelObjects(DMINstring.toLong(), objectPixels);
 
     segmentationDone = true;
 
     // Lastly, compute object parameters (which we need for masking)
     if (*verbosity > 1) emit messageAvailable(chipName + " : Measuring object parameters ... ", "image");
 
-    // #pragma omp parallel for num_threads(maxCPU)
-    for (long i=0; i<objectList.length(); ++i) {
-        objectList[i]->apertures = apertures;
-        objectList[i]->computeObjectParams();
-        objectList[i]->remove();
+    // The measurements of an object only read the image data, hence objects can be measured in parallel.
+    // Object sizes vary a lot, hence dynamic scheduling. Each object is measured and written into its catalog row.
+    const long numObjects = objectPixels.length();
+    objectCatalog.resize(numObjects, apertures.length());
+    const QVector<QList<long>> &pixels = objectPixels;
+    float effectiveGain = 1.0;   // ADUs converted during HDU reformatting
+#pragma omp parallel for num_threads(maxCPU) schedule(dynamic)
+    for (long k=0; k<numObjects; ++k) {
+        // object IDs are one larger than the segmentation labels
+        DetectedObject object(pixels.at(k), dataMeasure, dataBackground, dataWeight,
+                              globalMask, weightInMemory, naxis1, naxis2, k+2,
+                              saturationValue, effectiveGain);
+        object.globalMaskAvailable = globalMaskAvailable;
+        object.apertures = apertures;
+        object.computeObjectParams();
+        objectCatalog.setRow(k, object);
     }
+    objectPixels.clear();
+    objectPixels.squeeze();
+
+    // wcslib keeps work space in the wcsprm struct (e.g. for distortions), hence outside the parallel loop
+    objectCatalog.calcSkyCoords(wcs);
 
-    if (*verbosity > 1) emit messageAvailable(chipName + " : " + QString::number(objectList.length()) + " objects detected.", "image");
+    if (*verbosity > 1) emit messageAvailable(chipName + " : " + QString::number(objectCatalog.length()) + " objects detected.", "image");
 
     segmentationDone = true;
     if (writeSegImage) writeSegmentation(path + "/" + baseName+".seg.fits");
@@ -199,12 +187,12 @@ void MyImage::calcMedianSeeingEllipticity()
 {
     QVector<double> fwhmVec;
     QVector<double> ellipticityVec;
-    fwhmVec.reserve(objectList.length());
-    ellipticityVec.reserve(objectList.length());
-    for (auto &object : objectList) {
-        if (object->FLAGS == 0) {
-            fwhmVec.append(float(object->FWHM));
-            ellipticityVec.append(float(object->ELLIPTICITY));
+    fwhmVec.reserve(objectCatalog.length());
+    ellipticityVec.reserve(objectCatalog.length());
+    for (long i=0; i<objectCatalog.length(); ++i) {
+        if (objectCatalog.FLAGS.at(i) == 0) {
+            fwhmVec.append(float(objectCatalog.FWHM.at(i)));
+            ellipticityVec.append(float(objectCatalog.ELLIPTICITY.at(i)));
         }
     }
     fwhm_est = straightMedianInline(fwhmVec) * plateScale;
@@ -213,108 +201,166 @@ void MyImage::calcMedianSeeingEllipticity()
     updateHeaderValueInFITS("ELLIPEST", QString::number(ellipticity_est, 'f', 3));
 }
 
-// Flood fill an individual object with the objectID and calculate object area
-void MyImage::floodFill(const QPoint startPoint, QList<long> &allObjectPixelIndices, long &objID, QVector<long> &dataSegmentation, const long DMIN)
-{
-    if (!insideImage(startPoint)) return;
-
-    // Did we process this point already? If so, remove it from the list of indices
-    long index = startPoint.x() + naxis1*startPoint.y();
-    if (dataSegmentation[index] != -1) {
-        allObjectPixelIndices.pop_front();
-        return;
-    }
-
-    // temporary storage to mark pixels for deletion (if area less than DMIN)
-    QList<long> currentObjectPixels;
-    currentObjectPixels.reserve(10000);
-
-    QQueue<QPoint> pointQueue;
-    pointQueue.enqueue(startPoint);
-
-    // This is the actual flood filling
-    long area = 0;
-    while (!pointQueue.isEmpty()) {
-        QPoint p = pointQueue.first();
-        pointQueue.pop_front();
-        if (insideImage(p)) {
-            if (dataSegmentation[p.x()+naxis1*p.y()] == -1) {
-                dataSegmentation[p.x()+naxis1*p.y()] = objID;
-                // queue the edges
-                pointQueue.enqueue(QPoint(p.x() + 1, p.y()));
-                pointQueue.enqueue(QPoint(p.x() - 1, p.y()));
-                pointQueue.enqueue(QPoint(p.x(), p.y() + 1));
-                pointQueue.enqueue(QPoint(p.x(), p.y() - 1));
-                // queue the corners (8-connectivity)
-                pointQueue.enqueue(QPoint(p.x()-1, p.y()-1));
-                pointQueue.enqueue(QPoint(p.x()+1, p.y()-1));
-                pointQueue.enqueue(QPoint(p.x()-1, p.y()+1));
-                pointQueue.enqueue(QPoint(p.x()+1, p.y()+1));
-                currentObjectPixels.push_back(p.x()+naxis1*p.y());
-            }
-        }
-    }
+// A horizontal run of detected pixels
+struct PixelRun {
+    long row;
+    long start;    // first pixel (column)
+    long end;      // last pixel (column), inclusive
+};
 
-    area = currentObjectPixels.length();
-    // remove object from segmentation map if too small
-    if (area < DMIN) {
-        for (auto &pixel: currentObjectPixels) {
-            dataSegmentation[pixel] = 0;
-        }
-        return;
-    }
-
-    // Initialize the object and add it to the list of detected sources for this image
-    float effectiveGain = 1.0;   // ADUs converted during HDU reformatting
-    DetectedObject *newObject = new DetectedObject(currentObjectPixels, dataMeasure, dataBackground, dataWeight,
-                                                   globalMask, weightInMemory, naxis1, naxis2, ++objID,
-                                                   saturationValue, effectiveGain, *wcs);
-    newObject->globalMaskAvailable = globalMaskAvailable;
-    objectList.append(newObject);
-
-    // Remove the current pixel we just processed,
-    // and potentially a few more if they happen to be at the beginning of the list
-    while (!allObjectPixelIndices.isEmpty()
-           && !currentObjectPixels.isEmpty()
-           && allObjectPixelIndices.first() == currentObjectPixels.first()) {
-        allObjectPixelIndices.pop_front();
-        currentObjectPixels.pop_front();
+// Union-find with the smaller run index as the root. Runs are in raster order,
+// hence the root of a component is its first run in raster order.
+static long findRoot(long *parent, long r)
+{
+    while (parent[r] != r) {
+        parent[r] = parent[parent[r]];
+        r = parent[r];
     }
+    return r;
 }
 
-bool MyImage::insideImage(QPoint p)
+static void uniteRuns(long *parent, const long a, const long b)
 {
-    if (p.rx() >= 0
-            && p.rx() < naxis1
-            && p.ry() >= 0
-            && p.ry() < naxis2) return true;
-    else return false;
+    long ra = findRoot(parent, a);
+    long rb = findRoot(parent, b);
+    if (ra < rb) parent[rb] = ra;
+    else if (rb < ra) parent[ra] = rb;
 }
 
-// convolve with a general purpose noise filter
-QVector<float> MyImage::directConvolve(const QVector<float> &data)
+// Unites the runs in [prevFirst, prevLast) (one image row) with the runs in [currFirst, currLast) (the next row).
+// 8-connectivity: runs touch if they overlap or meet diagonally.
+static void uniteAdjacentRows(const PixelRun *runs, long *parent,
+                              const long prevFirst, const long prevLast, const long currFirst, const long currLast)
 {
-    float kernel[] = { 1./16., 2./16., 1./16.,
-                       2./16., 4./16., 2./16.,
-                       1./16., 2./16., 1./16.};
+    long p = prevFirst;
+    for (long c=currFirst; c<currLast; ++c) {
+        // skip runs in the previous row that end left of the current run
+        while (p < prevLast && runs[p].end + 1 < runs[c].start) ++p;
+        for (long q=p; q<prevLast && runs[q].start <= runs[c].end + 1; ++q) {
+            uniteRuns(parent, q, c);
+        }
+    }
+}
 
-    long n = naxis1;
-    long m = naxis2;
-    QVector<float> dataConv(n*m);
-
-    // direct convolution. We ignore the border
-    long s = 1; // half the kernel size - 1
-    for (long j=1; j<naxis2-1; ++j) {
-        for (long i=1; i<naxis1-1; ++i) {
-            for (long ii=-s; ii<=s; ++ii) {
-                for (long jj=-s; jj<=s; ++jj) {
-                    dataConv[i+n*j] += data[i+ii + n*(j+jj)] * kernel[ii+s + (2*s+1)*(jj+s)];
+// Connected-component labelling of the pixels marked with -1 in 'dataSegmentation'.
+// The image is split into horizontal stripes that are labelled in parallel (run-length encoding
+// and union-find); labels are merged across the stripe boundaries afterwards.
+// Objects are numbered in the raster order of their first pixel, and objects with fewer than DMIN
+// pixels are removed from the segmentation map. Returns the pixel indices of each object.
+void MyImage::labelObjects(const long DMIN, QVector<QList<long>> &objectPixels)
+{
+    const long n = naxis1;
+    const long m = naxis2;
+    const int numStripes = std::max(1L, std::min(long(maxCPU), m));
+
+    // Pass 1: run-length encoding and labelling within each stripe
+    QVector<QVector<PixelRun>> stripeRuns(numStripes);
+    QVector<QVector<long>> stripeParents(numStripes);
+    QVector<long> firstRowEnd(numStripes);      // one past the last run in the first row of a stripe
+    QVector<long> lastRowStart(numStripes);     // the first run in the last row of a stripe
+    const long *segPtr = dataSegmentation.constData();
+
+#pragma omp parallel for num_threads(maxCPU) schedule(static)
+    for (int s=0; s<numStripes; ++s) {
+        const long jmin = s * m / numStripes;
+        const long jmax = (s+1) * m / numStripes;
+        QVector<PixelRun> &runs = stripeRuns[s];
+        QVector<long> &parent = stripeParents[s];
+        long prevFirst = 0;
+        long prevLast = 0;
+        for (long j=jmin; j<jmax; ++j) {
+            const long *row = segPtr + n*j;
+            const long currFirst = runs.length();
+            long i = 0;
+            while (i < n) {
+                if (row[i] != -1) {
+                    ++i;
+                    continue;
                 }
+                PixelRun run;
+                run.row = j;
+                run.start = i;
+                while (i < n && row[i] == -1) ++i;
+                run.end = i-1;
+                parent.append(runs.length());
+                runs.append(run);
             }
+            const long currLast = runs.length();
+            if (j > jmin) uniteAdjacentRows(runs.constData(), parent.data(), prevFirst, prevLast, currFirst, currLast);
+            else firstRowEnd[s] = currLast;
+            prevFirst = currFirst;
+            prevLast = currLast;
         }
+        lastRowStart[s] = prevFirst;
+    }
+
+    // Concatenate the stripes; run indices remain in raster order
+    QVector<long> stripeOffset(numStripes+1, 0);
+    for (int s=0; s<numStripes; ++s) stripeOffset[s+1] = stripeOffset[s] + stripeRuns[s].length();
+    const long numRuns = stripeOffset[numStripes];
+    QVector<PixelRun> runs;
+    QVector<long> parent;
+    runs.reserve(numRuns);
+    parent.reserve(numRuns);
+    for (int s=0; s<numStripes; ++s) {
+        runs.append(stripeRuns[s]);
+        for (auto &p : stripeParents[s]) parent.append(p + stripeOffset[s]);
+        stripeRuns[s].clear();
+        stripeRuns[s].squeeze();
+        stripeParents[s].clear();
+        stripeParents[s].squeeze();
+    }
+
+    // Pass 2: merge across stripe boundaries (last row of a stripe with the first row of the next one)
+    for (int s=1; s<numStripes; ++s) {
+        uniteAdjacentRows(runs.constData(), parent.data(),
+                          lastRowStart[s-1] + stripeOffset[s-1], stripeOffset[s],
+                          stripeOffset[s], firstRowEnd[s] + stripeOffset[s]);
+    }
+
+    // Flatten: parents always have smaller indices, so a single forward pass suffices
+    long *parentPtr = parent.data();
+    QVector<long> area(numRuns, 0);
+    for (long r=0; r<numRuns; ++r) {
+        parentPtr[r] = parentPtr[parentPtr[r]];
+        area[parentPtr[r]] += runs[r].end - runs[r].start + 1;
+    }
+
+    // Label the objects that are large enough (in raster order of their first pixel)
+    QVector<long> label(numRuns, 0);
+    long numObjects = 0;
+    for (long r=0; r<numRuns; ++r) {
+        if (parentPtr[r] == r && area[r] >= DMIN) label[r] = ++numObjects;
+    }
+    for (long r=0; r<numRuns; ++r) {
+        label[r] = label[parentPtr[r]];
+    }
+
+    // Write the segmentation map
+    long *segOut = dataSegmentation.data();
+    const PixelRun *runPtr = runs.constData();
+    const long *labelPtr = label.constData();
+#pragma omp parallel for num_threads(maxCPU) schedule(static)
+    for (long r=0; r<numRuns; ++r) {
+        long *row = segOut + n*runPtr[r].row;
+        for (long i=runPtr[r].start; i<=runPtr[r].end; ++i) row[i] = labelPtr[r];
+    }
+
+    // Collect the pixels of each object (in raster order)
+    objectPixels.clear();
+    objectPixels.resize(numObjects);
+    for (long r=0; r<numRuns; ++r) {
+        if (labelPtr[r] == 0) continue;
+        QList<long> &pixels = objectPixels[labelPtr[r]-1];
+        if (pixels.isEmpty()) pixels.reserve(area[parentPtr[r]]);
+        for (long i=runPtr[r].start; i<=runPtr[r].end; ++i) pixels.append(i + n*runPtr[r].row);
     }
+}
 
-    return dataConv;
+// convolve with a general purpose noise filter
+QVector<float> MyImage::directConvolve(const QVector<float> &data)
+{
+    return detectionFilter.convolve(data, naxis1, naxis2, maxCPU);
 }
 
 // Transfer the detections to the object mask
@@ -323,11 +369,11 @@ void MyImage::transferObjectsToMask()
     if (!successProcessing) return;
     objectMask.fill(false, naxis1*naxis2);
 
-    if (objectList.isEmpty()) return;
+    if (objectCatalog.isEmpty()) return;
 
     long i=0;
     for (auto &segment : dataSegmentation) {
-        if (segment > 0.) objectMask[i] = true;
+        if (segment > 0.) objectMask.setBit(i);
         ++i;
     }
     objectMaskDone = true;
@@ -336,8 +382,8 @@ void MyImage::transferObjectsToMask()
 void MyImage::estimateMatchingTolerance()
 {
     QVector<float> sizes;
-    for (auto &object : objectList) {
-        if (object->FLAGS == 0) sizes.append(object->FLUX_RADIUS);
+    for (long i=0; i<objectCatalog.length(); ++i) {
+        if (objectCatalog.FLAGS.at(i) == 0) sizes.append(objectCatalog.FLUX_RADIUS.at(i));
     }
 
     if (sizes.isEmpty()) {
@@ -356,28 +402,11 @@ void MyImage::estimateMatchingTolerance()
 QVector<double> MyImage::collectObjectParameter(QString paramName)
 {
     QVector<double> param;
-    param.reserve(objectList.length());
 
-    if (paramName == "RA") {
-        for (auto &object : objectList) {
-            param << object->ALPHA_J2000;
-        }
-    }
-    if (paramName == "DEC") {
-        for (auto &object : objectList) {
-            param << object->DELTA_J2000;
-        }
-    }
-    if (paramName == "FWHM") {
-        for (auto &object : objectList) {
-            param << object->FLUX_RADIUS;
-        }
-    }
-    if (paramName == "ELLIPTICITY") {
-        for (auto &object : objectList) {
-            param << object->ELLIPTICITY;
-        }
-    }
+    if (paramName == "RA") param = objectCatalog.ALPHA_J2000;
+    if (paramName == "DEC") param = objectCatalog.DELTA_J2000;
+    if (paramName == "FWHM") param = objectCatalog.FLUX_RADIUS;
+    if (paramName == "ELLIPTICITY") param = objectCatalog.ELLIPTICITY;
 
     return param;
 }
@@ -390,19 +419,19 @@ void MyImage::collectSeeingParameters(QVector<QVector<double>> &outputParams, QV
     outputMag.clear();
 
     // Try memory access in MyImage
-    if (!objectList.isEmpty()) {
-        outputParams.reserve(objectList.length());
-        outputMag.reserve(objectList.length());
-        for (auto &object : objectList) {
+    if (!objectCatalog.isEmpty()) {
+        outputParams.reserve(objectCatalog.length());
+        outputMag.reserve(objectCatalog.length());
+        for (long i=0; i<objectCatalog.length(); ++i) {
             // Must recalculate RA and DEC after astrometry
             double raNew;
             double decNew;
-            xy2sky(object->XWIN, object->YWIN, raNew, decNew);
+            xy2sky(objectCatalog.XWIN.at(i), objectCatalog.YWIN.at(i), raNew, decNew);
             // must pass dec first for tools::match2D() method
-            if (object->FLAGS == 0) {
-                param << decNew << raNew << object->FWHM << object->ELLIPTICITY;
+            if (objectCatalog.FLAGS.at(i) == 0) {
+                param << decNew << raNew << objectCatalog.FWHM.at(i) << objectCatalog.ELLIPTICITY.at(i);
                 outputParams << param;
-                outputMag << object->MAG_AUTO;
+                outputMag << objectCatalog.MAG_AUTO.at(i);
                 param.clear();
             }
         }
@@ -540,21 +569,26 @@ void MyImage::maskExpand(QString expFactor, bool writeObjectmaskImage)
     long n = naxis1;
     long m = naxis2;
 
-    for (auto &it : objectMask) it = false;
+    objectMask.fill(false);
+
+    const DetectionCatalog &cat = objectCatalog;
 
     // Loop over all objects
-    for (auto &object : objectList) {
+    for (long k=0; k<cat.length(); ++k) {
         // skip spurious and bad detections
-        if (object->badDetection) continue;
+        if (cat.badDetection.at(k)) continue;
         // Do not mask expand extremely small objects (hot pixels etc)
-        if (object->B < 1.0) continue;
+        if (cat.B.at(k) < 1.0) continue;
         // Do not mask expand very large and extremely elongated objects (bad columns, saturation spikes)
-        if (object->ELLIPTICITY > 0.9 && object->A > 50) continue;
-        float oX = object->X;
-        float oY = object->Y;
-        float oAf = object->A * factor;
-        float xextent = 3. * pow(object->A*factor, 2);                   // max ellipse extent in x direction
-        float yextent = 3. * object->A * object->B * factor * factor;    // max ellipse extent in y direction
+        if (cat.ELLIPTICITY.at(k) > 0.9 && cat.A.at(k) > 50) continue;
+        float oX = cat.X.at(k);
+        float oY = cat.Y.at(k);
+        float oAf = cat.A.at(k) * factor;
+        float xextent = 3. * pow(cat.A.at(k)*factor, 2);                      // max ellipse extent in x direction
+        float yextent = 3. * cat.A.at(k) * cat.B.at(k) * factor * factor;     // max ellipse extent in y direction
+        const double cxx = cat.CXX.at(k);
+        const double cyy = cat.CYY.at(k);
+        const double cxy = cat.CXY.at(k);
         long imin = (oX - xextent > 0) ? int(oX - xextent) : 0;
         long imax = (oX + xextent < n) ? int(oX + xextent) : n-1;
         long jmin = (oY - yextent > 0) ? int(oY - yextent) : 0;
@@ -564,10 +598,10 @@ void MyImage::maskExpand(QString expFactor, bool writeObjectmaskImage)
             float dy = oY - j;
             for (long i=imin; i<=imax; ++i) {
                 float dx = oX - i;
-                if (object->CXX*dx*dx
-                        + object->CYY*dy*dy
-                        + object->CXY*dx*dy <= oAf*oAf) {
-                    objectMask[i+naxis1*j] = true;
+                if (cxx*dx*dx
+                        + cyy*dy*dy
+                        + cxy*dx*dy <= oAf*oAf) {
+                    objectMask.setBit(i+naxis1*j);
                 }
             }
         }
@@ -588,18 +622,14 @@ void MyImage::addExludedRegionToMask(long imin, long imax, long jmin, long jmax)
     if (jmin == 0)
     for (long j=jmin; j<=jmax; ++j) {
         for (long i=imin; i<=imax; ++i) {
-            objectMask[i+naxis2*j] = true;
+            objectMask.setBit(i+naxis2*j);
         }
     }
 }
 
 void MyImage::releaseAllDetectionMemory()
 {
-    for (auto &object : objectList) {
-        delete object;
-        object = nullptr;
-    }
-    objectList.clear();
+    objectCatalog.clear();
 
     releaseDetectionPixelMemory();
 }
@@ -630,22 +660,24 @@ void MyImage::writeCatalog(QString minFWHM_string, QString maxFlag_string)
     float maxFlag = maxFlag_string.toFloat();
     if (maxFlag_string.isEmpty()) maxFlag = 100;
 
+    const DetectionCatalog &cat = objectCatalog;
+
     // Write iview catalog
     QFile file(path+"/cat/iview/"+chipName+".iview");
     if (file.open(QIODevice::WriteOnly)) {
         QTextStream outputStream(&file);
-        for (auto &object : objectList) {
+        for (long i=0; i<cat.length(); ++i) {
             outputStream.setRealNumberPrecision(9);
-            if (3.*object->AWIN >= minFWHM
-                    && object->FLAGS <= maxFlag
-                    && object->FLUX_AUTO > 0.
-                    && object->ELLIPTICITY < 0.6) {
+            if (3.*cat.AWIN.at(i) >= minFWHM
+                    && cat.FLAGS.at(i) <= maxFlag
+                    && cat.FLUX_AUTO.at(i) > 0.
+                    && cat.ELLIPTICITY.at(i) < 0.6) {
                 // MUST APPLY ORIGIN OFFSET CORRECTION (+1), because calculations were done starting counting at 0 (in FITS files we start at 1)
-                outputStream << object->XWIN + 1. << " "
-                             << object->YWIN + 1. << " "
-                             << object->AWIN << " "
-                             << object->BWIN << " "
-                             << object->THETAWIN << "\n";
+                outputStream << cat.XWIN.at(i) + 1. << " "
+                             << cat.YWIN.at(i) + 1. << " "
+                             << cat.AWIN.at(i) << " "
+                             << cat.BWIN.at(i) << " "
+                             << cat.THETAWIN.at(i) << "\n";
             }
         }
         file.close();
@@ -661,28 +693,12 @@ void MyImage::writeCatalog(QString minFWHM_string, QString maxFlag_string)
     char tf3[10] = "1E";
     char *tform[3] = {tf1, tf2, tf3};
 
-    long numSources = objectList.length();
-    long numSourcesRetained = 0.;
-    for (long i=0; i<numSources; ++i) {
-        if (3.*objectList[i]->AWIN >= minFWHM && objectList[i]->FLAGS <= maxFlag && objectList[i]->FLUX_AUTO > 0.) {
-            ++numSourcesRetained;
-        }
-    }
-
-    long nrows = numSourcesRetained;
-    double x_arr[nrows];
-    double y_arr[nrows];
-    float mag_arr[nrows];
-    long k = 0;
-    for (long i=0; i<numSources; ++i) {
-        if (3.*objectList[i]->AWIN >= minFWHM && objectList[i]->FLAGS <= maxFlag && objectList[i]->FLUX_AUTO > 0.) {
-            // MUST APPLY ORIGIN OFFSET CORRECTION (+1), because calculations were done starting counting at 0 (in FITS files we start at 1)
-            x_arr[k] = objectList[i]->XWIN + 1.;
-            y_arr[k] = objectList[i]->YWIN + 1.;
-            mag_arr[k] = objectList[i]->MAG_AUTO;
-            ++k;
-        }
-    }
+    QVector<long> rows = cat.selectRows(minFWHM, maxFlag);
+    long nrows = rows.length();
+    // MUST APPLY ORIGIN OFFSET CORRECTION (+1), because calculations were done starting counting at 0 (in FITS files we start at 1)
+    QVector<double> x_arr = cat.gather<double>(cat.XWIN, rows, 1.);
+    QVector<double> y_arr = cat.gather<double>(cat.YWIN, rows, 1.);
+    QVector<float> mag_arr = cat.gather<float>(cat.MAG_AUTO, rows);
     int status = 0;
     fitsfile *fptr;
     long firstrow  = 1;
@@ -692,9 +708,9 @@ void MyImage::writeCatalog(QString minFWHM_string, QString maxFlag_string)
     filename = "!"+filename;
     fits_create_file(&fptr, filename.toUtf8().data(), &status);
     fits_create_tbl(fptr, BINARY_TBL, nrows, tfields, ttype, tform, nullptr, "OBJECTS", &status);
-    fits_write_col(fptr, TDOUBLE, 1, firstrow, firstelem, nrows, x_arr, &status);
-    fits_write_col(fptr, TDOUBLE, 2, firstrow, firstelem, nrows, y_arr, &status);
-    fits_write_col(fptr, TFLOAT, 3, firstrow, firstelem, nrows, mag_arr, &status);
+    fits_write_col(fptr, TDOUBLE, 1, firstrow, firstelem, nrows, x_arr.data(), &status);
+    fits_write_col(fptr, TDOUBLE, 2, firstrow, firstelem, nrows, y_arr.data(), &status);
+    fits_write_col(fptr, TFLOAT, 3, firstrow, firstelem, nrows, mag_arr.data(), &status);
     fits_close_file(fptr, &status);
 
     printCfitsioError("MyImage::writeCatalog()", status);
@@ -783,68 +799,47 @@ void MyImage::appendToScampCatalogInternal(fitsfile *fptr, QString minFWHM_strin
     char tf13[10] = "1E";
     char *tform2[13] = {tf1, tf2, tf3, tf4, tf5, tf6, tf7, tf8, tf9, tf10, tf11, tf12, tf13};
 
-    long numSources = objectList.length();
-    long numSourcesRetained = 0;
-    for (long i=0; i<numSources; ++i) {
-        if (3.*objectList[i]->AWIN >= minFWHM && objectList[i]->FLAGS <= maxFlag && objectList[i]->FLUX_AUTO > 0.) {
-            ++numSourcesRetained;
-        }
-    }
-
-    nrows = numSourcesRetained;  // one row per source
-    float xwin_arr[nrows];
-    float ywin_arr[nrows];
-    float erra_arr[nrows];
-    float errb_arr[nrows];
-    float errt_arr[nrows];
-    float flux_arr[nrows];
-    float fluxerr_arr[nrows];
-    short flags_arr[nrows];
-    double alpha_arr[nrows];
-    double delta_arr[nrows];
-    float fwhm_arr[nrows];
-    float mag_arr[nrows];
-    float ell_arr[nrows];
-
-    long k = 0;
-    for (long i=0; i<numSources; ++i) {
-        if (3.*objectList[i]->AWIN >= minFWHM && objectList[i]->FLAGS <= maxFlag && objectList[i]->FLUX_AUTO > 0.) {
-            // MUST APPLY ORIGIN OFFSET CORRECTION (+1), because calculations were done starting counting at 0 (in FITS files we start at 1)
-            xwin_arr[k] = objectList[i]->XWIN + 1.;
-            ywin_arr[k] = objectList[i]->YWIN + 1.;
-            erra_arr[k] = objectList[i]->ERRAWIN;
-            errb_arr[k] = objectList[i]->ERRBWIN;
-            errt_arr[k] = objectList[i]->ERRTHETAWIN;
-            flux_arr[k] = objectList[i]->FLUX_AUTO;
-            fluxerr_arr[k] = sqrt(objectList[i]->FLUX_AUTO);
-            flags_arr[k] = objectList[i]->FLAGS;
-            // The following are not needed by scamp. They are just for completeness.
-            alpha_arr[k] = objectList[i]->ALPHA_J2000;
-            delta_arr[k] = objectList[i]->DELTA_J2000;
-            fwhm_arr[k] = objectList[i]->FWHM;
-            mag_arr[k] = objectList[i]->MAG_AUTO;
-            ell_arr[k] = objectList[i]->ELLIPTICITY;
-            ++k;
-        }
-    }
+    const DetectionCatalog &cat = objectCatalog;
+    QVector<long> rows = cat.selectRows(minFWHM, maxFlag);
+    nrows = rows.length();  // one row per source
+
+    // MUST APPLY ORIGIN OFFSET CORRECTION (+1), because calculations were done starting counting at 0 (in FITS files we start at 1)
+    QVector<float> xwin_arr = cat.gather<float>(cat.XWIN, rows, 1.);
+    QVector<float> ywin_arr = cat.gather<float>(cat.YWIN, rows, 1.);
+    QVector<float> erra_arr = cat.gather<float>(cat.ERRAWIN, rows);
+    QVector<float> errb_arr = cat.gather<float>(cat.ERRBWIN, rows);
+    QVector<float> errt_arr = cat.gather<float>(cat.ERRTHETAWIN, rows);
+    QVector<float> flux_arr = cat.gather<float>(cat.FLUX_AUTO, rows);
+    QVector<float> fluxerr_arr(nrows);
+    QVector<short> flags_arr(nrows);
+    for (long k=0; k<nrows; ++k) {
+        fluxerr_arr[k] = sqrt(cat.FLUX_AUTO.at(rows.at(k)));
+        flags_arr[k] = cat.FLAGS.at(rows.at(k));
+    }
+    // The following are not needed by scamp. They are just for completeness.
+    QVector<double> alpha_arr = cat.gather<double>(cat.ALPHA_J2000, rows);
+    QVector<double> delta_arr = cat.gather<double>(cat.DELTA_J2000, rows);
+    QVector<float> fwhm_arr = cat.gather<float>(cat.FWHM, rows);
+    QVector<float> mag_arr = cat.gather<float>(cat.MAG_AUTO, rows);
+    QVector<float> ell_arr = cat.gather<float>(cat.ELLIPTICITY, rows);
 
     firstrow  = 1;
     firstelem = 1;
     tfields = 13;
     fits_create_tbl(fptr, BINARY_TBL, nrows, tfields, ttype2, tform2, nullptr, "LDAC_OBJECTS", &status);
-    fits_write_col(fptr, TFLOAT, 1, firstrow, firstelem, nrows, xwin_arr, &status);
-    fits_write_col(fptr, TFLOAT, 2, firstrow, firstelem, nrows, ywin_arr, &status);
-    fits_write_col(fptr, TFLOAT, 3, firstrow, firstelem, nrows, erra_arr, &status);
-    fits_write_col(fptr, TFLOAT, 4, firstrow, firstelem, nrows, errb_arr, &status);
-    fits_write_col(fptr, TFLOAT, 5, firstrow, firstelem, nrows, errt_arr, &status);
-    fits_write_col(fptr, TFLOAT, 6, firstrow, firstelem, nrows, flux_arr, &status);
-    fits_write_col(fptr, TFLOAT, 7, firstrow, firstelem, nrows, fluxerr_arr, &status);
-    fits_write_col(fptr, TSHORT, 8, firstrow, firstelem, nrows, flags_arr, &status);
-    fits_write_col(fptr, TDOUBLE, 9, firstrow, firstelem, nrows, alpha_arr, &status);
-    fits_write_col(fptr, TDOUBLE, 10, firstrow, firstelem, nrows, delta_arr, &status);
-    fits_write_col(fptr, TFLOAT, 11, firstrow, firstelem, nrows, fwhm_arr, &status);
-    fits_write_col(fptr, TFLOAT, 12, firstrow, firstelem, nrows, mag_arr, &status);
-    fits_write_col(fptr, TFLOAT, 13, firstrow, firstelem, nrows, ell_arr, &status);
+    fits_write_col(fptr, TFLOAT, 1, firstrow, firstelem, nrows, xwin_arr.data(), &status);
+    fits_write_col(fptr, TFLOAT, 2, firstrow, firstelem, nrows, ywin_arr.data(), &status);
+    fits_write_col(fptr, TFLOAT, 3, firstrow, firstelem, nrows, erra_arr.data(), &status);
+    fits_write_col(fptr, TFLOAT, 4, firstrow, firstelem, nrows, errb_arr.data(), &status);
+    fits_write_col(fptr, TFLOAT, 5, firstrow, firstelem, nrows, errt_arr.data(), &status);
+    fits_write_col(fptr, TFLOAT, 6, firstrow, firstelem, nrows, flux_arr.data(), &status);
+    fits_write_col(fptr, TFLOAT, 7, firstrow, firstelem, nrows, fluxerr_arr.data(), &status);
+    fits_write_col(fptr, TSHORT, 8, firstrow, firstelem, nrows, flags_arr.data(), &status);
+    fits_write_col(fptr, TDOUBLE, 9, firstrow, firstelem, nrows, alpha_arr.data(), &status);
+    fits_write_col(fptr, TDOUBLE, 10, firstrow, firstelem, nrows, delta_arr.data(), &status);
+    fits_write_col(fptr, TFLOAT, 11, firstrow, firstelem, nrows, fwhm_arr.data(), &status);
+    fits_write_col(fptr, TFLOAT, 12, firstrow, firstelem, nrows, mag_arr.data(), &status);
+    fits_write_col(fptr, TFLOAT, 13, firstrow, firstelem, nrows, ell_arr.data(), &status);
     //    fits_write_col(fptr, TSHORT, 8, firstrow, firstelem, nrows, fieldpos, &status);
 
     // Color-coding output lines
@@ -76,11 +76,34 @@ void MyImage::createSourceExtractorCatalog()
 {
     if (!successProcessing) return;
 
-    if (*verbosity >= 2) emit messageAvailable("Running the following command in " + path + " : <br>"+sourceExtractorCommand, "image");
+    // Source Extractor cannot read tile-compressed images; it runs on temporary uncompressed copies instead
+    QString command = sourceExtractorCommand;
+    QStringList uncompressedFiles;
+    QString imageName = path + "/" + chipName + processingStatus->statusString + ".fits";
+    QString weightName = weightPath + "/" + chipName + ".weight.fits";
+    QString imageCopy = path + "/cat/" + chipName + "_uncompressed.fits";
+    QString weightCopy = path + "/cat/" + chipName + "_uncompressed.weight.fits";
+    int status = 0;
+    if (uncompressedCopy(imageName, imageCopy, &status)) {
+        command.replace(imageName, imageCopy);
+        uncompressedFiles << imageCopy;
+    }
+    if (uncompressedCopy(weightName, weightCopy, &status)) {
+        command.replace(weightName, weightCopy);
+        uncompressedFiles << weightCopy;
+    }
+    if (status) {
+        printCfitsioError("createSourceExtractorCatalog()", status);
+        for (auto &it : uncompressedFiles) QFile::remove(it);
+        successProcessing = false;
+        return;
+    }
+
+    if (*verbosity >= 2) emit messageAvailable("Running the following command in " + path + " : <br>"+command, "image");
 
     // Run the SourceExtractor command
     workerThread = new QThread();
-    sourceExtractorWorker = new SourceExtractorWorker(sourceExtractorCommand, path);
+    sourceExtractorWorker = new SourceExtractorWorker(command, path);
     sourceExtractorWorker->moveToThread(workerThread);
     connect(workerThread, &QThread::started, sourceExtractorWorker, &SourceExtractorWorker::runSourceExtractor);
     connect(sourceExtractorWorker, &SourceExtractorWorker::errorFound, this, &MyImage::errorFoundReceived);
@@ -92,6 +115,8 @@ void MyImage::createSourceExtractorCatalog()
     connect(sourceExtractorWorker, &SourceExtractorWorker::messageAvailable, this, &MyImage::messageAvailableReceived);
     workerThread->start();
     workerThread->wait();
+
+    for (auto &it : uncompressedFiles) QFile::remove(it);
 }
 
 void MyImage::errorFoundReceived()
@@ -21,6 +21,7 @@ If not, see https://www.gnu.org/licenses/ .
 #include "../functions.h"
 #include "../tools/tools.h"
 #include "../tools/polygon.h"
+#include "../tools/medianfilter.h"
 #include "../processingInternal/data.h"
 
 #include <QFile>
@@ -28,6 +29,9 @@ If not, see https://www.gnu.org/licenses/ .
 #include <QDebug>
 #include <QString>
 
+#include <omp.h>
+#include <algorithm>
+
 void MyImage::readWeight()
 {
     dataWeight_deletable = false;
@@ -161,7 +165,7 @@ void MyImage::applyPolygons()
     if (!regionFile.exists()) return;
 
     if (*verbosity > 1) emit messageAvailable(chipName + " : Mask found, applying mask to weight ...", "image");
-    addRegionFilesToWeight(naxis1, naxis2, regionFileName, dataWeight);
+    addRegionFilesToWeight(naxis1, naxis2, regionFileName, dataWeight, maxCPU);
 }
 
 void MyImage::freeWeight()
@@ -322,78 +326,27 @@ void MyImage::maskBloomingSpike(QString instType, QString range, QString minVal,
     if (*verbosity > 1) emit messageAvailable(chipName + " : Bloomed pixels masked. Dynamic range: "+bloomRange, "image");
 }
 
-void MyImage::laplaceFilter(QVector<float> &dataFiltered)
+// Median of the first k elements, which get reordered. Same result as straightMedian_T(), without sorting
+static float medianInPlace(float *data, const long k)
 {
-    // Laplace kernel
-    QVector<float> kernel = {-1.,  -2., -1.,
-                             -2., +12., -2.,
-                             -1.,  -2., -1.};
-
-    // Laplace filtering using direct convolution, to enhance local defects
-    long n = naxis1;
-    long m = naxis2;
-    float datatmp = 0.;
-
-    float baseLevel = medianMask(dataCurrent);
-
-    for (long j=1; j<m-1; ++j) {
-        for (long i=1; i<n-1; ++i) {
-            long k = i+n*j;
-            float sum = 0.;
-            int l = 0;
-            for (int jt=j-1; jt<=j+1; ++jt) {
-                for (int it=i-1; it<=i+1; ++it) {
-                    long t = it+n*jt;
-                    datatmp = dataCurrent.at(t) - baseLevel + 1000.; // make sure the image has a positive background
-                    sum += datatmp;
-                    dataFiltered[k] += datatmp * kernel[l];
-                    ++l;
-                }
-            }
-            // the filtered image is flux-normalized.
-            // Purely empirical, suppresses stars much better (when afterwards subtracting a local median of the laplace filtered image)
-            // than if a local median or mean background is subtracted instead.
-            // Since we divide, we must make sure the local level is significantly larger than zero, hence the +1000.
-            dataFiltered[k] /= sum;
-        }
-    }
+    if (k == 0) return 0.;
+    std::nth_element(data, data+k/2, data+k);
+    const float upper = data[k/2];
+    if (k % 2) return upper;
+    const float lower = *std::max_element(data, data+k/2);
+    return (lower + upper) * 0.5;
 }
 
 void MyImage::median2D(const QVector<float> &data_in, QVector<float> &data_out, int filtersize)
 {
-    int s = 2*filtersize+1;
-    int n = naxis1;
-    int m = naxis2;
-    s = s*s;
-    QVector<float> chunk(s,0);
-
-    for (int j=0; j<m; ++j) {
-        for (int i=0; i<n; ++i) {
-            if (!globalMask.isEmpty()) {
-                if (globalMask[i+n*j]) continue;
-            }
-            long k = 0;
-            for (int jt=j-filtersize; jt<=j+filtersize; ++jt) {
-                for (int it=i-filtersize; it<=i+filtersize; ++it) {
-                    long t = it+n*jt;
-                    if (!globalMask.isEmpty()) {
-                        if (it>=0 && jt>=0 && it<n && jt<m && !globalMask[t]) {
-                            chunk[k++] = data_in[t];
-                        }
-                    }
-                    else {
-                        if (it>=0 && jt>=0 && it<n && jt<m) {
-                            chunk[k++] = data_in[t];
-                        }
-                    }
-                }
-            }
-            data_out[i+n*j] = straightMedianInline(chunk);
-        }
-    }
+    // Masked pixels are excluded from the windows, and left untouched in data_out
+    medianFilter2D(data_in.constData(), data_out.data(), naxis1, naxis2, filtersize, globalMask, maxCPU);
 }
 
 // Turns out this algorithm is similar to "LAcosmic" (http://www.astro.yale.edu/dokkum/lacosmic/)
+// Tiles of the image are Laplace filtered and median filtered in one go, while still in cache.
+// Only the residual image is kept, as its global rms is needed before the thresholding;
+// the thresholding is then a single pass over the 3x3 neighbourhood of each pixel.
 void MyImage::cosmicsFilter(QString aggressiveness)
 {
     if (!successProcessing) return;
@@ -402,98 +355,152 @@ void MyImage::cosmicsFilter(QString aggressiveness)
     float aggressiveFactor = aggressiveness.toFloat();
     if (aggressiveFactor == 0.) return;
 
+    if (dataWeight.isEmpty()) return;
+
     if (*verbosity > 1) emit messageAvailable(chipName + " : Filtering spurious pixels ...", "image");
 
-    long n = naxis1;
-    long m = naxis2;
-    QVector<float> dataLaplace(n*m);
-    QVector<float> dataMedian(n*m);
+    const long n = naxis1;
+    const long m = naxis2;
+    const long dim = n*m;
 
-    // Laplace filter, then median filter the Laplace filtered image
-    laplaceFilter(dataLaplace);             // CHECK: hogging some memory
-    median2D(dataLaplace, dataMedian, 1);   // CHECK: hogging some memory
+    // The image background level; the buffer is then reused for the residual image
+    QVector<float> dataResidual = dataCurrent;
+    const float baseLevel = medianInPlace(dataResidual.data(), dim);
 
-    // Remove the median image from the Laplace image.
-    // Suppresses residuals from bright but unsaturated stars
-    long k = 0;
-    for (auto &pixel : dataLaplace) {
-        pixel -= dataMedian[k];
-        ++k;
-    }
+    const float *data = dataCurrent.constData();
+    float *residual = dataResidual.data();
+    const bool masked = !globalMask.isEmpty();
 
-    float rms = 1.48 * madMask_T(dataLaplace, globalMask);
-    float thresh = 8.0 / aggressiveFactor; // user-adjusted threshold; the higher, the lower the threshold. Default: 8 sigma detection
-    float cutoff = thresh*rms;
+    // Laplace filter, then median filter the Laplace filtered image, and subtract the median.
+    // Suppresses residuals from bright but unsaturated stars
+    const float kernel[9] = {-1.,  -2., -1.,
+                             -2., +12., -2.,
+                             -1.,  -2., -1.};
+    const long tileSize = 128;
+    const long numTilesX = (n + tileSize - 1) / tileSize;
+    const long numTilesY = (m + tileSize - 1) / tileSize;
+#pragma omp parallel num_threads(maxCPU)
+    {
+        QVector<float> laplace;
+        QVector<float> median;
+        BitMask tileMask;
+#pragma omp for schedule(dynamic)
+        for (long tile=0; tile<numTilesX*numTilesY; ++tile) {
+            const long x0 = (tile % numTilesX) * tileSize;
+            const long y0 = (tile / numTilesX) * tileSize;
+            const long x1 = std::min(n, x0 + tileSize);
+            const long y1 = std::min(m, y0 + tileSize);
+            // The median filter needs a halo of one pixel
+            const long hx0 = std::max(0L, x0-1);
+            const long hy0 = std::max(0L, y0-1);
+            const long hx1 = std::min(n, x1+1);
+            const long hy1 = std::min(m, y1+1);
+            const long hw = hx1 - hx0;
+            const long hh = hy1 - hy0;
+
+            // Laplace filtering using direct convolution, to enhance local defects. Zero along the image border.
+            laplace.fill(0., hw*hh);
+            for (long j=std::max(1L, hy0); j<std::min(m-1, hy1); ++j) {
+                for (long i=std::max(1L, hx0); i<std::min(n-1, hx1); ++i) {
+                    float filtered = 0.;
+                    float sum = 0.;
+                    int l = 0;
+                    for (long jt=j-1; jt<=j+1; ++jt) {
+                        for (long it=i-1; it<=i+1; ++it) {
+                            float datatmp = data[it+n*jt] - baseLevel + 1000.; // make sure the image has a positive background
+                            sum += datatmp;
+                            filtered += datatmp * kernel[l];
+                            ++l;
+                        }
+                    }
+                    // the filtered image is flux-normalized.
+                    // Purely empirical, suppresses stars much better (when afterwards subtracting a local median of the laplace filtered image)
+                    // than if a local median or mean background is subtracted instead.
+                    // Since we divide, we must make sure the local level is significantly larger than zero, hence the +1000.
+                    laplace[i-hx0 + hw*(j-hy0)] = filtered / sum;
+                }
+            }
 
-    // Initiate cosmics mask
-    QVector<bool> cosmicsMask(n*m, false);
+            if (masked) {
+                tileMask.fill(false, hw*hh);
+                for (long j=hy0; j<hy1; ++j) {
+                    for (long i=hx0; i<hx1; ++i) {
+                        if (globalMask.at(i+n*j)) tileMask.setBit(i-hx0 + hw*(j-hy0));
+                    }
+                }
+            }
 
-    // Thresholding step 1
-    // Everything deviating by more than 'cutoff'
-    k = 0;
-    for (auto &pixel : dataLaplace) {
-        // not masking negative outliers because of the compensation of the laplace kernel
-        if (pixel > cutoff) cosmicsMask[k] = true;
-        ++k;
-    }
+            // Masked pixels do not get a median
+            median.fill(0., hw*hh);
+            medianFilter2D(laplace.constData(), median.data(), hw, hh, 1, tileMask, 1);
 
-    // Thresholding step 2
-    // If pixels above and below, or left and right are masked, then the current pixel gets also masked
-    QVector<bool> mask_tmp = cosmicsMask;
-    for (int j=1; j<m-1; ++j) {
-        for (int i=1; i<n-1; ++i) {
-            if ((mask_tmp[i-1+n*j] && mask_tmp[i+1+n*j])
-                    || (mask_tmp[i+n*(j-1)] && mask_tmp[i+n*(j+1)])) {
-                cosmicsMask[i+n*j] = true;
+            for (long j=y0; j<y1; ++j) {
+                for (long i=x0; i<x1; ++i) {
+                    const long t = i-hx0 + hw*(j-hy0);
+                    residual[i+n*j] = laplace.at(t) - median.at(t);
+                }
             }
         }
     }
 
-    // Thresholding step 3
-    // If at least 2 of the 8 surrounding pixels deviate by more than 'cutoff', and are not in the same row or column,
-    // then the current pixel gets also masked.
-    for (int j=1; j<m-1; ++j) {
-        for (int i=1; i<n-1; ++i) {
-            int count = 0;
-            int isum = 0;
-            int jsum = 0;
-            for (int jt=j-1; jt<=j+1; ++jt) {
-                for (int it=i-1; it<=i+1; ++it) {
-                    long t = it+n*jt;
-                    if (dataLaplace[t] > cutoff) {
-                        isum += it;
-                        jsum += jt;
-                        ++count;
-                    }
-                }
-            }
-            // Using the mean i and j to make sure pixels are not in the same column;
-            // This is to avoid that a single bad column/row gets tripled in width.
-            float meani = float(isum)/float(count);
-            float meanj = float(jsum)/float(count);
-            if (count >= 2 && fabs(meani-i) < 1. && fabs(meanj-j) < 1. ) cosmicsMask[i+n*j] = true;
+    // Global rms of the residuals
+    QVector<float> samples;
+    samples.reserve(dim);
+    if (masked) {
+        for (long k=0; k<dim; ++k) {
+            if (!globalMask.at(k)) samples.append(residual[k]);
         }
     }
-
-    // Thresholding step 4
-    // If at least 4 out of the 8 surrounding pixels deviate by more than 0.5*cutoff, then the current pixel gets also masked
-    for (int j=1; j<m-1; ++j) {
-        for (int i=1; i<n-1; ++i) {
-            int count = 0;
-            for (int jt=j-1; jt<=j+1; ++jt) {
-                for (int it=i-1; it<=i+1; ++it) {
-                    long t = it+n*jt;
-                    if (dataLaplace[t] > 0.5*cutoff) ++count;
+    else samples = dataResidual;
+    const long numSamples = samples.length();
+    float *sample = samples.data();
+    const float med = medianInPlace(sample, numSamples);
+    for (long k=0; k<numSamples; ++k) sample[k] = fabs(sample[k] - med);
+    const float mad = medianInPlace(sample, numSamples);
+    samples.clear();
+    samples.squeeze();
+
+    float rms = 1.48 * mad;
+    float thresh = 8.0 / aggressiveFactor; // user-adjusted threshold; the higher, the lower the threshold. Default: 8 sigma detection
+    const float cutoff = thresh*rms;
+    const double halfCutoff = 0.5*cutoff;
+
+    // All thresholding steps in one pass; masked pixels are set to zero in the weight map
+    float *weight = dataWeight.data();
+#pragma omp parallel for num_threads(maxCPU)
+    for (long j=0; j<m; ++j) {
+        for (long i=0; i<n; ++i) {
+            const long k = i+n*j;
+            // Step 1: everything deviating by more than 'cutoff'
+            // (not masking negative outliers because of the compensation of the laplace kernel)
+            bool cosmic = residual[k] > cutoff;
+            if (!cosmic && i>0 && i<n-1 && j>0 && j<m-1) {
+                // Step 2: if pixels above and below, or left and right are masked, then the current pixel gets also masked
+                cosmic = (residual[k-1] > cutoff && residual[k+1] > cutoff)
+                        || (residual[k-n] > cutoff && residual[k+n] > cutoff);
+                int count = 0;
+                int isum = 0;
+                int jsum = 0;
+                int countHalf = 0;
+                for (int jt=-1; jt<=1; ++jt) {
+                    for (int it=-1; it<=1; ++it) {
+                        const float value = residual[k+it+n*jt];
+                        if (value > cutoff) {
+                            isum += it;
+                            jsum += jt;
+                            ++count;
+                        }
+                        if (value > halfCutoff) ++countHalf;
+                    }
                 }
+                // Step 3: if at least 2 of the 8 surrounding pixels deviate by more than 'cutoff', and are not in the same row or column,
+                // then the current pixel gets also masked. Using the mean offsets to make sure pixels are not in the same column;
+                // This is to avoid that a single bad column/row gets tripled in width.
+                if (count >= 2 && abs(isum) < count && abs(jsum) < count) cosmic = true;
+                // Step 4: if at least 4 out of the 8 surrounding pixels deviate by more than 0.5*cutoff, then the current pixel gets also masked
+                if (countHalf >= 4) cosmic = true;
             }
-            if (count >= 4) cosmicsMask[i+n*j] = true;
+            if (cosmic) weight[k] = 0.;
         }
     }
-
-    // Apply the cosmics mask to the weight map
-    k = 0;
-    for (auto &pixel : dataWeight) {
-        if (cosmicsMask[k]) pixel = 0.;
-        ++k;
-    }
 }
@@ -28,9 +28,31 @@ If not, see https://www.gnu.org/licenses/ .
 #include <QFile>
 #include <QFileInfo>
 #include <QDebug>
+#include <QMutexLocker>
 #include <QString>
 
 
+namespace {
+// Writes the pixels of an image band by band. cfitsio byte-swaps the array it is given in place on
+// little-endian machines, so the pixel vectors (const, possibly shared or read by other threads) are
+// not handed over directly; instead 'value(i)' fills a small staging buffer that stays in the cache.
+// This avoids a temporary copy of the entire image.
+template <typename T, typename F>
+void writeImageBandwise(fitsfile *fptr, int datatype, long naxis1, long naxis2, F value, int *status)
+{
+    if (naxis1 <= 0 || naxis2 <= 0) return;
+    const long bandHeight = (1<<20) / naxis1 > 0 ? (1<<20) / naxis1 : 1;
+    QVector<T> band(naxis1 * (bandHeight < naxis2 ? bandHeight : naxis2));
+    T *buffer = band.data();
+    for (long y=0; y<naxis2 && !*status; y+=bandHeight) {
+        const long offset = y*naxis1;
+        const long nelem = naxis1 * (bandHeight < naxis2-y ? bandHeight : naxis2-y);
+        for (long i=0; i<nelem; ++i) buffer[i] = value(offset+i);
+        fits_write_img(fptr, datatype, offset+1, nelem, buffer, status);
+    }
+}
+}
+
 void MyImage::writeImage(QString fileName, QString filter, float exptime, bool addGain)
 {
     if (!successProcessing) return;
@@ -49,6 +71,94 @@ void MyImage::writeImage(QString fileName, QString filter, float exptime, bool a
     emit modelUpdateNeeded(chipName);
 }
 
+// Same as writeImage(), but the FITS file is written in the background by the write-behind queue.
+// The request shares the pixels with dataCurrent, hence the image may be modified or freed right away;
+// the data are released once they are on the drive. Without a queue the image is written immediately.
+// imageOnDrive is only set once the write succeeded (see waitForPendingWrites()), so that freeData()
+// cannot drop the only copy of an image whose write is still pending or failed.
+void MyImage::writeImageQueued(WriteQueue *queue, QString fileName, QString filter, float exptime, bool addGain)
+{
+    if (queue == nullptr) {
+        writeImage(fileName, filter, exptime, addGain);
+        return;
+    }
+
+    if (!successProcessing) return;
+
+    if (fileName.isEmpty()) {
+        fileName = path+"/"+chipName+processingStatus->statusString+".fits";
+    }
+
+    if (addGain) addGainNormalization = true;
+    else addGainNormalization = false;
+
+    // Earlier queued writes of this image go to the same file
+    waitForPendingWrites();
+
+    FitsWriteRequest request;
+    request.fileName = fileName;
+    request.data = dataCurrent;
+    request.header = header;
+    request.naxis1 = naxis1;
+    request.naxis2 = naxis2;
+    request.exptime = exptime;
+    request.filter = filter;
+    request.addGainNormalization = addGainNormalization;
+    request.gainNormalization = gainNormalization;
+    request.mjdobs = mjdobs;
+
+    updateHeaderValue("SATURATE", saturationValue, 'e');
+
+    imageOnDrive = false;
+    writeMutex.lock();
+    ++writesPending;
+    writeMutex.unlock();
+
+    const qint64 numBytes = request.data.size() * qint64(sizeof(float));
+    queue->enqueue([this, request]() {
+        int status = 0;
+        writeFITS(request, &status);
+        return queuedWriteFinished(request.fileName, status);
+    }, numBytes);
+}
+
+// Called by the I/O thread once a queued write is done. Only touches the members guarded by writeMutex;
+// the controller learns about a failure from WriteQueue::flush().
+bool MyImage::queuedWriteFinished(QString fileName, int status)
+{
+    if (status) {
+        CfitsioErrorCodes errorCodes;
+        emit messageAvailable("MyImage::writeImageQueued():<br>" + baseName + " : " + errorCodes.errorKeyMap.value(status), "error");
+    }
+    else {
+        if (*verbosity > 1) emit messageAvailable(fileName + " : Written to drive.", "image");
+    }
+
+    writeMutex.lock();
+    --writesPending;
+    queuedWritesDone = true;
+    if (status) queuedWriteFailed = true;
+    writeFinished.wakeAll();
+    writeMutex.unlock();
+
+    emit modelUpdateNeeded(chipName);
+    return status == 0;
+}
+
+// Reading a file (or replacing it) must wait until the write-behind queue has written it.
+// Afterwards, imageOnDrive reflects the outcome of the queued writes.
+void MyImage::waitForPendingWrites()
+{
+    QMutexLocker locker(&writeMutex);
+    while (writesPending > 0) writeFinished.wait(&writeMutex);
+    if (queuedWritesDone) {
+        imageOnDrive = !queuedWriteFailed;
+        if (queuedWriteFailed) successProcessing = false;
+        queuedWritesDone = false;
+        queuedWriteFailed = false;
+    }
+}
+
 // same as above, just writes the dataTIFF vector instead
 void MyImage::writeImageTIFF(QString fileName, QString filter, float exptime, bool addGain)
 {
@@ -119,7 +229,7 @@ void MyImage::writeWeight(QString fileName)
 {
     if (!successProcessing) return;
 
-    bool success = write(fileName, dataWeight, exptime, filter, header);
+    bool success = write(fileName, dataWeight, exptime, filter, header, true);
     if (success) weightOnDrive = true;
     else weightOnDrive = false;
 }
@@ -128,7 +238,7 @@ void MyImage::writeWeightSmoothed(QString fileName)
 {
     if (!successProcessing) return;
 
-    bool success = write(fileName, dataWeightSmooth, exptime, filter, header);
+    bool success = write(fileName, dataWeightSmooth, exptime, filter, header, true);
     if (success) weightOnDrive = true;
     else weightOnDrive = false;
 }
@@ -162,54 +272,29 @@ void MyImage::writeImageDebayer(bool addGain)
 
 // If the 'headerRef' member is set, the header from that image will be copied.
 bool MyImage::write(QString fileName, const QVector<float> &data, const float exptime,
-                    const QString filter, const QVector<QString> header)
+                    const QString filter, const QVector<QString> header, const bool lossless)
 {
-    // The new output file
-    fitsfile *fptr;
-    int status = 0;
-    long fpixel = 1;
-    int bitpix = FLOAT_IMG;
-    long naxis = 2;
-    long naxes[2] = {naxis1, naxis2};
-    long nelements = naxis1*naxis2;
-    float *array = new float[nelements];
-    for (long i=0; i<nelements; ++i) {
-        array[i] = data[i];
-    }
-
-    // Overwrite file if it exists
-    fileName = "!"+fileName;
-    fits_create_file(&fptr, fileName.toUtf8().data(), &status);
-    fits_create_img(fptr, bitpix, naxis, naxes, &status);
-    fits_write_img(fptr, TFLOAT, fpixel, nelements, array, &status);
+    // The file may still be queued for writing
+    waitForPendingWrites();
+
+    FitsWriteRequest request;
+    request.fileName = fileName;
+    request.data = data;
+    request.header = header;
+    request.naxis1 = naxis1;
+    request.naxis2 = naxis2;
+    request.exptime = exptime;
+    request.filter = filter;
+    request.addGainNormalization = addGainNormalization;
+    request.gainNormalization = gainNormalization;
+    request.mjdobs = mjdobs;
+    request.lossless = lossless;
 
     // header stuff
     updateHeaderValue("SATURATE", saturationValue, 'e');      // Could be done explicitly every time saturation is changed
-    if (!header.isEmpty()) propagateHeader(fptr, header);
-
-    if (exptime >= 0.) {
-        fits_write_key_flt(fptr, "EXPTIME", exptime, 6, nullptr, &status);
-    }
-
-    if (!filter.isEmpty()) {
-        fits_update_key_str(fptr, "FILTER", filter.toUtf8().data(), nullptr, &status);
-    }
 
-    if (addGainNormalization) {
-        fits_update_key_flt(fptr, "GAINCORR", gainNormalization, 6, nullptr, &status);
-    }
-
-    fits_update_key_dbl(fptr, "MJD-OBS", mjdobs, 15, nullptr, &status);
-
-    // BZERO should be 0 after THELI processing. Pixels are scaled by cfitsio already when loading images.
-    fits_update_key_flt(fptr, "BZERO", 0.0, 6, nullptr, &status);
-
-    // This image has been processed by THELI
-    fits_update_key_lng(fptr, "THELIPRO", 1, "Indicates that this is a THELI FITS file", &status);
-    fits_close_file(fptr, &status);
-
-    delete [] array;
-    array = nullptr;
+    int status = 0;
+    writeFITS(request, &status);
 
     if (status) {
         printCfitsioError("MyImage::write()", status);
@@ -235,6 +320,48 @@ bool MyImage::write(QString fileName, const QVector<float> &data, const float ex
     */
 }
 
+// Does not touch any member that changes during processing, hence safe to call from the I/O threads of the write-behind queue
+void MyImage::writeFITS(const FitsWriteRequest &request, int *status)
+{
+    // The new output file
+    fitsfile *fptr;
+    int bitpix = FLOAT_IMG;
+    long naxis = 2;
+    long naxes[2] = {request.naxis1, request.naxis2};
+    const float *pixels = request.data.constData();
+
+    // Overwrite file if it exists
+    QString fileName = "!"+request.fileName;
+    fits_create_file(&fptr, fileName.toUtf8().data(), status);
+    setupFitsCompression(fptr, request.lossless, status);
+    fits_create_img(fptr, bitpix, naxis, naxes, status);
+    writeImageBandwise<float>(fptr, TFLOAT, request.naxis1, request.naxis2, [pixels](long i) {return pixels[i];}, status);
+
+    // header stuff
+    if (!request.header.isEmpty()) propagateHeader(fptr, request.header);
+
+    if (request.exptime >= 0.) {
+        fits_write_key_flt(fptr, "EXPTIME", request.exptime, 6, nullptr, status);
+    }
+
+    if (!request.filter.isEmpty()) {
+        fits_update_key_str(fptr, "FILTER", request.filter.toUtf8().data(), nullptr, status);
+    }
+
+    if (request.addGainNormalization) {
+        fits_update_key_flt(fptr, "GAINCORR", request.gainNormalization, 6, nullptr, status);
+    }
+
+    fits_update_key_dbl(fptr, "MJD-OBS", request.mjdobs, 15, nullptr, status);
+
+    // BZERO should be 0 after THELI processing. Pixels are scaled by cfitsio already when loading images.
+    fits_update_key_flt(fptr, "BZERO", 0.0, 6, nullptr, status);
+
+    // This image has been processed by THELI
+    fits_update_key_lng(fptr, "THELIPRO", 1, "Indicates that this is a THELI FITS file", status);
+    fits_close_file(fptr, status);
+}
+
 void MyImage::writeSegmentation(QString fileName)
 {
     if (!successProcessing) return;
@@ -243,26 +370,19 @@ void MyImage::writeSegmentation(QString fileName)
 
     fitsfile *fptr;
     int status = 0;
-    long fpixel = 1;
     int bitpix = LONG_IMG;
     long naxis = 2;
     long naxes[2] = {naxis1, naxis2};
-    long nelements = naxis1*naxis2;
-    long *array = new long[nelements];
-    for (long i=0; i<nelements; ++i) {
-        array[i] = dataSegmentation[i];
-    }
+    const long *segmentation = dataSegmentation.constData();
 
     // Overwrite file if it exists
     fileName = "!"+fileName;
     fits_create_file(&fptr, fileName.toUtf8().data(), &status);
+    setupFitsCompression(fptr, true, &status);
     fits_create_img(fptr, bitpix, naxis, naxes, &status);
-    fits_write_img(fptr, TLONG, fpixel, nelements, array, &status);
+    writeImageBandwise<long>(fptr, TLONG, naxis1, naxis2, [segmentation](long i) {return segmentation[i];}, &status);
     fits_close_file(fptr, &status);
 
-    delete [] array;
-    array = nullptr;
-
     printCfitsioError("MyImage::writeSegmentation()", status);
 }
 
@@ -274,25 +394,18 @@ void MyImage::writeObjectMask(QString fileName)
 
     fitsfile *fptr;
     int status = 0;
-    long fpixel = 1;
     int bitpix = LONG_IMG;
     long naxis = 2;
     long naxes[2] = {naxis1, naxis2};
-    long nelements = naxis1*naxis2;
-    long *array = new long[nelements];
-    for (long i=0; i<nelements; ++i) {
-        if (objectMask[i]) array[i] = 0;
-        else array[i] = 1;
-    }
+    const BitMask &mask = objectMask;
 
     // Overwrite file if it exists
     fileName = "!"+fileName;
     fits_create_file(&fptr, fileName.toUtf8().data(), &status);
+    setupFitsCompression(fptr, true, &status);
     fits_create_img(fptr, bitpix, naxis, naxes, &status);
-    fits_write_img(fptr, TLONG, fpixel, nelements, array, &status);
+    writeImageBandwise<long>(fptr, TLONG, naxis1, naxis2, [&mask](long i) {return mask.at(i) ? 0L : 1L;}, &status);
     fits_close_file(fptr, &status);
-    delete [] array;
-    array = nullptr;
 
     printCfitsioError("MyImage::writeObjectMask()", status);
 }
@@ -304,21 +417,16 @@ void MyImage::writeConstImage(QString fileName, float constValue, const QVector<
     // The new output file
     fitsfile *fptr;
     int status = 0;
-    long fpixel = 1;
     int bitpix = FLOAT_IMG;
     long naxis = 2;
     long naxes[2] = {naxis1, naxis2};
-    long nelements = naxis1*naxis2;
-    float *array = new float[nelements];
-    for (long i=0; i<nelements; ++i) {
-        array[i] = constValue;
-    }
 
     // Overwrite file if it exists
     fileName = "!"+fileName;
     fits_create_file(&fptr, fileName.toUtf8().data(), &status);
+    setupFitsCompression(fptr, true, &status);
     fits_create_img(fptr, bitpix, naxis, naxes, &status);
-    fits_write_img(fptr, TFLOAT, fpixel, nelements, array, &status);
+    writeImageBandwise<float>(fptr, TFLOAT, naxis1, naxis2, [constValue](long) {return constValue;}, &status);
 
     // Header stuff
     if (!header.isEmpty()) propagateHeader(fptr, header);
@@ -342,9 +450,6 @@ void MyImage::writeConstImage(QString fileName, float constValue, const QVector<
     fits_update_key_lng(fptr, "THELIPRO", 1, "Indicates that this is a THELI FITS file", &status);
     fits_close_file(fptr, &status);
 
-    delete [] array;
-    array = nullptr;
-
     printCfitsioError("MyImage::writeConstImage()", status);
 }
 
@@ -132,6 +132,10 @@ void Controller::getNumberOfActiveImages(Data *&data)
 
 Controller::~Controller()
 {
+    // Images still queued for writing must reach the drive before they are deleted
+    delete writeQueue;
+    writeQueue = nullptr;
+
     for (auto &DT_x : masterListDT) {
         for (auto &it : DT_x) {
             delete it;
@@ -365,6 +369,19 @@ long Controller::makeListofAllImages(QList<MyImage*> &allMyImages, Data *data)
     return allMyImages.length();
 }
 
+// The number of images an ImagePrefetcher may load ahead of the compute threads: one per thread, within
+// a quarter of the memory budget. Nothing is prefetched if the task is repeated, because then setupData()
+// restores the backup data instead of reading the images.
+int Controller::prefetchLimit(bool isTaskRepeated)
+{
+    if (isTaskRepeated) return 0;
+    if (instData->storage <= 0.) return 0;
+
+    long maxImages = long(maxRAM / 4 / instData->storage);
+    if (maxImages > maxCPU) maxImages = maxCPU;
+    return int(maxImages);
+}
+
 // Rescan the data tree if a LineEdit was successfully edited
 void Controller::dataTreeEditedReceived()
 {
@@ -540,6 +557,11 @@ void Controller::loadPreferences()
         verbosity = 1;
     }
 
+    // Images handed to the write-behind queue may occupy up to a quarter of the memory budget;
+    // processing threads wait in enqueue() if the queue is full
+    if (writeQueue == nullptr) writeQueue = new WriteQueue();
+    writeQueue->setup(maxThreadsIO, maxRAM / 4);
+
     // We have maxExternalThreads, which is the max number of threads working on independent detectors.
     // If more CPUs than detectors, limit this number so that we have left-over threads for further parallelization
     // (internal threads in Data class)
@@ -571,7 +593,6 @@ void Controller::loadPreferences()
         //        connect(process, &QProcess::readyReadStandardError, this, &Controller::processExternalStderr);
         externalProcesses[i] = process;
     }
-    swarpCommands.resize(maxCPU);
     threadsFinished.fill(false, maxCPU);
     swarpWorkers.resize(maxCPU);
     workerThreads.resize(maxCPU);
@@ -646,6 +667,17 @@ void Controller::doDataFitInRAM(const long nImages, const long storageSize)
     }
 }
 
+// Calibrator stacks that do not fit into RAM are combined from drive, block by block.
+// In this case only one image per thread is kept in memory (for the mode), plus the master calibration
+void Controller::decideStreamCombine(Data *data, float &nimg)
+{
+    data->streamCombine = nimg*instData->storage*maxExternalThreads > maxRAM;
+    if (!data->streamCombine) return;
+
+    nimg = 3;
+    emit messageAvailable(data->subDirName + " : Stack exceeds the available RAM. Combining images directly from drive.", "note");
+}
+
 void Controller::releaseMemory(float RAMneededThisThread, int numThreads, QString mode)
 {
     // Requested by several threads, hence this must be locked
@@ -902,7 +934,9 @@ void Controller::updateImageAndData(MyImage *image, Data *data)
         // Update members in MyImage class
         image->processingStatus->statusString = statusNew;
         image->baseName = image->chipName + statusNew;
-        // New pixel data are not yet on drive
+        // New pixel data are not yet on drive. The outcome of earlier queued writes (which concerned the
+        // old pixels) must be applied first, otherwise it would overwrite this flag later.
+        image->waitForPendingWrites();
         image->imageOnDrive = false;
     }
     else {
@@ -919,6 +953,10 @@ void Controller::runTask()
     // Reset the process progress bar
     emit resetProgressBar();
 
+    // A project setting, but needed wherever images are written. Only changed here, between tasks: all writes of the
+    // previous task have been flushed, and loadPreferences() may be called from the GUI while a task is running.
+    MyImage::fitsCompression = cdw->ui->fitsCompressionComboBox->currentText();
+
     // call the function by its string representation (needs a const char *)
     bool test = true;
     if (taskBasename == "processScience") {
@@ -931,6 +969,14 @@ void Controller::runTask()
                                          Qt::DirectConnection);
     }
 
+    // All images written by the task must be on the drive before the next task starts
+    if (writeQueue != nullptr && !writeQueue->flush()) {
+        emit messageAvailable("Controller::runTask(): Not all images of " + taskBasename + " could be written to the drive", "error");
+        criticalReceived();
+        successProcessing = false;
+        return;
+    }
+
     if (!test) {
         emit messageAvailable("Controller::runTask(): Could not evaluate QMetaObject for " +taskBasename, "error");
         criticalReceived();
@@ -33,6 +33,8 @@ If not, see https://www.gnu.org/licenses/ .
 #include "dockwidgets/monitor.h"
 #include "../threading/scampworker.h"
 #include "../threading/swarpworker.h"
+#include "../threading/writequeue.h"
+#include "../threading/imageprefetcher.h"
 #include "../tools/fileprogresscounter.h"
 #include "photinst.h"
 #include "../iview/iview.h"
@@ -84,7 +86,6 @@ private:
     Data *tmpCoaddData;
     //    IView *checkplotViewer;
 
-    FileProgressCounter *numberFileCounter;
     FileProgressCounter *sizeFileCounter;
 
     QString swarpCommand;
@@ -158,9 +159,19 @@ private:
     void coaddSmoothEdge();
     void coaddPrepareProjectPM(QFile &headerFileOld, QString newHeaderName, QString refDE, double mjdobsZero, double mjdobsNow);
     void coaddPrepareProjectRotation();
+    bool coaddPrepareLink(QFile &file, QString linkName);
     void coaddPrepareBuildSwarpCommand(QString refRA, QString refDE);
-    void coaddResampleBuildSwarpCommand(QString imageList, int i);
+    QString coaddResampleBuildSwarpCommand();
+    void coaddResampleInternal(const QStringList &imageList);
     void coaddCoadditionBuildSwarpCommand(QString imageList);
+    void coaddIncrementalInit();
+    QString coaddIncrementalFingerprint();
+    void coaddIncrementalSaveState();
+    void coaddIncrementalCombine();
+    bool coaddIncremental = false;              // only new exposures are resampled and added to the existing coadd
+    QString coaddParentDirName;                 // the coadd directory, if coaddDirName points to the incremental staging directory
+    QStringList coaddIncrementalImages;         // exposures already contained in the existing coadd
+    QStringList coaddNewImages;                 // exposures resampled in the current run
     void foldCoaddFits();
     float coaddTexptime = 0.;
     float coaddSkyvalue = 0.;
@@ -213,6 +224,7 @@ private:
     void populateHeaderDictionary();
     void populateFilterDictionary();
     long makeListofAllImages(QList<MyImage *> &allMyImages, Data *data);
+    int prefetchLimit(bool isTaskRepeated);
 
     //    void updateMyImagesWithScampSolution(Data *scienceData);
     void doImageQualityAnalysis();
@@ -280,6 +292,7 @@ private:
     void pushConfigSkysubPoly();
     void flagLowDetectionImages(Data *scienceData, long &numExpRejected, long &numImgRejected);
     void doDataFitInRAM(const long nImages, const long storageSize);
+    void decideStreamCombine(Data *data, float &nimg);
     bool testResetDesire(const Data *data);
     void runAnet(Data *scienceData);
     void prepareAnetRun(Data *scienceData);
@@ -322,6 +335,7 @@ private slots:
 //    void processExternalStderr();
     void finishedPreparationReceived();
     void waitForResamplingThreads(int threadID);
+    void resamplingJobFinishedReceived(int numImages);
     void finishedScampReceived();
     void fieldMatchedReceived();
     void showScampCheckPlotsReceived();
@@ -379,6 +393,9 @@ public:
     bool alwaysStoreData = false;
     bool minimizeMemoryUsage = false;
 
+    // Background writer for the images written by the processing loops; flushed at the end of each task
+    WriteQueue *writeQueue = nullptr;
+
     float progress = 0.;
     long numActiveImages = 0;
     float progressStepSize = 0.;
@@ -426,6 +443,9 @@ public:
     QVector<QThread*> workerThreads;
     QVector<SwarpWorker*> swarpWorkers;
     QVector<bool> threadsFinished;
+    QStringList resampleQueue;         // images not yet taken by a swarp worker
+    QMutex resampleQueueMutex;
+    int resampleNumImages = 0;
     bool workersInit = false;
     bool workerThreadsInit = false;
 
@@ -444,7 +464,6 @@ public:
     QString currentDirName = "";
 
     QVector<QProcess*> externalProcesses;
-    QVector<QString> swarpCommands;
     QProcess *externalProcess;
     QByteArray *stdoutByteArray;
     QByteArray *stderrByteArray;
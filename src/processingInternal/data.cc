@@ -23,6 +23,7 @@ If not, see https://www.gnu.org/licenses/ .
 #include "../functions.h"
 #include "../tools/tools.h"
 #include "../tools/cfitsioerrorcodes.h"
+#include "../tools/combineestimator.h"
 #include "../preferences.h"
 #include "../instrumentdata.h"
 #include "../threading/memoryworker.h"
@@ -35,6 +36,7 @@ If not, see https://www.gnu.org/licenses/ .
 #include <QString>
 #include <QDebug>
 #include <QFile>
+#include <QFileInfo>
 #include <QPushButton>
 #include <QSettings>
 #include <QMainWindow>
@@ -214,6 +216,7 @@ Data::~Data()
     }
 
     deleteMyImageList();
+    releaseDynamicModel();
 
     omp_destroy_lock(&progressLock);
 }
@@ -257,7 +260,7 @@ bool Data::checkForRawData()
         fitsfile *fptr;
         int status = 0;
         QString name = dirName + "/" + fileName;
-        fits_open_file(&fptr, name.toUtf8().data(), READONLY, &status);
+        fits_open_image(&fptr, name.toUtf8().data(), READONLY, &status);     // tile-compressed THELI images carry THELIPRO in the extension
         long thelipro = 0;
         fits_read_key_lng(fptr, "THELIPRO", &thelipro, nullptr, &status);
         if (status == KEY_NO_EXIST) {
@@ -551,7 +554,7 @@ void Data::resetSuccessProcessing()
 // Used for creating master calibrators
 void Data::combineImagesCalib(int chip, float (*combineFunction_ptr) (const QVector<float> &, const QVector<bool> &, long),
                               const QString nlowString, const QString nhighString, const QString dirName, const QString subDirName,
-                              const QString dataType)
+                              const QString dataType, const MyImage *biasImage)
 {
     if (!successProcessing) return;
 
@@ -643,75 +646,167 @@ void Data::combineImagesCalib(int chip, float (*combineFunction_ptr) (const QVec
     if (!rescaleFlag) rescaled = ", without rescaling, ";
     if (*verbosity > 0) emit messageAvailable(subDirName + " : Calculating master "+dataType+" for chip "+QString::number(chip+1)
                                               + rescaled + " from : <br>"+goodImages, "image");
-    if (*verbosity > 0) emit messageAvailable(subDirName + " : Median combination running ...", "data");
+    const CombineEstimator::Type estimator = CombineEstimator::fromFunction(combineFunction_ptr);
+    if (*verbosity > 0) emit messageAvailable(subDirName + " : " + CombineEstimator::name(estimator) + " combination running ...", "data");
 
-    // 45% of the progress counter is reserved for combining the images. We update the progress bar for every 10% of these 45%
-    float localProgressStepSize = 0.45 / 10. / instData->numUsedChips * 100.;
-    int progCount = 1;  // runs from 1 to 10;
-    long progCountComparison = dim / 10;
-
-    // works on dataCurrent
-    dim = combinedImage.at(chip)->dataCurrent.length();
-    // Crashed by stack.append(), but not when running through valgrind (no multi-threading)?
-    // Update: does not crash anymore ... (at least for single-chip cameras)
-    // TODO: more efficient with semaphore if numcpu and numchips divide with remainder
-    //#pragma omp parallel for num_threads(maxCPU) if (instData->numChips == 1)
-
-    //int localMaxThreads = maxCPU/instData->numChips;
-    // if (instData->numChips > maxCPU) localMaxThreads = 1;
-    //  QList<MyImage*> imglist = myImageList[chip];
-    omp_set_nested(false);  // somehow not yet threadsafe!
-    // we still parallelise though for single-chip cameras:
-    int localMaxThreads = 1;
-    // NOT THREADSAFE
-    //    if (instData->numChips == 1) localMaxThreads = maxCPU;
-#pragma omp parallel for num_threads(localMaxThreads) firstprivate(rescaleFactors) // firstprivate(imglist, goodIndex, rescaleFactors)
-    for (long i=0; i<dim; ++i) {
-        QVector<float> stack;
-        stack.reserve(ngood);
-        long k = 0;
-        for (auto &gi : goodIndex) {
-            // if clause: needed because objectmask can be empty and the lookup will segfault
+    float *combined = combinedImage[chip]->dataCurrent.data();
 
-            if (myImageList[chip][gi]->objectMaskDone) {
-                if (!myImageList[chip][gi]->objectMask[i]) {
-                    stack.append(myImageList.at(chip).at(gi)->dataCurrent.at(i) * rescaleFactors[k]);
-                }
-            }
-            else {
-                stack.append(myImageList.at(chip).at(gi)->dataCurrent.at(i) * rescaleFactors[k]);
+    // 45% of the progress counter is reserved for combining the images.
+    float localProgressStepSize = 0.45 / instData->numUsedChips * 100.;
+
+    // Large stacks are not kept in memory, but read from drive block by block
+    if (streamCombine) {
+        if (!combineImagesCalibFromDrive(chip, goodIndex, rescaleFactors, biasImage, combined, n, m, nlow, nhigh, localProgressStepSize, estimator)) {
+            emit critical();
+            successProcessing = false;
+            return;
+        }
+    }
+    else {
+        // The combination is split into tiles of full image rows, processed in parallel.
+        // All threads work on raw pointers collected beforehand (see combineStack()).
+        QVector<const float*> stackData;
+        QVector<const BitMask*> stackMask;
+        stackData.reserve(ngood);
+        stackMask.reserve(ngood);
+        for (auto &gi : goodIndex) {
+            const MyImage *img = myImageList.at(chip).at(gi);
+            if (img->dataCurrent.length() < dim) {
+                emit messageAvailable(subDirName + " : Data::combineImgesCalib(): " + img->baseName + " does not match the geometry of the first image.", "error");
+                emit critical();
+                successProcessing = false;
+                return;
             }
+            stackData.append(img->dataCurrent.constData());
+            // objectmask can be empty and the lookup would segfault
+            if (img->objectMaskDone && img->objectMask.length() >= dim) stackMask.append(&img->objectMask);
+            else stackMask.append(nullptr);
+        }
+        combineStack(stackData, stackMask, rescaleFactors, combined, dim, n, nlow, nhigh, localProgressStepSize, estimator);
+    }
 
-            /*
-            if (imglist[gi]->objectMaskDone) {
-                if (!imglist[gi]->objectMask[i]) {
-                    stack.append(imglist[gi]->dataCurrent[i] * rescaleFactors[k]);
-                }
+    combinedImage[chip]->imageInMemory = true;
+    successProcessing = true;
+    combinedImage[chip]->emitModelUpdateNeeded();
+}
+
+// Combines calibrators without holding the full images in memory.
+// Matching row blocks are read from each input FITS file, bias-subtracted (if requested), and combined.
+// Peak memory is bounded by the block size times the stack depth, plus the master calibration itself.
+bool Data::combineImagesCalibFromDrive(const int chip, const QVector<long> &goodIndex, const QVector<float> &rescaleFactors,
+                                       const MyImage *biasImage, float *combined, const long n, const long m,
+                                       const int nlow, const int nhigh, const float progressStepSize,
+                                       const CombineEstimator::Type estimator)
+{
+    const long ngood = goodIndex.length();
+
+    QList<MyImage*> stackImages;
+    for (auto &gi : goodIndex) {
+        MyImage *img = myImageList.at(chip).at(gi);
+        if (img->naxis1 != n || img->naxis2 != m) {
+            emit messageAvailable(subDirName + " : Data::combineImagesCalibFromDrive(): " + img->baseName + " does not match the geometry of the first image.", "error");
+            return false;
+        }
+        if (!QFileInfo(img->path + "/" + img->name).exists()) {
+            emit messageAvailable(subDirName + " : Data::combineImagesCalibFromDrive(): " + img->name + " not found on drive.", "error");
+            return false;
+        }
+        stackImages.append(img);
+    }
+
+    const float *bias = nullptr;
+    if (biasImage != nullptr) {
+        if (biasImage->dataCurrent.length() != n*m) {
+            emit messageAvailable(subDirName + " : Data::combineImagesCalibFromDrive(): Master calibration has wrong size.", "error");
+            return false;
+        }
+        bias = biasImage->dataCurrent.constData();
+    }
+
+    // Half of the RAM available to this chip is used for the blocks
+    long blockRows = 0.5 * maxRAM * 1024. * 1024. / std::max(1, maxExternalThreads) / (ngood * n * sizeof(float));
+    if (blockRows < 1) blockRows = 1;
+    if (blockRows > m) blockRows = m;
+    const long blockSize = blockRows * n;
+    const long numBlocks = (m + blockRows - 1) / blockRows;
+
+    if (*verbosity > 1) emit messageAvailable(subDirName + " : Combining chip " + QString::number(chip+1) + " from drive in "
+                                              + QString::number(numBlocks) + " blocks of " + QString::number(blockRows) + " rows", "data");
+
+    QVector<float> blockBuffer(ngood * blockSize);
+    float *buffer = blockBuffer.data();
+    QVector<const float*> stackData(ngood);
+    QVector<const BitMask*> stackMask(ngood, nullptr);     // calibrators do not carry object masks
+    for (long k=0; k<ngood; ++k) stackData[k] = buffer + k*blockSize;
+
+    for (long block=0; block<numBlocks; ++block) {
+        if (userStop || userKill) return false;
+        const long ymin = block * blockRows;
+        const long ymax = std::min(m, ymin + blockRows) - 1;
+        const long numPixels = (ymax - ymin + 1) * n;
+        long numFailed = 0;
+#pragma omp parallel for num_threads(maxThreadsIO) reduction(+:numFailed)
+        for (long k=0; k<ngood; ++k) {
+            float *section = buffer + k*blockSize;
+            if (!stackImages.at(k)->loadDataSection(0, n-1, ymin, ymax, section)) {
+                ++numFailed;
+                continue;
             }
-            else {
-                stack.append(imglist[gi]->dataCurrent[i] * rescaleFactors[k]);
+            if (bias != nullptr) {
+                const float *biasSection = bias + ymin*n;
+                for (long i=0; i<numPixels; ++i) section[i] -= biasSection[i];
             }
-            */
-
-            ++k;
         }
-        //        auto &stackedPixel = combinedImage[chip]->dataCurrent[pix];
-        combinedImage[chip]->dataCurrent[i] = straightMedian_MinMax(stack, nlow, nhigh);
+        if (numFailed > 0) {
+            emit messageAvailable(subDirName + " : Data::combineImagesCalibFromDrive(): Could not read image sections.", "error");
+            return false;
+        }
+        combineStack(stackData, stackMask, rescaleFactors, combined + ymin*n, numPixels, n, nlow, nhigh, progressStepSize / numBlocks, estimator);
+    }
 
-        // stackedPixel = combineFunction_ptr(stack, QVector<bool>(), ngood);
+    return true;
+}
 
-        // Increment the progressBar every 10 %
-        if (i+1 == progCount * progCountComparison) {
+// Combines a stack of 'dim' pixels, row-tile by row-tile in parallel, with the given estimator.
+// stackData and stackMask hold one pointer per input image (mask pointers may be null);
+// 'combined' receives the result. The progress counter is incremented by 'progressStepSize' in total.
+void Data::combineStack(const QVector<const float*> &stackData, const QVector<const BitMask*> &stackMask,
+                        const QVector<float> &rescaleFactors, float *combined, const long dim, const long n,
+                        const int nlow, const int nhigh, const float progressStepSize,
+                        const CombineEstimator::Type estimator)
+{
+    // The loop below must not touch any Qt container: the non-const operator[] of the implicitly shared
+    // QVector / QList may detach, which is what made earlier parallel versions of this loop crash.
+    const float *const *inputData = stackData.constData();
+    const BitMask *const *inputMask = stackMask.constData();
+    const float *factors = rescaleFactors.constData();
+    const long ngood = stackData.length();
+
+    // Tiles of at least 64k pixels (or one row), such that the input rows of a tile stay in cache while being combined
+    const long tileRows = std::max(1L, 65536L / n);
+    const long numTiles = (dim / n + tileRows - 1) / tileRows;
+    const float tileProgressStepSize = progressStepSize / float(numTiles);
+
+    // The chip loop in the controller runs maxExternalThreads in parallel. The remaining cores are used here.
+    // For single-chip cameras this means all maxCPU cores.
+    int localMaxThreads = maxCPU / std::max(1, maxExternalThreads);
+    if (localMaxThreads < 1) localMaxThreads = 1;
+
+#pragma omp parallel num_threads(localMaxThreads)
+    {
+        // Thread-local work buffer, allocated once per thread
+        QVector<float> workBuffer(CombineEstimator::workSize(ngood));
+        float *work = workBuffer.data();
+
+#pragma omp for schedule(dynamic)
+        for (long tile=0; tile<numTiles; ++tile) {
+            const long iStart = tile * tileRows * n;
+            const long iEnd = std::min(dim, iStart + tileRows * n);
+            CombineEstimator::combineTile(estimator, ngood, inputData, inputMask, factors, combined, iStart, iEnd, nlow, nhigh, work);
 #pragma omp atomic
-            *progress += localProgressStepSize;
-            //                emit addToProgressBar(localProgressStepSize);
-            ++progCount;
+            *progress += tileProgressStepSize;
         }
     }
-
-    combinedImage[chip]->imageInMemory = true;
-    successProcessing = true;
-    combinedImage[chip]->emitModelUpdateNeeded();
 }
 
 void Data::resetStaticModel()
@@ -721,9 +816,85 @@ void Data::resetStaticModel()
     for (auto &it : staticModelDone) it = false;
 }
 
+// One incrementally updated stack per chip and per pass (the object masks differ between the passes).
+// The stacks are large; they are created by combineImagesIncremental() and released once the chip is done.
+void Data::resetDynamicModel()
+{
+    releaseDynamicModel();
+    dynamicModelStacks.resize(2);
+    for (auto &pass : dynamicModelStacks) {
+        pass.fill(nullptr, instData->numChips);
+    }
+}
+
+void Data::releaseDynamicModel()
+{
+    for (auto &pass : dynamicModelStacks) {
+        for (auto &it : pass) {
+            delete it;
+            it = nullptr;
+        }
+    }
+    dynamicModelStacks.clear();
+}
+
+void Data::releaseDynamicModel(const int chip)
+{
+    for (auto &pass : dynamicModelStacks) {
+        if (chip >= pass.length()) continue;
+        delete pass[chip];
+        pass[chip] = nullptr;
+    }
+}
+
+// Dynamic background model: Deletes the images that left the window from the per-pixel sorted stacks, and inserts
+// those that entered it. Object masks and nlow / nhigh rejection are honored as in the full combination.
+// Returns false if the stack cannot be updated incrementally; the caller then does the full combination.
+bool Data::combineImagesIncremental(const int chip, const QVector<long> &goodIndex, const int nlow, const int nhigh, const int pass)
+{
+    if (pass < 1 || pass > dynamicModelStacks.length()) return false;
+    if (chip >= dynamicModelStacks.at(pass-1).length()) return false;
+    SlidingWindowStack *&stack = dynamicModelStacks[pass-1][chip];
+    if (stack == nullptr) stack = new SlidingWindowStack();
+
+    const long dim = combinedImage.at(chip)->dataCurrent.length();
+
+    // The rescale factors (meanMode / skyValue) depend on all images in the window. Their common part (meanMode)
+    // does not change the sort order, hence the stacks keep the images scaled by 1/skyValue, only,
+    // and the median is multiplied by the meanMode of the current window.
+    QVector<SlidingWindowStack::Member> members;
+    members.reserve(goodIndex.length());
+    float meanMode = 0.;
+    for (auto &gi : goodIndex) {
+        const MyImage *img = myImageList.at(chip).at(gi);
+        if (img->dataBackupL1.length() < dim) return false;
+        SlidingWindowStack::Member member;
+        member.image = img;
+        member.data = img->dataBackupL1.constData();
+        // objectmask can be empty and the lookup would segfault
+        if (img->objectMaskDone && img->objectMask.length() >= dim) member.mask = &img->objectMask;
+        if (rescaleFlag) member.scale = 1. / img->skyValue;
+        members.append(member);
+        meanMode += img->skyValue;
+    }
+    float outputScale = 1.0;
+    if (rescaleFlag && !members.isEmpty()) outputScale = meanMode / members.length();
+
+    int localMaxThreads = maxCPU / std::max(1, maxExternalThreads);
+    if (localMaxThreads < 1) localMaxThreads = 1;
+
+    float *combined = combinedImage[chip]->dataCurrent.data();
+    if (!stack->update(members, dim, nlow, nhigh, outputScale, combined, localMaxThreads)) return false;
+
+    if (*verbosity > 1) emit messageAvailable(subDirName + " : Background window updated: " + QString::number(stack->numInserted)
+                                              + " image(s) added, " + QString::number(stack->numDeleted) + " removed", "data");
+    return true;
+}
+
 // Used for creating a background model
 void Data::combineImages(const int chip, const QString nlowString, const QString nhighString, const QString currentImage,
-                         const QString mode, const QString dirName, const QString subDirName, QVector<bool> &dataStaticModelDone)
+                         const QString mode, const QString dirName, const QString subDirName, QVector<bool> &dataStaticModelDone,
+                         const int pass)
 {
     if (!successProcessing) return;
     if (userStop || userKill) return;
@@ -816,58 +987,36 @@ void Data::combineImages(const int chip, const QString nlowString, const QString
         nhigh = 0;
     }
 
-    //    int localMaxThreads = maxCPU/instData->numChips;
-    //    if (instData->numChips > maxCPU) localMaxThreads = 1;
-
-    if (instData->numChips > 1) {
-        QList<float> stack;
-        // Not thread safe
-        //    long ngood = goodIndex.length();
-        //    stack.reserve(ngood);
-        // #pragma omp parallel for num_threads(localMaxThreads)
-        for (long i=0; i<dim; ++i) {
-            // not thread safe
-            //        QVector<float> stack;
-            //        stack.reserve(ngood);
-            long k = 0;
-            for (auto &gi : goodIndex) {
-                if (myImageList[chip][gi]->objectMaskDone) {         // needed because objectmask can be empty and the lookup will segfault
-                    if (!myImageList[chip][gi]->objectMask[i]) {
-                        stack.append(myImageList.at(chip).at(gi)->dataBackupL1.at(i) * rescaleFactors[k]);
-                    }
-                }
-                else {
-                    stack.append(myImageList.at(chip).at(gi)->dataBackupL1.at(i) * rescaleFactors[k]);
-                }
-                ++k;
-            }
-            combinedImage[chip]->dataCurrent[i] = straightMedian_MinMax(stack, nlow, nhigh);
-            stack.clear();
+    // Dynamic mode: neighbouring exposures share most of their background images.
+    // The per-pixel stacks are updated incrementally instead of being rebuilt.
+    if (mode == "dynamic" && pass > 0) {
+        if (combineImagesIncremental(chip, goodIndex, nlow, nhigh, pass)) {
+            combinedImage[chip]->imageInMemory = true;
+            successProcessing = true;
+            return;
         }
     }
 
-    // Single chip: we can use inner parallelization!
-    // UPDATE: identical to the section above, just 'stack' is declared inside the for loop and not outside
-    else {
-        // NOPE! we cannot, still crashing sometimes
-        // #pragma omp parallel for num_threads(localMaxThreads) firstprivate(rescaleFactors)
-        for (long i=0; i<dim; ++i) {
-            QList<float> stack;
-            long k = 0;
-            for (auto &gi : goodIndex) {
-                if (myImageList[chip][gi]->objectMaskDone) {         // needed because objectmask can be empty and the lookup will segfault
-                    if (!myImageList[chip][gi]->objectMask[i]) {
-                        stack.append(myImageList.at(chip).at(gi)->dataBackupL1.at(i) * rescaleFactors[k]);
-                    }
-                }
-                else {
-                    stack.append(myImageList.at(chip).at(gi)->dataBackupL1.at(i) * rescaleFactors[k]);
-                }
-                ++k;
-            }
-            combinedImage[chip]->dataCurrent[i] = straightMedian_MinMax(stack, nlow, nhigh);
+    // Collect raw pointers to the stack; the combination itself must not touch Qt containers (see combineStack())
+    QVector<const float*> stackData;
+    QVector<const BitMask*> stackMask;
+    stackData.reserve(ngood);
+    stackMask.reserve(ngood);
+    for (auto &gi : goodIndex) {
+        MyImage *img = myImageList.at(chip).at(gi);
+        if (img->dataBackupL1.length() < dim) {
+            emit messageAvailable(subDirName + " : Data::combineImages(): " + img->chipName + " : Inconsistent image geometry.", "error");
+            emit critical();
+            successProcessing = false;
+            return;
         }
+        stackData.append(img->dataBackupL1.constData());
+        // objectmask can be empty and the lookup would segfault
+        if (img->objectMaskDone && img->objectMask.length() >= dim) stackMask.append(&img->objectMask);
+        else stackMask.append(nullptr);
     }
+    combineStack(stackData, stackMask, rescaleFactors, combinedImage[chip]->dataCurrent.data(), dim, n, nlow, nhigh, 0.);
+
     if (mode == "static") dataStaticModelDone[chip] = true;
 
     combinedImage[chip]->imageInMemory = true;
@@ -1916,6 +2065,8 @@ void Data::resetProcessbackground()
 
 void Data::cleanBackgroundModelStatus()
 {
+    releaseDynamicModel();
+
     for (int chip=0; chip<instData->numChips; ++chip) {
         for (auto &it : myImageList[chip]) {
             it->resetObjectMasking();
@@ -2749,7 +2900,8 @@ float Data::memoryCurrentFootprint(bool globalweights)
                     footprint += it->dataBackupL2.capacity() * sizeof(float);
                     footprint += it->dataBackupL3.capacity() * sizeof(float);
                     footprint += it->dataMeasure.capacity() * sizeof(float);
-                    footprint += it->objectMask.capacity() * sizeof(bool);
+                    footprint += it->objectMask.memoryFootprint();
+                    footprint += it->objectCatalog.memoryFootprint();
                     footprint += it->dataWeight.capacity() * sizeof(float);
                     footprint += it->dataWeightSmooth.capacity() * sizeof(float);
                     footprint += it->dataBackground.capacity() * sizeof(float);
@@ -33,6 +33,8 @@ If not, see https://www.gnu.org/licenses/ .
 #include "../myimage/myimage.h"
 #include "../instrumentdata.h"
 #include "../processingStatus/processingStatus.h"
+#include "../tools/combineestimator.h"
+#include "../tools/slidingwindowstack.h"
 
 #include <omp.h>
 
@@ -113,6 +115,7 @@ public:
     bool dataInitialized = false;
     bool isTaskRepeated = false;
     QVector<bool> staticModelDone;
+    QVector<QVector<SlidingWindowStack*>> dynamicModelStacks;   // [pass][chip]; incrementally updated stacks for dynamic background models, allocated while a chip is processed
 
     bool currentlyDebayering = false;
 
@@ -149,9 +152,9 @@ public:
 
     // Processing functions
     void combineImagesCalib(int chip, float (*combineFunction_ptr) (const QVector<float> &, const QVector<bool> &, long), const QString nlow, const QString nhigh,
-                            const QString dirName, const QString subDirName, const QString dataType);
+                            const QString dirName, const QString subDirName, const QString dataType, const MyImage *biasImage = nullptr);
     void combineImages(const int chip, const QString nlowString, const QString nhighString, const QString currentImage, const QString mode,
-                       const QString dirName, const QString subDirName, QVector<bool> &dataStaticModelDone);
+                       const QString dirName, const QString subDirName, QVector<bool> &dataStaticModelDone, const int pass = 0);
 //    void combineImages_newParallel(int chip, MyImage *masterCombined, QList<MyImage *> &backgroundList, QString nlow, QString nhigh, QString currentImage, QString mode, const QString subDirName);
     void deleteMyImageList();
 //    void forceStatus(int chip, QString status);
@@ -172,6 +175,7 @@ public:
     //   bool flatoffFlag = false;
     //   bool flatFlag = false;
     bool rescaleFlag = false;    // Whether the images in this group have to be rescaled to the same mode when combining them  (FLAT: yes, BIAS: no)
+    bool streamCombine = false;  // Whether calibrators are combined from drive block by block instead of from memory (large stacks)
 
     // Memory functions
 //    float memoryCurrentFootprint(bool globalweights = false);
@@ -220,6 +224,9 @@ public:
     bool hasMatchingPartnerFiles(QString testDirName, QString suffix);
     bool checkTaskRepeatStatus(QString taskBasename);
     void resetStaticModel();
+    void resetDynamicModel();
+    void releaseDynamicModel();
+    void releaseDynamicModel(const int chip);
     void writeBackgroundModel(const int &chip, const QString &mode, const QString &basename, bool &staticImageWritten);
 //    void getModeCombineImagesBackground(int chip, MyImage *image);
 //    void writeBackgroundModel_newParallel(int chip, MyImage *combinedBackgroundImage, QString mode, QString basename,
@@ -261,6 +268,15 @@ private:
     void releaseMemoryIndividual(const QStringList &datalist, float &RAMfreed, const float RAMneededThisThread);
     void removeCurrentFITSfiles();
     void releaseMemoryDebayer(float &RAMfreed, const float RAMneededThisThread);
+    bool combineImagesCalibFromDrive(const int chip, const QVector<long> &goodIndex, const QVector<float> &rescaleFactors,
+                                     const MyImage *biasImage, float *combined, const long n, const long m,
+                                     const int nlow, const int nhigh, const float progressStepSize,
+                                     const CombineEstimator::Type estimator);
+    bool combineImagesIncremental(const int chip, const QVector<long> &goodIndex, const int nlow, const int nhigh, const int pass);
+    void combineStack(const QVector<const float*> &stackData, const QVector<const BitMask*> &stackMask,
+                      const QVector<float> &rescaleFactors, float *combined, const long dim, const long n,
+                      const int nlow, const int nhigh, const float progressStepSize,
+                      const CombineEstimator::Type estimator = CombineEstimator::Median);
 
 private slots:
 
@@ -75,6 +75,7 @@ void Controller::pushConfigHDUreformat()
     config += "Point crosstalk amplitude = "+ cdw->ui->normalxtalkAmplitudeLineEdit->text() + "<br>";
     config += "Row crosstalk correction = "+ boolToString(cdw->ui->rowxtalkCheckBox->isChecked()) + "<br>";
     config += "Row crosstalk amplitude = "+ cdw->ui->rowxtalkAmplitudeLineEdit->text() + "<br>";
+    config += "FITS compression = "+ cdw->ui->fitsCompressionComboBox->currentText() + "<br>";
     emit messageAvailable(config, "config");
 }
 
@@ -82,6 +83,7 @@ void Controller::pushConfigProcessbias()
 {
     QString config;
     config = "<tt>";
+    config += "Combination method = " + cdw->ui->biasMethodComboBox->currentText() + "<br>";
     config += "Number of low rejected pixels / stack = " + cdw->ui->biasNlowLineEdit->text() + "<br>";
     config += "Number of high rejected pixels / stack = " + cdw->ui->biasNhighLineEdit->text() + "<br>";
     config += "Min mode allowed [e-] = " + cdw->ui->biasMinLineEdit->text() + "<br>";
@@ -93,6 +95,7 @@ void Controller::pushConfigProcessdark()
 {
     QString config;
     config = "<tt>";
+    config += "Combination method = " + cdw->ui->darkMethodComboBox->currentText() + "<br>";
     config += "Number of low rejected pixels / stack = " + cdw->ui->darkNlowLineEdit->text() + "<br>";
     config += "Number of high rejected pixels / stack = " + cdw->ui->darkNhighLineEdit->text() + "<br>";
     config += "Min mode allowed [e-] = " + cdw->ui->darkMinLineEdit->text() + "<br>";
@@ -108,6 +111,7 @@ void Controller::pushConfigProcessflat()
     if (!cdw->ui->flatMinLineEdit->text().isEmpty()) note1 = " (NOTE: before DARK / FLATOFF subtraction!)";
     if (!cdw->ui->flatMaxLineEdit->text().isEmpty()) note2 = " (NOTE: before DARK / FLATOFF subtraction!)";
     config = "<tt>";
+    config += "Combination method = " + cdw->ui->flatMethodComboBox->currentText() + "<br>";
     config += "Number of low rejected pixels / stack = " + cdw->ui->flatNlowLineEdit->text() + "<br>";
     config += "Number of high rejected pixels / stack = " + cdw->ui->flatNhighLineEdit->text() + "<br>";
     config += "Min mode allowed [e-] = " + cdw->ui->flatMinLineEdit->text() + note1 + "<br>";
@@ -119,6 +123,7 @@ void Controller::pushConfigProcessflatoff()
 {
     QString config;
     config = "<tt>";
+    config += "Combination method = " + cdw->ui->flatoffMethodComboBox->currentText() + "<br>";
     config += "Number of low rejected pixels / stack = " + cdw->ui->flatoffNlowLineEdit->text() + "<br>";
     config += "Number of high rejected pixels / stack = " + cdw->ui->flatoffNhighLineEdit->text() + "<br>";
     config += "Min mode allowed [e-] = " + cdw->ui->flatoffMinLineEdit->text() + "<br>";
@@ -221,6 +226,7 @@ void Controller::pushConfigCreatesourcecat()
     config += "DEBLEND = " + cdw->ui->CSCmincontLineEdit->text() + "<br>";
     config += "Minimum FWHM [pixel] = " + cdw->ui->CSCFWHMLineEdit->text() + "<br>";
     config += "Convolve detections = " + boolToString(cdw->ui->CSCconvolutionCheckBox->isChecked()) + "<br>";
+    config += "Convolution mask = " + cdw->ui->CSCfilterComboBox->currentText() + "<br>";
     config += "Max FLAG = " + cdw->ui->CSCmaxflagLineEdit->text() + "<br>";
     config += "Saturation [e-] = " + cdw->ui->CSCsaturationLineEdit->text() + "<br>";
     config += "Background level [e-] = " + cdw->ui->CSCbackgroundLineEdit->text() + "<br>";
@@ -335,6 +341,8 @@ void Controller::pushConfigCoadd()
     config += "Sky projection  = " + cdw->ui->COAprojectionComboBox->currentText() + "<br>";
     config += "Celestial type  = " + cdw->ui->COAcelestialtypeComboBox->currentText() + "<br>";
     config += "Rescale weights = " + boolToString(cdw->ui->COArescaleweightsCheckBox->isChecked()) + "<br>";
+    config += "Internal resamp = " + boolToString(cdw->ui->COAresampleInternalCheckBox->isChecked()) + "<br>";
+    config += "Incremental     = " + boolToString(cdw->ui->COAincrementalCheckBox->isChecked()) + "<br>";
     config += "Outlier thresh  = " + cdw->ui->COAoutthreshLineEdit->text() + "<br>";
     config += "Outlier numpix  = " + cdw->ui->COAoutsizeLineEdit->text() + "<br>";
     config += "Outlier border  = " + cdw->ui->COAoutborderLineEdit->text() + "<br>";
@@ -65,7 +65,7 @@ void Mask::initMasks()
     long m_ref = instData->sizey[0];
     QFile file(globalMaskName);
     if (file.exists()) {
-        addRegionFilesToMask(n_ref, m_ref, globalMaskName, globalMask[0], isChipMasked[0]);
+        addRegionFilesToMask(n_ref, m_ref, globalMaskName, globalMask[0], isChipMasked[0], omp_get_max_threads());
         for (int chip=1; chip<instData->numChips; ++chip) {
             long n = instData->sizex[chip];
             long m = instData->sizey[chip];
@@ -80,7 +80,7 @@ void Mask::initMasks()
 
     // Individual mask (addRegionFiles exists immediately if file does not exist)
 #pragma omp parallel for
-  // NOT parallelized internally (polygon::addPolygon_bool()
+  // Chips in parallel, hence the region files are rasterised single-threaded
     for (int chip=0; chip<instData->numChips; ++chip) {
         QString individualMaskName = baseName+"_"+QString::number(chip+1)+".reg";
         long n = instData->sizex[chip];
@@ -92,9 +92,7 @@ void Mask::initMasks()
 void Mask::invert()
 {
     for (int chip=0; chip<instData->numChips; ++chip) {
-        for (auto &it : globalMask[chip]) {
-            it = !it;
-        }
+        globalMask[chip].invert();
     }
 }
 
@@ -136,10 +134,10 @@ void Mask::addImage(int chip, QVector<float> segmentationMap, bool invert)
     // segmentation map (zero for good p Directory not found in Data classixels, i.e. "no object")
     for (long i=0; i<n*m; ++i) {
         if (!invert) {
-            if (segmentationMap[i] != 0.) globalMask[chip][i] = true;
+            if (segmentationMap[i] != 0.) globalMask[chip].setBit(i);
         }
         else {
-            if (segmentationMap[i] == 0.) globalMask[chip][i] = true;
+            if (segmentationMap[i] == 0.) globalMask[chip].setBit(i);
         }
     }
 }
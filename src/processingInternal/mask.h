@@ -21,10 +21,11 @@ If not, see https://www.gnu.org/licenses/ .
 #define MASK_H
 
 #include "../instrumentdata.h"
+#include "../tools/bitmask.h"
 
 #include <QObject>
 
-// This class is used to create boolean masks for images (one mask per detector).
+// This class is used to create bit-packed masks for images (one mask per detector).
 // Value == false: good pixel (unmasked)
 // Value == true: bad pixel (masked)
 
@@ -34,7 +35,7 @@ class Mask : public QObject
 public:
     explicit Mask(const instrumentDataType *instrumentData, QObject *parent = nullptr);
 
-    QVector< QVector<bool> > globalMask;
+    QVector<BitMask> globalMask;
     QVector<bool> isChipMasked;
     void addImage(int chip, QVector<float> segmentationMap, bool invert);
     void invert();
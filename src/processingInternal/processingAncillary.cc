@@ -168,7 +168,7 @@ void Controller::taskInternalGetCatalogFromIMAGE()
     fi.setFile(image);
     QString imagePath = fi.absolutePath();
     QString imageName = fi.fileName();
-    QVector<bool> dummyMask;
+    BitMask dummyMask;
     dummyMask.clear();
     MyImage *detectionImage = new MyImage(imagePath, imageName, "", 1, dummyMask, &verbosity);
     detectionImage->setupCoaddMode();    // Read image, add a dummy global mask, and add a weight map if any
@@ -183,10 +183,11 @@ void Controller::taskInternalGetCatalogFromIMAGE()
     query->mainDirName = mainDirName;
     query->scienceData = scienceData;
     query->fromImage = true;
-    for (auto &object : detectionImage->objectList) {
-        query->ra_out.append(object->ALPHA_J2000);
-        query->de_out.append(object->DELTA_J2000);
-        query->mag1_out.append(object->MAG_AUTO);
+    const DetectionCatalog &cat = detectionImage->objectCatalog;
+    for (long i=0; i<cat.length(); ++i) {
+        query->ra_out.append(cat.ALPHA_J2000.at(i));
+        query->de_out.append(cat.DELTA_J2000.at(i));
+        query->mag1_out.append(cat.MAG_AUTO.at(i));
     }
     query->writeAstromScamp();
     query->writeAstromANET();
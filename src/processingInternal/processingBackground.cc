@@ -75,6 +75,7 @@ void Controller::taskInternalBackground()
     if (window.isEmpty() || window.toInt() == 0) {
         mode = "static";
     }
+    if (mode == "dynamic") skyData->resetDynamicModel();
 
     // Flag images with bright stars, leave if definitely too few images left
     QList<QVector<double>> brightStarList;
@@ -91,6 +92,11 @@ void Controller::taskInternalBackground()
     if (window.isEmpty() || window == "0") windowsize = scienceData->myImageList[0].length();
     else windowsize = window.toInt();
     float nimg = 7 + windowsize;  // image, combined image, new image, background, measure, segment, mask + window data; modify for SKY images?
+    // The sliding-window stacks of the dynamic model (one per pass) for each chip in flight
+    if (mode == "dynamic") {
+        int numPasses = cdw->ui->BAC2passCheckBox->isChecked() ? 2 : 1;
+        nimg += numPasses * SlidingWindowStack::bytesPerPixel(windowsize) / sizeof(float);
+    }
     releaseMemory(nimg*instData->storage*maxExternalThreads, 1);
     // Protect the rest, will be unprotected as needed
     scienceData->protectMemory();
@@ -119,6 +125,7 @@ void Controller::taskInternalBackground()
     // ****************************************
     processBackground(scienceData, skyData, nimg, numBackExpList, dt, dmin, expFactor, nlow1, nhigh1,
                       nlow2, nhigh2, twoPass, convolution, rescaleModel, nGroups, nLength, mode, staticImagesWritten);
+    skyData->releaseDynamicModel();
 
     // ****************************************
     // NEW PARALLELIZATION SCHEME (good if numCPU > numChips);    still not thread-safe
@@ -198,7 +205,7 @@ void Controller::processBackground(Data *scienceData, Data *skyData, const float
             // PASS 1:
             sendBackgroundMessage(mode, dataStaticModelDone[chip], it->chipName, 1);
             maskObjectsInSkyImagesPass1(chip, skyData, scienceData, twoPass, dt, dmin, convolution, expFactor);
-            skyData->combineImages(chip, nlow1, nhigh1, it->chipName, mode, dataDirName, dataSubDirName, dataStaticModelDone);
+            skyData->combineImages(chip, nlow1, nhigh1, it->chipName, mode, dataDirName, dataSubDirName, dataStaticModelDone, 1);
             skyData->combinedImage[chip]->modeDetermined = false;   // must redetermine!
             skyData->getModeCombineImages(chip);
 
@@ -207,7 +214,7 @@ void Controller::processBackground(Data *scienceData, Data *skyData, const float
                 sendBackgroundMessage(mode, dataStaticModelDone[chip], it->chipName, 2);
                 maskObjectsInSkyImagesPass2(chip, skyData, scienceData, twoPass, dt, dmin, convolution, expFactor, rescaleModel);
                 if (mode == "static" && !pass2staticDone) dataStaticModelDone[chip] = false;    // must recalculate static model (dynamic model will always be recalculated)
-                skyData->combineImages(chip, nlow2, nhigh2, it->chipName, mode, dataDirName, dataSubDirName, dataStaticModelDone);
+                skyData->combineImages(chip, nlow2, nhigh2, it->chipName, mode, dataDirName, dataSubDirName, dataStaticModelDone, 2);
                 pass2staticDone = true;
                 skyData->combinedImage[chip]->modeDetermined = false;   // must redetermine!
                 skyData->getModeCombineImages(chip);
@@ -220,7 +227,7 @@ void Controller::processBackground(Data *scienceData, Data *skyData, const float
             updateImageAndData(it, scienceData);
 
             if (alwaysStoreData) {
-                it->writeImage();
+                it->writeImageQueued(writeQueue);
                 // DO NOT UNPROTECT MEMORY HERE (could be needed elsewhere)
             }
 
@@ -237,6 +244,8 @@ void Controller::processBackground(Data *scienceData, Data *skyData, const float
         {
             numBackExpList[chip] = backExpList;
         }
+        if (mode == "dynamic") skyData->releaseDynamicModel(chip);
+
         // L1 always contains the data before any modification, hence we do not need to create a backup copy.
         if (scienceData->successProcessing) {
             for (auto &it : scienceData->myImageList[chip]) {
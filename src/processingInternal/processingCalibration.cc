@@ -61,6 +61,7 @@ void Controller::taskInternalProcessbias()
 
     // Release as much memory as maximally necessary
     float nimg = biasData->myImageList[0].length() + 1;  // The number of images one thread keeps in memory
+    decideStreamCombine(biasData, nimg);
     releaseMemory(nimg*instData->storage*maxExternalThreads, 1, "calibrator");
     // Protect the rest, will be unprotected as needed
     biasData->protectMemory();
@@ -78,6 +79,7 @@ void Controller::taskInternalProcessbias()
     for (int chip=0; chip<instData->numChips; ++chip) {
         if (abortProcess || !successProcessing || instData->badChips.contains(chip)) continue;
         float nimg = biasData->myImageList[chip].length() + 1;  // The number of images we must keep in memory
+        if (biasData->streamCombine) nimg = 3;
         // Release memory cannot touch any dataCurrent read by MyImage::readImage, because we 'protected' it outside the loop.
         // Initially, this call might not do anything because everything is protected. On systems with less RAM than
         // a single exposure this might cause swapping. We test for this elsewhere (when loading images).
@@ -89,6 +91,7 @@ void Controller::taskInternalProcessbias()
             it->setupCalibDataInMemory(false, true, false);   // Read image (if not already in memory), do not create backup, do get mode
             it->checkCorrectMaskSize(instData);
             it->setModeFlag(min, max);                        // Flag the image if its mode is outside a user-provided acceptable range
+            if (biasData->streamCombine) it->freeData();          // Pixels are read again block by block when combining
 #pragma omp atomic
             progress += progressHalfStepSize;
         }
@@ -149,6 +152,7 @@ void Controller::taskInternalProcessdark()
 
     // Release as much memory as maximally necessary
     float nimg = darkData->myImageList[0].length() + 1;  // The number of images one thread keeps in memory
+    decideStreamCombine(darkData, nimg);
     releaseMemory(nimg*instData->storage*maxExternalThreads, 1, "calibrator");
     // Protect the rest, will be unprotected as needed
     darkData->protectMemory();
@@ -164,6 +168,7 @@ void Controller::taskInternalProcessdark()
         if (abortProcess || !successProcessing || instData->badChips.contains(chip)) continue;
 
         float nimg = darkData->myImageList[chip].length() + 1;  // The number of images we must keep in memory
+        if (darkData->streamCombine) nimg = 3;
         releaseMemory(nimg*instData->storage, maxExternalThreads, "calibrator");
 
         for (auto &it : darkData->myImageList[chip]) {
@@ -172,6 +177,7 @@ void Controller::taskInternalProcessdark()
             it->setupCalibDataInMemory(false, true, false);
             it->checkCorrectMaskSize(instData);
             it->setModeFlag(min, max);
+            if (darkData->streamCombine) it->freeData();          // Pixels are read again block by block when combining
 #pragma omp atomic
             progress += progressHalfStepSize;
         }
@@ -225,6 +231,7 @@ void Controller::taskInternalProcessflatoff()
 
     // Release as much memory as maximally necessary
     float nimg = flatoffData->myImageList[0].length() + 1;  // The number of images one thread keeps in memory
+    decideStreamCombine(flatoffData, nimg);
     releaseMemory(nimg*instData->storage*maxExternalThreads, 1, "calibrator");
     // Protect the rest, will be unprotected as needed
     flatoffData->protectMemory();
@@ -240,6 +247,7 @@ void Controller::taskInternalProcessflatoff()
         if (abortProcess || !successProcessing || instData->badChips.contains(chip)) continue;
 
         float nimg = flatoffData->myImageList[chip].length() + 1;  // The number of images we must keep in memory
+        if (flatoffData->streamCombine) nimg = 3;
         releaseMemory(nimg*instData->storage, maxExternalThreads, "calibrator");
 
         for (auto &it : flatoffData->myImageList[chip]) {
@@ -248,6 +256,7 @@ void Controller::taskInternalProcessflatoff()
             it->setupCalibDataInMemory(false, true, false);
             it->checkCorrectMaskSize(instData);
             it->setModeFlag(min, max);
+            if (flatoffData->streamCombine) it->freeData();          // Pixels are read again block by block when combining
 #pragma omp atomic
             progress += progressHalfStepSize;
         }
@@ -345,6 +354,7 @@ void Controller::taskInternalProcessflat()
 
     // Release as much memory as maximally necessary
     float nimg = flatData->myImageList[0].length() + 2;  // The number of images one thread keeps in memory
+    decideStreamCombine(flatData, nimg);
     releaseMemory(nimg*instData->storage*maxExternalThreads, 1, "calibrator");
     // Protect the rest, will be unprotected as needed
     flatData->protectMemory();
@@ -364,6 +374,7 @@ void Controller::taskInternalProcessflat()
         if (abortProcess || !successProcessing || instData->badChips.contains(chip)) continue;
 
         float nimg = flatData->myImageList[chip].length() + 2;  // The number of images we must keep in memory
+        if (flatData->streamCombine) nimg = 3;
         releaseMemory(nimg*instData->storage, maxExternalThreads, "calibrator");
 
         QString message = "";
@@ -377,24 +388,28 @@ void Controller::taskInternalProcessflat()
             if (!it->successProcessing) continue;
             if (verbosity >= 0 && !message.isEmpty()) emit messageAvailable(it->chipName + " : Correcting with "+message+"_"+QString::number(chip+1)+".fits", "image");
             // careful with the booleans, they make sure the data is correctly reread from disk or memory if task is repeated
-            it->setupCalibDataInMemory(true, true, true);    // read from backupL1, if not then from disk. Makes backup copy if not yet done
+            it->setupCalibDataInMemory(!flatData->streamCombine, true, true);    // read from backupL1, if not then from disk. Makes backup copy if not yet done
             it->checkCorrectMaskSize(instData);
             it->setModeFlag(min, max);                       // Must set mode flags before subtracting dark component (flatoffs can have really high levels in NIR data)
             if (biasData != nullptr && biasData->successProcessing) { // cannot pass nullptr to subtractBias()
 //                it->subtractBias(ref, biasDataType);
-                it->subtractBias(biasData->combinedImage[chip], biasDataType);
+                // When combining from drive, the bias is subtracted block by block
+                if (!flatData->streamCombine) it->subtractBias(biasData->combinedImage[chip], biasDataType);
 //                  it->subtractBias(biasData->combinedImage[chip]->dataCurrent, biasDataType);
                 it->skyValue -= biasData->combinedImage[chip]->skyValue;
                 it->saturationValue -= biasData->combinedImage[chip]->skyValue;
             }
 //            it->getMode(true);
 //            it->setModeFlag(min, max);
+            if (flatData->streamCombine) it->freeData();          // Pixels are read again block by block when combining
             if (!it->successProcessing) flatData->successProcessing = false;  // does not need to be threadsafe
 # pragma omp atomic
             progress += progressHalfStepSize;
         }
+        MyImage *streamBiasImage = nullptr;
+        if (flatData->streamCombine && biasData != nullptr && biasData->successProcessing) streamBiasImage = biasData->combinedImage[chip];
+        flatData->combineImagesCalib(chip, combineFlat_ptr, nlow, nhigh, dataDirName, dataSubDirName, dataDataType, streamBiasImage);
         if (biasData != nullptr) biasData->unprotectMemory(chip);
-        flatData->combineImagesCalib(chip, combineFlat_ptr, nlow, nhigh, dataDirName, dataSubDirName, dataDataType);
         // Remove Bayer intensity variations within a 2x2 superpixel
         if (!instData->bayer.isEmpty()) equalizeBayerFlat(flatData->combinedImage[chip]);
         flatData->getModeCombineImages(chip);
@@ -552,6 +567,8 @@ void Controller::taskInternalProcessscience()
     scienceData->bayerList.clear();
     scienceData->bayerList.resize(instData->numChips);
 
+    ImagePrefetcher prefetcher(allMyImages, prefetchLimit(scienceData->isTaskRepeated), maxThreadsIO, false, false);
+
 #pragma omp parallel for num_threads(maxCPU) firstprivate(dataDirName, biasDataType)
     for (int k=0; k<numMyImages; ++k) {
         if (abortProcess || !successProcessing) continue;
@@ -586,6 +603,7 @@ void Controller::taskInternalProcessscience()
         }
         it->processingStatus->Processscience = false;
 
+        prefetcher.claim(k);
         it->setupData(scienceData->isTaskRepeated, true, false, backupDirName);
         it->checkCorrectMaskSize(instData);
 
@@ -612,7 +630,7 @@ void Controller::taskInternalProcessscience()
             it->backupOrigHeader(chip);             // Write out the zero order solution (before everything is kept in memory). This requires a FITS file
             updateImageAndData(it, scienceData);
             if (alwaysStoreData) {
-                it->writeImage();
+                it->writeImageQueued(writeQueue);
                 it->unprotectMemory();
                 if (minimizeMemoryUsage) {
                     it->freeAll();
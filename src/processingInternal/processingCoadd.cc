@@ -22,6 +22,7 @@ If not, see https://www.gnu.org/licenses/ .
 #include "../dockwidgets/monitor.h"
 #include "../tools/tools.h"
 #include "../tools/swarpfilter.h"
+#include "../tools/resampler.h"
 #include "../tools/fitting.h"
 #include "../tools/fileprogresscounter.h"
 #include "ui_confdockwidget.h"
@@ -40,6 +41,9 @@ If not, see https://www.gnu.org/licenses/ .
 #include <QTimer>
 #include <QProgressBar>
 
+#include <cmath>
+#include <cstdio>
+
 void Controller::taskInternalCoaddition()
 {
     coaddScienceDir = instructions.split(" ").at(1);
@@ -75,6 +79,9 @@ void Controller::taskInternalCoaddition()
         return;
     }
 
+    // Decide whether only new exposures are added to an existing coadd; then coaddDirName points to a staging directory
+    coaddIncrementalInit();
+
     //    qDebug() << "taskInternalCoaddition() : " << filterArg;
 
     // TODO
@@ -264,6 +271,8 @@ void Controller::coaddPrepare(QString filterArg)
 
     // Copy the headers (might be modified), link the images and weights, if they match the filterArg
     float numexp = 0;
+    long numLinked = 0;
+    coaddNewImages.clear();
     QList<QString> filterNames;
     for (int chip=0; chip<instData->numChips; ++chip) {
         if (!chipList.contains(chip) || instData->badChips.contains(chip)) continue;        // Skip chips that should not be coadded
@@ -275,11 +284,17 @@ void Controller::coaddPrepare(QString filterArg)
             if (!edgeSmooth.isEmpty()) weight.setFileName(it->weightPath + "/" + it->weightName + "smooth.fits");
             QString headerNewName = coaddDirName+"/" + it->baseName + ".head";
             QFile header(it->path + "/headers/" + it->chipName + ".head");
+            // Incremental coaddition: exposures already contained in the coadd are not resampled again
+            const bool isNew = !coaddIncrementalImages.contains(it->baseName);
             if (filterArg == "all") {
-                image.link(coaddDirName+"/" + it->baseName + ".fits");
-                weight.link(coaddDirName+"/" + it->baseName + ".weight.fits");
-                if (!doPMupdate) header.copy(headerNewName);
-                else coaddPrepareProjectPM(header, headerNewName, refDE, mjdobsZero, it->mjdobs);
+                if (isNew) {
+                    if (!coaddPrepareLink(image, coaddDirName+"/" + it->baseName + ".fits")
+                            || !coaddPrepareLink(weight, coaddDirName+"/" + it->baseName + ".weight.fits")) return;
+                    if (!doPMupdate) header.copy(headerNewName);
+                    else coaddPrepareProjectPM(header, headerNewName, refDE, mjdobsZero, it->mjdobs);
+                    ++numLinked;
+                    coaddNewImages.append(it->baseName);
+                }
                 coaddTexptime += it->exptime;
                 coaddSkyvalue += it->skyValue / it->exptime;
                 ++numexp;
@@ -287,10 +302,14 @@ void Controller::coaddPrepare(QString filterArg)
             }
             else {
                 if (it->filter == filterArg) {
-                    image.link(coaddDirName+"/" + it->baseName + ".fits");
-                    weight.link(coaddDirName+"/" + it->baseName + ".weight.fits");
-                    if (!doPMupdate) header.copy(coaddDirName+"/" + it->baseName + ".head");
-                    else coaddPrepareProjectPM(header, headerNewName, refDE, mjdobsZero, it->mjdobs);
+                    if (isNew) {
+                        if (!coaddPrepareLink(image, coaddDirName+"/" + it->baseName + ".fits")
+                                || !coaddPrepareLink(weight, coaddDirName+"/" + it->baseName + ".weight.fits")) return;
+                        if (!doPMupdate) header.copy(coaddDirName+"/" + it->baseName + ".head");
+                        else coaddPrepareProjectPM(header, headerNewName, refDE, mjdobsZero, it->mjdobs);
+                        ++numLinked;
+                        coaddNewImages.append(it->baseName);
+                    }
                     if (!filterNames.contains(it->filter)) filterNames.append(it->filter);
                     coaddTexptime += it->exptime;
                     coaddSkyvalue += it->skyValue / it->exptime;
@@ -309,11 +328,19 @@ void Controller::coaddPrepare(QString filterArg)
     coaddFilter.truncate(coaddFilter.length()-1);
     coaddGain = coaddTexptime;
 
+    if (coaddIncremental && numLinked == 0) {
+        emit messageAvailable("Incremental coaddition: no new exposures, " + coaddParentDirName + "/coadd.fits is up to date.", "warning");
+        QDir(coaddDirName).removeRecursively();
+        coaddDirName = coaddParentDirName;
+        successProcessing = false;
+        return;
+    }
+
     // Check if Swarp will open more file handles than the system currently allows
     long maxOpenFiles = sysconf(_SC_OPEN_MAX);
-    if (2*numexp > maxOpenFiles) {
+    if (2*numLinked > maxOpenFiles) {
         successProcessing = false;
-        SwarpReadme *swarpReadme = new SwarpReadme(2*numexp, maxOpenFiles, this);
+        SwarpReadme *swarpReadme = new SwarpReadme(2*numLinked, maxOpenFiles, this);
         swarpReadme->show();
         return;
     }
@@ -358,6 +385,21 @@ void Controller::coaddPrepare(QString filterArg)
 }
 
 
+// SWarp cannot read tile-compressed images; these are uncompressed into the coadd directory instead of being linked.
+// Returns false (and stops the task) if the uncompressed copy could not be made.
+bool Controller::coaddPrepareLink(QFile &file, QString linkName)
+{
+    int status = 0;
+    if (!cdw->ui->COAresampleInternalCheckBox->isChecked()
+            && MyImage::uncompressedCopy(file.fileName(), linkName, &status)) return true;
+    if (status) {
+        printCfitsioError("coaddPrepareLink(): " + file.fileName(), status);     // also sets successProcessing = false
+        return false;
+    }
+    file.link(linkName);
+    return true;
+}
+
 void Controller::errorFoundReceived()
 {
     successProcessing = false;
@@ -375,8 +417,19 @@ void Controller::finishedPreparationReceived()
 
     if (!successProcessing) return;
 
-    // If requested, rotate coadd.head to user-specified position angle
-    coaddPrepareProjectRotation();
+    if (coaddIncremental) {
+        // The new exposures are resampled onto the grid of the existing coadd
+        QFile::remove(coaddDirName+"/coadd.head");
+        if (!QFile::copy(coaddParentDirName+"/coadd.incremental.head", coaddDirName+"/coadd.head")) {
+            emit messageAvailable("Incremental coaddition: could not copy " + coaddParentDirName + "/coadd.incremental.head", "error");
+            successProcessing = false;
+            return;
+        }
+    }
+    else {
+        // If requested, rotate coadd.head to user-specified position angle
+        coaddPrepareProjectRotation();
+    }
 
     progress = 100.;
     //   emit progressUpdate(progress);
@@ -591,10 +644,9 @@ void Controller::coaddPrepareBuildSwarpCommand(QString refRA, QString refDE)
     if (verbosity > 1) emit messageAvailable("<br>Swarp output<br>", "ignore");
 }
 
-void Controller::coaddResampleBuildSwarpCommand(QString imageList, int i)
+// The image names are inserted by the swarp workers in place of '%1'
+QString Controller::coaddResampleBuildSwarpCommand()
 {
-    if (!successProcessing) return;
-
     QString swarpCommand;   // shadowing the class member 'swarpCommand' for a moment
 
     QString pixelScale = cdw->ui->COApixscaleLineEdit->text();
@@ -606,7 +658,7 @@ void Controller::coaddResampleBuildSwarpCommand(QString imageList, int i)
     statusOld = coaddScienceData->processingStatus->statusString;
 
     QString swarp = findExecutableName("swarp");
-    swarpCommand = swarp +" @"+imageList;
+    swarpCommand = swarp +" %1";
     swarpCommand += " -NTHREADS 1";  // Launching maxCPU externally
     //    swarpCommand += " -NTHREADS " + QString::number(maxExternalThreads);
     swarpCommand += " -RESAMPLE Y";
@@ -623,10 +675,10 @@ void Controller::coaddResampleBuildSwarpCommand(QString imageList, int i)
     swarpCommand += " -RESCALE_WEIGHTS " + rescaleWeights;
     swarpCommand += " -COPY_KEYWORDS OBJECT,SKYVALUE,EXPTIME,DATE-OBS";
 
-    swarpCommands[i] = swarpCommand;
-
-    if (verbosity > 1) emit messageAvailable("Executing the following swarp command :<br><br>"+swarpCommands[i]+"<br><br>in directory: <br><br>"+coaddDirName+"<br>", "info");
+    if (verbosity > 1) emit messageAvailable("Executing the following swarp command :<br><br>"+swarpCommand.arg("&lt;images&gt;")+"<br><br>in directory: <br><br>"+coaddDirName+"<br>", "info");
     if (verbosity > 1) emit messageAvailable("<br>Swarp output<br>", "ignore");
+
+    return swarpCommand;
 }
 
 void Controller::coaddCoadditionBuildSwarpCommand(QString imageList)
@@ -681,98 +733,72 @@ void Controller::coaddResample()
     QStringList filter("*"+statusOld+".fits");
     QStringList imageList = coaddDir.entryList(filter);
 
-    // Lists containing output files and streams
-    QString listName;
-    QFile file;
-    QTextStream stream;
-    QStringList listNames;
-    int i = 0;
-    int fileCount = 0;
-    int highGroup = imageList.length() % maxCPU - 1;
-    for (auto &imageName : imageList) {
-        if (i==0) {
-            listName = coaddDirName+"/listCoadd_"+QString::number(fileCount);
-            listNames << listName;
-            file.setFileName(listName);
-            stream.setDevice(&file);
-            if (!file.open(QIODevice::WriteOnly)) {
-                QString part1 = listName;
-                QString part2 = file.errorString();
-                emit showMessageBox("Controller::CANNOT_WRITE_RESAMPLE_LIST", part1, part2);
-                successProcessing = false;
-                return;
-            }
-        }
-        stream << imageName << "\n";
-        ++i;
-        /*
-        if (i == imageList.length() / maxCPU) {
-            i = 0;
-            ++fileCount;
-            file.close();
-            file.setPermissions(QFile::ReadUser | QFile::WriteUser);
-        }
-        */
-        // Spread images as evenly as possible across the threads
-        if (fileCount <= highGroup && i == imageList.length() / maxCPU + 1) {
-            i = 0;
-            ++fileCount;
-            file.close();
-            file.setPermissions(QFile::ReadUser | QFile::WriteUser);
-        }
-        if (fileCount > highGroup && i == imageList.length() / maxCPU) {
-            i = 0;
-            ++fileCount;
-            file.close();
-            file.setPermissions(QFile::ReadUser | QFile::WriteUser);
-        }
+    if (cdw->ui->COAresampleInternalCheckBox->isChecked()) {
+        coaddResampleInternal(imageList);
+        return;
     }
 
-    if (file.isOpen()) {
-        file.close();
-        file.setPermissions(QFile::ReadUser | QFile::WriteUser);
+    // Jobs of a few images each, shared by all swarp workers, such that all of them remain busy until the end
+    resampleQueue = imageList;
+    resampleNumImages = imageList.length();
+    const int batchSize = std::max(1, resampleNumImages / (8*maxCPU));
+    const int numJobs = (resampleNumImages + batchSize - 1) / batchSize;
+    if (numJobs == 0) {
+        emit swarpStartSwarpfilter();
+        return;
     }
 
-    numberFileCounter = new FileProgressCounter(coaddDirName, "*resamp.fits", imageList.length(), &progress, this);
-    connect(numberFileCounter->timer, &QTimer::timeout, numberFileCounter, &FileProgressCounter::numberFileProgress);
-    //   connect(numberFileCounter, &FileProgressCounter::progressUpdate, mainGUI, &MainWindow::progressUpdateReceived, Qt::DirectConnection);
-    numberFileCounter->timer->start(2000);
+    QString command = coaddResampleBuildSwarpCommand();
+    if (!successProcessing) return;
 
-    // We can use at most as many threads as we have files in listname:
-    localMaxCPU = maxCPU > listNames.length() ? listNames.length() : maxCPU;
+    // We can use at most as many threads as we have jobs
+    localMaxCPU = maxCPU > numJobs ? numJobs : maxCPU;
+    threadsFinished.fill(false, maxCPU);
 
     currentSwarpProcess = "swarpResampling";
 
-#pragma omp parallel for num_threads(localMaxCPU) firstprivate(coaddDirName)
     for (int i=0; i<localMaxCPU; ++i) {
-        coaddResampleBuildSwarpCommand(listNames[i], i);
-
-        // Run the Swarp command
-#pragma omp critical
-        {
-            workerThreads[i] = new QThread();
-            swarpWorkers[i] = new SwarpWorker(swarpCommands[i], coaddDirName, currentSwarpProcess);
-            workersInit = true;
-            workerThreadsInit = true;
-            swarpWorkers[i]->threadID = i;
-            swarpWorkers[i]->moveToThread(workerThreads[i]);
-        }
+        workerThreads[i] = new QThread();
+        swarpWorkers[i] = new SwarpWorker(command, coaddDirName, currentSwarpProcess);
+        workersInit = true;
+        workerThreadsInit = true;
+        swarpWorkers[i]->threadID = i;
+        swarpWorkers[i]->imageQueue = &resampleQueue;
+        swarpWorkers[i]->queueMutex = &resampleQueueMutex;
+        swarpWorkers[i]->batchSize = batchSize;
+        swarpWorkers[i]->moveToThread(workerThreads[i]);
         connect(workerThreads[i], &QThread::started, swarpWorkers[i], &SwarpWorker::runSwarp);
         connect(workerThreads[i], &QThread::finished, workerThreads[i], &QThread::deleteLater);
         connect(swarpWorkers[i], &SwarpWorker::errorFound, this, &Controller::errorFoundReceived);
-        //        connect(workerThreads[i], &QThread::finished, workerThreads[i], &QThread::deleteLater);
+        connect(swarpWorkers[i], &SwarpWorker::finishedResamplingJob, this, &Controller::resamplingJobFinishedReceived);
         connect(swarpWorkers[i], &SwarpWorker::finishedResampling, this, &Controller::waitForResamplingThreads);
-        //       connect(swarpWorkers[i], &SwarpWorker::finished, workerThreads[i], &QThread::quit);
         connect(swarpWorkers[i], &SwarpWorker::finished, swarpWorkers[i], &QObject::deleteLater);
         connect(swarpWorkers[i], &SwarpWorker::finished, workerThreads[i], &QThread::quit);
-        //        connect(swarpWorkers[i], &SwarpWorker::finished, swarpWorkers[i], &QObject::deleteLater);
         connect(swarpWorkers[i], &SwarpWorker::messageAvailable, monitor, &Monitor::displayMessage);
 
         workerThreads[i]->start();
-        //       workerThreads[i]->wait();
     }
+}
 
-    //    emit progressUpdate(100);
+void Controller::resamplingJobFinishedReceived(int numImages)
+{
+    omp_set_lock(&genericLock);
+    progress += 100. * numImages / resampleNumImages;
+    omp_unset_lock(&genericLock);
+}
+
+void Controller::coaddResampleInternal(const QStringList &imageList)
+{
+    Resampler resampler(coaddDirName, cdw->ui->COAkernelComboBox->currentText(), "."+coaddUniqueID+"resamp.fits", maxCPU, &verbosity);
+    resampler.progress = &progress;
+    connect(&resampler, &Resampler::messageAvailable, monitor, &Monitor::displayMessage);
+    connect(&resampler, &Resampler::progressUpdate, mainGUI, &MainWindow::progressUpdateReceived);
+    resampler.runResampling(imageList);
+    if (!resampler.successProcessing) successProcessing = false;
+
+    progress = 100.;
+    // Trigger Swarpfilter
+    emit swarpStartSwarpfilter();
 }
 
 void Controller::waitForResamplingThreads(int threadID)
@@ -788,7 +814,6 @@ void Controller::waitForResamplingThreads(int threadID)
         progress = 100.;
         //        emit progressUpdate(100);
         emit swarpStartSwarpfilter();
-        numberFileCounter->timer->stop();
         // We don't have to delete the swarpWorkers because they are "movedTo" the threads
         //        for (auto &it : workerThreads) {
         //            delete it;
@@ -852,6 +877,12 @@ void Controller::coaddCoaddition()
 
     pushBeginMessage("CoaddCoadd", coaddScienceDir);
 
+    if (coaddIncremental) {
+        coaddIncrementalCombine();
+        coaddUpdate();
+        return;
+    }
+
     // List of all images
     QDir coaddDir(coaddDirName);
     QStringList filter("*"+statusOld+"*resamp.fits");
@@ -941,6 +972,10 @@ void Controller::coaddUpdate()
     // Stop "measuring" the file size of coadd.fits
     emit stopFileProgressTimer();
 
+    // Keep the state for the next incremental coaddition
+    if (cdw->ui->COAincrementalCheckBox->isChecked() && !coaddIncremental
+        && cdw->ui->COAcombinetypeComboBox->currentText() == "WEIGHTED") coaddIncrementalSaveState();
+
     progress = 0.;
     emit resetProgressBar();
 
@@ -968,7 +1003,7 @@ void Controller::coaddUpdate()
     if (instData->pixscale <= 2.0 && instData->radius <= 0.5) {
         skippedIQ = false;
         emit messageAvailable("coadd.fits : Loading image data ...", "image");
-        QVector<bool> dummyMask;
+        BitMask dummyMask;
         dummyMask.clear();
         MyImage *coadd = new MyImage(coaddDirName, "coadd.fits", "", 1, dummyMask, &verbosity);
         connect(coadd, &MyImage::critical, this, &Controller::criticalReceived);
@@ -1050,9 +1085,9 @@ void Controller::coaddUpdate()
 
         /*
        // TODO: that should be redone using the new gaia matching method
-       QVector<float> fluxRadius(coadd->objectList.length());
-       for (auto &obj : coadd->objectList) {
-           if (obj->FLAGS == 0) fluxRadius.append(obj->FLUX_RADIUS);
+       QVector<float> fluxRadius(coadd->objectCatalog.length());
+       for (long i=0; i<coadd->objectCatalog.length(); ++i) {
+           if (coadd->objectCatalog.FLAGS.at(i) == 0) fluxRadius.append(coadd->objectCatalog.FLUX_RADIUS.at(i));
        }
        float seeing_image = modeMask(fluxRadius, "classic", QVector<bool>(), false)[0];
        float seeing_world = seeing_image * instData->pixscale;
@@ -1163,3 +1198,347 @@ void Controller::foldCoaddFits()
 
     fileIn.remove();
 }
+
+// The parameters that define the coadd grid and which data enter the coadd.
+// An existing coadd can only be extended if they did not change.
+QString Controller::coaddIncrementalFingerprint()
+{
+    QStringList parameters;
+    parameters << cdw->ui->COAraLineEdit->text()
+               << cdw->ui->COAdecLineEdit->text()
+               << cdw->ui->COApixscaleLineEdit->text()
+               << cdw->ui->COAskypaLineEdit->text()
+               << cdw->ui->COAprojectionComboBox->currentText()
+               << cdw->ui->COAcelestialtypeComboBox->currentText()
+               << cdw->ui->COAsizexLineEdit->text()
+               << cdw->ui->COAsizeyLineEdit->text()
+               << cdw->ui->COApmraLineEdit->text()
+               << cdw->ui->COApmdecLineEdit->text()
+               << cdw->ui->COAkernelComboBox->currentText()
+               << cdw->ui->COAchipsLineEdit->text()
+               << cdw->ui->COAedgesmoothingLineEdit->text()
+               << (cdw->ui->COArescaleweightsCheckBox->isChecked() ? "Y" : "N")
+               << (cdw->ui->COAresampleInternalCheckBox->isChecked() ? "Y" : "N")
+               << coaddScienceData->processingStatus->statusString;
+    return parameters.join("|");
+}
+
+// Checks whether the coadd in coaddDirName can be extended with new exposures.
+// If yes, the new exposures are resampled in a staging subdirectory, and coaddIncrementalCombine() adds them.
+void Controller::coaddIncrementalInit()
+{
+    coaddIncremental = false;
+    coaddParentDirName = "";
+    coaddIncrementalImages.clear();
+    coaddNewImages.clear();
+
+    if (!cdw->ui->COAincrementalCheckBox->isChecked()) return;
+
+    if (cdw->ui->COAcombinetypeComboBox->currentText() != "WEIGHTED") {
+        emit messageAvailable("Incremental coaddition requires COMBINE_TYPE = WEIGHTED. The coadd is rebuilt from all exposures.", "warning");
+        return;
+    }
+
+    QStringList requiredFiles = {"coadd.incremental", "coadd.incremental.head", "coadd.fits", "coadd.weight.fits", "coadd.sum.fits"};
+    for (auto &it : requiredFiles) {
+        if (!QFile(coaddDirName+"/"+it).exists()) {
+            emit messageAvailable("Incremental coaddition: No previous coadd state found in " + coaddDirName + ". The coadd is built from all exposures.", "note");
+            return;
+        }
+    }
+
+    QFile stateFile(coaddDirName+"/coadd.incremental");
+    if (!stateFile.open(QIODevice::ReadOnly)) {
+        emit messageAvailable("Incremental coaddition: Could not read " + stateFile.fileName() + ". The coadd is rebuilt from all exposures.", "warning");
+        return;
+    }
+    QString parameters = "";
+    QStringList images;
+    QTextStream stream(&stateFile);
+    QString line;
+    while (stream.readLineInto(&line)) {
+        if (line.startsWith("PARAMETERS=")) parameters = line.mid(11);
+        else if (line.startsWith("IMAGE=")) images.append(line.mid(6));
+    }
+    stateFile.close();
+
+    if (parameters != coaddIncrementalFingerprint()) {
+        emit messageAvailable("Incremental coaddition: The coaddition parameters or the processing status changed. The coadd is rebuilt from all exposures.", "warning");
+        return;
+    }
+
+    coaddIncremental = true;
+    coaddIncrementalImages = images;
+    coaddParentDirName = coaddDirName;
+    coaddDirName = coaddParentDirName + "/incremental";
+    emit messageAvailable("Incremental coaddition: " + QString::number(images.length()) + " images are already contained in the coadd", "note");
+}
+
+// Keeps what is needed to add further exposures later: the coadd grid, the weighted sum of the images, and the list of exposures.
+// Called before the cleanup in coaddUpdate() removes coadd.head.
+void Controller::coaddIncrementalSaveState()
+{
+    QFile::remove(coaddDirName+"/coadd.incremental");
+    QFile::remove(coaddDirName+"/coadd.incremental.head");
+    QFile::remove(coaddDirName+"/coadd.sum.fits");
+    if (!QFile::copy(coaddDirName+"/coadd.head", coaddDirName+"/coadd.incremental.head")
+            || !QFile::copy(coaddDirName+"/coadd.fits", coaddDirName+"/coadd.sum.fits")) {
+        emit messageAvailable("Incremental coaddition: Could not store the state of the coadd in " + coaddDirName, "warning");
+        return;
+    }
+
+    // coadd.sum.fits = coadd.fits * coadd.weight.fits, processed in bands of lines
+    fitsfile *sumptr = nullptr;
+    fitsfile *wgtptr = nullptr;
+    int status = 0;
+    long naxis[2] = {0, 0};
+    fits_open_file(&sumptr, (coaddDirName+"/coadd.sum.fits").toUtf8().data(), READWRITE, &status);
+    fits_open_file(&wgtptr, (coaddDirName+"/coadd.weight.fits").toUtf8().data(), READONLY, &status);
+    fits_get_img_size(sumptr, 2, naxis, &status);
+    const long bandHeight = 256;
+    QVector<float> sum(naxis[0]*bandHeight);
+    QVector<float> weight(naxis[0]*bandHeight);
+    for (long y=0; y<naxis[1] && !status; y+=bandHeight) {
+        long nlines = bandHeight < naxis[1]-y ? bandHeight : naxis[1]-y;
+        long nelem = naxis[0]*nlines;
+        long firstelem = y*naxis[0] + 1;
+        int anynul = 0;
+        fits_read_img(sumptr, TFLOAT, firstelem, nelem, NULL, sum.data(), &anynul, &status);
+        fits_read_img(wgtptr, TFLOAT, firstelem, nelem, NULL, weight.data(), &anynul, &status);
+        float *sumData = sum.data();
+        const float *weightData = weight.data();
+#pragma omp parallel for num_threads(maxCPU)
+        for (long i=0; i<nelem; ++i) {
+            if (std::isnan(sumData[i]) || std::isnan(weightData[i])) sumData[i] = 0.;
+            else sumData[i] *= weightData[i];
+        }
+        fits_write_img(sumptr, TFLOAT, firstelem, nelem, sum.data(), &status);
+    }
+    fits_close_file(wgtptr, &status);
+    fits_close_file(sumptr, &status);
+    if (status) {
+        printCfitsioError("coaddIncrementalSaveState()", status);
+        return;
+    }
+
+    QFile stateFile(coaddDirName+"/coadd.incremental");
+    if (!stateFile.open(QIODevice::WriteOnly)) {
+        emit messageAvailable("Incremental coaddition: Could not write " + stateFile.fileName(), "warning");
+        return;
+    }
+    QTextStream stream(&stateFile);
+    stream << "PARAMETERS=" << coaddIncrementalFingerprint() << "\n";
+    for (auto &it : coaddNewImages) stream << "IMAGE=" << it << "\n";
+    stateFile.close();
+    stateFile.setPermissions(QFile::ReadUser | QFile::WriteUser);
+}
+
+// Adds the exposures resampled in the staging directory to the weighted sum and the weight of the existing coadd,
+// and updates coadd.fits where it changed. Same result as a WEIGHTED swarp coaddition of all exposures.
+// All changes are made to temporary copies, which replace the originals only once all exposures were added.
+// A failed or interrupted update leaves the previous coadd and its state untouched.
+void Controller::coaddIncrementalCombine()
+{
+    QString parentDir = coaddParentDirName;
+
+    const QStringList stateFiles = {"coadd.sum.fits", "coadd.weight.fits", "coadd.fits", "coadd.incremental"};
+    auto removeTemporaries = [&]() {
+        for (auto &it : stateFiles) QFile::remove(parentDir+"/"+it+".tmp");
+    };
+    removeTemporaries();
+    for (auto &it : stateFiles) {
+        if (!QFile::copy(parentDir+"/"+it, parentDir+"/"+it+".tmp")) {
+            emit messageAvailable("Incremental coaddition: Could not copy " + parentDir + "/" + it, "error");
+            emit criticalReceived();
+            successProcessing = false;
+            removeTemporaries();
+            coaddDirName = parentDir;
+            return;
+        }
+    }
+
+    fitsfile *sumptr = nullptr;
+    fitsfile *wgtptr = nullptr;
+    int status = 0;
+    long naxis[2] = {0, 0};
+    double coadd_crpix1 = 0.;
+    double coadd_crpix2 = 0.;
+    fits_open_file(&sumptr, (parentDir+"/coadd.sum.fits.tmp").toUtf8().data(), READWRITE, &status);
+    fits_open_file(&wgtptr, (parentDir+"/coadd.weight.fits.tmp").toUtf8().data(), READWRITE, &status);
+    fits_get_img_size(sumptr, 2, naxis, &status);
+    fits_read_key_dbl(sumptr, "CRPIX1", &coadd_crpix1, NULL, &status);
+    fits_read_key_dbl(sumptr, "CRPIX2", &coadd_crpix2, NULL, &status);
+    if (status) {
+        int closeStatus = 0;
+        if (sumptr != nullptr) fits_close_file(sumptr, &closeStatus);
+        if (wgtptr != nullptr) fits_close_file(wgtptr, &closeStatus);
+        printCfitsioError("coaddIncrementalCombine()", status);
+        removeTemporaries();
+        coaddDirName = parentDir;
+        return;
+    }
+
+    QDir coaddDir(coaddDirName);
+    QStringList imageList = coaddDir.entryList(QStringList("*"+statusOld+"*resamp.fits"));
+
+    // The section of the coadd covered by the new exposures
+    long xmin = naxis[0];
+    long xmax = -1;
+    long ymin = naxis[1];
+    long ymax = -1;
+    float progressStepSize = 90. / imageList.length();
+    for (auto &imageName : imageList) {
+        QString base = imageName;
+        base.remove("resamp.fits");
+        fitsfile *imgptr = nullptr;
+        fitsfile *resampWgtptr = nullptr;
+        long n[2] = {0, 0};
+        double crpix1 = 0.;
+        double crpix2 = 0.;
+        float flxscale = 1.0;
+        fits_open_file(&imgptr, (coaddDirName+"/"+imageName).toUtf8().data(), READONLY, &status);
+        fits_open_file(&resampWgtptr, (coaddDirName+"/"+base+"resamp.weight.fits").toUtf8().data(), READONLY, &status);
+        fits_get_img_size(imgptr, 2, n, &status);
+        fits_read_key_dbl(imgptr, "CRPIX1", &crpix1, NULL, &status);
+        fits_read_key_dbl(imgptr, "CRPIX2", &crpix2, NULL, &status);
+        // FLASCALE is not applied: the resampling already scaled the pixel values with it, and
+        // the keyword only records that (swarpfilter likewise uses FLXSCALE alone).
+        int keystatus = 0;
+        fits_read_key_flt(imgptr, "FLXSCALE", &flxscale, NULL, &keystatus);
+        if (keystatus) flxscale = 1.0;
+        if (status) {
+            fits_close_file(imgptr, &status);
+            fits_close_file(resampWgtptr, &status);
+            break;
+        }
+
+        // Offset of the resampled image in the coadd grid, clipped to the grid
+        long xoffset = lround(coadd_crpix1 - crpix1);
+        long yoffset = lround(coadd_crpix2 - crpix2);
+        long x1 = xoffset > 0 ? xoffset : 0;
+        long y1 = yoffset > 0 ? yoffset : 0;
+        long x2 = xoffset+n[0]-1 < naxis[0]-1 ? xoffset+n[0]-1 : naxis[0]-1;
+        long y2 = yoffset+n[1]-1 < naxis[1]-1 ? yoffset+n[1]-1 : naxis[1]-1;
+        if (x1 > x2 || y1 > y2) {
+            emit messageAvailable("Incremental coaddition: " + imageName + " does not overlap with the coadd and is ignored", "warning");
+            fits_close_file(imgptr, &status);
+            fits_close_file(resampWgtptr, &status);
+            continue;
+        }
+
+        QVector<float> image(n[0]*n[1]);
+        QVector<float> weight(n[0]*n[1]);
+        int anynul = 0;
+        fits_read_img(imgptr, TFLOAT, 1, n[0]*n[1], NULL, image.data(), &anynul, &status);
+        fits_read_img(resampWgtptr, TFLOAT, 1, n[0]*n[1], NULL, weight.data(), &anynul, &status);
+        fits_close_file(imgptr, &status);
+        fits_close_file(resampWgtptr, &status);
+
+        long nsub = x2-x1+1;
+        long msub = y2-y1+1;
+        long fpixel[2] = {x1+1, y1+1};
+        long lpixel[2] = {x2+1, y2+1};
+        long inc[2] = {1, 1};
+        QVector<float> coaddSum(nsub*msub);
+        QVector<float> coaddWeight(nsub*msub);
+        fits_read_subset(sumptr, TFLOAT, fpixel, lpixel, inc, NULL, coaddSum.data(), &anynul, &status);
+        fits_read_subset(wgtptr, TFLOAT, fpixel, lpixel, inc, NULL, coaddWeight.data(), &anynul, &status);
+        if (status) break;
+
+        // Same weighting as in swarp: the flux scale multiplies the data and divides the weight quadratically
+        float *sumData = coaddSum.data();
+        float *weightData = coaddWeight.data();
+        const float *imageData = image.data();
+        const float *resampWeightData = weight.data();
+        const float wscale = 1. / (flxscale*flxscale);
+#pragma omp parallel for num_threads(maxCPU)
+        for (long j=0; j<msub; ++j) {
+            long jj = j + y1 - yoffset;
+            for (long i=0; i<nsub; ++i) {
+                long ii = i + x1 - xoffset;
+                float w = resampWeightData[ii+n[0]*jj] * wscale;
+                float v = imageData[ii+n[0]*jj];
+                if (w <= 0. || std::isnan(w) || std::isnan(v)) continue;
+                sumData[i+nsub*j] += w * v * flxscale;
+                weightData[i+nsub*j] += w;
+            }
+        }
+
+        fits_write_subset(sumptr, TFLOAT, fpixel, lpixel, coaddSum.data(), &status);
+        fits_write_subset(wgtptr, TFLOAT, fpixel, lpixel, coaddWeight.data(), &status);
+        if (status) break;
+
+        if (x1 < xmin) xmin = x1;
+        if (x2 > xmax) xmax = x2;
+        if (y1 < ymin) ymin = y1;
+        if (y2 > ymax) ymax = y2;
+
+        progress += progressStepSize;
+        emit progressUpdate(progress);
+    }
+
+    // Update coadd.fits in the section that changed
+    if (!status && xmax >= xmin && ymax >= ymin) {
+        fitsfile *coaddptr = nullptr;
+        long nsub = xmax-xmin+1;
+        long msub = ymax-ymin+1;
+        long fpixel[2] = {xmin+1, ymin+1};
+        long lpixel[2] = {xmax+1, ymax+1};
+        long inc[2] = {1, 1};
+        int anynul = 0;
+        QVector<float> coaddSum(nsub*msub);
+        QVector<float> coaddWeight(nsub*msub);
+        fits_read_subset(sumptr, TFLOAT, fpixel, lpixel, inc, NULL, coaddSum.data(), &anynul, &status);
+        fits_read_subset(wgtptr, TFLOAT, fpixel, lpixel, inc, NULL, coaddWeight.data(), &anynul, &status);
+        float *sumData = coaddSum.data();
+        const float *weightData = coaddWeight.data();
+#pragma omp parallel for num_threads(maxCPU)
+        for (long k=0; k<nsub*msub; ++k) {
+            if (weightData[k] > 0.) sumData[k] /= weightData[k];
+            else sumData[k] = 0.;
+        }
+        fits_open_file(&coaddptr, (parentDir+"/coadd.fits.tmp").toUtf8().data(), READWRITE, &status);
+        fits_write_subset(coaddptr, TFLOAT, fpixel, lpixel, coaddSum.data(), &status);
+        fits_close_file(coaddptr, &status);
+    }
+
+    fits_close_file(sumptr, &status);
+    fits_close_file(wgtptr, &status);
+
+    coaddDirName = parentDir;
+
+    if (status) {
+        printCfitsioError("coaddIncrementalCombine()", status);
+        removeTemporaries();
+        return;
+    }
+
+    // Record the new exposures
+    QFile stateFile(coaddDirName+"/coadd.incremental.tmp");
+    if (!stateFile.open(QIODevice::Append)) {
+        emit messageAvailable("Incremental coaddition: Could not update " + stateFile.fileName(), "error");
+        emit criticalReceived();
+        successProcessing = false;
+        removeTemporaries();
+        return;
+    }
+    QTextStream stream(&stateFile);
+    for (auto &it : coaddNewImages) stream << "IMAGE=" << it << "\n";
+    stream.flush();
+    stateFile.close();
+
+    // Replace the originals (rename() overwrites atomically), and remove the staging directory
+    for (auto &it : stateFiles) {
+        QString target = coaddDirName+"/"+it;
+        if (std::rename((target+".tmp").toUtf8().data(), target.toUtf8().data()) != 0) {
+            emit messageAvailable("Incremental coaddition: Could not replace " + target, "error");
+            emit criticalReceived();
+            successProcessing = false;
+            removeTemporaries();
+            return;
+        }
+    }
+    QDir(coaddDirName+"/incremental").removeRecursively();
+
+    emit messageAvailable("Incremental coaddition: " + QString::number(imageList.length()) + " images added to " + coaddDirName + "/coadd.fits", "note");
+}
@@ -111,6 +111,8 @@ void Controller::taskInternalCollapse()
     if (!cdw->ui->COCyminLineEdit->text().isEmpty()) jmin = cdw->ui->COCyminLineEdit->text().toLong() - 1;
     if (!cdw->ui->COCymaxLineEdit->text().isEmpty()) jmax = cdw->ui->COCymaxLineEdit->text().toLong() - 1;
 
+    ImagePrefetcher prefetcher(allMyImages, prefetchLimit(scienceData->isTaskRepeated), maxThreadsIO, true, false);
+
 #pragma omp parallel for num_threads(maxCPU)
     for (int k=0; k<numMyImages; ++k) {
         if (abortProcess || !successProcessing) continue;
@@ -124,6 +126,7 @@ void Controller::taskInternalCollapse()
 
         if (verbosity >= 0) emit messageAvailable(it->chipName + " : Collapse correction ...", "image");
         it->processingStatus->Collapse = false;
+        prefetcher.claim(k);
         it->setupData(scienceData->isTaskRepeated, true, true, backupDirName);  // CHECK: why do we determine the mode here?
         if (!it->successProcessing) {
             abortProcess = true;
@@ -141,7 +144,7 @@ void Controller::taskInternalCollapse()
         updateImageAndData(it, scienceData);
 
         if (alwaysStoreData) {
-            it->writeImage();
+            it->writeImageQueued(writeQueue);
             it->unprotectMemory();
             if (minimizeMemoryUsage) {
                 it->freeAll();
@@ -275,7 +278,7 @@ void Controller::taskInternalBinnedpreview()
         if (!outDir.exists()) outDir.mkdir(outDirName);
         QFile out(outDirName+outName);
         if (out.exists()) out.remove();
-        MyImage *myBinnedImage = new MyImage(outDirName, outName, "", 1, QVector<bool>(), &verbosity);
+        MyImage *myBinnedImage = new MyImage(outDirName, outName, "", 1, BitMask::empty(), &verbosity);
         connect(myBinnedImage, &MyImage::critical, this, &Controller::criticalReceived);
         connect(myBinnedImage, &MyImage::messageAvailable, this, &Controller::messageAvailableReceived);
         connect(myBinnedImage, &MyImage::warning, this, &Controller::warningReceived);
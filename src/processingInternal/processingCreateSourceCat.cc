@@ -114,6 +114,15 @@ void Controller::detectionInternal(Data *scienceData, QString minFWHM, QString m
     bool convolution = cdw->ui->CSCconvolutionCheckBox->isChecked();
     QString saturation = cdw->ui->CSCsaturationLineEdit->text();
 
+    DetectionFilter detectionFilter;
+    QString filterError;
+    if (convolution && !detectionFilter.setup(cdw->ui->CSCfilterComboBox->currentText(), filterError)) {
+        emit messageAvailable(filterError, "error");
+        criticalReceived();
+        successProcessing = false;
+        return;
+    }
+
     // Create source catalogs for each exposure (keep them in memory!)
     /*
 #pragma omp parallel for num_threads(maxExternalThreads)
@@ -138,6 +147,8 @@ void Controller::detectionInternal(Data *scienceData, QString minFWHM, QString m
 
     doDataFitInRAM(numMyImages*instData->numUsedChips, instData->storage);
 
+    ImagePrefetcher prefetcher(allMyImages, prefetchLimit(false), maxThreadsIO, true, true);
+
 #pragma omp parallel for num_threads(maxCPU)
     for (int k=0; k<numMyImages; ++k) {
         if (abortProcess || !successProcessing) continue;
@@ -152,6 +163,7 @@ void Controller::detectionInternal(Data *scienceData, QString minFWHM, QString m
         releaseMemory(nimg*instData->storage, maxCPU);
 
         if (verbosity > 1 ) emit messageAvailable(it->chipName + " : Creating source catalog ...", "image");
+        prefetcher.claim(k);
         it->setupDataInMemorySimple(true);
         if (!it->successProcessing) {
             abortProcess = true;
@@ -166,6 +178,7 @@ void Controller::detectionInternal(Data *scienceData, QString minFWHM, QString m
             criticalReceived();
             successProcessing = false;
         }
+        it->detectionFilter = detectionFilter;
         it->segmentImage(DT, DMIN, convolution, false);
         it->releaseBackgroundMemory();
         it->releaseDetectionPixelMemory();
@@ -176,7 +189,7 @@ void Controller::detectionInternal(Data *scienceData, QString minFWHM, QString m
             it->freeAll();
         }
         if (it->successProcessing) {
-            long nobj = it->objectList.length();
+            long nobj = it->objectCatalog.length();
             emitSourceCountMessage(nobj, it->chipName);
             if (!cdw->ui->CSCrejectExposureLineEdit->text().isEmpty()) {
                 long nReject = cdw->ui->CSCrejectExposureLineEdit->text().toLong();
@@ -238,6 +251,8 @@ void Controller::detectionSourceExtractor(Data *scienceData, QString minFWHM, QS
     releaseMemory(nimg*instData->storage*maxCPU, 1);
     scienceData->protectMemory();
 
+    ImagePrefetcher prefetcher(allMyImages, prefetchLimit(false), maxThreadsIO, true, false);
+
 #pragma omp parallel for num_threads(maxCPU)
     for (int k=0; k<numMyImages; ++k) {
         if (abortProcess || !successProcessing) continue;
@@ -251,6 +266,7 @@ void Controller::detectionSourceExtractor(Data *scienceData, QString minFWHM, QS
         releaseMemory(nimg*instData->storage, maxCPU);
 
         if (verbosity > 1) emit messageAvailable(it->chipName + " : Creating source catalog ...", "image");
+        prefetcher.claim(k);
         it->setupDataInMemorySimple(true);
         if (!it->successProcessing) {
             abortProcess = true;
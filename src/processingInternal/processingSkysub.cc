@@ -168,7 +168,7 @@ void Controller::skysubPolynomialFit(Data *scienceData)
             updateImageAndData(it, scienceData);
 
             // Must write for SWarp!
-            it->writeImage();
+            it->writeImageQueued(writeQueue);
             it->unprotectMemory();
             if (minimizeMemoryUsage) {
                 it->freeAll();
@@ -277,7 +277,7 @@ void Controller::skysubConstantFromArea(Data *scienceData)
         updateImageAndData(it, scienceData);
 
         // Must write for SWarp!
-        it->writeImage();
+        it->writeImageQueued(writeQueue);
         if (cdw->ui->skySavemodelCheckBox->isChecked()) {
             it->writeConstSkyImage(it->meanExposureBackground);
         }
@@ -405,7 +405,7 @@ void Controller::skysubConstantReferenceChip(Data *scienceData, QString DT, QStr
         updateImageAndData(it, scienceData);
 
         // Must write for SWarp!
-        it->writeImage();
+        it->writeImageQueued(writeQueue);
         if (cdw->ui->skySavemodelCheckBox->isChecked()) {
             it->writeConstSkyImage(it->meanExposureBackground);
         }
@@ -476,6 +476,8 @@ void Controller::skysubConstantEachChip(Data *scienceData, QString DT, QString D
 
     doDataFitInRAM(numMyImages*instData->numUsedChips, instData->storage);
 
+    ImagePrefetcher prefetcher(allMyImages, prefetchLimit(scienceData->isTaskRepeated), maxThreadsIO, false, true);
+
 #pragma omp parallel for num_threads(maxCPU) firstprivate(DT, DMIN, expFactor, backupDirName)
     for (int k=0; k<numMyImages; ++k) {
         if (abortProcess || !successProcessing) continue;
@@ -489,6 +491,7 @@ void Controller::skysubConstantEachChip(Data *scienceData, QString DT, QString D
         if (instData->badChips.contains(chip)) continue;
         it->processingStatus->Skysub = false;
 
+        prefetcher.claim(k);
         it->setupData(scienceData->isTaskRepeated, true, false, backupDirName);
         if (!it->successProcessing) {
             abortProcess = true;
@@ -509,7 +512,7 @@ void Controller::skysubConstantEachChip(Data *scienceData, QString DT, QString D
         updateImageAndData(it, scienceData);
 
         // Must write for SWarp!
-        it->writeImage();
+        it->writeImageQueued(writeQueue);
         if (cdw->ui->skySavemodelCheckBox->isChecked()) {
             it->writeConstSkyImage(meanExposureBackground);
         }
@@ -610,6 +613,8 @@ void Controller::skysubModel(Data *scienceData, QString DT, QString DMIN, QStrin
 
     emit messageAvailable(" Calculating sky models ...", "controller");
 
+    ImagePrefetcher prefetcher(allMyImages, prefetchLimit(scienceData->isTaskRepeated), maxThreadsIO, false, true);
+
 #pragma omp parallel for num_threads(maxCPU) firstprivate(DT, DMIN, expFactor, backupDirName)
     for (int k=0; k<numMyImages; ++k) {
         if (abortProcess || !successProcessing) continue;
@@ -624,6 +629,7 @@ void Controller::skysubModel(Data *scienceData, QString DT, QString DMIN, QStrin
         //        emit messageAvailable(it->baseName + " : Modeling the sky ...", "controller");
         it->processingStatus->Skysub = false;
 //        it->setupData(scienceData->isTaskRepeated, false, true, backupDirName);
+        prefetcher.claim(k);
         it->setupData(scienceData->isTaskRepeated, true, false, backupDirName);
         if (!it->successProcessing) {
             abortProcess = true;
@@ -670,7 +676,7 @@ void Controller::skysubModel(Data *scienceData, QString DT, QString DMIN, QStrin
         updateImageAndData(it, scienceData);
 
         // Must write for SWarp
-        it->writeImage();
+        it->writeImageQueued(writeQueue);
         it->unprotectMemory();
         if (minimizeMemoryUsage) {
             it->freeAll();
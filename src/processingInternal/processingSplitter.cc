@@ -191,7 +191,7 @@ void Controller::uniformMJDOBS(QDir &dir)
             fitsfile *fptr;
             int status = 0;
             QString completeName = path+"/"+fileName;
-            fits_open_file(&fptr, completeName.toUtf8().data(), READWRITE, &status);
+            fits_open_image(&fptr, completeName.toUtf8().data(), READWRITE, &status);
             // Extract DATE-OBS and MJD-OBS from chip 1
             if (chipNumber == "1") {
                 fits_read_key_str(fptr, "DATE-OBS", dateObsChip1, nullptr, &status);
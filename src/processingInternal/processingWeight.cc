@@ -239,6 +239,8 @@ void Controller::taskInternalIndividualweight()
 
     QString instType = instData->type;
 
+    ImagePrefetcher prefetcher(allMyImages, prefetchLimit(false), maxThreadsIO, false, false);
+
 #pragma omp parallel for num_threads(maxCPU) firstprivate(instType, mainDirName)
     for (int k=0; k<numMyImages; ++k) {
         if (abortProcess || !successProcessing) continue;
@@ -252,6 +254,7 @@ void Controller::taskInternalIndividualweight()
         releaseMemory(nimg*instData->storage, maxCPU);
 
         if (verbosity >= 0) emit messageAvailable(it->chipName + " : Creating weight map ...", "image");
+        prefetcher.claim(k);
         it->setupDataInMemorySimple(false);
         if (!it->successProcessing) {
             abortProcess = true;
@@ -180,7 +180,7 @@ void Query::getCatalogSearchLocationPhotom()
     if (!successProcessing) return;
 
     // Calculate RA/DEC of image center
-    photomImage = new MyImage(photomDir, photomImageName, "", 1, QVector<bool>(), verbosity);
+    photomImage = new MyImage(photomDir, photomImageName, "", 1, BitMask::empty(), verbosity);
     photomImage->loadHeader();
     naxis1 = photomImage->naxis1;
     naxis2 = photomImage->naxis2;
@@ -221,6 +221,8 @@ int MainWindow::writeGUISettings()
     settings.setValue("COAprojectionComboBox", cdw->ui->COAprojectionComboBox->currentIndex());
     settings.setValue("COAraLineEdit", cdw->ui->COAraLineEdit->text());
     settings.setValue("COArescaleweightsCheckBox", cdw->ui->COArescaleweightsCheckBox->isChecked());
+    settings.setValue("COAresampleInternalCheckBox", cdw->ui->COAresampleInternalCheckBox->isChecked());
+    settings.setValue("COAincrementalCheckBox", cdw->ui->COAincrementalCheckBox->isChecked());
     settings.setValue("COAsizexLineEdit", cdw->ui->COAsizexLineEdit->text());
     settings.setValue("COAsizeyLineEdit", cdw->ui->COAsizeyLineEdit->text());
     settings.setValue("COAskypaLineEdit", cdw->ui->COAskypaLineEdit->text());
@@ -242,6 +244,7 @@ int MainWindow::writeGUISettings()
     settings.setValue("CSCmincontLineEdit", cdw->ui->CSCmincontLineEdit->text());
     settings.setValue("CSCrejectExposureLineEdit", cdw->ui->CSCrejectExposureLineEdit->text());
     settings.setValue("CSCconvolutionCheckBox", cdw->ui->CSCconvolutionCheckBox->isChecked());
+    settings.setValue("CSCfilterComboBox", cdw->ui->CSCfilterComboBox->currentText());
     settings.setValue("CSCsamplingCheckBox", cdw->ui->CSCsamplingCheckBox->isChecked());
     settings.setValue("CSCsaturationLineEdit", cdw->ui->CSCsaturationLineEdit->text());
     settings.setValue("CSCMethodComboBox", cdw->ui->CSCMethodComboBox->currentIndex());
@@ -274,6 +277,7 @@ int MainWindow::writeGUISettings()
     settings.setValue("flatoffMethodComboBox", cdw->ui->flatoffMethodComboBox->currentIndex());
     settings.setValue("overscanCheckBox", cdw->ui->overscanCheckBox->isChecked());
     settings.setValue("theliRenamingCheckBox", cdw->ui->theliRenamingCheckBox->isChecked());
+    settings.setValue("fitsCompressionComboBox", cdw->ui->fitsCompressionComboBox->currentIndex());
     settings.setValue("nonlinearityCheckBox", cdw->ui->nonlinearityCheckBox->isChecked());
     settings.setValue("normalxtalkAmplitudeLineEdit", cdw->ui->normalxtalkAmplitudeLineEdit->text());
     settings.setValue("normalxtalkCheckBox", cdw->ui->normalxtalkCheckBox->isChecked());
@@ -481,6 +485,8 @@ int MainWindow::readGUISettings(QString projectname)
     cdw->ui->COAprojectionComboBox->setCurrentIndex(settings.value("COAprojectionComboBox").toInt());
     cdw->ui->COAraLineEdit->setText(settings.value("COAraLineEdit").toString());
     cdw->ui->COArescaleweightsCheckBox->setChecked(settings.value("COArescaleweightsCheckBox").toBool());
+    cdw->ui->COAresampleInternalCheckBox->setChecked(settings.value("COAresampleInternalCheckBox").toBool());
+    cdw->ui->COAincrementalCheckBox->setChecked(settings.value("COAincrementalCheckBox").toBool());
     cdw->ui->COAsizexLineEdit->setText(settings.value("COAsizexLineEdit").toString());
     cdw->ui->COAsizeyLineEdit->setText(settings.value("COAsizeyLineEdit").toString());
     cdw->ui->COAskypaLineEdit->setText(settings.value("COAskypaLineEdit").toString());
@@ -503,6 +509,7 @@ int MainWindow::readGUISettings(QString projectname)
     cdw->ui->CSCmincontLineEdit->setText(settings.value("CSCmincontLineEdit").toString());
     cdw->ui->CSCrejectExposureLineEdit->setText(settings.value("CSCrejectExposureLineEdit").toString());
     cdw->ui->CSCconvolutionCheckBox->setChecked(settings.value("CSCconvolutionCheckBox").toBool());
+    cdw->ui->CSCfilterComboBox->setCurrentText(settings.value("CSCfilterComboBox", "default").toString());
     cdw->ui->CSCsamplingCheckBox->setChecked(settings.value("CSCsamplingCheckBox").toBool());
     cdw->ui->CSCsaturationLineEdit->setText(settings.value("CSCsaturationLineEdit").toString());
     cdw->ui->SPSlengthLineEdit->setText(settings.value("SPSlengthLineEdit").toString());
@@ -542,6 +549,7 @@ int MainWindow::readGUISettings(QString projectname)
     cdw->ui->skyPolynomialSpinBox->setValue(settings.value("skyPolynomialSpinBox").toInt());
     cdw->ui->skySavemodelCheckBox->setChecked(settings.value("skySavemodelCheckBox").toBool());
     cdw->ui->theliRenamingCheckBox->setChecked(settings.value("theliRenamingCheckBox").toBool());
+    cdw->ui->fitsCompressionComboBox->setCurrentIndex(settings.value("fitsCompressionComboBox").toInt());
     cdw->ui->overscanCheckBox->setChecked(settings.value("overscanCheckBox").toBool());
     cdw->ui->nonlinearityCheckBox->setChecked(settings.value("nonlinearityCheckBox").toBool());
     cdw->ui->normalxtalkAmplitudeLineEdit->setText(settings.value("normalxtalkAmplitudeLineEdit").toString());
@@ -1014,7 +1014,7 @@ QStringList MainWindow::displayCoaddFilterChoice(QString dirname, QString &filte
         int status = 0;
         fitsfile *fptr = nullptr;
         char filter[80];
-        fits_open_file(&fptr, (dirname+"/"+fits).toUtf8().data(), READONLY, &status);
+        fits_open_image(&fptr, (dirname+"/"+fits).toUtf8().data(), READONLY, &status);
         fits_read_key_str(fptr, "FILTER", filter, NULL, &status);
         fits_close_file(fptr, &status);
         printCfitsioError(fits+" : MainWindow::displayCoaddFilterChoice()", status);
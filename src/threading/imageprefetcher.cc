@@ -0,0 +1,123 @@
+/*
+Copyright (C) 2019 Mischa Schirmer
+
+This file is part of THELI.
+
+THELI is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free
+Software Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program in the LICENSE file.
+If not, see https://www.gnu.org/licenses/ .
+*/
+
+#include "imageprefetcher.h"
+
+#include <QMutexLocker>
+#include <QRunnable>
+
+#include <functional>
+
+namespace {
+class PrefetchJob : public QRunnable
+{
+public:
+    PrefetchJob(std::function<void()> job) :
+        prefetchJob(job)
+    {}
+
+    void run() override
+    {
+        prefetchJob();
+    }
+
+private:
+    std::function<void()> prefetchJob;
+};
+}
+
+// 'determineMode' must be the same as in the setupData() call of the loop, because setupData()
+// does not touch images that are already in memory. With 'maxImages' = 0 nothing is prefetched.
+ImagePrefetcher::ImagePrefetcher(const QList<MyImage*> &imageList, int maxImages, int numThreads,
+                                 bool determineMode, bool readWeights, int depth) :
+    images(imageList),
+    maxAhead(maxImages),
+    lookAhead(depth),
+    modeDetermination(determineMode),
+    weights(readWeights)
+{
+    state.fill(IDLE, images.length());
+    if (numThreads < 1) numThreads = 1;
+    pool.setMaxThreadCount(numThreads);
+}
+
+ImagePrefetcher::~ImagePrefetcher()
+{
+    // Cancel everything that has not been started yet
+    {
+        QMutexLocker locker(&mutex);
+        for (auto &it : state) {
+            if (it == QUEUED) it = IDLE;
+        }
+    }
+    pool.waitForDone();
+}
+
+// Called by the compute thread before it sets up the data of image 'index'. Returns once the image
+// is not touched anymore by the prefetcher.
+void ImagePrefetcher::claim(int index)
+{
+    if (maxAhead <= 0) return;
+    if (index < 0 || index >= images.length()) return;
+
+    QMutexLocker locker(&mutex);
+
+    // Queue the following images, in the order they will be processed
+    for (int i=index+1; i<=index+lookAhead && i<images.length(); ++i) {
+        if (numAhead >= maxAhead) break;
+        if (state[i] != IDLE) continue;
+        state[i] = QUEUED;
+        ++numAhead;
+        pool.start(new PrefetchJob([this, i]() {load(i);}));
+    }
+
+    // The image itself; if it is not being loaded yet, the compute thread reads it itself
+    while (state[index] == LOADING) {
+        imageLoaded.wait(&mutex);
+    }
+    if (state[index] == QUEUED || state[index] == LOADED) --numAhead;
+    state[index] = CLAIMED;
+}
+
+void ImagePrefetcher::load(int index)
+{
+    {
+        QMutexLocker locker(&mutex);
+        if (state[index] != QUEUED) return;       // claimed or cancelled in the meantime
+        state[index] = LOADING;
+    }
+
+    // Images skipped by the processing loop are never claimed and must not count against the budget
+    MyImage *image = images[index];
+    bool skipped = !image->successProcessing || image->activeState != MyImage::ACTIVE;
+    if (!skipped) {
+        image->readImage(modeDetermination);
+        if (weights && image->successProcessing) image->readWeight();
+    }
+
+    QMutexLocker locker(&mutex);
+    if (skipped) {
+        state[index] = CLAIMED;
+        --numAhead;
+    }
+    else {
+        state[index] = LOADED;
+    }
+    imageLoaded.wakeAll();
+}
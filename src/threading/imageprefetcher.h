@@ -0,0 +1,63 @@
+/*
+Copyright (C) 2019 Mischa Schirmer
+
+This file is part of THELI.
+
+THELI is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free
+Software Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program in the LICENSE file.
+If not, see https://www.gnu.org/licenses/ .
+*/
+
+// Read-ahead for the per-image processing loops. Whenever a compute thread claims image k of the
+// loop, the next 'depth' images are loaded (and optionally their weights) by a small pool of I/O
+// threads, such that the thread usually finds its next image already in memory. The number of
+// images loaded ahead but not yet claimed is limited by 'maxImages' (the memory budget).
+
+#ifndef IMAGEPREFETCHER_H
+#define IMAGEPREFETCHER_H
+
+#include "../myimage/myimage.h"
+
+#include <QList>
+#include <QMutex>
+#include <QThreadPool>
+#include <QVector>
+#include <QWaitCondition>
+
+class ImagePrefetcher
+{
+public:
+    explicit ImagePrefetcher(const QList<MyImage*> &imageList, int maxImages, int numThreads,
+                             bool determineMode, bool readWeights, int depth = 2);
+    ~ImagePrefetcher();
+
+    void claim(int index);
+
+private:
+    enum prefetchState {IDLE, QUEUED, LOADING, LOADED, CLAIMED};
+
+    QList<MyImage*> images;
+    QVector<prefetchState> state;
+    int maxAhead = 0;
+    int numAhead = 0;
+    int lookAhead = 2;
+    bool modeDetermination = false;
+    bool weights = false;
+
+    QThreadPool pool;
+    QMutex mutex;
+    QWaitCondition imageLoaded;
+
+    void load(int index);
+};
+
+#endif // IMAGEPREFETCHER_H
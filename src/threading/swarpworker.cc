@@ -37,8 +37,19 @@ void SwarpWorker::runSwarp()
     connect(extProcess, &QProcess::readyReadStandardError, this, &SwarpWorker::processExternalStderr);
     QTest::qWait(300);   // If I don't do this, the GUI crashes. It seems the process produces an output faster than the connection can be made ...
     extProcess->setWorkingDirectory(coaddDirName);
-    extProcess->start("/bin/sh -c \""+swarpCommand+"\"");
-    extProcess->waitForFinished(-1);
+
+    if (imageQueue == nullptr) runCommand(swarpCommand);
+    else {
+        while (!aborted.loadAcquire()) {
+            QStringList batch;
+            queueMutex->lock();
+            while (!imageQueue->isEmpty() && batch.length() < batchSize) batch << imageQueue->takeFirst();
+            queueMutex->unlock();
+            if (batch.isEmpty()) break;
+            runCommand(swarpCommand.arg(batch.join(" ")));
+            emit finishedResamplingJob(batch.length());
+        }
+    }
 
     if (swarpType == "swarpPreparation") emit finishedPreparation();
     if (swarpType == "swarpResampling") emit finishedResampling(threadID);
@@ -48,8 +59,15 @@ void SwarpWorker::runSwarp()
     // stdout and stderr channels are slotted into the monitor's plainTextEdit
 }
 
+void SwarpWorker::runCommand(const QString &command)
+{
+    extProcess->start("/bin/sh -c \""+command+"\"");
+    extProcess->waitForFinished(-1);
+}
+
 void SwarpWorker::abort()
 {
+    aborted.storeRelease(1);
     if (extProcess == nullptr) {
         emit finished();
         return;
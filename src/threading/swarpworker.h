@@ -22,8 +22,11 @@ If not, see https://www.gnu.org/licenses/ .
 
 #include "worker.h"
 
+#include <QAtomicInt>
 #include <QObject>
 #include <QProcess>
+#include <QMutex>
+#include <QStringList>
 
 class SwarpWorker : public Worker
 {
@@ -37,6 +40,12 @@ public:
     int threadID = 0;
     QProcess *extProcess = nullptr;
 
+    // Resampling: batches of images are taken from a queue shared by all workers, until it is empty.
+    // 'swarpCommand' then contains '%1' in place of the image names.
+    QStringList *imageQueue = nullptr;
+    QMutex *queueMutex = nullptr;
+    int batchSize = 1;
+
     void abort();
 
 public slots:
@@ -46,11 +55,16 @@ signals:
     void finishedPreparation();
     void errorFound();
     void finishedResampling(int threadID);
+    void finishedResamplingJob(int numImages);
     void finishedCoaddition();
     void messageAvailable(QString message, QString type);
 
 private slots:
     void processExternalStderr();
+
+private:
+    QAtomicInt aborted = 0;            // Set from the GUI thread by abort()
+    void runCommand(const QString &command);
 };
 
 #endif // SWARPWORKER_H
@@ -0,0 +1,102 @@
+/*
+Copyright (C) 2019 Mischa Schirmer
+
+This file is part of THELI.
+
+THELI is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free
+Software Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program in the LICENSE file.
+If not, see https://www.gnu.org/licenses/ .
+*/
+
+#include "writequeue.h"
+
+#include <QMutexLocker>
+#include <QRunnable>
+
+namespace {
+class WriteJob : public QRunnable
+{
+public:
+    WriteJob(std::function<bool()> job, std::function<void(bool)> done) :
+        writeJob(job),
+        doneJob(done)
+    {}
+
+    void run() override
+    {
+        doneJob(writeJob());
+    }
+
+private:
+    std::function<bool()> writeJob;
+    std::function<void(bool)> doneJob;
+};
+}
+
+// 'maxMemory' is in MB, like the memory settings in the preferences
+WriteQueue::WriteQueue(int numThreads, long maxMemory)
+{
+    setup(numThreads, maxMemory);
+}
+
+WriteQueue::~WriteQueue()
+{
+    flush();
+}
+
+void WriteQueue::setup(int numThreads, long maxMemory)
+{
+    if (numThreads < 1) numThreads = 1;
+    if (maxMemory < 1) maxMemory = 1;
+    pool.setMaxThreadCount(numThreads);
+    // Keep idle I/O threads alive between the images of a task
+    pool.setExpiryTimeout(-1);
+
+    QMutexLocker locker(&mutex);
+    maxBytesPending = qint64(maxMemory) * 1024 * 1024;
+}
+
+// Applies back-pressure: waits until the job fits into the budget. A job larger than the budget
+// is accepted once the queue has drained completely, otherwise the caller would wait forever.
+void WriteQueue::enqueue(std::function<bool()> job, qint64 numBytes)
+{
+    {
+        QMutexLocker locker(&mutex);
+        while (bytesPending > 0 && bytesPending + numBytes > maxBytesPending) {
+            jobFinished.wait(&mutex);
+        }
+        bytesPending += numBytes;
+    }
+
+    // QThreadPool starts queued runnables in FIFO order (they all have the same priority)
+    pool.start(new WriteJob(job, [this, numBytes](bool success) {finish(numBytes, success);}));
+}
+
+void WriteQueue::finish(qint64 numBytes, bool success)
+{
+    QMutexLocker locker(&mutex);
+    bytesPending -= numBytes;
+    if (!success) ++numFailed;
+    jobFinished.wakeAll();
+}
+
+// Blocks until all queued images are on the drive.
+// Returns false if any write since the last flush failed.
+bool WriteQueue::flush()
+{
+    pool.waitForDone();
+
+    QMutexLocker locker(&mutex);
+    bool success = numFailed == 0;
+    numFailed = 0;
+    return success;
+}
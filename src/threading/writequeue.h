@@ -0,0 +1,57 @@
+/*
+Copyright (C) 2019 Mischa Schirmer
+
+This file is part of THELI.
+
+THELI is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free
+Software Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program in the LICENSE file.
+If not, see https://www.gnu.org/licenses/ .
+*/
+
+// A bounded write-behind queue for image persistence. Processing threads hand over a write job
+// (which holds an implicitly shared reference to the pixel data) and continue with the next image,
+// while a small pool of dedicated I/O threads writes the FITS files in the order they were queued.
+// The number of bytes queued but not yet written is limited; enqueue() blocks until enough earlier
+// jobs have finished.
+// A job returns false if the write failed; flush() reports whether all jobs since the last flush succeeded.
+
+#ifndef WRITEQUEUE_H
+#define WRITEQUEUE_H
+
+#include <QMutex>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+#include <functional>
+
+class WriteQueue
+{
+public:
+    explicit WriteQueue(int numThreads = 1, long maxMemory = 512);
+    ~WriteQueue();
+
+    void setup(int numThreads, long maxMemory);
+    void enqueue(std::function<bool()> job, qint64 numBytes);
+    bool flush();
+
+private:
+    QThreadPool pool;
+    QMutex mutex;
+    QWaitCondition jobFinished;
+    qint64 bytesPending = 0;
+    qint64 maxBytesPending = 0;
+    long numFailed = 0;
+
+    void finish(qint64 numBytes, bool success);
+};
+
+#endif // WRITEQUEUE_H
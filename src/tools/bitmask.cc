@@ -0,0 +1,160 @@
+/*
+Copyright (C) 2019 Mischa Schirmer
+
+This file is part of THELI.
+
+THELI is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free
+Software Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program in the LICENSE file.
+If not, see https://www.gnu.org/licenses/ .
+*/
+
+#include "bitmask.h"
+
+#include <algorithm>
+
+void BitMask::clear()
+{
+    words.clear();
+    numBits = 0;
+}
+
+BitMask::Word BitMask::lastWordBits() const
+{
+    const int rest = numBits & 63;
+    return rest == 0 ? ~Word(0) : (Word(1) << rest) - 1;
+}
+
+void BitMask::resize(const long n)
+{
+    // Clear the unused bits of the current last word, they become valid pixels
+    if (n > numBits && !words.isEmpty()) words.last() &= lastWordBits();
+    words.resize((n + wordBits - 1) / wordBits);
+    const long oldNumWords = (numBits + wordBits - 1) / wordBits;
+    for (long w=oldNumWords; w<words.length(); ++w) words[w] = 0;
+    numBits = n;
+    if (!words.isEmpty()) words.last() &= lastWordBits();
+}
+
+void BitMask::fill(const bool value, const long n)
+{
+    if (n >= 0) numBits = n;
+    words.fill(value ? ~Word(0) : Word(0), (numBits + wordBits - 1) / wordBits);
+    if (!words.isEmpty()) words.last() &= lastWordBits();
+}
+
+bool BitMask::isWordMasked(const long w) const
+{
+    const Word full = (w == words.length() - 1) ? lastWordBits() : ~Word(0);
+    return words.at(w) == full;
+}
+
+long BitMask::count() const
+{
+    long num = 0;
+    for (auto &word : words) num += __builtin_popcountll(word);
+    return num;
+}
+
+BitMask &BitMask::operator&=(const BitMask &other)
+{
+    const long nw = std::min(words.length(), other.words.length());
+    Word *a = words.data();
+    const Word *b = other.words.constData();
+    for (long w=0; w<nw; ++w) a[w] &= b[w];
+    for (long w=nw; w<words.length(); ++w) a[w] = 0;
+    return *this;
+}
+
+BitMask &BitMask::operator|=(const BitMask &other)
+{
+    const long nw = std::min(words.length(), other.words.length());
+    Word *a = words.data();
+    const Word *b = other.words.constData();
+    for (long w=0; w<nw; ++w) a[w] |= b[w];
+    if (!words.isEmpty()) words.last() &= lastWordBits();
+    return *this;
+}
+
+void BitMask::setRange(const long first, const long last)
+{
+    if (first > last) return;
+    Word *a = words.data();
+    const long w0 = first >> 6;
+    const long w1 = last >> 6;
+    const Word head = ~Word(0) << (first & 63);
+    const Word tail = ~Word(0) >> (63 - (last & 63));
+    if (w0 == w1) {
+        a[w0] |= head & tail;
+        return;
+    }
+    a[w0] |= head;
+    for (long w=w0+1; w<w1; ++w) a[w] = ~Word(0);
+    a[w1] |= tail;
+}
+
+void BitMask::invert()
+{
+    for (auto &word : words) word = ~word;
+    if (!words.isEmpty()) words.last() &= lastWordBits();
+}
+
+long BitMask::nextUnmasked(const long i) const
+{
+    if (i >= numBits) return numBits;
+    const Word *a = words.constData();
+    long w = i >> 6;
+    // Unmasked bits are the zeros; invert and discard the bits below i
+    Word bits = ~a[w] & (~Word(0) << (i & 63));
+    const long nw = words.length();
+    while (bits == 0) {
+        if (++w == nw) return numBits;
+        bits = ~a[w];
+    }
+    const long pos = w * wordBits + __builtin_ctzll(bits);
+    return pos < numBits ? pos : numBits;
+}
+
+long BitMask::nextMasked(const long i) const
+{
+    if (i >= numBits) return numBits;
+    const Word *a = words.constData();
+    long w = i >> 6;
+    Word bits = a[w] & (~Word(0) << (i & 63));
+    const long nw = words.length();
+    while (bits == 0) {
+        if (++w == nw) return numBits;
+        bits = a[w];
+    }
+    return w * wordBits + __builtin_ctzll(bits);
+}
+
+const BitMask &BitMask::empty()
+{
+    static const BitMask emptyMask;
+    return emptyMask;
+}
+
+QVector<bool> BitMask::toBoolVector() const
+{
+    QVector<bool> vector(numBits);
+    for (long i=0; i<numBits; ++i) vector[i] = at(i);
+    return vector;
+}
+
+BitMask BitMask::fromBoolVector(const QVector<bool> &vector)
+{
+    BitMask mask(vector.length(), false);
+    for (long i=0; i<vector.length(); ++i) {
+        if (vector.at(i)) mask.setBit(i);
+    }
+    return mask;
+}
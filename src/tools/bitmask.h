@@ -0,0 +1,85 @@
+/*
+Copyright (C) 2019 Mischa Schirmer
+
+This file is part of THELI.
+
+THELI is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free
+Software Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program in the LICENSE file.
+If not, see https://www.gnu.org/licenses/ .
+*/
+
+// Bit-packed pixel mask (1 = masked), replacing QVector<bool> for the global and object masks.
+// 64 pixels share one word, such that masks take 1/8 of the memory, whole words
+// can be combined / counted at once, and loops can skip fully masked or fully
+// unmasked runs of pixels. Bits beyond length() are always zero.
+//
+// The read interface (length(), isEmpty(), at(), operator[]) follows QVector<bool>.
+// Writing single bits is not thread safe if different threads write into the same 64 pixels.
+
+#ifndef BITMASK_H
+#define BITMASK_H
+
+#include <QVector>
+#include <cstdint>
+
+class BitMask
+{
+public:
+    typedef uint64_t Word;
+    static const int wordBits = 64;
+
+    BitMask() {}
+    BitMask(const long n, const bool value) { fill(value, n); }
+
+    long length() const { return numBits; }
+    long size() const { return numBits; }
+    bool isEmpty() const { return numBits == 0; }
+    void clear();
+    void squeeze() { words.squeeze(); }
+    void resize(const long n);                    // new pixels are unmasked
+    void fill(const bool value, const long n = -1);  // like QVector::fill(); n < 0 keeps the current size
+
+    bool at(const long i) const { return (words.constData()[i >> 6] >> (i & 63)) & 1; }
+    bool operator[](const long i) const { return at(i); }
+    void setBit(const long i) { words.data()[i >> 6] |= Word(1) << (i & 63); }
+    void clearBit(const long i) { words.data()[i >> 6] &= ~(Word(1) << (i & 63)); }
+    void setBit(const long i, const bool value) { if (value) setBit(i); else clearBit(i); }
+
+    // Word level access
+    long numWords() const { return words.length(); }
+    const Word *constWords() const { return words.constData(); }
+    Word *wordData() { return words.data(); }
+    bool isWordMasked(const long w) const;        // all (valid) pixels in word w are masked
+    long memoryFootprint() const { return words.capacity() * sizeof(Word); }
+
+    long count() const;                           // number of masked pixels
+    BitMask &operator&=(const BitMask &other);    // pixels masked in both
+    BitMask &operator|=(const BitMask &other);    // pixels masked in either
+    void setRange(const long first, const long last);   // masks pixels first ... last (inclusive)
+    void invert();
+
+    // Runs: index of the first unmasked (masked) pixel >= i, or length() if there is none
+    long nextUnmasked(const long i) const;
+    long nextMasked(const long i) const;
+
+    QVector<bool> toBoolVector() const;
+    static BitMask fromBoolVector(const QVector<bool> &vector);
+    static const BitMask &empty();                // for images without a global mask; outlives all images
+
+private:
+    QVector<Word> words;
+    long numBits = 0;
+
+    Word lastWordBits() const;                    // the valid bits in the last word
+};
+
+#endif // BITMASK_H
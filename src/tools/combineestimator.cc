@@ -0,0 +1,256 @@
+/*
+Copyright (C) 2019 Mischa Schirmer
+
+This file is part of THELI.
+
+THELI is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free
+Software Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program in the LICENSE file.
+If not, see https://www.gnu.org/licenses/ .
+*/
+
+#include "combineestimator.h"
+#include "sortingnetwork.h"
+#include "../functions.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace CombineEstimator {
+
+const int lanes = SortingNetwork::lanes;
+
+Type fromFunction(float (*combineFunction_ptr) (const QVector<float> &, const QVector<bool> &, long))
+{
+    // meanMask() is overloaded; the typed pointers select the functor versions
+    float (*mean_ptr) (const QVector<float> &, const QVector<bool> &, long) = &meanMask;
+    float (*clippedMean_ptr) (const QVector<float> &, const QVector<bool> &, long) = &clippedMeanMask;
+    float (*winsorisedMean_ptr) (const QVector<float> &, const QVector<bool> &, long) = &winsorisedMeanMask;
+    if (combineFunction_ptr == mean_ptr) return Mean;
+    if (combineFunction_ptr == clippedMean_ptr) return ClippedMean;
+    if (combineFunction_ptr == winsorisedMean_ptr) return WinsorisedMean;
+    return Median;
+}
+
+QString name(const Type type)
+{
+    if (type == Mean) return "Mean";
+    if (type == ClippedMean) return "Clipped mean";
+    if (type == WinsorisedMean) return "Winsorised mean";
+    return "Median";
+}
+
+long workSize(const long depth)
+{
+    // the stack, and one column for sorting stacks that are too deep for the networks
+    return depth * lanes + depth;
+}
+
+// Deep stacks: sort each lane individually
+static void sortLanes_fallback(const long depth, float (*v)[lanes], float *column)
+{
+    for (int l=0; l<lanes; ++l) {
+        for (long k=0; k<depth; ++k) column[k] = v[k][l];
+        std::sort(column, column+depth);
+        for (long k=0; k<depth; ++k) v[k][l] = column[k];
+    }
+}
+
+void combineTile(const Type type, const long depth, const float *const *data, const BitMask *const *mask, const float *factors,
+                 float *combined, const long iStart, const long iEnd, const int nlow, const int nhigh, float *work)
+{
+    float (*v)[lanes] = reinterpret_cast<float (*)[lanes]>(work);
+    float *column = work + depth*lanes;
+
+    // A plain mean does not need the sorted stack
+    const bool sortStack = type != Mean || nlow + nhigh > 0;
+
+    // Per-lane state. Stack indices are kept as floats, such that all comparisons vectorise together with the data.
+    float count[lanes];
+    float lo[lanes];         // first accepted index in the sorted stack
+    float hi[lanes];         // one past the last accepted index
+    float sum[lanes];
+    float sumsq[lanes];
+    float num[lanes];
+    float center[lanes];
+    float sigma[lanes];
+    float vmin[lanes];
+    float vmax[lanes];
+
+    for (long i0=iStart; i0<iEnd; i0+=lanes) {
+        const int nlanes = std::min(long(lanes), iEnd - i0);
+
+        // Gather; masked pixels are moved to the top of the sorted stack
+        for (int l=0; l<lanes; ++l) {
+            count[l] = 0.f;
+            sum[l] = 0.f;
+        }
+        for (long k=0; k<depth; ++k) {
+            const float *d = data[k] + i0;
+            const BitMask *m = (mask == nullptr) ? nullptr : mask[k];
+            const float f = factors[k];
+            float *vk = v[k];
+            if (nlanes == lanes && m == nullptr) {
+                for (int l=0; l<lanes; ++l) vk[l] = d[l] * f;
+            }
+            else if (nlanes == lanes) {
+                for (int l=0; l<lanes; ++l) vk[l] = m->at(i0+l) ? FLT_MAX : d[l] * f;
+            }
+            else {
+                // last, incomplete group of pixels
+                for (int l=0; l<lanes; ++l) {
+                    const bool valid = l < nlanes && (m == nullptr || !m->at(i0+l));
+                    vk[l] = valid ? d[l] * f : FLT_MAX;
+                }
+            }
+            for (int l=0; l<lanes; ++l) {
+                const bool valid = vk[l] != FLT_MAX;
+                count[l] += valid ? 1.f : 0.f;
+                sum[l] += valid ? vk[l] : 0.f;
+            }
+        }
+
+        if (!sortStack) {
+            for (int l=0; l<nlanes; ++l) combined[i0+l] = count[l] > 0.f ? sum[l] / count[l] : 0.f;
+            continue;
+        }
+
+        if (!sortLanes_network(depth, v)) sortLanes_fallback(depth, v, column);
+
+        for (int l=0; l<lanes; ++l) {
+            lo[l] = nlow;
+            hi[l] = count[l] - nhigh;
+        }
+
+        // Median; also the starting point of the clipped mean
+        if (type == Median || type == ClippedMean) {
+            for (int l=0; l<lanes; ++l) {
+                const int first = nlow;
+                const int nuse = hi[l] - lo[l];
+                // identical indices if nuse is odd
+                center[l] = nuse > 0 ? 0.5f * (v[first + (nuse-1)/2][l] + v[first + nuse/2][l]) : 0.f;
+            }
+            if (type == Median) {
+                for (int l=0; l<nlanes; ++l) combined[i0+l] = center[l];
+                continue;
+            }
+        }
+
+        if (type == Mean) {
+            for (int l=0; l<lanes; ++l) sum[l] = 0.f;
+            for (long k=0; k<depth; ++k) {
+                const float fk = k;
+                for (int l=0; l<lanes; ++l) {
+                    sum[l] += ((fk >= lo[l]) & (fk < hi[l])) ? v[k][l] : 0.f;
+                }
+            }
+            for (int l=0; l<nlanes; ++l) {
+                const float nuse = hi[l] - lo[l];
+                combined[i0+l] = nuse > 0.f ? sum[l] / nuse : 0.f;
+            }
+            continue;
+        }
+
+        if (type == WinsorisedMean) {
+            for (int l=0; l<lanes; ++l) {
+                const bool ok = hi[l] > lo[l];
+                vmin[l] = ok ? v[nlow][l] : 0.f;
+                vmax[l] = ok ? v[int(hi[l])-1][l] : 0.f;
+                sum[l] = 0.f;
+            }
+            for (long k=0; k<depth; ++k) {
+                const float fk = k;
+                for (int l=0; l<lanes; ++l) {
+                    const float x = std::min(std::max(v[k][l], vmin[l]), vmax[l]);
+                    sum[l] += fk < count[l] ? x : 0.f;
+                }
+            }
+            for (int l=0; l<nlanes; ++l) {
+                combined[i0+l] = hi[l] > lo[l] ? sum[l] / count[l] : 0.f;
+            }
+            continue;
+        }
+
+        // ClippedMean: initial rms from the interquartile range of the sorted stack, such that a single outlier
+        // in a shallow stack cannot inflate it. Falls back to the rms around the median if the quartiles coincide.
+        for (int l=0; l<lanes; ++l) sumsq[l] = 0.f;
+        for (long k=0; k<depth; ++k) {
+            const float fk = k;
+            for (int l=0; l<lanes; ++l) {
+                const float dx = v[k][l] - center[l];
+                sumsq[l] += ((fk >= lo[l]) & (fk < hi[l])) ? dx*dx : 0.f;
+            }
+        }
+        for (int l=0; l<lanes; ++l) {
+            const int first = nlow;
+            const int nuse = hi[l] - lo[l];
+            const float iqr = nuse > 0 ? v[first + 3*(nuse-1)/4][l] - v[first + (nuse-1)/4][l] : 0.f;
+            if (iqr > 0.f) sigma[l] = 0.7413f * iqr;
+            else sigma[l] = nuse > 1 ? std::sqrt(sumsq[l] / (nuse - 1)) : 0.f;
+        }
+
+        for (int iter=0; iter<clipIterations; ++iter) {
+            for (int l=0; l<lanes; ++l) {
+                sum[l] = 0.f;
+                sumsq[l] = 0.f;
+                num[l] = 0.f;
+                sigma[l] *= clipKappa;
+            }
+            for (long k=0; k<depth; ++k) {
+                const float fk = k;
+                for (int l=0; l<lanes; ++l) {
+                    // offsets from the previous estimate, to avoid cancellation in the variance
+                    const float dx = v[k][l] - center[l];
+                    const bool accept = (fk >= lo[l]) & (fk < hi[l]) & (std::fabs(dx) <= sigma[l]);
+                    sum[l] += accept ? dx : 0.f;
+                    sumsq[l] += accept ? dx*dx : 0.f;
+                    num[l] += accept ? 1.f : 0.f;
+                }
+            }
+            // Keep the previous estimate if all values were rejected (e.g. zero rms and even stack depth)
+            for (int l=0; l<lanes; ++l) {
+                const float n = std::max(num[l], 1.f);
+                const float shift = sum[l] / n;
+                const float var = (sumsq[l] - n * shift * shift) / std::max(n - 1.f, 1.f);
+                center[l] += shift;
+                sigma[l] = num[l] > 1.f ? std::sqrt(std::max(var, 0.f)) : (num[l] == 0.f ? sigma[l] / clipKappa : 0.f);
+            }
+        }
+        for (int l=0; l<nlanes; ++l) combined[i0+l] = center[l];
+    }
+}
+
+float combineVector(const Type type, const QVector<float> &data, const QVector<bool> &mask, long maxLength)
+{
+    long depth = data.length();
+    if (maxLength > 0 && maxLength < depth) depth = maxLength;
+
+    // Masked values are dropped here. The rest is a stack of images with a single pixel each.
+    QVector<float> values;
+    values.reserve(depth);
+    for (long k=0; k<depth; ++k) {
+        if (mask.length() >= depth && mask.at(k)) continue;
+        values.append(data.at(k));
+    }
+    const long numValues = values.length();
+    if (numValues == 0) return 0.;
+
+    QVector<const float*> dataPtr(numValues);
+    QVector<float> factors(numValues, 1.0);
+    for (long k=0; k<numValues; ++k) dataPtr[k] = values.constData() + k;
+    QVector<float> work(workSize(numValues));
+    float result = 0.;
+    combineTile(type, numValues, dataPtr.constData(), nullptr, factors.constData(), &result, 0, 1, 0, 0, work.data());
+    return result;
+}
+
+}
@@ -0,0 +1,66 @@
+/*
+Copyright (C) 2019 Mischa Schirmer
+
+This file is part of THELI.
+
+THELI is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free
+Software Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program in the LICENSE file.
+If not, see https://www.gnu.org/licenses/ .
+*/
+
+// Estimators for the combination of image stacks (master calibrations, background models).
+// The stack is processed in groups of SortingNetwork::lanes neighbouring pixels,
+// such that all inner loops run over the lanes and vectorise.
+// Stacks up to SortingNetwork::maxDepth images are sorted with sorting networks.
+//
+// Median         : median after rejecting the nlow lowest and nhigh highest values
+// Mean           : mean after rejecting the nlow lowest and nhigh highest values
+// ClippedMean    : iterative kappa-sigma clipped mean, starting from the median and the interquartile range.
+//                  Uses the same nlow / nhigh rejection.
+// WinsorisedMean : the nlow lowest and nhigh highest values are replaced by their nearest remaining neighbours
+//
+// Pixels without enough unmasked values are set to zero.
+
+#ifndef COMBINEESTIMATOR_H
+#define COMBINEESTIMATOR_H
+
+#include "bitmask.h"
+
+#include <QString>
+#include <QVector>
+
+namespace CombineEstimator {
+
+enum Type {Median, Mean, ClippedMean, WinsorisedMean};
+
+const float clipKappa = 3.0;
+const int clipIterations = 5;
+
+// Maps the functors selected in the GUI (medianMask, meanMask, ...) onto an estimator. nullptr maps to the median.
+Type fromFunction(float (*combineFunction_ptr) (const QVector<float> &, const QVector<bool> &, long));
+
+QString name(const Type type);
+
+// Size of the work buffer required by combineTile()
+long workSize(const long depth);
+
+// Combines pixels [iStart, iEnd) of 'depth' images. Individual mask pointers (or 'mask') can be nullptr.
+// 'work' must hold workSize(depth) floats; one buffer per thread.
+void combineTile(const Type type, const long depth, const float *const *data, const BitMask *const *mask, const float *factors,
+                 float *combined, const long iStart, const long iEnd, const int nlow, const int nhigh, float *work);
+
+// The same estimators for a single vector, e.g. for use as functors
+float combineVector(const Type type, const QVector<float> &data, const QVector<bool> &mask, long maxLength);
+
+}
+
+#endif // COMBINEESTIMATOR_H
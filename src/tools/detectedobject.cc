@@ -23,12 +23,10 @@ If not, see https://www.gnu.org/licenses/ .
 #include "detectedobject.h"
 
 #include <cmath>
+#include <algorithm>
 #include "functions.h"
 #include <QVector>
 
-#include "wcs.h"
-#include "wcshdr.h"
-
 
 //  ========  WARNING  ==========================================
 //
@@ -38,14 +36,13 @@ If not, see https://www.gnu.org/licenses/ .
 // ==============================================================
 
 DetectedObject::DetectedObject(const QList<long> &objectIndices, const QVector<float> &data, const QVector<float> &background, const QVector<float> &weight,
-                               const QVector<bool> &_mask, bool weightinmemory, const long nax1, const long nax2, const long objid,
-                               const float satVal, const float gainval, wcsprm &wcsImage, QObject *parent) : QObject(parent),
+                               const BitMask &_mask, bool weightinmemory, const long nax1, const long nax2, const long objid,
+                               const float satVal, const float gainval) :
     dataMeasure(data),
     dataBackground(background),
     dataWeight(weight),
     mask(_mask),
     weightInMemory(weightinmemory),
-    wcs(wcsImage),
     saturationValue(satVal),
     gain(gainval)                    // GAIN is 1.0 always as we convert ADU to electrons during HDU reformatting, already. Kept for clarity
 {
@@ -93,17 +90,12 @@ void DetectedObject::remove()
     pixels_flux.clear();
     pixels_back.clear();
     pixels_weight.clear();
-    pixelsAper_back.clear();
-    pixelsAper_flux.clear();
-    pixelsAper_weight.clear();
     pixelsWin_back.clear();
     pixelsWin_flux.clear();
     pixelsWin_weight.clear();
     pixelsWin_x.clear();
     pixelsWin_y.clear();
     apertures.clear();
-    pixelsAper_x.clear();
-    pixelsAper_y.clear();
     pixels_x.clear();
     pixels_y.clear();
 
@@ -112,17 +104,12 @@ void DetectedObject::remove()
     pixels_weight.squeeze();
     pixels_x.squeeze();
     pixels_y.squeeze();
-    pixelsAper_back.squeeze();
-    pixelsAper_flux.squeeze();
-    pixelsAper_weight.squeeze();
     pixelsWin_back.squeeze();
     pixelsWin_flux.squeeze();
     pixelsWin_weight.squeeze();
     pixelsWin_x.squeeze();
     pixelsWin_y.squeeze();
     apertures.squeeze();
-    pixelsAper_x.squeeze();
-    pixelsAper_y.squeeze();
 }
 
 void DetectedObject::computeObjectParams()
@@ -147,7 +134,8 @@ void DetectedObject::computeObjectParams()
 
     // Applied only when writing catalogs to disk for scamp
     // correctOriginOffset();
-    calcSkyCoords();
+
+    // The sky coordinates are calculated by DetectionCatalog::calcSkyCoords() (wcslib is not re-entrant)
 
 //    qDebug() << FLAGS;
 }
@@ -165,13 +153,94 @@ void DetectedObject::calcFlux()
     MAG_ISO = -2.5*log10(FLUX_ISO) + ZP;
 }
 
-QVector<double> DetectedObject::calcFluxAper(float aperture)
+// Area of the circle segment between two points on a circle of radius r
+static double areaArc(const double x1, const double y1, const double x2, const double y2, const double r)
+{
+    double a = sqrt((x2-x1)*(x2-x1) + (y2-y1)*(y2-y1));
+    double theta = 2. * asin(std::min(1., 0.5*a/r));
+    return 0.5 * r * r * (theta - sin(theta));
+}
+
+static double areaTriangle(const double x1, const double y1, const double x2, const double y2, const double x3, const double y3)
+{
+    return 0.5 * fabs(x1*(y2-y3) + x2*(y3-y1) + x3*(y1-y2));
+}
+
+static double safeSqrt(const double x)
+{
+    return x > 0. ? sqrt(x) : 0.;
+}
+
+// Overlap of the rectangle [xmin,xmax]x[ymin,ymax] with a circle of radius r centred on the origin,
+// for a rectangle in the first quadrant (0 <= xmin, 0 <= ymin)
+static double circularOverlapCore(const double xmin, const double ymin, const double xmax, const double ymax, const double r)
+{
+    const double rsq = r*r;
+    if (xmin*xmin + ymin*ymin >= rsq) return 0.;
+    if (xmax*xmax + ymax*ymax <= rsq) return (xmax-xmin) * (ymax-ymin);
+
+    const bool lowerRightInside = xmax*xmax + ymin*ymin < rsq;
+    const bool upperLeftInside = xmin*xmin + ymax*ymax < rsq;
+    if (lowerRightInside && upperLeftInside) {
+        // only the upper right corner is outside
+        double x1 = safeSqrt(rsq - ymax*ymax);
+        double y2 = safeSqrt(rsq - xmax*xmax);
+        return (xmax-xmin) * (ymax-ymin) - areaTriangle(x1, ymax, xmax, y2, xmax, ymax) + areaArc(x1, ymax, xmax, y2, r);
+    }
+    else if (lowerRightInside) {
+        // the circle crosses the left and right edges
+        double y1 = safeSqrt(rsq - xmin*xmin);
+        double y2 = safeSqrt(rsq - xmax*xmax);
+        return areaArc(xmin, y1, xmax, y2, r) + areaTriangle(xmin, y1, xmin, ymin, xmax, ymin) + areaTriangle(xmin, y1, xmax, ymin, xmax, y2);
+    }
+    else if (upperLeftInside) {
+        // the circle crosses the bottom and top edges
+        double x1 = safeSqrt(rsq - ymin*ymin);
+        double x2 = safeSqrt(rsq - ymax*ymax);
+        return areaArc(x1, ymin, x2, ymax, r) + areaTriangle(x1, ymin, xmin, ymin, xmin, ymax) + areaTriangle(x1, ymin, xmin, ymax, x2, ymax);
+    }
+    else {
+        // only the lower left corner is inside
+        double x1 = safeSqrt(rsq - ymin*ymin);
+        double y2 = safeSqrt(rsq - xmin*xmin);
+        return areaArc(x1, ymin, xmin, y2, r) + areaTriangle(x1, ymin, xmin, y2, xmin, ymin);
+    }
+}
+
+// Exact overlap of the rectangle [xmin,xmax]x[ymin,ymax] with a circle of radius r centred on the origin.
+// The rectangle is split at the axes, and each part is mirrored into the first quadrant.
+static double circularOverlap(const double xmin, const double ymin, const double xmax, const double ymax, const double r)
 {
+    if (xmin < 0. && xmax > 0.) return circularOverlap(xmin, ymin, 0., ymax, r) + circularOverlap(0., ymin, xmax, ymax, r);
+    if (ymin < 0. && ymax > 0.) return circularOverlap(xmin, ymin, xmax, 0., r) + circularOverlap(xmin, 0., xmax, ymax, r);
+    const double x0 = xmin >= 0. ? xmin : -xmax;
+    const double x1 = xmin >= 0. ? xmax : -xmin;
+    const double y0 = ymin >= 0. ? ymin : -ymax;
+    const double y1 = ymin >= 0. ? ymax : -ymin;
+    return circularOverlapCore(x0, y0, x1, y1, r);
+}
+
+// Circular aperture photometry (apertures are diameters). Each pixel contributes with the exact fraction
+// of its area inside the aperture. All apertures are measured in one pass over the bounding box of the largest one.
+void DetectedObject::calcApertureMagnitudes()
+{
+    if (badDetection) return;
+
+    if (apertures.isEmpty()) return;
+
+    const int numAper = apertures.length();
+    QVector<double> radius(numAper);
+    double rmax = 0.;
+    for (int k=0; k<numAper; ++k) {
+        radius[k] = 0.5*apertures[k];
+        rmax = std::max(rmax, radius[k]);
+    }
+
     // get aperture pixels
-    long xminAper = floor(X-0.5*aperture);
-    long xmaxAper = ceil(X+0.5*aperture);
-    long yminAper = floor(Y-0.5*aperture);
-    long ymaxAper = ceil(Y+0.5*aperture);
+    long xminAper = floor(X-rmax);
+    long xmaxAper = ceil(X+rmax);
+    long yminAper = floor(Y-rmax);
+    long ymaxAper = ceil(Y+rmax);
 
     // Check truncation by image frame
     if (isTruncated(xminAper, xmaxAper, yminAper, ymaxAper)) bitflags.setBit(5,true);
@@ -182,113 +251,63 @@ QVector<double> DetectedObject::calcFluxAper(float aperture)
     yminAper = yminAper < 0 ? 0 : yminAper;
     ymaxAper = ymaxAper >=naxis2 ? naxis2-1 : ymaxAper;
 
-    long npixAper = (xmaxAper-xminAper+1) * (ymaxAper-yminAper+1);
-    pixelsAper_flux.resize(npixAper);
-    pixelsAper_back.resize(npixAper);
-    pixelsAper_weight.fill(1.0, npixAper);     // fill vector with dummy weight (if weight map is not available, e.g. during background object masking)
-    pixelsAper_x.resize(npixAper);
-    pixelsAper_y.resize(npixAper);
-    long k = 0;
+    QVector<double> fluxSum(numAper, 0.);
+    QVector<double> varianceSum(numAper, 0.);
     for (long j=yminAper; j<=ymaxAper; ++j) {
+        // pixel edges relative to the centroid
+        const double dy0 = j - 0.5 - Y;
+        const double dy1 = j + 0.5 - Y;
+        const double dyNear = dy0 > 0. ? dy0 : (dy1 < 0. ? -dy1 : 0.);
+        const double dyFar = std::max(fabs(dy0), fabs(dy1));
         for (long i=xminAper; i<=xmaxAper; ++i) {
-            pixelsAper_flux[k] = dataMeasure.at(i+naxis1*j);
-            pixelsAper_back[k] = dataBackground.at(i+naxis1*j);
-            if (weightInMemory) pixelsAper_weight[k] = dataWeight.at(i+naxis1*j);           // update weight if weight map is available
-            pixelsAper_x[k] = i;
-            pixelsAper_y[k] = j;
-            ++k;
-        }
-    }
-
-    // We use a 4 times sub-sampled grid for finer resolution for compact objects smaller than 10 pixels
-    int s = 0;
-    if (XMAX-XMIN <= 10 && YMAX - YMIN <= 10) s = 4;
-    else s = 1;
-
-    // The measurement window is defined by the aperture
-    long nn = (xmaxAper-xminAper+1) * s;
-    long mm = (ymaxAper-yminAper+1) * s;
-    QVector<double> dataSub(nn*mm, 0);
-    QVector<double> backSub(nn*mm, 0);
-    QVector<double> weightSub(nn*mm, 0);
-
-    // Subsample the original pixel data. The window is the minimum rectangular envelope
-    long dim = pixelsAper_flux.length();
-    for (long k=0; k<dim; ++k) {
-        double flux = pixelsAper_flux.at(k);
-        double back = pixelsAper_back.at(k);
-        double weight = pixelsAper_weight.at(k);
-        double spx = s*(pixelsAper_x.at(k)-xminAper);
-        double spy = s*(pixelsAper_y.at(k)-yminAper);
-        for (int ss1=0; ss1<s; ++ss1) {
-            long jj = spy + ss1;
-            for (int ss2=0; ss2<s; ++ss2) {
-                long ii = spx + ss2;
-                dataSub[ii+nn*jj] = flux;
-                backSub[ii+nn*jj] = back;
-                weightSub[ii+nn*jj] = weight;
+            const double dx0 = i - 0.5 - X;
+            const double dx1 = i + 0.5 - X;
+            const double dxNear = dx0 > 0. ? dx0 : (dx1 < 0. ? -dx1 : 0.);
+            const double dxFar = std::max(fabs(dx0), fabs(dx1));
+            const double rsqNear = dxNear*dxNear + dyNear*dyNear;
+            const double rsqFar = dxFar*dxFar + dyFar*dyFar;
+            if (rsqNear >= rmax*rmax) continue;
+            const long index = i+naxis1*j;
+            const double flux = dataMeasure.at(index);
+            const double back = dataBackground.at(index);
+            const double weight = weightInMemory ? dataWeight.at(index) : 1.0;   // no weight map e.g. during background object masking
+            bool inside = false;
+            for (int k=0; k<numAper; ++k) {
+                const double r = radius.at(k);
+                if (rsqNear >= r*r) continue;
+                // fully inside, or partially
+                const double overlap = rsqFar <= r*r ? 1. : circularOverlap(dx0, dy0, dx1, dy1, r);
+                if (overlap <= 0.) continue;
+                fluxSum[k] += overlap * flux;
+                varianceSum[k] += overlap * (back/gain + flux/gain);
+                inside = true;
             }
-        }
-    }
-
-    // The object centroid in the subsampled coordinate system
-    double xcen = (X-xminAper) * double(s);
-    double ycen = (Y-yminAper) * double(s);
-
-    double fluxAper = 0.;
-    double fluxErrAper = 0.;
-    for (long j=0; j<=ycen*2; ++j) {
-        double jj = double(j);
-        for (long i=0; i<=xcen*2; ++i) {
-            double ii = double(i);
-            if (ii<0 || ii>=nn || jj<0 || jj>=mm) continue;
-            double rsq = (xcen-ii)*(xcen-ii) + (ycen-jj)*(ycen-jj);
-            if (rsq <= 0.25*aperture*aperture*s*s) {
-                fluxAper += dataSub[ii+nn*jj];
-                fluxErrAper += backSub[ii+nn*jj]/gain + dataSub[ii+nn*jj]/gain;
-                if (weightSub[ii+nn*jj] == 0.) bitflags.setBit(5,true);
-                if (dataSub[ii+nn*jj] > saturationValue) bitflags.setBit(2,true);
-                dataSub[ii+nn*jj] = 0.;     // just making sure we don't count a pixel twice
+            if (inside) {
+                if (weight == 0.) bitflags.setBit(5,true);
+                if (flux > saturationValue) bitflags.setBit(2,true);
             }
         }
     }
 
-    // correct for subsampling of aperture
-    fluxAper = fluxAper / (s*s);
-    fluxErrAper = fluxErrAper / (s*s);
-
-    fluxErrAper = sqrt(fluxErrAper);
-    double magAper = -2.5*log10(fluxAper) + ZP;
-    double magErrAper = 99.;
-    if (fluxAper > 0.) magErrAper = 2.5*log10(1.+fluxErrAper/fluxAper);
-    QVector<double> result;
-    result << fluxAper << fluxErrAper << magAper << magErrAper;
-    if ((fluxAper < 0. || std::isnan(magErrAper))) {
-        bitflags.setBit(7,true);
-        badDetection = true;
-    }
-
-    return result;
-}
-
-void DetectedObject::calcApertureMagnitudes()
-{
-    if (badDetection) return;
-
-    if (apertures.isEmpty()) return;
-
-    FLUX_APER.reserve(apertures.length());
-    MAG_APER.reserve(apertures.length());
-    FLUXERR_APER.reserve(apertures.length());
-    MAGERR_APER.reserve(apertures.length());
-
-    QVector<double> result;
-    for (auto &aperture : apertures) {
-        result = calcFluxAper(aperture);
-        FLUX_APER.append(result[0]);
-        FLUXERR_APER.append(result[1]);
-        MAG_APER.append(result[2]);
-        MAGERR_APER.append(result[3]);
+    FLUX_APER.reserve(numAper);
+    MAG_APER.reserve(numAper);
+    FLUXERR_APER.reserve(numAper);
+    MAGERR_APER.reserve(numAper);
+
+    for (int k=0; k<numAper; ++k) {
+        double fluxAper = fluxSum.at(k);
+        double fluxErrAper = sqrt(varianceSum.at(k));
+        double magAper = -2.5*log10(fluxAper) + ZP;
+        double magErrAper = 99.;
+        if (fluxAper > 0.) magErrAper = 2.5*log10(1.+fluxErrAper/fluxAper);
+        if ((fluxAper < 0. || std::isnan(magErrAper))) {
+            bitflags.setBit(7,true);
+            badDetection = true;
+        }
+        FLUX_APER.append(fluxAper);
+        FLUXERR_APER.append(fluxErrAper);
+        MAG_APER.append(magAper);
+        MAGERR_APER.append(magErrAper);
     }
 }
 
@@ -516,24 +535,6 @@ void DetectedObject::calcWindowedMomentsErrors()
     if (ERRTHETAWIN < 0.01) ERRTHETAWIN = 0.01;
 }
 
-void DetectedObject::calcSkyCoords()
-{
-    if (badDetection) return;
-
-    double world[2];
-    double phi;
-    double theta;
-    double imgcrd[2];
-    double pixcrd[2];
-    // CAREFUL! wcslib starts pixels counting at 1, hence must add +1 to zero-indexed C++ vectors
-    pixcrd[0] = XWIN + 1.;
-    pixcrd[1] = YWIN + 1.;
-    int stat[1];
-    wcsp2s(&wcs, 1, 2, pixcrd, imgcrd, &phi, &theta, world, stat);
-    ALPHA_J2000 = world[0];
-    DELTA_J2000 = world[1];
-}
-
 void DetectedObject::calcEllipticity()
 {
   //  if (badDetection) return;
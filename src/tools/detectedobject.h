@@ -20,15 +20,16 @@ If not, see https://www.gnu.org/licenses/ .
 #ifndef DETECTEDOBJECT_H
 #define DETECTEDOBJECT_H
 
-#include <QObject>
+#include <QList>
 #include <QVector>
 #include<QBitArray>
 
-#include "wcs.h"
+#include "bitmask.h"
 
-class DetectedObject : public QObject
+// Measures a single detected object. Not a QObject, so that objects can be created cheaply
+// (on the stack, in parallel) while measuring an image; the results end up in a DetectionCatalog.
+class DetectedObject
 {
-    Q_OBJECT
     void calcFlux();
     void calcMoments();
     void calcMomentsErrors();
@@ -38,10 +39,8 @@ class DetectedObject : public QObject
     void calcWindowedMomentsErrors();
     void calcMagAuto();
     void getWindowedPixels();
-    void calcSkyCoords();
     void calcWindowedEllipticity();
     void filterSpuriousDetections();
-    QVector<double> calcFluxAper(float aperture);
     void calcApertureMagnitudes();
     void correctOriginOffset();
     void calcFWHM();
@@ -49,22 +48,21 @@ class DetectedObject : public QObject
 
 public:
     explicit DetectedObject(const QList<long> &objectIndices, const QVector<float> &data, const QVector<float> &background,
-                            const QVector<float> &weight, const QVector<bool> &mask, bool weightinmemory,
-                            const long naxis1, const long naxis2, const long objid, const float satVal, const float gainval,
-                            wcsprm &wcsImage, QObject *parent = nullptr);
+                            const QVector<float> &weight, const BitMask &mask, bool weightinmemory,
+                            const long naxis1, const long naxis2, const long objid, const float satVal, const float gainval);
     ~DetectedObject();
 
+    void computeObjectParams();          // re-entrant; objects may be measured in parallel
+
     const QVector<float> &dataMeasure;
     const QVector<float> &dataBackground;
     const QVector<float> &dataWeight;
-    const QVector<bool> &mask;
+    const BitMask &mask;
 
     bool badDetection = false;   // set if anything goes wrong with an object parameter's calculation
     bool globalMaskAvailable = true;   // the default for internal processing (but not for external images, e.g. abs zeropoint)
     bool weightInMemory = true;
 
-    wcsprm &wcs;
-
     // Moments and shapes
     // Using Source Extractor naming style for easier recognition
 
@@ -160,22 +158,13 @@ public:
     QVector<float> pixelsWin_weight;
 
     QVector<float> apertures;
-    QVector<long> pixelsAper_x;
-    QVector<long> pixelsAper_y;
-    QVector<float> pixelsAper_flux;
-    QVector<float> pixelsAper_back;
-    QVector<float> pixelsAper_weight;
 
     long naxis1 = 0;  // image geometry, needed to respect boundaries
     long naxis2 = 0;
 
     double rad = 3.14159265/180.;
 
-    void computeObjectParams();
     void remove();
-signals:
-
-public slots:
 };
 
 #endif // DETECTEDOBJECT_H
@@ -0,0 +1,146 @@
+/*
+Copyright (C) 2019 Mischa Schirmer
+
+This file is part of THELI.
+
+THELI is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free
+Software Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program in the LICENSE file.
+If not, see https://www.gnu.org/licenses/ .
+*/
+
+
+#include "detectioncatalog.h"
+#include "detectedobject.h"
+
+void DetectionCatalog::clear()
+{
+    resize(0, 0);
+    for (auto *column : {&X, &Y, &A, &B, &CXX, &CYY, &CXY,
+         &XWIN, &YWIN, &AWIN, &BWIN, &THETAWIN, &ERRAWIN, &ERRBWIN, &ERRTHETAWIN,
+         &MAG_AUTO, &MAGERR_AUTO, &FLUX_AUTO, &FLUX_RADIUS, &FWHM, &ELLIPTICITY,
+         &ALPHA_J2000, &DELTA_J2000}) {
+        column->squeeze();
+    }
+    FLAGS.squeeze();
+    badDetection.squeeze();
+    MAG_APER.squeeze();
+    MAGERR_APER.squeeze();
+}
+
+void DetectionCatalog::resize(const long n, const int numApertures)
+{
+    numObjects = n;
+    for (auto *column : {&X, &Y, &A, &B, &CXX, &CYY, &CXY,
+         &XWIN, &YWIN, &AWIN, &BWIN, &THETAWIN, &ERRAWIN, &ERRBWIN, &ERRTHETAWIN,
+         &MAG_AUTO, &MAGERR_AUTO, &FLUX_AUTO, &FLUX_RADIUS, &FWHM, &ELLIPTICITY,
+         &ALPHA_J2000, &DELTA_J2000}) {
+        column->fill(0., n);
+    }
+    FLAGS.fill(0, n);
+    badDetection.fill(false, n);
+    MAG_APER.resize(numApertures);
+    MAGERR_APER.resize(numApertures);
+    for (auto &column : MAG_APER) column.fill(0., n);
+    for (auto &column : MAGERR_APER) column.fill(0., n);
+}
+
+// The columns are not reallocated here, hence different rows can be set from different threads
+void DetectionCatalog::setRow(const long i, const DetectedObject &object)
+{
+    X[i] = object.X;
+    Y[i] = object.Y;
+    A[i] = object.A;
+    B[i] = object.B;
+    CXX[i] = object.CXX;
+    CYY[i] = object.CYY;
+    CXY[i] = object.CXY;
+    XWIN[i] = object.XWIN;
+    YWIN[i] = object.YWIN;
+    AWIN[i] = object.AWIN;
+    BWIN[i] = object.BWIN;
+    THETAWIN[i] = object.THETAWIN;
+    ERRAWIN[i] = object.ERRAWIN;
+    ERRBWIN[i] = object.ERRBWIN;
+    ERRTHETAWIN[i] = object.ERRTHETAWIN;
+    MAG_AUTO[i] = object.MAG_AUTO;
+    MAGERR_AUTO[i] = object.MAGERR_AUTO;
+    FLUX_AUTO[i] = object.FLUX_AUTO;
+    FLUX_RADIUS[i] = object.FLUX_RADIUS;
+    FWHM[i] = object.FWHM;
+    ELLIPTICITY[i] = object.ELLIPTICITY;
+    for (int k=0; k<MAG_APER.length() && k<object.MAG_APER.length(); ++k) {
+        MAG_APER[k][i] = object.MAG_APER.at(k);
+        MAGERR_APER[k][i] = object.MAGERR_APER.at(k);
+    }
+    FLAGS[i] = object.FLAGS;
+    badDetection[i] = object.badDetection;
+}
+
+// Sky coordinates for all good detections in a single wcslib call
+void DetectionCatalog::calcSkyCoords(wcsprm *wcs)
+{
+    QVector<long> rows;
+    rows.reserve(numObjects);
+    for (long i=0; i<numObjects; ++i) {
+        if (!badDetection.at(i)) rows.append(i);
+    }
+    const long ncoord = rows.length();
+    if (ncoord == 0) return;
+
+    QVector<double> pixcrd(2*ncoord);
+    QVector<double> imgcrd(2*ncoord);
+    QVector<double> world(2*ncoord);
+    QVector<double> phi(ncoord);
+    QVector<double> theta(ncoord);
+    QVector<int> stat(ncoord);
+    // CAREFUL! wcslib starts pixels counting at 1, hence must add +1 to zero-indexed C++ vectors
+    for (long k=0; k<ncoord; ++k) {
+        pixcrd[2*k] = XWIN.at(rows.at(k)) + 1.;
+        pixcrd[2*k+1] = YWIN.at(rows.at(k)) + 1.;
+    }
+    wcsp2s(wcs, ncoord, 2, pixcrd.data(), imgcrd.data(), phi.data(), theta.data(), world.data(), stat.data());
+    for (long k=0; k<ncoord; ++k) {
+        ALPHA_J2000[rows.at(k)] = world.at(2*k);
+        DELTA_J2000[rows.at(k)] = world.at(2*k+1);
+    }
+}
+
+QVector<double> DetectionCatalog::magAper(const long i) const
+{
+    QVector<double> mag;
+    for (auto &column : MAG_APER) mag.append(column.at(i));
+    return mag;
+}
+
+QVector<double> DetectionCatalog::magerrAper(const long i) const
+{
+    QVector<double> magerr;
+    for (auto &column : MAGERR_APER) magerr.append(column.at(i));
+    return magerr;
+}
+
+// The objects that enter the iview, anet and scamp catalogs
+QVector<long> DetectionCatalog::selectRows(const float minFWHM, const float maxFlag) const
+{
+    QVector<long> rows;
+    rows.reserve(numObjects);
+    for (long i=0; i<numObjects; ++i) {
+        if (3.*AWIN.at(i) >= minFWHM && FLAGS.at(i) <= maxFlag && FLUX_AUTO.at(i) > 0.) rows.append(i);
+    }
+    return rows;
+}
+
+long DetectionCatalog::memoryFootprint() const
+{
+    long numColumns = 23 + 2*MAG_APER.length();
+    return numColumns * X.capacity() * sizeof(double) + FLAGS.capacity() * sizeof(int) + badDetection.capacity();
+}
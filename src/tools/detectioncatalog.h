@@ -0,0 +1,95 @@
+/*
+Copyright (C) 2019 Mischa Schirmer
+
+This file is part of THELI.
+
+THELI is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free
+Software Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program in the LICENSE file.
+If not, see https://www.gnu.org/licenses/ .
+*/
+
+
+#ifndef DETECTIONCATALOG_H
+#define DETECTIONCATALOG_H
+
+#include <QVector>
+
+#include "wcs.h"
+
+class DetectedObject;
+
+// The objects detected in an image, stored column-wise: one contiguous array per parameter,
+// row i of each column belongs to the same object. Filled by MyImage::segmentImage().
+// Using Source Extractor naming style for easier recognition.
+// WARNING: X, Y, XWIN and YWIN are zero-indexed, must add +1 if used externally
+class DetectionCatalog
+{
+public:
+    long length() const {return numObjects;}
+    bool isEmpty() const {return numObjects == 0;}
+    void clear();
+    void resize(const long n, const int numApertures);
+    void setRow(const long i, const DetectedObject &object);    // rows can be set in parallel after resize()
+    void calcSkyCoords(wcsprm *wcs);
+    QVector<double> magAper(const long i) const;                // MAG_APER of all apertures for object i
+    QVector<double> magerrAper(const long i) const;
+    QVector<long> selectRows(const float minFWHM, const float maxFlag) const;
+    long memoryFootprint() const;
+
+    // The values of 'column' for the given rows (plus an offset), e.g. to write a FITS table column
+    template<class T>
+    static QVector<T> gather(const QVector<double> &column, const QVector<long> &rows, const double offset = 0.)
+    {
+        QVector<T> values(rows.length());
+        for (long k=0; k<rows.length(); ++k) values[k] = column.at(rows.at(k)) + offset;
+        return values;
+    }
+
+    // ISOPHOTAL
+    QVector<double> X;
+    QVector<double> Y;
+    QVector<double> A;
+    QVector<double> B;
+    QVector<double> CXX;
+    QVector<double> CYY;
+    QVector<double> CXY;
+
+    // WINDOWED
+    QVector<double> XWIN;
+    QVector<double> YWIN;
+    QVector<double> AWIN;
+    QVector<double> BWIN;
+    QVector<double> THETAWIN;
+    QVector<double> ERRAWIN;
+    QVector<double> ERRBWIN;
+    QVector<double> ERRTHETAWIN;
+    QVector<double> MAG_AUTO;
+    QVector<double> MAGERR_AUTO;
+    QVector<double> FLUX_AUTO;
+    QVector<double> FLUX_RADIUS;
+    QVector<double> FWHM;
+    QVector<double> ELLIPTICITY;
+
+    // APERTURE, [aperture][object]
+    QVector<QVector<double>> MAG_APER;
+    QVector<QVector<double>> MAGERR_APER;
+
+    QVector<double> ALPHA_J2000;
+    QVector<double> DELTA_J2000;
+    QVector<int> FLAGS;
+    QVector<bool> badDetection;
+
+private:
+    long numObjects = 0;
+};
+
+#endif // DETECTIONCATALOG_H
@@ -0,0 +1,268 @@
+/*
+Copyright (C) 2019 Mischa Schirmer
+
+This file is part of THELI.
+
+THELI is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free
+Software Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program in the LICENSE file.
+If not, see https://www.gnu.org/licenses/ .
+*/
+
+
+#include "detectionfilter.h"
+
+#include <omp.h>
+#include <algorithm>
+#include <cmath>
+
+#include <QFile>
+#include <QTextStream>
+#include <QStringList>
+
+DetectionFilter::DetectionFilter()
+{
+    QVector<float> allGround = {1., 2., 1.,
+                                2., 4., 2.,
+                                1., 2., 1.};
+    setKernel(allGround, 3, 3, true);
+}
+
+DetectionFilter DetectionFilter::gaussian(const float fwhm, const int size)
+{
+    DetectionFilter filter;
+    const int s = size / 2;
+    const float sigma = fwhm / 2.3548;
+    QVector<float> coefficients;
+    for (int j=-s; j<=s; ++j) {
+        for (int i=-s; i<=s; ++i) {
+            coefficients.append(exp(-0.5 * (i*i + j*j) / (sigma*sigma)));
+        }
+    }
+    filter.setKernel(coefficients, 2*s+1, 2*s+1, true);
+    return filter;
+}
+
+DetectionFilter DetectionFilter::tophat(const float radius, const int size)
+{
+    DetectionFilter filter;
+    const int s = size / 2;
+    QVector<float> coefficients;
+    for (int j=-s; j<=s; ++j) {
+        for (int i=-s; i<=s; ++i) {
+            coefficients.append(i*i + j*j <= radius*radius ? 1. : 0.);
+        }
+    }
+    filter.setKernel(coefficients, 2*s+1, 2*s+1, true);
+    return filter;
+}
+
+// Source Extractor format: "CONV NORM" or "CONV NONORM", followed by the rows of the mask; '#' starts a comment
+bool DetectionFilter::readFile(const QString &fileName, QString &errorMessage)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        errorMessage = "DetectionFilter::readFile(): Could not open " + fileName;
+        return false;
+    }
+
+    QTextStream stream(&file);
+    bool headerFound = false;
+    bool normalise = true;
+    int width = 0;
+    int height = 0;
+    QVector<float> coefficients;
+    while (!stream.atEnd()) {
+        QString line = stream.readLine();
+        line = line.left(line.indexOf('#')).simplified();
+        if (line.isEmpty()) continue;
+        if (!headerFound) {
+            if (!line.startsWith("CONV")) break;
+            normalise = !line.contains("NONORM");
+            headerFound = true;
+            continue;
+        }
+        QStringList values = line.split(' ');
+        if (width == 0) width = values.length();
+        if (values.length() != width) {
+            errorMessage = "DetectionFilter::readFile(): Rows of different length in " + fileName;
+            return false;
+        }
+        for (auto &value : values) {
+            bool ok = false;
+            coefficients.append(value.toFloat(&ok));
+            if (!ok) {
+                errorMessage = "DetectionFilter::readFile(): Invalid entry '" + value + "' in " + fileName;
+                return false;
+            }
+        }
+        ++height;
+    }
+    file.close();
+
+    if (!headerFound || width == 0) {
+        errorMessage = "DetectionFilter::readFile(): " + fileName + " is not a convolution mask";
+        return false;
+    }
+    if (width % 2 == 0 || height % 2 == 0) {
+        errorMessage = "DetectionFilter::readFile(): " + fileName + " must have odd dimensions";
+        return false;
+    }
+
+    setKernel(coefficients, width, height, normalise);
+    return true;
+}
+
+// 'name' is "default", a Source Extractor style name such as "gauss_3.0_7x7" (FWHM) or "tophat_2.5_5x5" (diameter),
+// or the name of a .conv file
+bool DetectionFilter::setup(const QString &name, QString &errorMessage)
+{
+    if (name.isEmpty() || name == "default") {
+        *this = DetectionFilter();
+        return true;
+    }
+
+    QStringList parts = name.split('_');
+    if (parts.length() == 3 && (parts[0] == "gauss" || parts[0] == "tophat")) {
+        bool okWidth = false;
+        bool okSize = false;
+        const float width = parts[1].toFloat(&okWidth);
+        const QStringList dims = parts[2].split('x');
+        const int size = dims[0].toInt(&okSize);
+        if (!okWidth || !okSize || width <= 0. || size < 1 || size % 2 == 0
+                || dims.length() != 2 || dims[1] != dims[0]) {
+            errorMessage = "DetectionFilter::setup(): Invalid convolution mask " + name;
+            return false;
+        }
+        if (parts[0] == "gauss") *this = gaussian(width, size);
+        else *this = tophat(0.5*width, size);
+        return true;
+    }
+
+    return readFile(name, errorMessage);
+}
+
+void DetectionFilter::setKernel(const QVector<float> &coefficients, const int width, const int height, const bool normalise)
+{
+    nx = width;
+    ny = height;
+    kernel = coefficients;
+
+    if (normalise) {
+        double sum = 0.;
+        for (auto &k : kernel) sum += k;
+        if (sum != 0.) {
+            for (auto &k : kernel) k /= sum;
+        }
+    }
+
+    // Separable if the mask is the outer product of its row and column through the largest coefficient
+    long kmax = 0;
+    for (long k=0; k<kernel.length(); ++k) {
+        if (fabs(kernel[k]) > fabs(kernel[kmax])) kmax = k;
+    }
+    const float pivot = kernel[kmax];
+    const int imax = kmax % nx;
+    const int jmax = kmax / nx;
+    kernelX.resize(nx);
+    kernelY.resize(ny);
+    for (int i=0; i<nx; ++i) kernelX[i] = kernel[i+nx*jmax];
+    for (int j=0; j<ny; ++j) kernelY[j] = pivot != 0. ? kernel[imax+nx*j] / pivot : 0.;
+    separable = pivot != 0.;
+    for (int j=0; j<ny && separable; ++j) {
+        for (int i=0; i<nx; ++i) {
+            if (fabs(kernel[i+nx*j] - kernelY[j]*kernelX[i]) > 1.e-5 * fabs(pivot)) {
+                separable = false;
+                break;
+            }
+        }
+    }
+    if (!separable) {
+        kernelX.clear();
+        kernelY.clear();
+    }
+}
+
+QVector<float> DetectionFilter::convolve(const QVector<float> &data, const long n, const long m, const int nthreads) const
+{
+    QVector<float> dataConv(n*m, 0.);
+    if (n < nx || m < ny) return dataConv;
+
+    if (separable) convolveSeparable(data.constData(), dataConv.data(), n, m, nthreads);
+    else convolveDirect(data.constData(), dataConv.data(), n, m, nthreads);
+
+    return dataConv;
+}
+
+// Horizontal pass into a ring buffer holding the last 'ny' rows, then a vertical pass over the ring buffer.
+// Each thread works on a contiguous block of output rows.
+void DetectionFilter::convolveSeparable(const float *in, float *out, const long n, const long m, const int nthreads) const
+{
+    const int sx = nx / 2;
+    const int sy = ny / 2;
+    const float *kx = kernelX.constData();
+    const float *ky = kernelY.constData();
+
+#pragma omp parallel num_threads(nthreads)
+    {
+        const int numThreads = omp_get_num_threads();
+        const int thread = omp_get_thread_num();
+        const long jmin = sy + thread * (m - 2*sy) / numThreads;
+        const long jmax = sy + (thread+1) * (m - 2*sy) / numThreads;
+
+        QVector<float> ringBuffer(ny*n);
+        float *ring = ringBuffer.data();
+        long nextRow = jmin - sy;                       // the next input row to be filtered horizontally
+
+        for (long j=jmin; j<jmax; ++j) {
+            for (; nextRow<=j+sy; ++nextRow) {
+                const float *src = in + n*nextRow;
+                float *dst = ring + n*(nextRow % ny);
+                std::fill(dst, dst+n, 0.f);
+                for (int dx=0; dx<nx; ++dx) {
+                    const float k = kx[dx];
+                    const float *shifted = src + dx - sx;
+#pragma omp simd
+                    for (long i=sx; i<n-sx; ++i) dst[i] += k * shifted[i];
+                }
+            }
+            float *dst = out + n*j;
+            for (int dy=0; dy<ny; ++dy) {
+                const float k = ky[dy];
+                const float *src = ring + n*((j+dy-sy) % ny);
+#pragma omp simd
+                for (long i=sx; i<n-sx; ++i) dst[i] += k * src[i];
+            }
+        }
+    }
+}
+
+void DetectionFilter::convolveDirect(const float *in, float *out, const long n, const long m, const int nthreads) const
+{
+    const int sx = nx / 2;
+    const int sy = ny / 2;
+    const float *kptr = kernel.constData();
+
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+    for (long j=sy; j<m-sy; ++j) {
+        float *dst = out + n*j;
+        for (int dy=0; dy<ny; ++dy) {
+            const float *src = in + n*(j+dy-sy);
+            for (int dx=0; dx<nx; ++dx) {
+                const float k = kptr[dx+nx*dy];
+                if (k == 0.) continue;
+                const float *shifted = src + dx - sx;
+#pragma omp simd
+                for (long i=sx; i<n-sx; ++i) dst[i] += k * shifted[i];
+            }
+        }
+    }
+}
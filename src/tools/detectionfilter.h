@@ -0,0 +1,62 @@
+/*
+Copyright (C) 2019 Mischa Schirmer
+
+This file is part of THELI.
+
+THELI is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free
+Software Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program in the LICENSE file.
+If not, see https://www.gnu.org/licenses/ .
+*/
+
+
+// Convolution masks for object detection, in the format of Source Extractor's filter files
+// (e.g. config/default.conv). Separable masks (such as Gaussians and the default "all-ground" mask)
+// are applied as two 1D passes; other masks (such as top-hats) row by row. Both use vectorised
+// row kernels and run multithreaded over image rows. Pixels closer to the image border than
+// half the mask width are set to zero.
+
+#ifndef DETECTIONFILTER_H
+#define DETECTIONFILTER_H
+
+#include <QString>
+#include <QVector>
+
+class DetectionFilter
+{
+public:
+    DetectionFilter();        // 3x3 "all-ground" mask with FWHM = 2 pixels, same as config/default.conv
+
+    static DetectionFilter gaussian(const float fwhm, const int size);
+    static DetectionFilter tophat(const float radius, const int size);
+    bool readFile(const QString &fileName, QString &errorMessage);
+    bool setup(const QString &name, QString &errorMessage);
+
+    int width() const {return nx;}
+    int height() const {return ny;}
+    bool isSeparable() const {return separable;}
+
+    QVector<float> convolve(const QVector<float> &data, const long n, const long m, const int nthreads) const;
+
+private:
+    int nx = 0;                   // mask dimensions (odd)
+    int ny = 0;
+    QVector<float> kernel;        // [ny][nx], normalised unless read from a NONORM file
+    bool separable = false;
+    QVector<float> kernelX;       // kernel = kernelY x kernelX, if separable
+    QVector<float> kernelY;
+
+    void setKernel(const QVector<float> &coefficients, const int width, const int height, const bool normalise);
+    void convolveSeparable(const float *in, float *out, const long n, const long m, const int nthreads) const;
+    void convolveDirect(const float *in, float *out, const long n, const long m, const int nthreads) const;
+};
+
+#endif // DETECTIONFILTER_H
@@ -0,0 +1,317 @@
+/*
+Copyright (C) 2019 Mischa Schirmer
+
+This file is part of THELI.
+
+THELI is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free
+Software Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program in the LICENSE file.
+If not, see https://www.gnu.org/licenses/ .
+*/
+
+#include "medianfilter.h"
+
+#include <QVector>
+
+#include <omp.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// Median sorting networks (Paeth; Devillard). Destroy the input.
+// min/max instead of a conditional swap, such that the networks compile without branches
+#define PIX_SORT(a,b) { const float tmp = std::min((a),(b)); (b) = std::max((a),(b)); (a) = tmp; }
+
+static inline float median9(float *p)
+{
+    PIX_SORT(p[1], p[2]); PIX_SORT(p[4], p[5]); PIX_SORT(p[7], p[8]);
+    PIX_SORT(p[0], p[1]); PIX_SORT(p[3], p[4]); PIX_SORT(p[6], p[7]);
+    PIX_SORT(p[1], p[2]); PIX_SORT(p[4], p[5]); PIX_SORT(p[7], p[8]);
+    PIX_SORT(p[0], p[3]); PIX_SORT(p[5], p[8]); PIX_SORT(p[4], p[7]);
+    PIX_SORT(p[3], p[6]); PIX_SORT(p[1], p[4]); PIX_SORT(p[2], p[5]);
+    PIX_SORT(p[4], p[7]); PIX_SORT(p[4], p[2]); PIX_SORT(p[6], p[4]);
+    PIX_SORT(p[4], p[2]);
+    return p[4];
+}
+
+static inline float median25(float *p)
+{
+    PIX_SORT(p[0], p[1]);   PIX_SORT(p[3], p[4]);   PIX_SORT(p[2], p[4]);
+    PIX_SORT(p[2], p[3]);   PIX_SORT(p[6], p[7]);   PIX_SORT(p[5], p[7]);
+    PIX_SORT(p[5], p[6]);   PIX_SORT(p[9], p[10]);  PIX_SORT(p[8], p[10]);
+    PIX_SORT(p[8], p[9]);   PIX_SORT(p[12], p[13]); PIX_SORT(p[11], p[13]);
+    PIX_SORT(p[11], p[12]); PIX_SORT(p[15], p[16]); PIX_SORT(p[14], p[16]);
+    PIX_SORT(p[14], p[15]); PIX_SORT(p[18], p[19]); PIX_SORT(p[17], p[19]);
+    PIX_SORT(p[17], p[18]); PIX_SORT(p[21], p[22]); PIX_SORT(p[20], p[22]);
+    PIX_SORT(p[20], p[21]); PIX_SORT(p[23], p[24]); PIX_SORT(p[2], p[5]);
+    PIX_SORT(p[3], p[6]);   PIX_SORT(p[0], p[6]);   PIX_SORT(p[0], p[3]);
+    PIX_SORT(p[4], p[7]);   PIX_SORT(p[1], p[7]);   PIX_SORT(p[1], p[4]);
+    PIX_SORT(p[11], p[14]); PIX_SORT(p[8], p[14]);  PIX_SORT(p[8], p[11]);
+    PIX_SORT(p[12], p[15]); PIX_SORT(p[9], p[15]);  PIX_SORT(p[9], p[12]);
+    PIX_SORT(p[13], p[16]); PIX_SORT(p[10], p[16]); PIX_SORT(p[10], p[13]);
+    PIX_SORT(p[20], p[23]); PIX_SORT(p[17], p[23]); PIX_SORT(p[17], p[20]);
+    PIX_SORT(p[21], p[24]); PIX_SORT(p[18], p[24]); PIX_SORT(p[18], p[21]);
+    PIX_SORT(p[19], p[22]); PIX_SORT(p[8], p[17]);  PIX_SORT(p[9], p[18]);
+    PIX_SORT(p[0], p[18]);  PIX_SORT(p[0], p[9]);   PIX_SORT(p[10], p[19]);
+    PIX_SORT(p[1], p[19]);  PIX_SORT(p[1], p[10]);  PIX_SORT(p[11], p[20]);
+    PIX_SORT(p[2], p[20]);  PIX_SORT(p[2], p[11]);  PIX_SORT(p[12], p[21]);
+    PIX_SORT(p[3], p[21]);  PIX_SORT(p[3], p[12]);  PIX_SORT(p[13], p[22]);
+    PIX_SORT(p[4], p[22]);  PIX_SORT(p[4], p[13]);  PIX_SORT(p[14], p[23]);
+    PIX_SORT(p[5], p[23]);  PIX_SORT(p[5], p[14]);  PIX_SORT(p[15], p[24]);
+    PIX_SORT(p[6], p[24]);  PIX_SORT(p[6], p[15]);  PIX_SORT(p[7], p[16]);
+    PIX_SORT(p[7], p[19]);  PIX_SORT(p[13], p[21]); PIX_SORT(p[15], p[23]);
+    PIX_SORT(p[7], p[13]);  PIX_SORT(p[7], p[15]);  PIX_SORT(p[1], p[9]);
+    PIX_SORT(p[3], p[11]);  PIX_SORT(p[5], p[17]);  PIX_SORT(p[11], p[17]);
+    PIX_SORT(p[9], p[17]);  PIX_SORT(p[4], p[10]);  PIX_SORT(p[6], p[12]);
+    PIX_SORT(p[7], p[14]);  PIX_SORT(p[4], p[6]);   PIX_SORT(p[4], p[7]);
+    PIX_SORT(p[12], p[14]); PIX_SORT(p[10], p[14]); PIX_SORT(p[6], p[7]);
+    PIX_SORT(p[10], p[12]); PIX_SORT(p[6], p[10]);  PIX_SORT(p[6], p[17]);
+    PIX_SORT(p[12], p[17]); PIX_SORT(p[7], p[17]);  PIX_SORT(p[7], p[10]);
+    PIX_SORT(p[12], p[18]); PIX_SORT(p[7], p[12]);  PIX_SORT(p[10], p[18]);
+    PIX_SORT(p[12], p[20]); PIX_SORT(p[10], p[20]); PIX_SORT(p[10], p[12]);
+    return p[12];
+}
+
+#undef PIX_SORT
+
+// Median of the valid pixels in the window around (i,j), the general case
+static inline float windowMedian(const float *in, const long n, const long m, const long i, const long j,
+                                 const int r, const BitMask &mask, float *buffer)
+{
+    const long imin = std::max(0L, i-r);
+    const long imax = std::min(n-1, i+r);
+    const long jmin = std::max(0L, j-r);
+    const long jmax = std::min(m-1, j+r);
+    long k = 0;
+    const bool masked = !mask.isEmpty();
+    for (long jt=jmin; jt<=jmax; ++jt) {
+        for (long it=imin; it<=imax; ++it) {
+            const long t = it+n*jt;
+            if (masked && mask.at(t)) continue;
+            buffer[k++] = in[t];
+        }
+    }
+    std::sort(buffer, buffer+k);
+    return (k % 2) ? buffer[k/2] : (buffer[k/2-1] + buffer[k/2]) * 0.5f;
+}
+
+// Radius 1 and 2: rows in parallel. Sorting networks where the window lies inside the image and contains
+// no masked pixels; the mask is checked word-wise for groups of neighbouring pixels.
+template<int R>
+static void medianFilterSmall_T(const float *in, float *out, const long n, const long m,
+                                const BitMask &mask, const int nthreads)
+{
+    const long group = 16;
+    const int S = 2*R+1;
+    const bool masked = !mask.isEmpty();
+
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic, 16)
+    for (long j=0; j<m; ++j) {
+        float window[(2*R+1)*(2*R+1)];
+        const bool interiorRow = j >= R && j < m-R;
+        // If no pixel in rows j-R ... j+R is masked, then no window in this row needs to be checked
+        bool clean = !masked;
+        if (masked && interiorRow) clean = mask.nextMasked(n*(j-R)) >= n*(j+R+1);
+        long i = 0;
+        while (i < n) {
+            // Group of pixels i ... i+group-1, whose windows cover columns i-R ... i+group-1+R
+            bool network = interiorRow && i >= R && i+group-1+R < n;
+            if (network && !clean) {
+                for (long jt=j-R; jt<=j+R && network; ++jt) {
+                    network = mask.nextMasked(i-R+n*jt) > i+group-1+R+n*jt;
+                }
+            }
+            if (network) {
+                for (long ig=i; ig<i+group; ++ig) {
+                    int l = 0;
+                    for (long jt=j-R; jt<=j+R; ++jt) {
+                        const float *row = in + ig - R + n*jt;
+                        for (int it=0; it<S; ++it) window[l++] = row[it];
+                    }
+                    out[ig+n*j] = R == 1 ? median9(window) : median25(window);
+                }
+                i += group;
+                continue;
+            }
+            const long k = i+n*j;
+            if (!masked || !mask.at(k)) out[k] = windowMedian(in, n, m, i, j, R, mask, window);
+            ++i;
+        }
+    }
+}
+
+// Sliding window over the ranks of the pixels in one tile (plus halo). Each rank occurs at most once,
+// so the histogram of the window is a bitset; block counts allow to find the k-th rank quickly.
+class RankWindow
+{
+public:
+    void init(const long numRanks)
+    {
+        numWords = (numRanks + 63) / 64;
+        numBlocks = (numWords + wordsPerBlock - 1) / wordsPerBlock;
+        words.fill(0, numWords);
+        blockCounts.fill(0, numBlocks);
+        count = 0;
+    }
+    void clear()
+    {
+        memset(words.data(), 0, numWords*sizeof(uint64_t));
+        memset(blockCounts.data(), 0, numBlocks*sizeof(long));
+        count = 0;
+    }
+    inline void insert(const long rank)
+    {
+        words[rank >> 6] |= uint64_t(1) << (rank & 63);
+        ++blockCounts[(rank >> 6) / wordsPerBlock];
+        ++count;
+    }
+    inline void remove(const long rank)
+    {
+        words[rank >> 6] &= ~(uint64_t(1) << (rank & 63));
+        --blockCounts[(rank >> 6) / wordsPerBlock];
+        --count;
+    }
+    // The k-th smallest rank in the window (k = 0 ... count-1)
+    long select(long k) const
+    {
+        long b = 0;
+        while (k >= blockCounts[b]) {
+            k -= blockCounts[b];
+            ++b;
+        }
+        long w = b*wordsPerBlock;
+        int c = __builtin_popcountll(words[w]);
+        while (k >= c) {
+            k -= c;
+            ++w;
+            c = __builtin_popcountll(words[w]);
+        }
+        uint64_t word = words[w];
+        for (; k>0; --k) word &= word - 1;        // clear the lowest set bits
+        return 64*w + __builtin_ctzll(word);
+    }
+
+    long count = 0;
+
+private:
+    static const long wordsPerBlock = 16;
+    long numWords = 0;
+    long numBlocks = 0;
+    QVector<uint64_t> words;
+    QVector<long> blockCounts;
+};
+
+// Radius > 2: Huang's sliding window on tiles, with exact ranks instead of a quantised histogram
+static void medianFilterLarge(const float *in, float *out, const long n, const long m, const int r,
+                              const BitMask &mask, const int nthreads)
+{
+    const long tileSize = 128;
+    const long numTilesX = (n + tileSize - 1) / tileSize;
+    const long numTilesY = (m + tileSize - 1) / tileSize;
+    const long numTiles = numTilesX * numTilesY;
+    const bool masked = !mask.isEmpty();
+
+#pragma omp parallel num_threads(nthreads)
+    {
+        QVector<std::pair<float,long>> sorted;
+        QVector<long> ranks;
+        QVector<float> rankValues;
+        RankWindow window;
+
+#pragma omp for schedule(dynamic)
+        for (long tile=0; tile<numTiles; ++tile) {
+            const long x0 = (tile % numTilesX) * tileSize;
+            const long y0 = (tile / numTilesX) * tileSize;
+            const long x1 = std::min(n, x0 + tileSize);
+            const long y1 = std::min(m, y0 + tileSize);
+            // tile plus halo
+            const long hx0 = std::max(0L, x0 - r);
+            const long hy0 = std::max(0L, y0 - r);
+            const long hx1 = std::min(n, x1 + r);
+            const long hy1 = std::min(m, y1 + r);
+            const long hw = hx1 - hx0;
+            const long hh = hy1 - hy0;
+
+            // Rank transform; masked pixels have no rank
+            sorted.resize(0);
+            sorted.reserve(hw*hh);
+            for (long j=hy0; j<hy1; ++j) {
+                for (long i=hx0; i<hx1; ++i) {
+                    const long t = i+n*j;
+                    if (masked && mask.at(t)) continue;
+                    sorted.append(std::make_pair(in[t], (i-hx0) + hw*(j-hy0)));
+                }
+            }
+            std::sort(sorted.begin(), sorted.end());
+            const long numRanks = sorted.length();
+            ranks.fill(-1, hw*hh);
+            rankValues.resize(numRanks);
+            for (long k=0; k<numRanks; ++k) {
+                ranks[sorted[k].second] = k;
+                rankValues[k] = sorted[k].first;
+            }
+            if (numRanks == 0) continue;
+            window.init(numRanks);
+
+            const long *rank = ranks.constData();
+            for (long j=y0; j<y1; ++j) {
+                const long jmin = std::max(hy0, j-r) - hy0;
+                const long jmax = std::min(hy1-1, j+r) - hy0;
+                window.clear();
+                // initial window for the first pixel in this row
+                for (long it=std::max(hx0, x0-r); it<=std::min(hx1-1, x0+r); ++it) {
+                    for (long jt=jmin; jt<=jmax; ++jt) {
+                        const long rk = rank[it-hx0 + hw*jt];
+                        if (rk >= 0) window.insert(rk);
+                    }
+                }
+                for (long i=x0; i<x1; ++i) {
+                    if (i > x0) {
+                        // slide one pixel to the right: remove the leftmost column, add a new one on the right
+                        const long iout = i-r-1;
+                        const long iin = i+r;
+                        if (iout >= hx0) {
+                            for (long jt=jmin; jt<=jmax; ++jt) {
+                                const long rk = rank[iout-hx0 + hw*jt];
+                                if (rk >= 0) window.remove(rk);
+                            }
+                        }
+                        if (iin < hx1) {
+                            for (long jt=jmin; jt<=jmax; ++jt) {
+                                const long rk = rank[iin-hx0 + hw*jt];
+                                if (rk >= 0) window.insert(rk);
+                            }
+                        }
+                    }
+                    const long k = i+n*j;
+                    if (masked && mask.at(k)) continue;
+                    const long c = window.count;
+                    if (c % 2) out[k] = rankValues[window.select(c/2)];
+                    else out[k] = (rankValues[window.select(c/2-1)] + rankValues[window.select(c/2)]) * 0.5f;
+                }
+            }
+        }
+    }
+}
+
+void medianFilter2D(const float *in, float *out, const long n, const long m, const int radius,
+                    const BitMask &mask, const int nthreads)
+{
+    if (n <= 0 || m <= 0) return;
+    if (radius <= 0) {
+        for (long k=0; k<n*m; ++k) {
+            if (mask.isEmpty() || !mask.at(k)) out[k] = in[k];
+        }
+    }
+    else if (radius == 1) medianFilterSmall_T<1>(in, out, n, m, mask, nthreads);
+    else if (radius == 2) medianFilterSmall_T<2>(in, out, n, m, mask, nthreads);
+    else medianFilterLarge(in, out, n, m, radius, mask, nthreads);
+}
@@ -0,0 +1,37 @@
+/*
+Copyright (C) 2019 Mischa Schirmer
+
+This file is part of THELI.
+
+THELI is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free
+Software Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program in the LICENSE file.
+If not, see https://www.gnu.org/licenses/ .
+*/
+
+// 2D median filter over (2r+1)x(2r+1) windows, clipped at the image border.
+// Masked pixels do not enter any window, and their output pixels are left untouched.
+// For even numbers of valid pixels the two central values are averaged, like straightMedianInline().
+//
+// 3x3 and 5x5 windows without masked pixels are evaluated with median sorting networks.
+// Larger windows use a sliding-window (Huang) method on cache-sized tiles: the tile's pixels
+// are replaced by their ranks, such that each window is an exact histogram of ranks
+// (a bitset with block counts) that is updated column by column and queried in constant time.
+
+#ifndef MEDIANFILTER_H
+#define MEDIANFILTER_H
+
+#include "bitmask.h"
+
+void medianFilter2D(const float *in, float *out, const long n, const long m, const int radius,
+                    const BitMask &mask, const int nthreads);
+
+#endif // MEDIANFILTER_H
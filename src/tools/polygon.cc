@@ -25,6 +25,11 @@ If not, see https://www.gnu.org/licenses/ .
 #include <QTextStream>
 #include <QDebug>
 
+#include <omp.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
 // Split a ds9 region POLYGON string into x- and y vertice arrays
 void polygon2vertices(QString polystring, QVector<float> &vertx, QVector<float> &verty)
 {
@@ -94,125 +99,295 @@ void addPolygon_bool(const long n, const long m, const QVector<float> &vertx, co
 }
 */
 
-void addPolygon_bool(const long n, const long m, const QVector<float> &vertx, const QVector<float> &verty, const QString senseMode, QVector<bool> &mask)
+// Scanline rasteriser for the polygons and circles of a region file.
+// All shapes are applied in one pass over the image: rows are processed in parallel bands, and within a row
+// the shapes are applied in the order of the region file. The result is identical to testing each pixel against
+// each shape one after the other: polygon spans are bounded by the same edge crossings as computed in pnpoly_T(),
+// with pixel centres at (i+1, j+1); circles use pixel centres at (i, j).
+class RegionRasteriser
 {
-    // apply the polygon mask
-    // NOT THREADSAFE!
-    // #pragma omp parallel for firstprivate(vertx, verty, senseMode)
-    for (long j=0; j<m; ++j) {
-        // we have to add +1 to compensate for arrays in C starting with 0
-        // because the polygon system starts with 1, not 0
-        float y = (float) j + 1;
-        for (long i=0; i<n; ++i) {
-            float x = (float) i + 1;
-            // if a pixel is masked already (value = true) then it must remain masked no matter what.
-            // that is, we only check whether still unmasked pixels need to be masked
-//            if (!mask.at(i+n*j)) {
-                // test if the pixel is inside or outside the polygon
-                bool polytest = pnpoly_T(vertx, verty, x, y);
-                // Mask pixels inside or outside the polygon
-                if (senseMode == "in") {        // everything masked by default in the beginning
-                    // Pixels inside the polygon are good
-                    // pnpoly() returns 0 if a pixel is outside the polygon
-                    if (polytest == 1) {
-                        mask[i+n*j] = false;
-                    }
-                }
-                else {         // everything unmasked by default in the beginning
-                    // Pixels outside the polygon are good
-                    if (polytest == 1) {   // pixels inside the polygon must remain masked
-                        mask[i+n*j] = true;
+public:
+    void addSense(const QString &senseMode)
+    {
+        Shape shape;
+        shape.type = Shape::Sense;
+        shape.senseIn = senseMode == "in";
+        shapes.append(shape);
+    }
+
+    void addPolygon(const QVector<float> &vertx, const QVector<float> &verty, const QString &senseMode)
+    {
+        Shape shape;
+        shape.type = Shape::Polygon;
+        shape.senseIn = senseMode == "in";
+        // Edge table, in the orientation used by pnpoly_T()
+        long nvert = vertx.length();
+        for (long i=0, j=nvert-1; i<nvert; j=i++) {
+            Edge edge;
+            edge.xi = vertx[i];
+            edge.yi = verty[i];
+            edge.xj = vertx[j];
+            edge.yj = verty[j];
+            // The edge crosses row j (at y = j+1) if ymin <= j+1 < ymax; horizontal edges never do
+            edge.jmin = ceil(std::min(edge.yi, edge.yj)) - 1;
+            edge.jmax = ceil(std::max(edge.yi, edge.yj)) - 2;
+            if (edge.jmin <= edge.jmax) shape.edges.append(edge);
+        }
+        std::sort(shape.edges.begin(), shape.edges.end(),
+                  [](const Edge &a, const Edge &b) {return a.jmin < b.jmin;});
+        shapes.append(shape);
+    }
+
+    void addCircle(const float x, const float y, const float r, const QString &senseMode)
+    {
+        Shape shape;
+        shape.type = Shape::Circle;
+        shape.senseIn = senseMode == "in";
+        shape.x = x;
+        shape.y = y;
+        shape.r = r;
+        shapes.append(shape);
+    }
+
+    bool isEmpty() const {return shapes.isEmpty();}
+
+    // Sense "in": a "# Sense:" line masks everything, polygons unmask their interior, circles mask their exterior.
+    // Otherwise: a "# Sense:" line unmasks everything, polygons and circles mask their interior.
+    void applyToMask(const long n, const long m, BitMask &mask, const int nthreads) const
+    {
+        // Bands start at multiples of 64 rows, such that no two threads write into the same word of the mask
+        const long bandHeight = 64;
+        const long numBands = (m + bandHeight - 1) / bandHeight;
+#pragma omp parallel num_threads(nthreads)
+        {
+            QVector<unsigned char> row(n);
+            QVector<QVector<const Edge*>> active(shapes.length());
+            QVector<float> crossings;
+            unsigned char *r = row.data();
+#pragma omp for schedule(dynamic)
+            for (long band=0; band<numBands; ++band) {
+                const long j0 = band*bandHeight;
+                const long j1 = std::min(m, j0+bandHeight);
+                for (long j=j0; j<j1; ++j) {
+                    const long offset = n*j;
+                    for (long i=0; i<n; ++i) r[i] = mask.at(offset+i);
+                    for (int s=0; s<shapes.length(); ++s) {
+                        const Shape &shape = shapes[s];
+                        if (shape.type == Shape::Sense) {
+                            memset(r, shape.senseIn ? 1 : 0, n);
+                        }
+                        else if (shape.type == Shape::Polygon) {
+                            polygonCrossings(shape, j, j==j0, active[s], crossings);
+                            const unsigned char value = shape.senseIn ? 0 : 1;
+                            for (long k=0; k+1<crossings.length(); k+=2) {
+                                long ilo, ihi;
+                                if (crossingSpan(crossings[k], crossings[k+1], n, ilo, ihi)) memset(r+ilo, value, ihi-ilo+1);
+                            }
+                        }
+                        else {
+                            long ilo, ihi;
+                            if (shape.senseIn) {
+                                // mask pixels outside the circle (d >= r*r)
+                                if (circleSpan(shape, j, n, false, ilo, ihi)) {
+                                    memset(r, 1, ilo);
+                                    memset(r+ihi+1, 1, n-ihi-1);
+                                }
+                                else memset(r, 1, n);
+                            }
+                            else {
+                                // mask pixels inside the circle (d <= r*r)
+                                if (circleSpan(shape, j, n, true, ilo, ihi)) memset(r+ilo, 1, ihi-ilo+1);
+                            }
+                        }
                     }
+                    for (long i=0; i<n; ++i) mask.setBit(offset+i, r[i]);
                 }
-//            }
+            }
         }
     }
-}
 
-void addPolygon_float(const long n, const long m, const QVector<float> &vertx, const QVector<float> &verty, QString senseMode, QVector<float> &weight)
-{
-    // apply the polygon mask
-    // NOT THREADSAFE
-    //#pragma omp parallel for
-    for (long j=0; j<m; ++j) {
-        // we have to add +1 to compensate for arrays in C starting with 0
-        // because the polygon system starts with 1, not 0
-        float y = (float) j + 1;
-        for (long i=0; i<n; ++i) {
-            float x = (float) i + 1;
-            // if a pixel has weight zero already then it must retain that weight no matter what.
-            // that is, we check only pixels with weight > 0
-            if (weight[i+n*j] > 0.) {
-                // test if the pixel is inside or outside the polygon
-                bool polytest = pnpoly_T(vertx, verty, x, y);
-                // Mask pixels inside or outside the polygon
-                if (senseMode == "in") {
-                    // Pixels inside the polygon are bad
-                    // pnpoly() returns 0 if a pixel is outside the polygon
-                    if (polytest == 1) weight[i+n*j] = 0.;
-                }
-                else {
-                    if (polytest == 0) weight[i+n*j] = 0;
+    // Sense "in": pixels inside polygons and circles get zero weight; otherwise, pixels outside of them.
+    // Pixels with zero or negative weight are left alone.
+    void applyToWeight(const long n, const long m, QVector<float> &weight, const int nthreads) const
+    {
+        float *w = weight.data();
+#pragma omp parallel num_threads(nthreads)
+        {
+            QVector<QVector<const Edge*>> active(shapes.length());
+            QVector<float> crossings;
+            bool firstRow = true;
+#pragma omp for schedule(static)
+            for (long j=0; j<m; ++j) {
+                float *r = w + n*j;
+                for (int s=0; s<shapes.length(); ++s) {
+                    const Shape &shape = shapes[s];
+                    if (shape.type == Shape::Sense) continue;
+                    long ilo = 0;
+                    long ihi = -1;
+                    if (shape.type == Shape::Polygon) {
+                        // static schedule: each thread processes one contiguous block of rows
+                        polygonCrossings(shape, j, firstRow, active[s], crossings);
+                        if (shape.senseIn) {
+                            for (long k=0; k+1<crossings.length(); k+=2) {
+                                if (crossingSpan(crossings[k], crossings[k+1], n, ilo, ihi)) zeroWeight(r, ilo, ihi);
+                            }
+                        }
+                        else {
+                            long inext = 0;
+                            for (long k=0; k+1<crossings.length(); k+=2) {
+                                if (!crossingSpan(crossings[k], crossings[k+1], n, ilo, ihi)) continue;
+                                zeroWeight(r, inext, ilo-1);
+                                inext = ihi+1;
+                            }
+                            zeroWeight(r, inext, n-1);
+                        }
+                    }
+                    else {
+                        if (shape.senseIn) {
+                            // pixels inside the circle (d <= r*r)
+                            if (circleSpan(shape, j, n, true, ilo, ihi)) zeroWeight(r, ilo, ihi);
+                        }
+                        else {
+                            // pixels outside the circle (d >= r*r)
+                            if (circleSpan(shape, j, n, false, ilo, ihi)) {
+                                zeroWeight(r, 0, ilo-1);
+                                zeroWeight(r, ihi+1, n-1);
+                            }
+                            else zeroWeight(r, 0, n-1);
+                        }
+                    }
                 }
+                firstRow = false;
             }
         }
     }
-}
 
-void addCircle_bool(const long n, const long m, float x, float y, float r, QString senseMode, QVector<bool> &mask)
-{
+private:
+    struct Edge {
+        float xi = 0.;
+        float yi = 0.;
+        float xj = 0.;
+        float yj = 0.;
+        long jmin = 0;      // rows crossed by the edge
+        long jmax = 0;
+    };
+
+    struct Shape {
+        enum Type {Sense, Polygon, Circle};
+        Type type = Sense;
+        bool senseIn = true;
+        QVector<Edge> edges;   // polygons, sorted by jmin
+        float x = 0.;          // circles
+        float y = 0.;
+        float r = 0.;
+    };
+
+    QVector<Shape> shapes;
+
+    // Sorted x coordinates where the polygon's edges cross row j. The active edge list is rebuilt
+    // for the first row of a block of consecutive rows, and updated incrementally afterwards.
+    static void polygonCrossings(const Shape &shape, const long j, const bool newBlock,
+                                 QVector<const Edge*> &active, QVector<float> &crossings)
+    {
+        const Edge *edges = shape.edges.constData();
+        const long numEdges = shape.edges.length();
+        if (newBlock) {
+            active.clear();
+            for (long e=0; e<numEdges && edges[e].jmin <= j; ++e) {
+                if (edges[e].jmax >= j) active.append(edges+e);
+            }
+        }
+        else {
+            // drop finished edges, add the ones starting in this row
+            long k = 0;
+            for (auto &edge : active) {
+                if (edge->jmax >= j) active[k++] = edge;
+            }
+            active.resize(k);
+            const Edge *first = std::lower_bound(edges, edges+numEdges, j,
+                                                 [](const Edge &a, const long row) {return a.jmin < row;});
+            for (const Edge *e=first; e<edges+numEdges && e->jmin == j; ++e) active.append(e);
+        }
 
-    // NOT THREADSAFE
-// #pragma omp parallel for
-    for (long j=0; j<m; ++j) {
-        float jj = (float) j;
-        for (long i=0; i<n; ++i) {
-            float ii = (float) i;
-            // if a pixel is masked already (value = true) then it must remain masked no matter what.
-            // that is, we only check whether still unmasked pixels need to be masked
-            if (!mask[i+n*j]) {
-                // Mask pixels inside or outside the circle
-                float d = (ii-x) * (ii-x) + (jj-y) * (jj-y);
-                if (senseMode == "in") {
-                    // mask pixels outside the circle
-                    if (d >= r*r) mask[i+n*j] = true;
-                }
-                else {
-                    // mask pixels inside the circle
-                    if (d <= r*r) mask[i+n*j] = true;
-                }
+        const float testy = (float) j + 1;
+        crossings.resize(0);
+        for (auto &edge : active) {
+            // Same arithmetic as in pnpoly_T()
+            if ((edge->yi > testy) != (edge->yj > testy)) {
+                crossings.append((edge->xj - edge->xi) * (testy - edge->yi) / (edge->yj - edge->yi) + edge->xi);
             }
         }
+        std::sort(crossings.begin(), crossings.end());
+    }
+
+    // Pixels i whose centre x = i+1 satisfies c0 <= x < c1, i.e. pnpoly_T() counts an odd number of crossings beyond x
+    static bool crossingSpan(const float c0, const float c1, const long n, long &ilo, long &ihi)
+    {
+        const double lo = std::max(0., ceil(c0) - 1.);
+        const double hi = std::min(double(n-1), ceil(c1) - 2.);
+        if (lo > hi) return false;
+        ilo = lo;
+        ihi = hi;
+        return true;
+    }
+
+    // The pixels of row j inside the circle (d <= r*r if 'inclusive', otherwise d < r*r), clipped to the row
+    static bool circleSpan(const Shape &shape, const long j, const long n, const bool inclusive, long &ilo, long &ihi)
+    {
+        const float jj = (float) j;
+        const float dy2 = (jj-shape.y) * (jj-shape.y);
+        const float rsq = shape.r * shape.r;
+        auto inside = [&](const long i) {
+            const float ii = (float) i;
+            const float d = (ii-shape.x) * (ii-shape.x) + dy2;
+            return inclusive ? d <= rsq : d < rsq;
+        };
+        // Generous estimate, then trimmed with the same test as for individual pixels
+        const double h = sqrt(std::max(0., double(rsq) - double(dy2)));
+        ilo = std::max(0., floor(shape.x - h) - 1.);
+        ihi = std::min(double(n-1), ceil(shape.x + h) + 1.);
+        while (ilo <= ihi && !inside(ilo)) ++ilo;
+        while (ihi >= ilo && !inside(ihi)) --ihi;
+        return ilo <= ihi;
+    }
+
+    static inline void zeroWeight(float *row, const long ilo, const long ihi)
+    {
+        for (long i=ilo; i<=ihi; ++i) {
+            if (row[i] > 0.) row[i] = 0.;
+        }
     }
+};
+
+void addPolygon_bool(const long n, const long m, const QVector<float> &vertx, const QVector<float> &verty, const QString senseMode, BitMask &mask)
+{
+    RegionRasteriser rasteriser;
+    rasteriser.addPolygon(vertx, verty, senseMode);
+    rasteriser.applyToMask(n, m, mask, 1);
+}
+
+void addPolygon_float(const long n, const long m, const QVector<float> &vertx, const QVector<float> &verty, QString senseMode, QVector<float> &weight)
+{
+    RegionRasteriser rasteriser;
+    rasteriser.addPolygon(vertx, verty, senseMode);
+    rasteriser.applyToWeight(n, m, weight, 1);
+}
+
+void addCircle_bool(const long n, const long m, float x, float y, float r, QString senseMode, BitMask &mask)
+{
+    RegionRasteriser rasteriser;
+    rasteriser.addCircle(x, y, r, senseMode);
+    rasteriser.applyToMask(n, m, mask, 1);
 }
 
 void addCircle_float(const long n, const long m, float x, float y, float r, QString senseMode, QVector<float> &weight)
 {
-// NOT THREADSAFE
-// #pragma omp parallel for
-    for (long j=0; j<m; ++j) {
-        float jj = (float) j;
-        for (long i=0; i<n; ++i) {
-            float ii = (float) i;
-            // if a pixel has weight zero already then it must retain that weight no matter what.
-            // that is, we check only pixels with weight > 0
-            if (weight[i+n*j] > 0.) {
-                // Mask pixels inside or outside the circle
-                float d = (ii-x) * (ii-x) + (jj-y) * (jj-y);
-                if (senseMode == "in") {
-                    // mask pixels inside the circle
-                    if (d <= r*r) weight[i+n*j] = 0.;
-                }
-                else {
-                    // mask pixels inside the circle
-                    if (d >= r*r) weight[i+n*j] = 0.;
-                }
-            }
-        }
-    }
+    RegionRasteriser rasteriser;
+    rasteriser.addCircle(x, y, r, senseMode);
+    rasteriser.applyToWeight(n, m, weight, 1);
 }
 
-void addRegionFilesToMask(const long n, const long m, QString regionFile, QVector<bool> &mask, bool &isChipMasked)
+void addRegionFilesToMask(const long n, const long m, QString regionFile, BitMask &mask, bool &isChipMasked, const int nthreads)
 {
     QFile file(regionFile);
     if (!file.exists()) return;
@@ -226,14 +401,18 @@ void addRegionFilesToMask(const long n, const long m, QString regionFile, QVecto
     QString senseMode = "in";
     QString combineMode = "or"; // not used
 
+    // Collect all shapes, then rasterise them in one go
+    RegionRasteriser rasteriser;
+
     QTextStream in(&(file));
     while(!in.atEnd()) {
         QString line = in.readLine().simplified();
         if (line.isEmpty()) continue;
         if (line.contains("# Sense: ")) {
             senseMode = line.split(":")[1].simplified();
-            if (senseMode == "in") mask.fill(true);     // default, everything masked. Only keep pixels inside polygons and circles
-            else mask.fill(false);                      // default, everything unmasked. Only keep pixels inside polygons and circles
+            // "in": default, everything masked. Only keep pixels inside polygons and circles
+            // otherwise: default, everything unmasked. Only keep pixels outside polygons and circles
+            rasteriser.addSense(senseMode);
         }
         //  if (line.contains("# Combine: ")) combineMode = line.split(":")[1].simplified();
 
@@ -245,7 +424,7 @@ void addRegionFilesToMask(const long n, const long m, QString regionFile, QVecto
             QVector<float> vertx;
             QVector<float> verty;
             polygon2vertices(line, vertx, verty);
-            addPolygon_bool(n, m, vertx, verty, senseMode, mask);
+            rasteriser.addPolygon(vertx, verty, senseMode);
             isChipMasked = true;
         }
 
@@ -255,14 +434,16 @@ void addRegionFilesToMask(const long n, const long m, QString regionFile, QVecto
             float y = 0.;
             float r = 0.;
             region2circle(line, x, y, r);
-            addCircle_bool(n, m, x, y, r, senseMode, mask);
+            rasteriser.addCircle(x, y, r, senseMode);
             isChipMasked = true;
         }
     }
     file.close();
+
+    if (!rasteriser.isEmpty()) rasteriser.applyToMask(n, m, mask, nthreads);
 }
 
-void addRegionFilesToWeight(const long n, const long m, QString regionFile, QVector<float> &weight)
+void addRegionFilesToWeight(const long n, const long m, QString regionFile, QVector<float> &weight, const int nthreads)
 {
     QFile file(regionFile);
     if (!file.exists()) return;
@@ -274,6 +455,8 @@ void addRegionFilesToWeight(const long n, const long m, QString regionFile, QVec
     QString senseMode = "in";
     QString combineMode = "or"; // not used
 
+    // Collect all shapes, then rasterise them in one go
+    RegionRasteriser rasteriser;
 
     QTextStream in(&(file));
     while(!in.atEnd()) {
@@ -290,7 +473,7 @@ void addRegionFilesToWeight(const long n, const long m, QString regionFile, QVec
             QVector<float> vertx;
             QVector<float> verty;
             polygon2vertices(line, vertx, verty);
-            addPolygon_float(n, m, vertx, verty, senseMode, weight);
+            rasteriser.addPolygon(vertx, verty, senseMode);
         }
 
         // Mask a circle
@@ -299,8 +482,10 @@ void addRegionFilesToWeight(const long n, const long m, QString regionFile, QVec
             float y = 0.;
             float r = 0.;
             region2circle(line, x, y, r);
-            addCircle_float(n, m, x, y, r, senseMode, weight);
+            rasteriser.addCircle(x, y, r, senseMode);
         }
     }
     file.close();
+
+    if (!rasteriser.isEmpty()) rasteriser.applyToWeight(n, m, weight, nthreads);
 }
@@ -20,14 +20,16 @@ If not, see https://www.gnu.org/licenses/ .
 #ifndef POLYGON_H
 #define POLYGON_H
 
+#include "bitmask.h"
+
 #include <QVector>
 
 void polygon2vertices(QString polystring, QVector<float> &vertx, QVector<float> &verty);
-void addCircle_bool(const long n, const long m, float x, float y, float r, QString senseMode, QVector<bool> &mask);
-void addPolygon_bool(const long n, const long m, const QVector<float> &vertx, const QVector<float> &verty, const QString senseMode, QVector<bool> &mask);
+void addCircle_bool(const long n, const long m, float x, float y, float r, QString senseMode, BitMask &mask);
+void addPolygon_bool(const long n, const long m, const QVector<float> &vertx, const QVector<float> &verty, const QString senseMode, BitMask &mask);
 void addPolygon_float(const long n, const long m, const QVector<float> &vertx, const QVector<float> &verty, QString senseMode, QVector<float> &weight);
-void addRegionFilesToMask(const long n, const long m, QString regionFile, QVector<bool> &mask, bool &isChipMasked);
-void addRegionFilesToWeight(const long n, const long m, QString regionFile, QVector<float> &mask);
+void addRegionFilesToMask(const long n, const long m, QString regionFile, BitMask &mask, bool &isChipMasked, const int nthreads = 1);
+void addRegionFilesToWeight(const long n, const long m, QString regionFile, QVector<float> &weight, const int nthreads = 1);
 void region2circle(QString circlestring, float &x, float &y, float &r);
 
 /*
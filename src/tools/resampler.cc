@@ -0,0 +1,623 @@
+/*
+Copyright (C) 2019 Mischa Schirmer
+
+This file is part of THELI.
+
+THELI is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free
+Software Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program in the LICENSE file.
+If not, see https://www.gnu.org/licenses/ .
+*/
+
+#include "resampler.h"
+#include "cfitsioerrorcodes.h"
+
+#include "wcshdr.h"
+#include <fitsio.h>
+#include <omp.h>
+
+#include <QFile>
+#include <QTextStream>
+#include <QRegularExpression>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace {
+
+// Spacing of the grid on which the exact pixel mapping is computed; bilinear interpolation in between
+const long gridStep = 16;
+// Number of output lines per work item
+const long tileHeight = 32;
+
+QString toCard(const QString &line)
+{
+    return line.leftJustified(80, ' ', true);
+}
+
+QString cardKey(const QString &card)
+{
+    return card.left(8).trimmed();
+}
+
+QString numberCard(const QString &key, const double value, const QString &comment)
+{
+    QString card = key.leftJustified(8, ' ') + "= " + QString::number(value, 'g', 12).rightJustified(20, ' ');
+    if (!comment.isEmpty()) card += " / " + comment;
+    return toCard(card);
+}
+
+QString stringCard(const QString &key, const QString &value, const QString &comment)
+{
+    QString card = key.leftJustified(8, ' ') + "= " + ("'" + value.leftJustified(8, ' ') + "'").leftJustified(20, ' ');
+    if (!comment.isEmpty()) card += " / " + comment;
+    return toCard(card);
+}
+
+double cardValue(const QStringList &cards, const QString &key, const double defaultValue)
+{
+    double value = defaultValue;
+    for (auto &card : cards) {
+        if (cardKey(card) == key && card.mid(8,1) == "=") value = card.mid(10).split("/").at(0).trimmed().toDouble();
+    }
+    return value;
+}
+
+// coadd.head, and the scamp headers
+QStringList readHeaderFile(const QString &fileName)
+{
+    QStringList cards;
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) return cards;
+    QTextStream in(&file);
+    while (!in.atEnd()) {
+        QString line = in.readLine();
+        if (line.trimmed().isEmpty() || cardKey(line) == "END") continue;
+        cards << toCard(line);
+    }
+    file.close();
+    return cards;
+}
+
+bool isWCSCard(const QString &card)
+{
+    static const QRegularExpression wcsKeys("^((CTYPE|CUNIT|CRVAL|CRPIX|CDELT|CROTA)[0-9]|(CD|PC|PV)[0-9]_[0-9]+"
+                                            "|EQUINOX|EPOCH|RADESYS|RADECSYS|LONPOLE|LATPOLE)$");
+    return wcsKeys.match(cardKey(card)).hasMatch();
+}
+
+// Not everything in wcslib is thread safe, hence the critical sections
+struct wcsprm *parseWCS(const QStringList &cards, int &nwcs)
+{
+    QByteArray header;
+    for (auto &card : cards) header.append(card.toLatin1());
+    header.append(toCard("END").toLatin1());
+
+    struct wcsprm *wcs = nullptr;
+    int nreject = 0;
+    nwcs = 0;
+    int check = 0;
+#pragma omp critical (resamplerWCS)
+    {
+        check = wcspih(header.data(), header.length() / 80, WCSHDR_all, 0, &nreject, &nwcs, &wcs);
+        if (!check && nwcs > 0) check = wcsset(wcs);
+        else if (!check) check = 1;
+        if (check && wcs != nullptr) wcsvfree(&nwcs, &wcs);
+    }
+    if (check) {
+        nwcs = 0;
+        return nullptr;
+    }
+    return wcs;
+}
+
+// wcsp2s() and wcss2p() use scratch memory inside wcsprm (e.g. for the distortions); every thread needs its own copy
+struct wcsprm *copyWCS(struct wcsprm *wcs)
+{
+    struct wcsprm *copy = (struct wcsprm*) calloc(1, sizeof(struct wcsprm));
+    copy->flag = -1;
+#pragma omp critical (resamplerWCS)
+    {
+        wcssub(1, wcs, 0x0, 0x0, copy);
+        wcsset(copy);
+    }
+    return copy;
+}
+
+void freeWCS(struct wcsprm *wcs)
+{
+    wcsfree(wcs);
+    free(wcs);
+}
+
+// Pixel (1-indexed) to pixel mapping between two WCS; returns false for points that cannot be projected
+void mapPixels(struct wcsprm *wcsFrom, struct wcsprm *wcsTo, QVector<double> &pixcrd, QVector<bool> &valid)
+{
+    const int ncoord = pixcrd.length() / 2;
+    QVector<double> imgcrd(2*ncoord);
+    QVector<double> world(2*ncoord);
+    QVector<double> phi(ncoord);
+    QVector<double> theta(ncoord);
+    QVector<int> stat(ncoord);
+    valid.fill(true, ncoord);
+    if (ncoord == 0) return;
+
+    wcsp2s(wcsFrom, ncoord, 2, pixcrd.data(), imgcrd.data(), phi.data(), theta.data(), world.data(), stat.data());
+    for (int k=0; k<ncoord; ++k) {
+        if (stat[k]) valid[k] = false;
+    }
+    wcss2p(wcsTo, ncoord, 2, world.data(), phi.data(), theta.data(), imgcrd.data(), pixcrd.data(), stat.data());
+    for (int k=0; k<ncoord; ++k) {
+        if (stat[k] || !std::isfinite(pixcrd[2*k]) || !std::isfinite(pixcrd[2*k+1])) valid[k] = false;
+    }
+}
+
+// Grid nodes first, first+step, ..., last, for the interpolation of the pixel mapping
+QVector<long> gridNodes(const long first, const long last)
+{
+    QVector<long> nodes;
+    for (long p=first; p<last; p+=gridStep) nodes.append(p);
+    nodes.append(last);
+    return nodes;
+}
+
+// Interpolation kernels
+enum KernelType {NEAREST, BILINEAR, LANCZOS};
+
+struct Kernel {
+    KernelType type = LANCZOS;
+    int half = 3;                    // number of taps on either side
+    double sinStep[8];               // sin(k pi / half), cos(k pi / half) for the angle addition in weights()
+    double cosStep[8];
+
+    Kernel(const QString &name)
+    {
+        if (name == "NEAREST") {
+            type = NEAREST;
+            half = 1;
+        }
+        else if (name == "BILINEAR") {
+            type = BILINEAR;
+            half = 1;
+        }
+        else {
+            type = LANCZOS;
+            if (name == "LANCZOS2") half = 2;
+            else if (name == "LANCZOS4") half = 4;
+            else half = 3;
+        }
+        for (int k=0; k<2*half && k<8; ++k) {
+            sinStep[k] = sin(k * M_PI / half);
+            cosStep[k] = cos(k * M_PI / half);
+        }
+    }
+
+    // Normalised weights of the 2*half taps floor(x)-half+1 ... floor(x)+half, for dx = x - floor(x)
+    void weights(const double dx, double *w) const
+    {
+        if (type == BILINEAR) {
+            w[0] = 1. - dx;
+            w[1] = dx;
+            return;
+        }
+        // L(t) = half * sin(pi t) sin(pi t / half) / (pi t)^2, with t = dx - k and k = -half+1 ... half
+        const double s1 = sin(M_PI * dx);
+        const double s2 = sin(M_PI * dx / half);
+        const double c2 = cos(M_PI * dx / half);
+        double sum = 0.;
+        for (int i=0; i<2*half; ++i) {
+            const int k = i - half + 1;
+            const double t = dx - k;
+            if (fabs(t) < 1.e-7) w[i] = 1.;
+            else {
+                // sin(pi (dx-k)) = (-1)^k sin(pi dx); sin(pi (dx-k) / half) by angle addition
+                const int ka = k < 0 ? -k : k;
+                const double sinK = k < 0 ? -sinStep[ka] : sinStep[ka];
+                const double sinT = (ka % 2 == 0) ? s1 : -s1;
+                const double sinTh = s2 * cosStep[ka] - c2 * sinK;
+                w[i] = half * sinT * sinTh / (M_PI * M_PI * t * t);
+            }
+            sum += w[i];
+        }
+        for (int i=0; i<2*half; ++i) w[i] /= sum;
+    }
+};
+
+}
+
+Resampler::Resampler(QString coadddirname, QString kernelString, QString suffixString, int maxCPU, int *verbose)
+{
+    coaddDirName = coadddirname;
+    if (!kernelString.isEmpty()) kernel = kernelString;
+    resampleSuffix = suffixString;
+    nthreads = maxCPU;
+    verbosity = verbose;
+}
+
+Resampler::~Resampler()
+{
+    if (coaddWCS != nullptr) wcsvfree(&coaddNumWCS, &coaddWCS);
+}
+
+void Resampler::runResampling(const QStringList &imageList)
+{
+    if (!readCoaddHeader()) {
+        successProcessing = false;
+        return;
+    }
+
+    const int numImages = imageList.length();
+    if (numImages == 0) return;
+    progressStepSize = 100. / numImages;
+
+    // Many images: one image per thread. Few (large) images: all threads work on the tiles of one image.
+    const int outerThreads = numImages >= nthreads ? nthreads : 1;
+    const int innerThreads = nthreads / outerThreads;
+
+    emit messageAvailable("Resampling " + QString::number(numImages) + " images with kernel " + kernel + " ...", "output");
+
+    bool success = true;
+#pragma omp parallel for num_threads(outerThreads) schedule(dynamic) reduction(&&:success)
+    for (int i=0; i<numImages; ++i) {
+        if (!resampleImage(imageList.at(i), innerThreads)) success = false;
+        if (progress != nullptr) {
+#pragma omp atomic
+            *progress += progressStepSize;
+            emit progressUpdate(*progress);
+        }
+    }
+    if (!success) successProcessing = false;
+}
+
+bool Resampler::readCoaddHeader()
+{
+    QStringList cards = readHeaderFile(coaddDirName+"/coadd.head");
+    if (cards.isEmpty()) {
+        emit messageAvailable("Resampler::readCoaddHeader(): Could not read " + coaddDirName + "/coadd.head", "error");
+        return false;
+    }
+    coadd_naxis1 = cardValue(cards, "NAXIS1", 0);
+    coadd_naxis2 = cardValue(cards, "NAXIS2", 0);
+    coadd_crpix1 = cardValue(cards, "CRPIX1", 0.);
+    coadd_crpix2 = cardValue(cards, "CRPIX2", 0.);
+    coaddWCS = parseWCS(cards, coaddNumWCS);
+    if (coaddWCS == nullptr || coadd_naxis1 <= 0 || coadd_naxis2 <= 0) {
+        emit messageAvailable("Resampler::readCoaddHeader(): No valid WCS in " + coaddDirName + "/coadd.head", "error");
+        return false;
+    }
+
+    // CRPIX is set individually for every resampled image
+    coaddCards.clear();
+    for (auto &card : cards) {
+        if (isWCSCard(card) && !cardKey(card).startsWith("CRPIX")) coaddCards << card;
+    }
+    return true;
+}
+
+bool Resampler::resampleImage(const QString &imageName, const int innerThreads)
+{
+    QString baseName = imageName;
+    baseName.chop(5);    // ".fits"
+    const QString imageFile = coaddDirName + "/" + imageName;
+    const QString weightFile = coaddDirName + "/" + baseName + ".weight.fits";
+    QString outName = coaddDirName + "/" + baseName + resampleSuffix;
+    QString outWeightName = outName;
+    outWeightName.chop(5);
+    outWeightName.append(".weight.fits");
+
+    // The astrometric solution from scamp replaces the WCS of the image header
+    QStringList headCards = readHeaderFile(coaddDirName + "/" + baseName + ".head");
+    bool headHasWCS = false;
+    bool headHasPV = false;
+    for (auto &card : headCards) {
+        if (cardKey(card) == "CRVAL1") headHasWCS = true;
+        if (cardKey(card).startsWith("PV1_")) headHasPV = true;
+    }
+
+    // Read image and weight
+    int status = 0;
+    fitsfile *fptr = nullptr;
+    long naxes[2] = {0, 0};
+    char *header = nullptr;
+    int numHeaderKeys = 0;
+    char *excludeList[] = {(char*) "CTYPE?", (char*) "CUNIT?", (char*) "CRVAL?", (char*) "CRPIX?", (char*) "CDELT?",
+                           (char*) "CROTA?", (char*) "CD?_?", (char*) "PC?_?", (char*) "PV?_*", (char*) "EQUINOX",
+                           (char*) "EPOCH", (char*) "RADESYS", (char*) "RADECSYS", (char*) "LONPOLE", (char*) "LATPOLE"};
+    int numExclude = headHasWCS ? 15 : 0;
+    // The inputs may be tile-compressed (fits_open_image() moves to the compressed extension)
+    fits_open_image(&fptr, imageFile.toUtf8().data(), READONLY, &status);
+    fits_get_img_size(fptr, 2, naxes, &status);
+    fits_convert_hdr2str(fptr, 1, excludeList, numExclude, &header, &numHeaderKeys, &status);
+    const long n = naxes[0];
+    const long m = naxes[1];
+    QVector<float> data(n*m);
+    QVector<float> weight(n*m);
+    float nullval = 0.;
+    int anynull = 0;
+    fits_read_img(fptr, TFLOAT, 1, n*m, &nullval, data.data(), &anynull, &status);
+    fits_close_file(fptr, &status);
+    printCfitsioError("resampleImage(): " + imageName, status);
+    if (status) {
+        if (header != nullptr) fits_free_memory(header, &status);
+        return false;
+    }
+
+    QStringList cards;
+    for (int k=0; k<numHeaderKeys; ++k) {
+        QString card = QString::fromLatin1(header + 80*k, 80);
+        if (cardKey(card) != "END") cards << card;
+    }
+    fits_free_memory(header, &status);
+    for (auto &card : headCards) {
+        // scamp's distortion polynomials are known to wcslib as TPV
+        if (headHasPV && cardKey(card).startsWith("CTYPE")) card.replace("-TAN", "-TPV");
+        cards << card;
+    }
+
+    fits_open_image(&fptr, weightFile.toUtf8().data(), READONLY, &status);
+    fits_read_img(fptr, TFLOAT, 1, n*m, &nullval, weight.data(), &anynull, &status);
+    fits_close_file(fptr, &status);
+    printCfitsioError("resampleImage(): " + baseName + ".weight.fits", status);
+    if (status) return false;
+
+    int imageNumWCS = 0;
+    struct wcsprm *imageWCS = parseWCS(cards, imageNumWCS);
+    if (imageWCS == nullptr) {
+        emit messageAvailable("Resampler::resampleImage(): No valid WCS for " + imageName, "error");
+        return false;
+    }
+    struct wcsprm *coaddCopy = copyWCS(coaddWCS);
+
+    // Footprint in the coadded image: the image border, mapped onto the coadd grid
+    QVector<double> pixcrd;
+    QVector<bool> valid;
+    const int numEdge = 32;
+    for (int k=0; k<=numEdge; ++k) {
+        const double x = 1. + (n-1.) * k / numEdge;
+        const double y = 1. + (m-1.) * k / numEdge;
+        pixcrd << x << 1. << x << double(m) << 1. << y << double(n) << y;
+    }
+    // The centre, and half a pixel around it, for the flux scaling
+    const double xc = 0.5 * (n+1.);
+    const double yc = 0.5 * (m+1.);
+    pixcrd << xc-0.5 << yc << xc+0.5 << yc << xc << yc-0.5 << xc << yc+0.5;
+    mapPixels(imageWCS, coaddCopy, pixcrd, valid);
+
+    const int numFootprint = 4*(numEdge+1);
+    double xminf = 1.e30;
+    double xmaxf = -1.e30;
+    double yminf = 1.e30;
+    double ymaxf = -1.e30;
+    for (int k=0; k<numFootprint; ++k) {
+        if (!valid[k]) continue;
+        xminf = std::min(xminf, pixcrd[2*k]);
+        xmaxf = std::max(xmaxf, pixcrd[2*k]);
+        yminf = std::min(yminf, pixcrd[2*k+1]);
+        ymaxf = std::max(ymaxf, pixcrd[2*k+1]);
+    }
+    if (xminf > xmaxf || yminf > ymaxf) {
+        emit messageAvailable("Resampler::resampleImage(): Could not project " + imageName + " onto the coadded image", "error");
+        freeWCS(coaddCopy);
+        wcsvfree(&imageNumWCS, &imageWCS);
+        return false;
+    }
+    // coadd pixels (1-indexed) covered by the resampled image
+    const long xmin = std::max(1L, long(floor(xminf - 0.5)));
+    const long xmax = std::min(coadd_naxis1, long(ceil(xmaxf + 0.5)));
+    const long ymin = std::max(1L, long(floor(yminf - 0.5)));
+    const long ymax = std::min(coadd_naxis2, long(ceil(ymaxf + 0.5)));
+    if (xmin > xmax || ymin > ymax) {
+        emit messageAvailable(imageName + " : does not overlap with the coadded image, skipped", "warning");
+        freeWCS(coaddCopy);
+        wcsvfree(&imageNumWCS, &imageWCS);
+        return true;
+    }
+
+    // Flux conservation: ratio of the pixel areas at the image centre (swarp's FSCALASTRO_TYPE = FIXED)
+    double astroScale = 1.;
+    const int c = numFootprint;
+    if (valid[c] && valid[c+1] && valid[c+2] && valid[c+3]) {
+        const double dXdx = pixcrd[2*(c+1)] - pixcrd[2*c];
+        const double dYdx = pixcrd[2*(c+1)+1] - pixcrd[2*c+1];
+        const double dXdy = pixcrd[2*(c+3)] - pixcrd[2*(c+2)];
+        const double dYdy = pixcrd[2*(c+3)+1] - pixcrd[2*(c+2)+1];
+        const double det = fabs(dXdx * dYdy - dXdy * dYdx);
+        if (det > 0.) astroScale = 1. / det;
+    }
+    const float weightScale = 1. / (astroScale * astroScale);
+    freeWCS(coaddCopy);
+
+    const long nout = xmax - xmin + 1;
+    const long mout = ymax - ymin + 1;
+    QVector<float> dataOut(nout*mout, 0.);
+    QVector<float> weightOut(nout*mout, 0.);
+
+    const float *in = data.constData();
+    const float *win = weight.constData();
+    float *out = dataOut.data();
+    float *wout = weightOut.data();
+    const Kernel interpolator(kernel);
+    const long numTiles = (mout + tileHeight - 1) / tileHeight;
+    const QVector<long> nodesX = gridNodes(0, nout-1);
+
+    // Column position within the grid
+    QVector<long> segmentX(nout);
+    QVector<double> fracX(nout);
+    for (long i=0; i<nout; ++i) {
+        long s = std::min(long(i / gridStep), long(nodesX.length()) - 2);
+        if (s < 0) s = 0;
+        segmentX[i] = s;
+        const long span = nodesX.length() > 1 ? nodesX[s+1] - nodesX[s] : 1;
+        fracX[i] = double(i - nodesX[s]) / span;
+    }
+
+#pragma omp parallel num_threads(innerThreads)
+    {
+        struct wcsprm *coaddLocal = copyWCS(coaddWCS);
+        struct wcsprm *imageLocal = copyWCS(imageWCS);
+        QVector<double> nodes;
+        QVector<bool> nodesValid;
+        double wx[8];
+        double wy[8];
+        const int taps = interpolator.type == NEAREST ? 1 : 2*interpolator.half;
+
+#pragma omp for schedule(dynamic)
+        for (long tile=0; tile<numTiles; ++tile) {
+            const long j0 = tile * tileHeight;
+            const long j1 = std::min(j0 + tileHeight, mout) - 1;
+            const QVector<long> nodesY = gridNodes(j0, j1);
+            const long nnx = nodesX.length();
+            const long nny = nodesY.length();
+
+            // Exact mapping at the grid nodes, from the coadd grid into the input image
+            nodes.resize(2*nnx*nny);
+            for (long q=0; q<nny; ++q) {
+                for (long p=0; p<nnx; ++p) {
+                    nodes[2*(p+nnx*q)] = xmin + nodesX[p];
+                    nodes[2*(p+nnx*q)+1] = ymin + nodesY[q];
+                }
+            }
+            mapPixels(coaddLocal, imageLocal, nodes, nodesValid);
+
+            for (long j=j0; j<=j1; ++j) {
+                long sy = std::min(long((j - j0) / gridStep), nny - 2);
+                if (sy < 0) sy = 0;
+                const long spanY = nny > 1 ? nodesY[sy+1] - nodesY[sy] : 1;
+                const double ty = double(j - nodesY[sy]) / spanY;
+                const long sy1 = nny > 1 ? sy+1 : sy;
+                for (long i=0; i<nout; ++i) {
+                    const long sx = segmentX[i];
+                    const long sx1 = nnx > 1 ? sx+1 : sx;
+                    const double tx = fracX[i];
+                    const long k00 = sx + nnx*sy;
+                    const long k10 = sx1 + nnx*sy;
+                    const long k01 = sx + nnx*sy1;
+                    const long k11 = sx1 + nnx*sy1;
+                    if (!nodesValid[k00] || !nodesValid[k10] || !nodesValid[k01] || !nodesValid[k11]) continue;
+                    const double b00 = (1.-tx)*(1.-ty);
+                    const double b10 = tx*(1.-ty);
+                    const double b01 = (1.-tx)*ty;
+                    const double b11 = tx*ty;
+                    // 0-indexed position in the input image
+                    const double fx = b00*nodes[2*k00] + b10*nodes[2*k10] + b01*nodes[2*k01] + b11*nodes[2*k11] - 1.;
+                    const double fy = b00*nodes[2*k00+1] + b10*nodes[2*k10+1] + b01*nodes[2*k01+1] + b11*nodes[2*k11+1] - 1.;
+                    if (fx < -0.5 || fx > n-0.5 || fy < -0.5 || fy > m-0.5) continue;
+
+                    // Bad input pixels remain bad
+                    const long ixn = std::min(std::max(long(floor(fx+0.5)), 0L), n-1);
+                    const long iyn = std::min(std::max(long(floor(fy+0.5)), 0L), m-1);
+                    if (win[ixn+n*iyn] <= 0.) continue;
+
+                    // Weights: bilinear interpolation
+                    const long ix = long(floor(fx));
+                    const long iy = long(floor(fy));
+                    const double dx = fx - ix;
+                    const double dy = fy - iy;
+                    const long xa = std::max(ix, 0L);
+                    const long xb = std::min(ix+1, n-1);
+                    const long ya = std::max(iy, 0L);
+                    const long yb = std::min(iy+1, m-1);
+                    const double w = (1.-dx)*(1.-dy)*win[xa+n*ya] + dx*(1.-dy)*win[xb+n*ya]
+                            + (1.-dx)*dy*win[xa+n*yb] + dx*dy*win[xb+n*yb];
+
+                    // Pixel values: the chosen kernel; the image is continued beyond its edges.
+                    // Taps on bad (zero weight) pixels are left out and the kernel is renormalised;
+                    // if most of the kernel is bad, the nearest pixel is used.
+                    double value = 0.;
+                    if (interpolator.type == NEAREST) value = in[ixn+n*iyn];
+                    else {
+                        interpolator.weights(dx, wx);
+                        interpolator.weights(dy, wy);
+                        double kernelSum = 0.;
+                        double goodSum = 0.;
+                        for (int b=0; b<taps; ++b) {
+                            const long yy = std::min(std::max(iy - interpolator.half + 1 + b, 0L), m-1);
+                            const float *line = in + n*yy;
+                            const float *wline = win + n*yy;
+                            double sum = 0.;
+                            double sumGood = 0.;
+                            double sumAll = 0.;
+                            for (int a=0; a<taps; ++a) {
+                                const long xx = std::min(std::max(ix - interpolator.half + 1 + a, 0L), n-1);
+                                sumAll += wx[a];
+                                if (wline[xx] <= 0.) continue;
+                                sum += wx[a] * line[xx];
+                                sumGood += wx[a];
+                            }
+                            value += wy[b] * sum;
+                            goodSum += wy[b] * sumGood;
+                            kernelSum += wy[b] * sumAll;
+                        }
+                        if (goodSum > 0.5 * kernelSum) value *= kernelSum / goodSum;
+                        else value = in[ixn+n*iyn];
+                    }
+                    out[i+nout*j] = value * astroScale;
+                    wout[i+nout*j] = w * weightScale;
+                }
+            }
+        }
+        freeWCS(coaddLocal);
+        freeWCS(imageLocal);
+    }
+    wcsvfree(&imageNumWCS, &imageWCS);
+
+    // Header of the resampled image and weight
+    QStringList outCards = coaddCards;
+    outCards << numberCard("CRPIX1", coadd_crpix1 - (xmin-1), "Reference pixel on this axis");
+    outCards << numberCard("CRPIX2", coadd_crpix2 - (ymin-1), "Reference pixel on this axis");
+    for (auto &key : QStringList() << "OBJECT" << "SKYVALUE" << "EXPTIME" << "DATE-OBS" << "GAIN") {
+        QString copy = "";
+        for (auto &card : cards) {
+            if (cardKey(card) == key) copy = card;
+        }
+        if (!copy.isEmpty()) outCards << copy;
+    }
+    outCards << numberCard("FLXSCALE", cardValue(headCards, "FLXSCALE", 1.), "Relative flux scaling from photometry");
+    outCards << numberCard("FLASCALE", astroScale, "Relative flux scaling from astrometry");
+    outCards << stringCard("RESAMPT1", kernel, "RESAMPLING_TYPE config parameter");
+    outCards << stringCard("RESAMPT2", kernel, "RESAMPLING_TYPE config parameter");
+
+    if (!writeImage(outName, dataOut, nout, mout, outCards)) return false;
+    if (!writeImage(outWeightName, weightOut, nout, mout, outCards)) return false;
+
+    if (*verbosity > 1) emit messageAvailable(imageName + " : resampled to " + QString::number(nout) + " x "
+                                              + QString::number(mout) + " pixels", "image");
+    return true;
+}
+
+bool Resampler::writeImage(const QString &fileName, const QVector<float> &data, const long n, const long m,
+                           const QStringList &cards)
+{
+    int status = 0;
+    fitsfile *fptr = nullptr;
+    long naxes[2] = {n, m};
+    QString outName = "!" + fileName;   // overwrite
+    fits_create_file(&fptr, outName.toUtf8().data(), &status);
+    fits_create_img(fptr, FLOAT_IMG, 2, naxes, &status);
+    for (auto &card : cards) {
+        fits_write_record(fptr, card.toLatin1().data(), &status);
+    }
+    fits_write_img(fptr, TFLOAT, 1, n*m, (float*) data.constData(), &status);
+    fits_close_file(fptr, &status);
+    printCfitsioError("writeImage(): " + fileName, status);
+    if (status) return false;
+    else return true;
+}
+
+// Called from the resampling threads; the callers return false, and runResampling() sets successProcessing
+void Resampler::printCfitsioError(QString funcName, int status)
+{
+    if (status) {
+        CfitsioErrorCodes errorCodes;
+        emit messageAvailable("Resampler::"+funcName+":<br>" + errorCodes.errorKeyMap.value(status), "error");
+    }
+}
@@ -0,0 +1,76 @@
+/*
+Copyright (C) 2019 Mischa Schirmer
+
+This file is part of THELI.
+
+THELI is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free
+Software Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program in the LICENSE file.
+If not, see https://www.gnu.org/licenses/ .
+*/
+
+// Resamples the images in a coadd directory onto the grid of coadd.head, in place of "swarp -RESAMPLE Y -COMBINE N".
+// The input astrometry (incl. the scamp distortion polynomials) is taken from the .head files, and the
+// output has the layout of swarp's resampled images (the overlapping section of the coadd grid, with
+// CRPIX shifted accordingly, FLXSCALE etc in the header), such that SwarpFilter and the swarp
+// coaddition can use them unchanged.
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "wcs.h"
+
+class Resampler : public QObject
+{
+    Q_OBJECT
+public:
+    Resampler(QString coadddirname, QString kernelString, QString suffixString, int maxCPU, int *verbose);
+    ~Resampler();
+
+    float *progress = nullptr;
+    bool successProcessing = true;
+
+    void runResampling(const QStringList &imageList);
+
+signals:
+    void messageAvailable(QString message, QString type);
+    void progressUpdate(float progress);
+
+private:
+    QString coaddDirName;
+    QString kernel = "LANCZOS3";
+    QString resampleSuffix;    // appended to the base name of the input image, e.g. ".resamp.fits"
+    int nthreads = 1;
+    int *verbosity;
+    float progressStepSize = 0.;
+
+    // The coadded image
+    struct wcsprm *coaddWCS = nullptr;
+    int coaddNumWCS = 0;
+    long coadd_naxis1 = 0;
+    long coadd_naxis2 = 0;
+    double coadd_crpix1 = 0.;
+    double coadd_crpix2 = 0.;
+    QStringList coaddCards;    // WCS cards of coadd.head, copied to the output headers
+
+    bool readCoaddHeader();
+    bool resampleImage(const QString &imageName, const int innerThreads);
+    bool writeImage(const QString &fileName, const QVector<float> &data, const long n, const long m,
+                    const QStringList &cards);
+    void printCfitsioError(QString funcName, int status);
+};
+
+#endif // RESAMPLER_H
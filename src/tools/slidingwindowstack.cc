@@ -0,0 +1,192 @@
+/*
+Copyright (C) 2019 Mischa Schirmer
+
+This file is part of THELI.
+
+THELI is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free
+Software Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program in the LICENSE file.
+If not, see https://www.gnu.org/licenses/ .
+*/
+
+#include "slidingwindowstack.h"
+
+#include <omp.h>
+#include <algorithm>
+
+namespace {
+// Object masks are rewritten in place between (and during) the passes, hence the content is compared, not the pointer
+uint64_t checksum(const BitMask *mask)
+{
+    if (mask == nullptr) return 0;
+    const BitMask::Word *words = mask->constWords();
+    uint64_t hash = 14695981039346656037ULL;
+    for (long w=0; w<mask->numWords(); ++w) {
+        hash ^= words[w];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+}
+
+const int SlidingWindowStack::maxCapacity;
+
+// Memory needed by a stack holding 'numMembers' images, including the headroom allocated by update()
+float SlidingWindowStack::bytesPerPixel(const int numMembers)
+{
+    const int cap = std::min(maxCapacity, numMembers + 4);
+    return cap * (sizeof(float) + sizeof(unsigned char)) + sizeof(unsigned char);
+}
+
+void SlidingWindowStack::clear()
+{
+    dim = 0;
+    capacity = 0;
+    slots.clear();
+    slots.squeeze();
+    values.clear();
+    values.squeeze();
+    owners.clear();
+    owners.squeeze();
+    counts.clear();
+    counts.squeeze();
+}
+
+void SlidingWindowStack::init(const long newDim, const int newCapacity)
+{
+    clear();
+    dim = newDim;
+    capacity = newCapacity;
+    slots.resize(capacity);
+    values.resize(dim*capacity);
+    owners.resize(dim*capacity);
+    counts.fill(0, dim);
+}
+
+// Makes the stack contain exactly the 'members', and writes the clipped median (times 'outputScale') into 'combined'.
+// Returns false if the stack cannot be handled incrementally (too many images), in which case nothing is done.
+bool SlidingWindowStack::update(const QVector<Member> &members, const long newDim, const int nlow, const int nhigh,
+                                const float outputScale, float *combined, const int nthreads)
+{
+    const int numMembers = members.length();
+    if (numMembers > maxCapacity) return false;
+
+    // Geometry changed, or the window grew beyond what was allocated: start from scratch.
+    // Leave some headroom so that a slightly fluctuating window size does not trigger a rebuild every time.
+    if (newDim != dim || numMembers > capacity) {
+        init(newDim, std::min(maxCapacity, numMembers + 4));
+    }
+
+    // Images that left the window, or whose mask or scaling changed since they were inserted, must be deleted.
+    // (The skyValue of background images is determined once, hence rescaling does not happen in practice.)
+    bool deleteSlot[maxCapacity] = {false};
+    QVector<bool> isMemberInStack(numMembers, false);
+    QVector<uint64_t> maskChecksums(numMembers);
+    for (int k=0; k<numMembers; ++k) maskChecksums[k] = checksum(members[k].mask);
+    numDeleted = 0;
+    for (int s=0; s<capacity; ++s) {
+        if (slots[s].image == nullptr) continue;
+        bool keep = false;
+        for (int k=0; k<numMembers; ++k) {
+            const Member &member = members[k];
+            if (member.image == slots[s].image
+                    && (member.mask != nullptr) == slots[s].masked
+                    && maskChecksums[k] == slots[s].maskChecksum
+                    && member.scale == slots[s].scale) {
+                keep = true;
+                isMemberInStack[k] = true;
+                break;
+            }
+        }
+        if (!keep) {
+            deleteSlot[s] = true;
+            slots[s] = Slot();
+            ++numDeleted;
+        }
+    }
+
+    // New images get a free slot. Slots freed above can be recycled right away, because
+    // for each pixel the deletions are carried out before the insertions.
+    QVector<Member> newMembers;
+    QVector<unsigned char> newSlots;
+    for (int k=0; k<numMembers; ++k) {
+        if (isMemberInStack[k]) continue;
+        int s = 0;
+        while (s < capacity && slots[s].image != nullptr) ++s;
+        if (s == capacity) return false;     // cannot happen, as capacity >= numMembers
+        slots[s].image = members[k].image;
+        slots[s].masked = members[k].mask != nullptr;
+        slots[s].maskChecksum = maskChecksums[k];
+        slots[s].scale = members[k].scale;
+        newMembers.append(members[k]);
+        newSlots.append(s);
+    }
+    numInserted = newMembers.length();
+
+    // values.data() etc inside the loop would run the QVector detach check for every pixel
+    float *stackValues = values.data();
+    unsigned char *stackOwners = owners.data();
+    unsigned char *stackCounts = counts.data();
+    const Member *insertions = newMembers.constData();
+    const unsigned char *insertionSlots = newSlots.constData();
+    const long numInsertions = newMembers.length();
+    const long cap = capacity;
+    const bool anyDeletion = numDeleted > 0;
+
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+    for (long i=0; i<dim; ++i) {
+        float *v = stackValues + i*cap;
+        unsigned char *o = stackOwners + i*cap;
+        int c = stackCounts[i];
+
+        // Delete; compaction keeps the sort order
+        if (anyDeletion) {
+            int w = 0;
+            for (int r=0; r<c; ++r) {
+                if (!deleteSlot[o[r]]) {
+                    v[w] = v[r];
+                    o[w] = o[r];
+                    ++w;
+                }
+            }
+            c = w;
+        }
+
+        // Insert
+        for (long k=0; k<numInsertions; ++k) {
+            const Member &member = insertions[k];
+            if (member.mask != nullptr && member.mask->at(i)) continue;
+            const float x = member.data[i] * member.scale;
+            int p = c;
+            while (p > 0 && v[p-1] > x) {
+                v[p] = v[p-1];
+                o[p] = o[p-1];
+                --p;
+            }
+            v[p] = x;
+            o[p] = insertionSlots[k];
+            ++c;
+        }
+        stackCounts[i] = c;
+
+        // Median after rejecting the nlow lowest and nhigh highest values
+        const long nuse = c - nlow - nhigh;
+        if (c == 0 || nuse <= 0) {
+            combined[i] = 0.;
+            continue;
+        }
+        const float *first = v + nlow;
+        const float med = (nuse % 2) ? first[nuse/2] : (first[nuse/2-1] + first[nuse/2]) * 0.5f;
+        combined[i] = med * outputScale;
+    }
+
+    return true;
+}
@@ -0,0 +1,76 @@
+/*
+Copyright (C) 2019 Mischa Schirmer
+
+This file is part of THELI.
+
+THELI is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free
+Software Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program in the LICENSE file.
+If not, see https://www.gnu.org/licenses/ .
+*/
+
+// Per-pixel sorted stacks for the dynamic background model.
+// Neighbouring science exposures share most of the images in their time window.
+// Instead of rebuilding the median stack for every exposure, images leaving the
+// window are deleted from, and images entering the window are inserted into the
+// sorted stack of each pixel. Each stack entry remembers which image it came from,
+// so that deletion is exact even if an image's object mask changed in the meantime.
+// Images whose mask changed since their insertion are deleted and inserted again.
+
+#ifndef SLIDINGWINDOWSTACK_H
+#define SLIDINGWINDOWSTACK_H
+
+#include "bitmask.h"
+
+#include <QVector>
+
+class MyImage;
+
+class SlidingWindowStack
+{
+public:
+    // One image that is supposed to be part of the stack
+    struct Member {
+        const MyImage *image = nullptr;
+        const float *data = nullptr;      // the pixels that enter the stack
+        const BitMask *mask = nullptr;    // pixels that are masked do not enter the stack; may be nullptr
+        float scale = 1.0;                // the pixels are multiplied with this factor before entering the stack
+    };
+
+    static const int maxCapacity = 255;   // stack entries are tagged with 8-bit slot numbers
+    static float bytesPerPixel(const int numMembers);
+
+    void clear();
+    bool update(const QVector<Member> &members, const long dim, const int nlow, const int nhigh,
+                const float outputScale, float *combined, const int nthreads);
+
+    long numInserted = 0;                 // images inserted during the last update()
+    long numDeleted = 0;                  // images deleted during the last update()
+
+private:
+    struct Slot {
+        const MyImage *image = nullptr;   // nullptr if the slot is free
+        bool masked = false;              // whether the mask was applied when the image was inserted
+        uint64_t maskChecksum = 0;        // the mask content when the image was inserted
+        float scale = 1.0;                // the scale factor applied when the image was inserted
+    };
+
+    long dim = 0;
+    int capacity = 0;
+    QVector<Slot> slots;
+    QVector<float> values;                // [pixel][capacity], sorted per pixel
+    QVector<unsigned char> owners;        // [pixel][capacity], slot number of each entry
+    QVector<unsigned char> counts;        // [pixel], number of entries
+
+    void init(const long newDim, const int newCapacity);
+};
+
+#endif // SLIDINGWINDOWSTACK_H
@@ -0,0 +1,27 @@
+/*
+Copyright (C) 2019 Mischa Schirmer
+
+This file is part of THELI.
+
+THELI is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free
+Software Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program in the LICENSE file.
+If not, see https://www.gnu.org/licenses/ .
+*/
+
+#include "sortingnetwork.h"
+
+// Instantiates the networks for all depths up to maxDepth, once
+bool sortLanes_network(const long depth, float (*v)[SortingNetwork::lanes])
+{
+    if (depth < 1 || depth > SortingNetwork::maxDepth) return false;
+    return SortingNetwork::Dispatch<SortingNetwork::maxDepth>::run(depth, v);
+}
@@ -0,0 +1,86 @@
+/*
+Copyright (C) 2019 Mischa Schirmer
+
+This file is part of THELI.
+
+THELI is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free
+Software Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program in the LICENSE file.
+If not, see https://www.gnu.org/licenses/ .
+*/
+
+// Sorting networks for small pixel stacks.
+// The stack depth N is a template parameter, such that the network (Batcher's odd-even merge sort)
+// is fixed at compile time. The same network is applied to 'lanes' neighbouring pixels at once;
+// compare-exchange is done branch-free with std::min / std::max, hence the loop over the
+// lanes vectorises. The stack is stored as v[depth][lanes].
+
+#ifndef SORTINGNETWORK_H
+#define SORTINGNETWORK_H
+
+#include <algorithm>
+
+namespace SortingNetwork {
+
+const int lanes = 8;           // 8 floats = one AVX register
+const int maxDepth = 32;       // deepest stack for which a network is instantiated
+
+template<int N>
+inline void sort_T(float (*v)[lanes])
+{
+    // Batcher's odd-even merge sort for arbitrary N
+    for (int p=1; p<N; p+=p) {
+        for (int k=p; k>0; k/=2) {
+            for (int j=k%p; j+k<N; j+=k+k) {
+                for (int i=0; i<k && i+j+k<N; ++i) {
+                    if ((i+j) / (p+p) != (i+j+k) / (p+p)) continue;
+                    float *a = v[i+j];
+                    float *b = v[i+j+k];
+                    for (int l=0; l<lanes; ++l) {
+                        const float lo = std::min(a[l], b[l]);
+                        const float hi = std::max(a[l], b[l]);
+                        a[l] = lo;
+                        b[l] = hi;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Compile-time dispatch on the stack depth
+template<int N>
+struct Dispatch {
+    static bool run(const long depth, float (*v)[lanes])
+    {
+        if (depth == N) {
+            sort_T<N>(v);
+            return true;
+        }
+        return Dispatch<N-1>::run(depth, v);
+    }
+};
+
+template<>
+struct Dispatch<0> {
+    static bool run(const long, float (*)[lanes])
+    {
+        return false;
+    }
+};
+
+}
+
+// Sorts each lane of v[depth][lanes] in ascending order.
+// Returns false if the stack is deeper than SortingNetwork::maxDepth; then nothing is done
+bool sortLanes_network(const long depth, float (*v)[SortingNetwork::lanes]);
+
+#endif // SORTINGNETWORK_H
@@ -832,6 +832,7 @@ void Splitter::writeImage(int chipMapped)
         }
     }
     fits_create_file(&fptr, splitFileName.toUtf8().data(), &status);
+    MyImage::setupFitsCompression(fptr, false, &status);
     fits_create_img(fptr, FLOAT_IMG, naxis, naxes, &status);
     fits_write_img(fptr, TFLOAT, fpixel, nelements, array, &status);
 
@@ -955,6 +956,7 @@ bool Splitter::individualFixWriteImage(int chipMapped)
                 outName = "!"+newPath+"/"+instData.shortName+"."+filter+"_"+channelID+"."+dateObsValue+"_1P.fits";
             }
             fits_create_file(&fptr, outName.toUtf8().data(), &status);
+            MyImage::setupFitsCompression(fptr, false, &status);
             fits_create_img(fptr, FLOAT_IMG, naxis, naxes, &status);
             fits_write_img(fptr, TFLOAT, fpixel, nelements, array, &status);
 
@@ -1034,6 +1036,7 @@ bool Splitter::individualFixWriteImage(int chipMapped)
                 outName = "!"+newPath+"/"+instData.shortName+"."+channelID+"."+dateObsValue+"_1P.fits";
             }
             fits_create_file(&fptr, outName.toUtf8().data(), &status);
+            MyImage::setupFitsCompression(fptr, false, &status);
             fits_create_img(fptr, FLOAT_IMG, naxis, naxes, &status);
             fits_write_img(fptr, TFLOAT, fpixel, nelements, array, &status);
 
@@ -1097,6 +1100,7 @@ void Splitter::writeImageSlice(int chip, long slice)
         }
     }
     fits_create_file(&fptr, outName.toUtf8().data(), &status);
+    MyImage::setupFitsCompression(fptr, false, &status);
     fits_create_img(fptr, FLOAT_IMG, naxis, naxes, &status);
     fits_write_img(fptr, TFLOAT, fpixel, nelements, array, &status);
 
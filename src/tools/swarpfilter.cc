@@ -28,6 +28,11 @@ If not, see https://www.gnu.org/licenses/ .
 #include <QDebug>
 #include <QTextStream>
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <sys/resource.h>
+
 SwarpFilter::SwarpFilter(QString coadddirname, QString kappaString,
                          QString clustersizeString, QString borderwidthString,
                          int maxCPU, int *verbose)
@@ -63,6 +68,9 @@ void SwarpFilter::init()
     // RAM considerations
     getBlocksize();
 
+    // File handles
+    openImages();
+
     // Set the size for the containers
     initStorage();
 
@@ -100,16 +108,12 @@ void SwarpFilter::freeMemoryVectors()
 
 void SwarpFilter::freeMemoryBlocks()
 {
-    for (long i=0; i<num_images; ++i) {
-        block_coadd_image[i].clear();
-        block_coadd_index[i].clear();
-        block_coadd_image[i].squeeze();
-        block_coadd_index[i].squeeze();
-    }
-    block_coadd_image.clear();
-    block_coadd_index.clear();
-    block_coadd_image.squeeze();
-    block_coadd_index.squeeze();
+    for (auto &coaddBlock : blockBuffer) {
+        coaddBlock.sections.clear();
+        coaddBlock.sections.squeeze();
+        coaddBlock.presentImages.clear();
+        coaddBlock.presentImages.squeeze();
+    }
 }
 
 // This does not read the data sections, it just creates MyImage pointers to the resampled images and weights
@@ -130,7 +134,7 @@ void SwarpFilter::getImages()
             return;
         }
         // global masks don't apply here because of different image geometry. Hence passing QVector<bool>()
-        QVector<bool> dummyMask;
+        BitMask dummyMask;
         dummyMask.clear();
         MyImage *myImage = new MyImage(coaddDirName, base+"resamp.fits", "", 0, dummyMask, verbosity);
         MyImage *myWeight = new MyImage(coaddDirName, base+"resamp.weight.fits", "", 0, dummyMask, verbosity);
@@ -141,6 +145,31 @@ void SwarpFilter::getImages()
     emit messageAvailable("Including "+QString::number(num_images)+" images ...", "config");
 }
 
+// The resampled images are read block by block. Keep them open for the entire outlier detection,
+// as far as the limit for open files permits; the remaining ones are opened for every block.
+void SwarpFilter::openImages()
+{
+    long maxOpenFiles = num_images;
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+        // leave some file descriptors for everything else, incl. the images that are not kept open
+        maxOpenFiles = std::min(maxOpenFiles, long(limit.rlim_cur) - 64 - nthreads);
+    }
+
+    long numOpen = 0;
+    for (long i=0; i<num_images && numOpen<maxOpenFiles; ++i) {
+        if (!images[i]->openDataSectionFile()) break;
+        ++numOpen;
+    }
+    if (*verbosity > 1) emit messageAvailable(QString::number(numOpen) + " of " + QString::number(num_images)
+                                              + " images kept open for reading ...", "config");
+}
+
+void SwarpFilter::closeImages()
+{
+    for (auto &it : images) it->closeDataSectionFile();
+}
+
 void SwarpFilter::getCoaddInfo()
 {
     QFile coaddHead(coaddDirName+"/coadd.head");
@@ -195,13 +224,28 @@ void SwarpFilter::getGeometries()
     emit messageAvailable("Geometries of the resampled images loaded ...", "config");
 }
 
-// The maximum number of lines that can be read without filling up the RAM
+// The maximum number of lines that can be read without filling up the RAM.
+// Two blocks are held in memory at any time: one is analysed while the next one is read.
 void SwarpFilter::getBlocksize()
 {
     long systemRAM = 1024 * get_memory();
 
+    // Memory per line of the coadded image, assuming all images overlap with it.
+    // get_coaddblock() reads only the columns within the coadd.
+    long lineMemory = 0;
+    for (long i=0; i<num_images; ++i) {
+        lineMemory += std::min(naxis1[i], coadd_naxis1) * sizeof(float);
+    }
+    lineMemory *= 2;   // double buffer
+
+    // The bitmaps of rejected pixels, in the worst case for all images
+    long maskMemory = 0;
+    for (long i=0; i<num_images; ++i) {
+        maskMemory += naxis1[i] * naxis2[i] / 8;
+    }
+
     // maxmimum memory used: 50% of the available RAM
-    blocksize = 0.5 * systemRAM / (coadd_naxis1 * sizeof(float) * num_images * 2);
+    blocksize = lineMemory > 0 ? (0.5 * systemRAM - maskMemory) / lineMemory : 0;
     blocksize = blocksize > coadd_naxis2 ? coadd_naxis2 : blocksize;  // upper limit
 
     if (blocksize < 1) {
@@ -209,24 +253,21 @@ void SwarpFilter::getBlocksize()
         return;
     }
 
-    // TODO: introduce upper limit, like naxis2[i]? Variable between images.
-    // What happens if larger than naxis2[i]?
-    if (blocksize > 300) blocksize = 300;  // upper limit (can probably be dropped after some testing)
-    chunksize = coadd_naxis1 * blocksize;
-    nblocks = long(coadd_naxis2 / blocksize + 1.);
+    // At least 8 blocks (if the coadd is high enough), such that reading and analysing overlap most of the time
+    long maxBlocksize = (coadd_naxis2 + 7) / 8;
+    if (blocksize > maxBlocksize) blocksize = maxBlocksize;
+    nblocks = (coadd_naxis2 + blocksize - 1) / blocksize;
     emit messageAvailable("Block size = "+QString::number(blocksize) + ", Number of blocks = "+QString::number(nblocks), "config");
 }
 
 void SwarpFilter::initStorage()
 {
-    block_coadd_image.resize(num_images);
-    block_coadd_index.resize(num_images);
-    sky.resize(num_images);
-    badpixindex.resize(num_images);
-
-    for (long i=0; i<num_images; ++i) {
-        badpixindex[i].reserve(10000);
+    for (auto &coaddBlock : blockBuffer) {
+        coaddBlock.sections.resize(num_images);
+        coaddBlock.presentImages.reserve(num_images);
     }
+    sky.resize(num_images);
+    badPixels.resize(num_images);
 }
 
 
@@ -236,44 +277,44 @@ void SwarpFilter::runCosmicFilter()
     // Doing the init here, so that the signals get heard outside (connections are made after the constructor).
     init();
 
+    if (nblocks < 1) {
+        closeImages();
+        return;
+    }
+
     progressStepSize = 66. / nblocks;
 
     emit messageAvailable("Identifying outliers ...", "output");
-    // load the images and identify bad pixels
-    for (long block=0; block<nblocks; ++block) {
-
-        QVector<long> presentImages;
-        presentImages.reserve(num_images);
-
-        if (*verbosity >= 2) emit messageAvailable("Processing block " + QString::number(block+1) + "/" + QString::number(nblocks)+" ...", "output");
 
-        // read a chunk of data from the images
-#pragma omp parallel num_threads(nthreads)
-        {
-            // two private temporary containers
-            QVector<float> resampledData;
-            QVector<long> resampledCoaddIndex;
+    // Pipeline: in step 'step', block 'step' is read into one buffer, while block 'step-1' in the other buffer is analysed.
+    // A few threads start with reading, the others with analysing; threads running out of work help with the other task.
+    const int numReaders = std::max(1, nthreads/4);
+
+    for (long step=0; step<=nblocks; ++step) {
+        const long readBlock = step < nblocks ? step : -1;
+        const long analyseBlock = step - 1;
+        CoaddBlock &nextBlock = blockBuffer[step % 2];
+        const CoaddBlock &currentBlock = blockBuffer[(step+1) % 2];
+
+        // Work items: images to be read, and lines to be analysed
+        long numReadItems = 0;
+        long numAnalyseItems = 0;
+        long firstLine = 0;
+        if (readBlock >= 0) numReadItems = num_images;
+        if (analyseBlock >= 0 && !currentBlock.presentImages.isEmpty()) {
+            firstLine = analyseBlock * blocksize;
+            numAnalyseItems = std::min(blocksize, coadd_naxis2 - firstLine);
+        }
+        long nextReadItem = 0;
+        long nextAnalyseItem = 0;
 
-            // loop over resampled images
-#pragma omp for
-            for (long i=0; i<num_images; ++i) {
-                // read a chunk of data overlapping with the current block
-                bool isImagePresent = get_coaddblock(i, block, resampledData, resampledCoaddIndex);
-
-                // transfer of pixel data must be sequential
-#pragma omp critical (updateBlockData)
-                {
-                    if (isImagePresent) presentImages.append(i);
-                    block_coadd_image[i].swap(resampledData);
-                    block_coadd_index[i].swap(resampledCoaddIndex);
-                }
-            }
+        if (*verbosity >= 2 && analyseBlock >= 0) {
+            emit messageAvailable("Processing block " + QString::number(analyseBlock+1) + "/" + QString::number(nblocks)+" ...", "output");
         }
 
-        // if this block does not contain resampled images (bottom or top borders of coadded image)
-        if (presentImages.isEmpty()) continue;
+        // nextBlock.sections.data() must not be called by several threads at once (it may detach)
+        BlockSection *nextSections = nextBlock.sections.data();
 
-        // find the bad pixels
 #pragma omp parallel num_threads(nthreads)
         {
             // bad pixel pair (index in the coadded image and index in the individual frame)
@@ -283,24 +324,33 @@ void SwarpFilter::runCosmicFilter()
             QVector<long> gooddataind;         // The index of an image contributing to a coadded pixel
             gooddata.reserve(num_images);      // maximally num_images will contribute to a coadded pixel
             gooddataind.reserve(num_images);
-
-#pragma omp for
-            for (long l=0; l<chunksize; ++l) {                 // loop over coadded pixels
-                for (auto &pi : presentImages) {               // Loop over all images present at the current coadded pixel
-                    long pixpos = block_coadd_index[pi][l];    // The index of the current coadded pixel in the coord system of the resampled image
-                    if (pixpos >= 0) {                         // Negative if image does not overlap with current pixel
-                        float value = block_coadd_image[pi][pixpos];
-                        if (value != 0.) {                     // If a pixel has value zero then it was most likely masked
-                            gooddata.append(value);            // pixel value
-                            gooddataind.append(pi);            // image index
-                        }
+            QVector<const BlockSection*> rowSections;
+            QVector<long> rowImages;
+            rowSections.reserve(num_images);
+            rowImages.reserve(num_images);
+
+            const bool isReader = omp_get_thread_num() < numReaders;
+            for (int pass=0; pass<2; ++pass) {
+                if (isReader == (pass == 0)) {
+                    // read a chunk of data from the images overlapping with the next block
+                    while (true) {
+                        long i = 0;
+#pragma omp atomic capture
+                        i = nextReadItem++;
+                        if (i >= numReadItems) break;
+                        get_coaddblock(i, readBlock, nextSections[i]);
+                    }
+                }
+                else {
+                    // find the bad pixels in the current block
+                    while (true) {
+                        long j = 0;
+#pragma omp atomic capture
+                        j = nextAnalyseItem++;
+                        if (j >= numAnalyseItems) break;
+                        analyseRow(currentBlock, firstLine + j, gooddata, gooddataind, rowSections, rowImages, bpp);
                     }
                 }
-                long ngoodweight = gooddata.length();  // Number of pixels contributing to a coadded pixel
-                long currentpixel = l + block*chunksize;
-                identify_bad_pixels(gooddata, gooddataind, currentpixel, ngoodweight, bpp);
-                gooddata.clear();
-                gooddataind.clear();
             }
 #pragma omp critical (updateBadPixels)
             {
@@ -308,20 +358,22 @@ void SwarpFilter::runCosmicFilter()
             }
         }
 
-        // Reset the block data. Not sure why this is necessary. Perhaps caused by swap()?
-        for (long i=0; i<num_images; ++i) {
-            block_coadd_image[i].clear();
-            block_coadd_index[i].clear();
+        // if the next block does not contain resampled images (bottom or top borders of coadded image), it will be skipped
+        if (readBlock >= 0) {
+            nextBlock.presentImages.clear();
+            for (long i=0; i<num_images; ++i) {
+                if (!nextBlock.sections[i].data.isEmpty()) nextBlock.presentImages.append(i);
+            }
         }
+
+        if (analyseBlock >= 0) {
 #pragma omp atomic
-        *progress += progressStepSize;
-        emit progressUpdate(*progress);
+            *progress += progressStepSize;
+            emit progressUpdate(*progress);
+        }
     }
 
-    // The badpixindex must be sorted!
-    for (auto &bp : badpixindex) {
-        std::sort(bp.begin(), bp.end());
-    }
+    closeImages();
 
     freeMemoryBlocks();
 
@@ -331,102 +383,120 @@ void SwarpFilter::runCosmicFilter()
     freeMemoryVectors();
 }
 
+// Transfers the rejected pixels (image index, coadd pixel index) into the bitmaps of the images
 void SwarpFilter::updateBadPixelIndex(const QVector<std::pair<long,long>> bpp)
 {
     for (auto &pair : bpp) {
-        badpixindex[pair.first].append(pair.second);
+        const long i = pair.first;
+        const long x = pair.second % coadd_naxis1 - xoffset[i];
+        const long y = pair.second / coadd_naxis1 - yoffset[i];
+        BitMask &mask = badPixels[i];
+        if (mask.isEmpty()) mask.fill(false, naxis1[i] * naxis2[i]);
+        mask.setBit(x + naxis1[i] * y);
+    }
+}
+
+//***************************************************************************************
+// Analyse one line of the coadded image
+//***************************************************************************************
+void SwarpFilter::analyseRow(const CoaddBlock &coaddBlock, const long row, QVector<float> &gooddata, QVector<long> &gooddataind,
+                             QVector<const BlockSection*> &rowSections, QVector<long> &rowImages, QVector<std::pair<long,long>> &bpp)
+{
+    // The images overlapping with this line
+    rowSections.clear();
+    rowImages.clear();
+    for (auto &pi : coaddBlock.presentImages) {
+        const BlockSection &section = coaddBlock.sections[pi];
+        if (row >= section.ymin && row <= section.ymax) {
+            rowSections.append(&section);
+            rowImages.append(pi);
+        }
+    }
+    if (rowSections.isEmpty()) return;
+
+    const long numRowImages = rowSections.length();
+    for (long i=0; i<coadd_naxis1; ++i) {                  // loop over coadded pixels
+        for (long k=0; k<numRowImages; ++k) {               // Loop over all images present at the current coadded pixel
+            const BlockSection *section = rowSections[k];
+            if (i < section->xmin || i > section->xmax) continue;
+            const long width = section->xmax - section->xmin + 1;
+            float value = section->data[i - section->xmin + width * (row - section->ymin)];
+            if (value != 0.) {                     // If a pixel has value zero then it was most likely masked
+                gooddata.append(value);            // pixel value
+                gooddataind.append(rowImages[k]);  // image index
+            }
+        }
+        long ngoodweight = gooddata.length();  // Number of pixels contributing to a coadded pixel
+        long currentpixel = i + coadd_naxis1 * row;
+        identify_bad_pixels(gooddata, gooddataind, currentpixel, ngoodweight, bpp);
+        gooddata.clear();
+        gooddataind.clear();
     }
 }
 
 //***************************************************************************************
 // Load a section of one of the resampled images
-// (a block naxis1 wide and some rows high)
+// (the part overlapping with a block of the coadded image, naxis1 wide and some rows high)
 //***************************************************************************************
-bool SwarpFilter::get_coaddblock(const int index, const long block, QVector<float> &resampledData, QVector<long> &resampledCoaddIndex)
+bool SwarpFilter::get_coaddblock(const int index, const long block, BlockSection &section)
 {
+    // Keeps the capacity, the buffers are reused for every other block
+    section.data.resize(0);
+    section.xmin = 0;
+    section.xmax = -1;
+    section.ymin = 0;
+    section.ymax = -1;
+
     // index == current image
     long bbs0 = block * blocksize;
-    long bbs1 = bbs0 + blocksize;
+    long bbs1 = std::min(bbs0 + blocksize, coadd_naxis2);
+
+    long xoff = xoffset[index];
+    long yoff = yoffset[index];
+    long nax1 = naxis1[index];
+    long nax2 = naxis2[index];
 
     // nothing to do if the image is entirely below or above the current coadd block
-    if (yoffset[index] + naxis2[index] <= bbs0 || yoffset[index] >= bbs1) {
+    if (yoff + nax2 <= bbs0 || yoff >= bbs1) {
         return false;
     }
 
     // The image overlaps with the current coadd block
+    long firstline2read = std::max(bbs0, yoff) - yoff;          // we start counting at 0!
+    long lastline2read  = std::min(bbs1, yoff + nax2) - 1 - yoff;
 
-    // assume that the image covers the block entirely:
-    long firstline2read = bbs0 - yoffset[index];           // we start counting at 0!
-    long lastline2read  = firstline2read + blocksize - 1;  // we start counting at 0!
-
-    // if the image does not cover the lower part of the block
-    // but the upper part entirely
-    if (firstline2read < 0 && yoffset[index] + naxis2[index] >= bbs1) {
-        lastline2read  = bbs1 - yoffset[index] - 1;
-        firstline2read = 0;
-    }
-
-    // if the image does not cover the upper part of the block
-    // but the lower part entirely
-    if (yoffset[index] + naxis2[index] < bbs1 && yoffset[index] <= bbs0) {
-        lastline2read  = naxis2[index] - 1;
-        firstline2read = bbs0 - yoffset[index];
-    }
-
-    // if the image is entirely contained in the block
-    // without touching its borders
-    if (yoffset[index] > bbs0 && yoffset[index] + naxis2[index] < bbs1) {
-        firstline2read = 0;
-        lastline2read  = naxis2[index] - 1;
+    // The columns overlapping with the coadded image
+    long xmin = std::max(0L, xoff);
+    long xmax = std::min(coadd_naxis1, xoff + nax1) - 1;
+    if (xmin > xmax) {
+        emit messageAvailable("SwarpFilter:getCoaddBlock(): No overlap was found<br>"
+                              +images[index]->name + " : First line / last line: "
+                              + QString::number(firstline2read) +  " " + QString::number(lastline2read), "error");
+        return false;
     }
 
-    int nsub = naxis1[index];
-    int msub = lastline2read - firstline2read + 1;
-
-    float *data_in = new float[nsub*msub];
+    long msub = lastline2read - firstline2read + 1;
 
     // Load the data sections;
     // One could load the weights too, but that would double the memory load for very little return
     // We later on reject image pixels with zero value; likely they have zero weight; what would be missed is manually masked areas, such as satellites.
     // But the algorithm is supposed to detect them anyway, so no harm done by skipping the weights.
-    images[index]->loadDataSection(0, naxis1[index]-1, firstline2read, lastline2read, data_in);
-    long l = 0;  // the running index of the image
-    long k = 0;  // the running index of the coadd [0,chunksize)
-
-    resampledData.reserve(naxis1[index]*(lastline2read-firstline2read+1)); // Contains valid data points, only
-    resampledCoaddIndex.resize(coadd_naxis1*blocksize); // Must stretch over the entire chunksize
-    for (auto &it: resampledCoaddIndex) it = -1; // Initialize with invalid index
-
-    // Map the image pixels onto the coadded image block.
-    // Save some CPU cycles and do array calculations outside the loop
-    long xoff = xoffset[index];
-    long yoff = yoffset[index];
-    long nax1 = naxis1[index];
-    long nax2 = naxis2[index];
-    float fluxcorr = fluxscale[index];
-    for (long j=0; j<blocksize; ++j) {
-        long yi = bbs0 + j - yoff;
-        for (long i=0; i<coadd_naxis1; ++i) {
-            long xi = i - xoff;
-            // if the image overlaps with the coadd block
-            if (xi >= 0 && yi >= 0 && xi < nax1 && yi < nax2) {
-                resampledData.append(data_in[l] * fluxcorr);
-                resampledCoaddIndex[k] = l;
-                ++l;
-            }
-            ++k;
-        }
-    }
-
-    if (l==0) {
-        emit messageAvailable("SwarpFilter:getCoaddBlock(): No overlap was found<br>"
-                              +images[index]->name + " : First line / last line: "
-                              + QString::number(firstline2read) +  " " + QString::number(lastline2read), "error");
+    // Only the columns overlapping with the coadded image are read (all of them, usually)
+    long width = xmax - xmin + 1;
+    section.data.resize(width*msub);
+    float *data = section.data.data();
+    if (!images[index]->loadDataSection(xmin-xoff, xmax-xoff, firstline2read, lastline2read, data)) {
+        section.data.resize(0);
         return false;
     }
 
-    delete [] data_in;
-    data_in = nullptr;
+    float fluxcorr = fluxscale[index];
+    for (auto &pixel : section.data) pixel *= fluxcorr;
+
+    section.xmin = xmin;
+    section.xmax = xmax;
+    section.ymin = firstline2read + yoff;
+    section.ymax = lastline2read + yoff;
 
     return true;
 }
@@ -552,108 +622,186 @@ void SwarpFilter::stackfilter_rejectminmax(const QVector<float> &gooddata, float
 }
 
 //**************************************************************
-void SwarpFilter::writeWeight()
+// Helpers for the rejection masks in writeWeight(). These are stored line by line, each line
+// starting with a new word, such that whole words can be shifted without mixing lines.
+
+namespace {
+
+typedef BitMask::Word Word;
+
+// ORs the line 'in', shifted by 'shift' pixels (> 0: towards larger x), into 'out'
+void orShiftedLine(const Word *in, Word *out, const long numWords, const long shift)
+{
+    const long wordShift = std::abs(shift) / BitMask::wordBits;
+    const int bitShift = std::abs(shift) % BitMask::wordBits;
+    if (shift > 0) {
+        for (long w=wordShift; w<numWords; ++w) {
+            Word value = in[w-wordShift] << bitShift;
+            if (bitShift > 0 && w-wordShift > 0) value |= in[w-wordShift-1] >> (BitMask::wordBits - bitShift);
+            out[w] |= value;
+        }
+    }
+    else {
+        for (long w=0; w<numWords-wordShift; ++w) {
+            Word value = in[w+wordShift] >> bitShift;
+            if (bitShift > 0 && w+wordShift+1 < numWords) value |= in[w+wordShift+1] << (BitMask::wordBits - bitShift);
+            out[w] |= value;
+        }
+    }
+}
+
+// Masks a box of (2*width+1)^2 pixels around every masked pixel, clipped at the image borders.
+// The box is separable; each direction grows by doubling, i.e. log2(width) shifted copies only.
+void dilateMask(QVector<Word> &mask, const long n, const long m, const long wordsPerLine, const long width)
 {
+    const int lastBits = n % BitMask::wordBits;
+    const Word lastWordBits = lastBits == 0 ? ~Word(0) : (Word(1) << lastBits) - 1;
+
+    QVector<Word> line(wordsPerLine);
+    for (long j=0; j<m; ++j) {
+        Word *maskLine = mask.data() + j*wordsPerLine;
+        bool empty = true;
+        for (long w=0; w<wordsPerLine; ++w) {
+            if (maskLine[w] != 0) {
+                empty = false;
+                break;
+            }
+        }
+        if (empty) continue;
+        long reach = 0;
+        while (reach < width) {
+            const long step = std::min(reach + 1, width - reach);
+            memcpy(line.data(), maskLine, wordsPerLine*sizeof(Word));
+            orShiftedLine(line.constData(), maskLine, wordsPerLine, step);
+            orShiftedLine(line.constData(), maskLine, wordsPerLine, -step);
+            maskLine[wordsPerLine-1] &= lastWordBits;    // nothing beyond the right border
+            reach += step;
+        }
+    }
+
+    QVector<Word> copy;
+    long reach = 0;
+    while (reach < width) {
+        const long step = std::min(reach + 1, width - reach);
+        copy = mask;
+        const Word *in = copy.constData();
+        Word *out = mask.data();
+        for (long j=0; j<m; ++j) {
+            Word *outLine = out + j*wordsPerLine;
+            if (j-step >= 0) {
+                const Word *inLine = in + (j-step)*wordsPerLine;
+                for (long w=0; w<wordsPerLine; ++w) outLine[w] |= inLine[w];
+            }
+            if (j+step < m) {
+                const Word *inLine = in + (j+step)*wordsPerLine;
+                for (long w=0; w<wordsPerLine; ++w) outLine[w] |= inLine[w];
+            }
+        }
+        reach += step;
+    }
+}
+
+}
 
-    // cout << "This is thread " << args->th << endl;
+//**************************************************************
+void SwarpFilter::writeWeight()
+{
     emit messageAvailable("Writing updated weight maps ...", "output");
 
     progressStepSize = 34. / num_images;
 
-#pragma omp parallel for num_threads(nthreads)
+    const BitMask *badPixelData = badPixels.constData();
+    MyImage *const *weightData = weights.constData();
+
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic)
     for (long i=0; i<num_images; ++i) {
 
-        long n = naxis1[i];
-        long m = naxis2[i];
-        QVector<char> weight_out(n*m, 1);   // 1 = pixel is good, 0 = pixel is bad
-        QVector<char> weight_cpy(n*m, 1);
-
-        long s = 0;
-        long t = 0;
-        long nbadpix = badpixindex[i].size();
-        // mask all bad pixels found
-        for (long j=yoffset[i]; j<(yoffset[i] + m); ++j) {
-            if (t==nbadpix) break;
-            for (long l=xoffset[i]; l<(xoffset[i] + n); ++l) {
-                if (t==nbadpix) break;
-                long k = l + coadd_naxis1 * j;
-                // WARNING: THIS IS FAST, BUT ASSUMES A SORTED BADPIX INDEX!
-                if (k == badpixindex[i][t]) {
-                    weight_out[s] = 0;
-                    if (clusterSize < 2) weight_cpy[s] = 0;
-                    ++t;
+        const BitMask &bad = badPixelData[i];
+        const long n = naxis1[i];
+        const long m = naxis2[i];
+        const long npix = n*m;
+
+        if (!bad.isEmpty()) {
+            // The pixels to be masked in the weight, line by line
+            const long wordsPerLine = (n + BitMask::wordBits - 1) / BitMask::wordBits;
+            QVector<Word> rejected(m*wordsPerLine, 0);
+            Word *rej = rejected.data();
+
+            // NOTE:
+            // There could be many more bad pixels than visibly marked in the end,
+            // if the clustersize is larger than 1.
+            for (long p=bad.nextMasked(0); p<npix; p=bad.nextMasked(p+1)) {
+                const long k = p % n;
+                const long j = p / n;
+                if (clusterSize < 2) {
+                    rej[j*wordsPerLine + k/BitMask::wordBits] |= Word(1) << (k % BitMask::wordBits);
+                    continue;
                 }
-                ++s;
-            }
-        }
-
-        // NOTE:
-        // There could be many more masked pixels in badpixindex[i] than visibly marked in the end,
-        // if the clustersize is larger than 1.
-
-        // mask only clusters consisting of at least 'clustersize' pixels
-        if (clusterSize > 1) {
-            // we ignore the 1 pixel wide border of the image
-            for (long j=1; j<m-1; ++j) {
-                for (long k=1; k<n-1; ++k) {
-                    if (weight_out[k+n*j] == 0) {
-                        long clustercount = 1;
-                        for (long l=j-1; l<=j+1; ++l) {
-                            for (long o=k-1; o<=k+1; ++o) {
-                                clustercount += (weight_out[o+(l*n)] ^ 1);
-                            }
-                        }
-                        if (clustercount >= clusterSize) {
-                            for (long l=j-1; l<=j+1; ++l) {
-                                for (long o=k-1; o<=k+1; ++o) {
-                                    weight_cpy[o+(l*n)] = weight_out[o+(l*n)];
-                                }
-                            }
+                // mask only clusters consisting of at least 'clustersize' pixels
+                // we ignore the 1 pixel wide border of the image
+                if (j < 1 || j >= m-1 || k < 1 || k >= n-1) continue;
+                long clustercount = 1;
+                for (long l=j-1; l<=j+1; ++l) {
+                    for (long o=k-1; o<=k+1; ++o) {
+                        clustercount += bad.at(o+l*n);
+                    }
+                }
+                if (clustercount >= clusterSize) {
+                    for (long l=j-1; l<=j+1; ++l) {
+                        for (long o=k-1; o<=k+1; ++o) {
+                            if (bad.at(o+l*n)) rej[l*wordsPerLine + o/BitMask::wordBits] |= Word(1) << (o % BitMask::wordBits);
                         }
                     }
                 }
             }
-            // copy the vectors
-            weight_out = weight_cpy;
-        }
 
-        // if a border of width 'width' pixels should be masked around a
-        // bad pixel, too
-        if (maskWidth > 0) {
-            for (long j=0; j<m; ++j) {
-                for (long k=0; k<n; ++k) {
-                    if (weight_cpy[k+n*j] == 0) {
-                        long jmW0 = j - maskWidth;
-                        long kmW0 = k - maskWidth;
-                        long jmW1 = j + maskWidth;
-                        long kmW1 = k + maskWidth;
-                        long masklinemin = jmW0 < 0 ? 0 : jmW0;
-                        long maskcolmin  = kmW0 < 0 ? 0 : kmW0;
-                        long masklinemax = jmW1 > (m - 1) ? (m - 1) : jmW1;
-                        long maskcolmax  = kmW1 > (n - 1) ? (n - 1) : kmW1;
-                        for (long l=masklinemin; l <= masklinemax; ++l) {
-                            for (long o=maskcolmin; o <= maskcolmax; ++o) {
-                                weight_out[o+(l*n)] = 0;
-                            }
+            // if a border of width 'width' pixels should be masked around a
+            // bad pixel, too
+            if (maskWidth > 0) dilateMask(rejected, n, m, wordsPerLine, maskWidth);
+
+            // Modify the resampled weight in place, band by band, touching only lines with masked pixels
+            MyImage *weight = weightData[i];
+            weight->openDataSectionFile(true);   // otherwise the file is opened for every band
+            const long bandHeight = 256;
+            QVector<float> band;
+            for (long y0=0; y0<m; y0+=bandHeight) {
+                long first = -1;
+                long last = -1;
+                for (long j=y0; j<std::min(y0+bandHeight, m); ++j) {
+                    const Word *line = rej + j*wordsPerLine;
+                    for (long w=0; w<wordsPerLine; ++w) {
+                        if (line[w] != 0) {
+                            if (first < 0) first = j;
+                            last = j;
+                            break;
+                        }
+                    }
+                }
+                if (first < 0) continue;
+                band.resize((last-first+1)*n);
+                float *bandData = band.data();
+                if (!weight->loadDataSection(0, n-1, first, last, bandData)) break;
+                for (long j=first; j<=last; ++j) {
+                    const Word *line = rej + j*wordsPerLine;
+                    float *pixels = bandData + (j-first)*n;
+                    for (long w=0; w<wordsPerLine; ++w) {
+                        Word bits = line[w];
+                        while (bits != 0) {
+                            pixels[w*BitMask::wordBits + __builtin_ctzll(bits)] = 0.;
+                            bits &= bits - 1;
                         }
                     }
                 }
+                if (!weight->writeDataSection(first, last, bandData)) break;
             }
+            weight->closeDataSectionFile();
         }
 
-        QString outName = weights[i]->path + "/" + weights[i]->name;
-        // Modify the resampled weight and write it
-        weights[i]->readImage(outName);
-        long k=0;
-        for (auto &pixel : weights[i]->dataCurrent) {
-            pixel *= weight_out[k];
-            ++k;
-        }
-        weights[i]->writeImage(outName);
-        weights[i]->freeData();
-
 #pragma omp atomic
         *progress += progressStepSize;
         emit progressUpdate(*progress);
     }
+
+    badPixels.clear();
+    badPixels.squeeze();
 }
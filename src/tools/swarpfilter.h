@@ -65,7 +65,6 @@ private:
     int clusterSize = 1;       // Minimum size of a cluster of bad pixels to trigger masking
     int maskWidth = 0;         // Width of an extra border around a detected bad pixel cluster
     long blocksize = 0;        // Number of lines read at a time
-    long chunksize = 0;        // Number of pixels analysed in one step
     long nblocks = 0;          // The total number of blocks to process
 
     QVector<long> naxis1;
@@ -77,9 +76,27 @@ private:
     QVector<long> xoffset;     // number of pixels between the left border of coadd.fits and the resampled image
     QVector<long> yoffset;     // number of pixels between the lower border of coadd.fits and the resampled image
 
-    QVector< QVector<long> > badpixindex;
-    QVector< QVector<long> > block_coadd_index;
-    QVector< QVector<float> > block_coadd_image;
+    // The rejected pixels of each image, in the pixel coordinates of the resampled image
+    // (allocated with the first rejected pixel; images without outliers need no memory)
+    QVector<BitMask> badPixels;
+
+    // The overlap of one resampled image with a block of the coadded image
+    struct BlockSection {
+        QVector<float> data;   // pixel values (times fluxscale), row-major within the overlap
+        long xmin = 0;         // the overlap in pixel coordinates of the coadded image
+        long xmax = -1;
+        long ymin = 0;
+        long ymax = -1;
+    };
+
+    // A block of rows of the coadded image
+    struct CoaddBlock {
+        QVector<BlockSection> sections;   // one per resampled image
+        QVector<long> presentImages;      // the images overlapping with the block, in ascending order
+    };
+
+    // Double buffer: the next block is read into one while the current block in the other is analysed
+    CoaddBlock blockBuffer[2];
 
     QDir coaddDir;
     QString coaddDirName = "";
@@ -93,8 +110,12 @@ private:
     void getCoaddInfo();
     void getGeometries();
     void getImages();
+    void openImages();
+    void closeImages();
     void getBlocksize();
-    bool get_coaddblock(const int index, const long block, QVector<float> &resampledData, QVector<long> &resampledCoaddIndex);
+    void analyseRow(const CoaddBlock &coaddBlock, const long row, QVector<float> &gooddata, QVector<long> &gooddataind,
+                    QVector<const BlockSection*> &rowSections, QVector<long> &rowImages, QVector<std::pair<long,long>> &bpp);
+    bool get_coaddblock(const int index, const long block, BlockSection &section);
     void identify_bad_pixels(const QVector<float> &gooddata, const QVector<long> &gooddataind, const long &currentpixel,
                              const long &ngoodweight, QVector<std::pair<long,long>> &bpp);
     void initStorage();
@@ -289,7 +289,7 @@ void mapBinnedData(QVector<float> &dataBinnedGlobal, const QVector<float> &dataB
     }
 }
 
-QVector<float> collapse_x(QVector<float> &data, const QVector<bool> &globalMask, QVector<bool> &objectMask,
+QVector<float> collapse_x(QVector<float> &data, const BitMask &globalMask, BitMask &objectMask,
                           const float kappa, const long n, const long m, const QString returnMode)
 {
     long i, j;
@@ -340,7 +340,7 @@ QVector<float> collapse_x(QVector<float> &data, const QVector<bool> &globalMask,
 }
 
 // Keeping a functor version as comments for future reference
-QVector<float> collapse_y(QVector<float> &data, const QVector<bool> &globalMask, QVector<bool> &objectMask,
+QVector<float> collapse_y(QVector<float> &data, const BitMask &globalMask, BitMask &objectMask,
                           //                                float (*statisticsMode)(QVector<float>, float, int),
                           const float kappa, const long n, const long m, const QString returnMode)
 {
@@ -393,7 +393,7 @@ QVector<float> collapse_y(QVector<float> &data, const QVector<bool> &globalMask,
 
 // collapse along vhhv (vertical, horizontal, horizontal,
 // vertical readout quadrants) or hvvh, hhhh, vvvv directions
-QVector<float> collapse_quad(QVector<float> &data, const QVector<bool> &globalMask, QVector<bool> &objectMask,
+QVector<float> collapse_quad(QVector<float> &data, const BitMask &globalMask, BitMask &objectMask,
                              const float kappa, const long n, const long m, const QString direction, const QString returnMode)
 {
     long i, j;
@@ -412,8 +412,8 @@ QVector<float> collapse_quad(QVector<float> &data, const QVector<bool> &globalMa
     QVector<float> quadrant(nh*mh, 0);
     QVector<float> collquad(nh*mh, 0);
     QVector<float> collapsed2D(n*m, 0);
-    QVector<bool> globalMaskquad(nh*mh, false);
-    QVector<bool> objectMaskquad(nh*mh, false);
+    BitMask globalMaskquad(nh*mh, false);
+    BitMask objectMaskquad(nh*mh, false);
 
     if (objectMask.isEmpty()) objectMask.fill(false, n*m);
 
@@ -447,8 +447,8 @@ QVector<float> collapse_quad(QVector<float> &data, const QVector<bool> &globalMa
         for (j=0; j<mh; ++j) {
             for (i=0; i<nh; ++i) {
                 quadrant[i+nh*j] = data[i+n1+n*(j+m1)];
-                globalMaskquad[i+nh*j] = globalMask[i+n1+n*(j+m1)];
-                objectMaskquad[i+nh*j] = objectMask[i+n1+n*(j+m1)];
+                globalMaskquad.setBit(i+nh*j, globalMask.at(i+n1+n*(j+m1)));
+                objectMaskquad.setBit(i+nh*j, objectMask.at(i+n1+n*(j+m1)));
             }
         }
 
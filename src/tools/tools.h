@@ -24,6 +24,7 @@ If not, see https://www.gnu.org/licenses/ .
 #include <QVector>
 #include <QList>
 #include "instrumentdata.h"
+#include "bitmask.h"
 #include "../myimage/myimage.h"
 
 void binData(const QVector<float> &data, QVector<float> &dataBinned, const int n,
@@ -43,11 +44,11 @@ void mapBinnedData(QVector<float> &dataBinnedGlobal, const QVector<float> &dataB
 float posangle(const QVector<double> CDmatrix);
 void rotateCDmatrix(QVector<double> &CDin, float pa_new);
 void updateDebayerMemoryStatus(MyImage *image);
-QVector<float> collapse_x(QVector<float> &data, const QVector<bool> &globalMask, QVector<bool> &objectMask,
+QVector<float> collapse_x(QVector<float> &data, const BitMask &globalMask, BitMask &objectMask,
                           const float kappa, const long n, const long m, const QString returnMode);
-QVector<float> collapse_y(QVector<float> &data, const QVector<bool> &globalMask, QVector<bool> &objectMask,
+QVector<float> collapse_y(QVector<float> &data, const BitMask &globalMask, BitMask &objectMask,
                           const float kappa, const long n, const long m, const QString returnMode);
-QVector<float> collapse_quad(QVector<float> &data, const QVector<bool> &globalMask, QVector<bool> &objectMask,
+QVector<float> collapse_quad(QVector<float> &data, const BitMask &globalMask, BitMask &objectMask,
                              const float kappa, const long n, const long m, const QString direction, const QString returnMode);
 void match2D(const QVector<QVector<double> > vec1, QVector<QVector<double> > vec2, QVector<QVector<double>> &matched,
              double tolerance, int &multiple1, int &multiple2, int nthreads);